@@ -0,0 +1,271 @@
+#include <QDir>
+#include <QDirIterator>
+#include <QFile>
+#include <QFileInfo>
+#include <QTextStream>
+#include <QDateTime>
+#include <QStringList>
+#include <QMutexLocker>
+#include <QCryptographicHash>
+#include <algorithm>
+#include "analysiscache.h"
+#include "reporttemplate.h"
+#include "detector.h"
+#include "settings.h"
+#include "preflight.h"
+
+static const char* stageNames[AnalysisStageCount] = {
+    "peak search", "peak area", "background", "efficiency", "nuclide id", "MDA", "report"
+};
+
+static const char* stageTags[AnalysisStageCount] = {
+    "PEAK", "AREA", "BKG", "EFF", "NID", "MDA", "RPT"
+};
+
+QString analysisStageName(AnalysisStage stage)
+{
+    return stageNames[stage];
+}
+
+QString analysisCacheSummary(const AnalysisCache::Stats& stats)
+{
+    QStringList parts;
+    for(int i=0; i<AnalysisStageCount; i++)
+        parts << QString("%1 %2/%3").arg(stageNames[i]).arg(stats.hits[i]).arg(stats.hits[i] + stats.misses[i]);
+    return parts.join(", ");
+}
+
+AnalysisCache::AnalysisCache(const QString& directory)
+    : mDirectory(directory)
+{
+    resetStats();
+}
+
+AnalysisCache::Stats AnalysisCache::stats() const
+{
+    QMutexLocker lock(&mMutex);
+    return mStats;
+}
+
+void AnalysisCache::resetStats()
+{
+    QMutexLocker lock(&mMutex);
+    for(int i=0; i<AnalysisStageCount; i++)
+        mStats.hits[i] = mStats.misses[i] = 0;
+}
+
+void AnalysisCache::record(AnalysisStage stage, bool hit)
+{
+    QMutexLocker lock(&mMutex);
+    if(hit)
+        mStats.hits[stage]++;
+    else
+        mStats.misses[stage]++;
+}
+
+QString AnalysisCache::stageFile(const QByteArray& key, AnalysisStage stage) const
+{
+    // Spread over 256 folders, the cache holds several snapshots per spectrum
+    QString hex = key.toHex();
+    return QDir::toNativeSeparators(mDirectory + "/" + hex.left(2) + "/" + hex + (stage == StageReport ? ".RPT" : ".CNF"));
+}
+
+void AnalysisCache::trim(qint64 maxBytes)
+{
+    QList<QFileInfo> files;
+    qint64 total = 0;
+    QDirIterator iter(mDirectory, QDir::Files, QDirIterator::Subdirectories);
+    while(iter.hasNext())
+    {
+        iter.next();
+        files.append(iter.fileInfo());
+        total += iter.fileInfo().size();
+    }
+
+    std::sort(files.begin(), files.end(), [](const QFileInfo& a, const QFileInfo& b)
+    {
+        return a.lastModified() < b.lastModified();
+    });
+
+    for(int i=0; i<files.count() && total > maxBytes; i++)
+    {
+        if(QFile::remove(files[i].absoluteFilePath()))
+            total -= files[i].size();
+    }
+}
+
+// Size and time of the file Genie would read for name, files updated in place change it
+static QString fileStamp(const Settings& settings, const QString& name, const QString& folder)
+{
+    if(name.isEmpty())
+        return QString();
+    foreach(const QString& candidate, genieCandidates(settings, name, folder))
+    {
+        QFileInfo info(candidate);
+        if(info.isFile())
+            return QString(" %1 %2").arg(info.size()).arg(info.lastModified().toMSecsSinceEpoch());
+    }
+    return " missing";
+}
+
+QByteArray analysisStageKey(const QByteArray& inputKey, AnalysisStage stage,
+                            const Detector& detector, const Settings& settings)
+{
+    // The stage commands with fixed file names capture every parameter the stage uses,
+    // the files they name are added by size and time. Keys are chained, so a stage's
+    // files count for every stage after it too.
+    QString text;
+    QTextStream stream(&text);
+    writeAnalysisStage(stream, stage, "SPECTRUM", "OUTPUT", detector, settings);
+    stream.flush();
+
+    switch(stage)
+    {
+    case StageBackground:
+        text += fileStamp(settings, detector.backgroundSubtract, "CAMFILES");
+        break;
+    case StageNuclideId:
+        text += fileStamp(settings, detector.NIDLibrary, "CAMFILES");
+        break;
+    case StageReport:
+    {
+        text += fileStamp(settings, settings.templateName, "CTLFILES");
+        QString native = nativeTemplateName(settings.templateName);
+        if(!native.isEmpty())
+            text += fileStamp(settings, native, "CTLFILES");
+        break;
+    }
+    default:
+        break;
+    }
+
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    hash.addData(inputKey);
+    hash.addData(text.toUtf8());
+    return hash.result();
+}
+
+static bool restoreFile(const QString& source, const QString& target)
+{
+    QString tmp = target + ".tmp";
+    QFile::remove(tmp);
+    if(!QFile::copy(source, tmp))
+        return false;
+    QFile::remove(target);
+    return QFile::rename(tmp, target);
+}
+
+int prepareCachedAnalysis(const QString& baseFilename, const Detector& detector, const Settings& settings,
+                          AnalysisCache& cache, QByteArray keys[AnalysisStageCount])
+{
+    QString spectrum = baseFilename + ".CNF";
+    QFile file(spectrum);
+    if(!file.open(QIODevice::ReadOnly))
+        return -1;
+
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    if(!hash.addData(&file))
+        return -1;
+    file.close();
+
+    QByteArray key = hash.result();
+    for(int i=0; i<AnalysisStageCount; i++)
+        key = keys[i] = analysisStageKey(key, (AnalysisStage)i, detector, settings);
+
+    // The report stage leaves no spectrum snapshot, it needs the one from MDA as well.
+    // An empty file is left from a copy that failed.
+    int resume = 0;
+    for(int i=AnalysisStageCount - 1; i>=0 && resume == 0; i--)
+    {
+        bool hit = QFileInfo(cache.stageFile(keys[i], (AnalysisStage)i)).size() > 0;
+        if(hit && i == StageReport)
+            hit = QFileInfo(cache.stageFile(keys[StageMDA], StageMDA)).size() > 0;
+        if(hit)
+            resume = i + 1;
+    }
+
+    if(resume > 0)
+    {
+        AnalysisStage snapshot = resume > StageMDA ? StageMDA : (AnalysisStage)(resume - 1);
+        if(!restoreFile(cache.stageFile(keys[snapshot], snapshot), spectrum))
+            resume = 0;
+    }
+    if(resume == AnalysisStageCount && !restoreFile(cache.stageFile(keys[StageReport], StageReport), baseFilename + ".RPT"))
+        resume = 0;
+
+    for(int i=0; i<AnalysisStageCount; i++)
+        cache.record((AnalysisStage)i, i < resume);
+    return resume;
+}
+
+// Copied under a temporary name and renamed, a snapshot that exists is complete
+static void writeStageSnapshot(QTextStream& stream, const QString& baseFilename, AnalysisStage stage,
+                               AnalysisCache& cache, const QByteArray& key)
+{
+    QString target = cache.stageFile(key, stage);
+    if(!QDir().mkpath(QFileInfo(target).absolutePath()))
+        return;
+    QString source = baseFilename + (stage == StageReport ? ".RPT" : ".CNF");
+    startJobCommand(stream, "copy");
+    addJobParamSingle(stream, "/y \"" + source + "\" \"" + target + ".tmp\" >NUL");
+    endJobCommand(stream);
+    startJobCommand(stream, "move");
+    addJobParamSingle(stream, "/y \"" + target + ".tmp\" \"" + target + "\" >NUL");
+    endJobCommand(stream);
+}
+
+bool runCachedAnalysis(const QString& baseFilename, const Detector& detector, const Settings& settings,
+                       JobRunner runner, AnalysisCache& cache, int* resumedStage)
+{
+    QByteArray keys[AnalysisStageCount];
+    int resume = prepareCachedAnalysis(baseFilename, detector, settings, cache, keys);
+    if(resume < 0)
+        return false;
+    if(resumedStage)
+        *resumedStage = resume;
+    if(resume == AnalysisStageCount)
+        return true;
+
+    QFile script(baseFilename + ".BAT");
+    if(!script.open(QIODevice::WriteOnly | QIODevice::Text | QIODevice::Truncate))
+        return false;
+
+    // Snapshot after every stage, a failing stage stops the script before its snapshot
+    QTextStream stream(&script);
+    for(int i=resume; i<AnalysisStageCount; i++)
+    {
+        writeAnalysisStage(stream, (AnalysisStage)i, baseFilename + ".CNF", baseFilename, detector, settings);
+        stream << "if errorlevel 1 exit /b 1\n";
+        writeStageSnapshot(stream, baseFilename, (AnalysisStage)i, cache, keys[i]);
+    }
+    stream.flush();
+    script.close();
+
+    return runner(jobCommandLine(baseFilename));
+}
+
+QString analysisStageFilename(const QString& baseFilename, AnalysisStage stage)
+{
+    return baseFilename + "-" + stageTags[stage];
+}
+
+bool runAnalysisStage(const QString& baseFilename, AnalysisStage stage, const Detector& detector,
+                      const Settings& settings, JobRunner runner, AnalysisCache* cache, const QByteArray& key)
+{
+    QString stageFilename = analysisStageFilename(baseFilename, stage);
+    QFile script(stageFilename + ".BAT");
+    if(!script.open(QIODevice::WriteOnly | QIODevice::Text | QIODevice::Truncate))
+        return false;
+
+    QTextStream stream(&script);
+    writeAnalysisStage(stream, stage, baseFilename + ".CNF", baseFilename, detector, settings);
+    if(cache)
+    {
+        stream << "if errorlevel 1 exit /b 1\n";
+        writeStageSnapshot(stream, baseFilename, stage, *cache, key);
+    }
+    stream.flush();
+    script.close();
+
+    return runner(jobCommandLine(stageFilename));
+}
@@ -0,0 +1,74 @@
+#ifndef ANALYSISCACHE_H
+#define ANALYSISCACHE_H
+
+#include <QString>
+#include <QByteArray>
+#include <QMutex>
+#include "jobutils.h"
+
+struct Detector;
+struct Settings;
+
+// Snapshots of a spectrum after each analysis stage, keyed by a hash of the input
+// spectrum and the commands of that stage and all stages before it. Changing a late
+// parameter (e.g. MDAConfidenceFactor) only changes the keys from that stage on, so a
+// re-run restores the last valid snapshot and runs the remaining stages.
+class AnalysisCache
+{
+public:
+
+    struct Stats
+    {
+        int hits[AnalysisStageCount];
+        int misses[AnalysisStageCount];
+    };
+
+    explicit AnalysisCache(const QString& directory);
+
+    QString directory() const { return mDirectory; }
+
+    Stats stats() const;
+    void resetStats();
+
+    // Removes the least recently written snapshots until the cache fits in maxBytes
+    void trim(qint64 maxBytes);
+
+    QString stageFile(const QByteArray& key, AnalysisStage stage) const;
+    void record(AnalysisStage stage, bool hit);
+
+private:
+
+    QString mDirectory;
+    mutable QMutex mMutex;
+    Stats mStats;
+};
+
+// "peak search 12/40, peak area 12/40, ..." hits per stage
+QString analysisCacheSummary(const AnalysisCache::Stats& stats);
+
+QByteArray analysisStageKey(const QByteArray& inputKey, AnalysisStage stage,
+                            const Detector& detector, const Settings& settings);
+
+QString analysisStageName(AnalysisStage stage);
+
+// Hashes baseFilename.CNF, fills keys with the cache key of every stage and restores
+// the spectrum (and report) of the last cached stage. Returns the first stage that has
+// to run, AnalysisStageCount if everything came from the cache, or -1 on error.
+int prepareCachedAnalysis(const QString& baseFilename, const Detector& detector, const Settings& settings,
+                          AnalysisCache& cache, QByteArray keys[AnalysisStageCount]);
+
+// Script, output and error file of a single stage, e.g. <base>-MDA.BAT
+QString analysisStageFilename(const QString& baseFilename, AnalysisStage stage);
+
+// Runs one stage on baseFilename.CNF as its own script, snapshotting the result to the
+// cache under key if there is a cache
+bool runAnalysisStage(const QString& baseFilename, AnalysisStage stage, const Detector& detector,
+                      const Settings& settings, JobRunner runner, AnalysisCache* cache, const QByteArray& key);
+
+// Analyses baseFilename.CNF in place, resuming after the last cached stage. The report
+// is written to baseFilename.RPT. resumedStage receives the first stage that had to run
+// (AnalysisStageCount if everything came from the cache).
+bool runCachedAnalysis(const QString& baseFilename, const Detector& detector, const Settings& settings,
+                       JobRunner runner, AnalysisCache& cache, int* resumedStage = 0);
+
+#endif // ANALYSISCACHE_H
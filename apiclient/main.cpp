@@ -0,0 +1,173 @@
+#include <cstdio>
+#include <algorithm>
+#include <QCoreApplication>
+#include <QLocalSocket>
+#include <QElapsedTimer>
+#include <QStringList>
+#include <QVector>
+#include <QQueue>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QJsonArray>
+#include "jobapi.h"
+
+static void usage()
+{
+    fprintf(stderr,
+            "Usage: nailab-apiclient [--name=<server>] <command> [arguments]\n\n"
+            "Commands:\n"
+            "  request <json>                   Send one request and print the response\n"
+            "  load [--samples=<n>] [--batch=<n>] [--pipeline=<n>] [--geometry=<beaker>] [--detector=<name>]\n"
+            "                                   Submit samples as fast as possible and report throughput\n"
+            "                                   and latency percentiles\n");
+}
+
+static QString option(const QStringList& args, const QString& name, const QString& defaultValue)
+{
+    foreach(const QString& arg, args)
+    {
+        if(arg.startsWith("--" + name + "="))
+            return arg.mid(name.length() + 3);
+    }
+    return defaultValue;
+}
+
+static bool readResponse(QLocalSocket& socket, QByteArray& line)
+{
+    while(!socket.canReadLine())
+    {
+        if(!socket.waitForReadyRead(30000))
+            return false;
+    }
+    line = socket.readLine().trimmed();
+    return true;
+}
+
+static int request(QLocalSocket& socket, const QStringList& args)
+{
+    if(args.isEmpty())
+    {
+        usage();
+        return 2;
+    }
+
+    socket.write(args[0].toUtf8() + "\n");
+    socket.flush();
+
+    QByteArray line;
+    if(!readResponse(socket, line))
+    {
+        fprintf(stderr, "nailab-apiclient: no response from server\n");
+        return 1;
+    }
+
+    printf("%s\n", line.constData());
+    QJsonObject response = QJsonDocument::fromJson(line).object();
+    return response["ok"].toBool() ? 0 : 1;
+}
+
+static double percentile(QVector<double>& values, double p)
+{
+    if(values.isEmpty())
+        return 0.0;
+    int idx = qMin(values.count() - 1, (int)(p * values.count()));
+    std::nth_element(values.begin(), values.begin() + idx, values.end());
+    return values[idx];
+}
+
+static int load(QLocalSocket& socket, const QStringList& args)
+{
+    int samples = option(args, "samples", "1000").toInt();
+    int batch = qMax(1, option(args, "batch", "10").toInt());
+    int pipeline = qMax(1, option(args, "pipeline", "4").toInt());
+    QString geometry = option(args, "geometry", "");
+    QString detector = option(args, "detector", "");
+
+    QQueue<qint64> sendTimes;
+    QVector<double> latencies;
+    int sent = 0, accepted = 0, rejected = 0;
+
+    QElapsedTimer timer;
+    timer.start();
+
+    // Keep up to <pipeline> requests in flight to measure server throughput, not round trips
+    while(sent < samples || !sendTimes.isEmpty())
+    {
+        while(sendTimes.count() < pipeline && sent < samples)
+        {
+            QJsonArray list;
+            for(int i=0; i<batch && sent < samples; i++, sent++)
+            {
+                QJsonObject sample;
+                sample["Title"] = "Load test";
+                sample["ID"] = QString("LOAD-%1").arg(sent);
+                sample["Geometry"] = geometry;
+                if(!detector.isEmpty())
+                    sample["Detector"] = detector;
+                list.append(sample);
+            }
+
+            QJsonObject req;
+            req["cmd"] = "submit";
+            req["samples"] = list;
+            socket.write(QJsonDocument(req).toJson(QJsonDocument::Compact) + "\n");
+            sendTimes.enqueue(timer.nsecsElapsed());
+        }
+        socket.flush();
+
+        QByteArray line;
+        if(!readResponse(socket, line))
+        {
+            fprintf(stderr, "nailab-apiclient: no response from server\n");
+            return 1;
+        }
+
+        latencies.append((timer.nsecsElapsed() - sendTimes.dequeue()) / 1000000.0);
+        QJsonObject response = QJsonDocument::fromJson(line).object();
+        accepted += response["accepted"].toArray().count();
+        rejected += response["rejected"].toArray().count();
+    }
+
+    double seconds = timer.nsecsElapsed() / 1000000000.0;
+    printf("samples     %d (accepted %d, rejected %d)\n", samples, accepted, rejected);
+    printf("requests    %d, batch %d, pipeline %d\n", latencies.count(), batch, pipeline);
+    printf("elapsed     %.3f s\n", seconds);
+    printf("throughput  %.1f samples/s\n", seconds > 0.0 ? samples / seconds : 0.0);
+    printf("latency ms  p50 %.3f  p95 %.3f  p99 %.3f  max %.3f\n",
+           percentile(latencies, 0.50), percentile(latencies, 0.95),
+           percentile(latencies, 0.99), percentile(latencies, 1.0));
+    return rejected ? 1 : 0;
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication a(argc, argv);
+
+    QStringList args = a.arguments().mid(1);
+    QString name = option(args, "name", NAILAB_API_SERVER_NAME);
+    if(!args.isEmpty() && args[0].startsWith("--name="))
+        args.removeFirst();
+
+    if(args.isEmpty())
+    {
+        usage();
+        return 2;
+    }
+
+    QLocalSocket socket;
+    socket.connectToServer(name);
+    if(!socket.waitForConnected(5000))
+    {
+        fprintf(stderr, "nailab-apiclient: unable to connect to %s: %s\n", qPrintable(name), qPrintable(socket.errorString()));
+        return 1;
+    }
+
+    QString command = args.takeFirst();
+    if(command == "request")
+        return request(socket, args);
+    else if(command == "load")
+        return load(socket, args);
+
+    usage();
+    return 2;
+}
@@ -0,0 +1,19 @@
+#-------------------------------------------------
+#
+# Test client and load generator for the nailab job API
+#
+#-------------------------------------------------
+
+CONFIG += c++11 console
+CONFIG -= app_bundle
+
+QT       += core network
+QT       -= gui
+
+TARGET = nailab-apiclient
+TEMPLATE = app
+
+INCLUDEPATH += $$PWD/..
+DEPENDPATH += $$PWD/..
+
+SOURCES += main.cpp
@@ -0,0 +1,152 @@
+#include <QFile>
+#include <QFileInfo>
+#include <QDir>
+#include <QDirIterator>
+#include <QDateTime>
+#include <QElapsedTimer>
+#include <QTextStream>
+#include <QTimer>
+#ifdef Q_OS_WIN
+#include <windows.h>
+#elif defined(Q_OS_LINUX)
+#include <unistd.h>
+#include <sys/syscall.h>
+#endif
+#include "archivestore.h"
+#include "jobutils.h"
+#include "chunkstore.h"
+
+ArchiveStore::ArchiveStore(const QString& tempDirectory, const QString& archiveDirectory, QObject *parent)
+    : QObject(parent), mTempDirectory(tempDirectory), mArchiveDirectory(archiveDirectory)
+{
+}
+
+void ArchiveStore::store(const Detector& detector)
+{
+    QString name = detector.name;
+    QString archiveBase, error;
+    bool ok = storeJob(mTempDirectory, mArchiveDirectory, detector, &archiveBase, &error,
+                       [this, name](int done, int total) { emit progress(name, done, total); });
+    if(ok)
+        emit stored(name, archiveBase);
+    else
+        emit storeFailed(name, error);
+}
+
+static void lowerIoPriority()
+{
+#ifdef Q_OS_WIN
+    // Background mode lowers both CPU and I/O priority of the thread
+    SetThreadPriority(GetCurrentThread(), THREAD_MODE_BACKGROUND_BEGIN);
+#elif defined(Q_OS_LINUX)
+    // ioprio_set(IOPRIO_WHO_PROCESS, this thread, IOPRIO_CLASS_IDLE)
+    syscall(SYS_ioprio_set, 1, 0, 3 << 13);
+#endif
+}
+
+ArchiveScrubber::ArchiveScrubber(const QString& archiveDirectory, const QString& logFilename,
+                                 qint64 bytesPerSecond, int intervalHours, QObject *parent)
+    : QObject(parent), mArchiveDirectory(archiveDirectory), mLogFilename(logFilename),
+      mBytesPerSecond(qMax(qint64(1), bytesPerSecond)), mIntervalHours(intervalHours), mTimer(NULL),
+      mManifests(0), mFiles(0), mFailures(0)
+{
+}
+
+void ArchiveScrubber::start()
+{
+    if(mTimer)
+        return;
+
+    lowerIoPriority();
+
+    mTimer = new QTimer(this);
+    mTimer->setSingleShot(true);
+    connect(mTimer, SIGNAL(timeout()), this, SLOT(step()));
+
+    // Leave startup alone
+    mTimer->start(10 * 60 * 1000);
+}
+
+void ArchiveScrubber::log(const QString& line)
+{
+    QFile file(mLogFilename);
+    if(!file.open(QIODevice::WriteOnly | QIODevice::Text | QIODevice::Append))
+        return;
+    QTextStream s(&file);
+    s << QDateTime::currentDateTime().toString("yyyy-MM-dd HH:mm:ss") << " " << line << "\n";
+}
+
+void ArchiveScrubber::step()
+{
+    if(mPending.isEmpty())
+    {
+        QDirIterator iter(mArchiveDirectory, QStringList() << "*.SUM", QDir::Files, QDirIterator::Subdirectories);
+        while(iter.hasNext())
+            mPending << iter.next();
+        mManifests = mFiles = mFailures = 0;
+        if(mPending.isEmpty())
+        {
+            mTimer->start(mIntervalHours * 3600 * 1000);
+            return;
+        }
+    }
+
+    QString manifest = mPending.takeFirst();
+    QDir dir = QFileInfo(manifest).dir();
+    qint64 bytes = 0;
+    QElapsedTimer timer;
+    timer.start();
+
+    QFile file(manifest);
+    if(file.open(QIODevice::ReadOnly | QIODevice::Text))
+    {
+        // <sha256 hex>  <file name>, as written by storeJob
+        QTextStream s(&file);
+        for(QString line = s.readLine(); !line.isNull(); line = s.readLine())
+        {
+            int sep = line.indexOf("  ");
+            if(sep <= 0)
+                continue;
+
+            QString filename = dir.absoluteFilePath(line.mid(sep + 2));
+            QByteArray expected = QByteArray::fromHex(line.left(sep).toLatin1());
+            mFiles++;
+
+            // Chunked files are read back through their recipe
+            QString problem;
+            qint64 size = 0;
+            QByteArray checksum = archivedFileChecksum(filename, &size);
+            if(checksum.isEmpty())
+                problem = "missing";
+            else if(checksum != expected)
+                problem = "checksum mismatch";
+            bytes += size;
+
+            if(!problem.isEmpty())
+            {
+                mFailures++;
+                log(problem.toUpper() + " " + QDir::toNativeSeparators(filename));
+                emit corrupted(filename, problem);
+            }
+        }
+        mManifests++;
+    }
+    else
+    {
+        mFailures++;
+        log("UNREADABLE " + QDir::toNativeSeparators(manifest));
+        emit corrupted(manifest, "unreadable manifest");
+    }
+
+    if(mPending.isEmpty())
+    {
+        log(QString("pass finished, %1 jobs, %2 files, %3 failures").arg(mManifests).arg(mFiles).arg(mFailures));
+        emit passFinished(mManifests, mFiles, mFailures);
+        mTimer->start(mIntervalHours * 3600 * 1000);
+        return;
+    }
+
+    // Paced to the byte budget, the time spent reading counts towards it
+    qint64 budgetMs = bytes * 1000 / mBytesPerSecond;
+    mTimer->start(int(qMax(qint64(0), budgetMs - timer.elapsed())));
+}
@@ -0,0 +1,75 @@
+#ifndef ARCHIVESTORE_H
+#define ARCHIVESTORE_H
+
+#include <QObject>
+#include <QString>
+#include <QStringList>
+#include "detector.h"
+
+class QTimer;
+
+// Stores finished jobs with storeJob on the thread it lives in, so copies to an
+// archive on another volume never block the GUI
+class ArchiveStore : public QObject
+{
+    Q_OBJECT
+
+public:
+
+    ArchiveStore(const QString& tempDirectory, const QString& archiveDirectory, QObject *parent = 0);
+
+public slots:
+
+    // detector must already have its spectrum counter incremented
+    void store(const Detector& detector);
+
+signals:
+
+    void progress(const QString& detector, int done, int total);
+    void stored(const QString& detector, const QString& archiveBase);
+    void storeFailed(const QString& detector, const QString& error);
+
+private:
+
+    QString mTempDirectory, mArchiveDirectory;
+};
+
+// Re-verifies the .SUM manifests written by storeJob. Reads at most bytesPerSecond,
+// one manifest per step, and lowers the I/O priority of its thread. Results of each
+// pass are appended to logFilename; a pass starts when started and then every
+// intervalHours.
+class ArchiveScrubber : public QObject
+{
+    Q_OBJECT
+
+public:
+
+    ArchiveScrubber(const QString& archiveDirectory, const QString& logFilename,
+                    qint64 bytesPerSecond, int intervalHours, QObject *parent = 0);
+
+public slots:
+
+    void start();
+
+signals:
+
+    void corrupted(const QString& file, const QString& problem);
+    void passFinished(int manifests, int files, int failures);
+
+private slots:
+
+    void step();
+
+private:
+
+    QString mArchiveDirectory, mLogFilename;
+    qint64 mBytesPerSecond;
+    int mIntervalHours;
+    QTimer *mTimer;
+    QStringList mPending;
+    int mManifests, mFiles, mFailures;
+
+    void log(const QString& line);
+};
+
+#endif // ARCHIVESTORE_H
@@ -0,0 +1,20 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <QString>
+#include <QStringList>
+#include "detector.h"
+
+QString option(const QStringList& args, const QString& name, const QString& defaultValue);
+QStringList positionalArguments(const QStringList& args);
+
+// Detector DET<index + 1> with eight beakers, as written to a generated mca.xml
+Detector syntheticDetector(int index);
+
+int benchReports(const QStringList& args);
+int benchResults(const QStringList& args);
+int benchStartup(const QStringList& args);
+int benchLoad(const QStringList& args);
+int benchDetectors(const QStringList& args);
+
+#endif // BENCH_H
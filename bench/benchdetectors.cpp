@@ -0,0 +1,192 @@
+#include <cstdio>
+#include <QDir>
+#include <QFile>
+#include <QSet>
+#include <QTextStream>
+#include <QElapsedTimer>
+#include "bench.h"
+#include "dbutils.h"
+#include "jobutils.h"
+#include "sampleinput.h"
+#include "settings.h"
+
+// Heap bytes held by the strings of a detector list, shared strings counted once
+static qint64 stringBytes(const QList<Detector>& detectors)
+{
+    QSet<const void*> seen;
+    qint64 bytes = 0;
+    foreach(const Detector& detector, detectors)
+    {
+        QList<QString> strings;
+        strings << detector.name << detector.backgroundSubtract << detector.NIDLibrary;
+        QMapIterator<QString, QString> iter(detector.beakers);
+        while(iter.hasNext())
+        {
+            iter.next();
+            strings << iter.key() << iter.value();
+        }
+
+        foreach(const QString& string, strings)
+        {
+            if(string.isEmpty() || seen.contains(string.constData()))
+                continue;
+            seen.insert(string.constData());
+            bytes += sizeof(QArrayData) + (string.size() + 1) * sizeof(QChar);
+        }
+    }
+    return bytes;
+}
+
+static const Detector* findLinear(const QList<Detector>& detectors, const QString& name)
+{
+    for(int i=0; i<detectors.count(); i++)
+    {
+        if(detectors[i].name == name)
+            return &detectors[i];
+    }
+    return NULL;
+}
+
+int benchDetectors(const QStringList& args)
+{
+    QStringList positional = positionalArguments(args);
+    if(positional.isEmpty())
+    {
+        fprintf(stderr, "detectors: missing directory\n");
+        return 2;
+    }
+
+    int detectorCount = qMax(1, option(args, "detectors", "50").toInt());
+    int lookups = qMax(1, option(args, "lookups", "1000000").toInt());
+    int scripts = qMax(1, option(args, "scripts", "10000").toInt());
+    int rounds = qMax(1, option(args, "rounds", "5").toInt());
+
+    if(!QDir().mkpath(positional[0]))
+    {
+        fprintf(stderr, "detectors: unable to create %s\n", qPrintable(positional[0]));
+        return 1;
+    }
+
+    QList<Detector> detectors;
+    for(int i=0; i<detectorCount; i++)
+        detectors << syntheticDetector(i);
+    QFile file(QDir(positional[0]).absoluteFilePath("mca.xml"));
+    if(!writeDetectorXml(file, detectors))
+    {
+        fprintf(stderr, "detectors: unable to write %s\n", qPrintable(file.fileName()));
+        return 1;
+    }
+
+    // Best of the rounds for each measurement
+    qint64 loadUs = -1;
+    for(int r=0; r<rounds; r++)
+    {
+        QElapsedTimer timer;
+        timer.start();
+        if(!readDetectorXml(file, detectors))
+        {
+            fprintf(stderr, "detectors: unable to read %s\n", qPrintable(file.fileName()));
+            return 1;
+        }
+        qint64 us = timer.nsecsElapsed() / 1000;
+        if(loadUs < 0 || us < loadUs)
+            loadUs = us;
+    }
+
+    QStringList names;
+    for(int i=0; i<detectorCount; i++)
+        names << detectors[i].name;
+
+    qint64 linearNs = -1, indexedNs = -1;
+    int found = 0;
+    DetectorIndex index;
+    for(int r=0; r<rounds; r++)
+    {
+        QElapsedTimer timer;
+        timer.start();
+        for(int i=0; i<lookups; i++)
+            found += findLinear(detectors, names[i % detectorCount]) != NULL;
+        qint64 ns = timer.nsecsElapsed();
+        if(linearNs < 0 || ns < linearNs)
+            linearNs = ns;
+
+        timer.restart();
+        for(int i=0; i<lookups; i++)
+            found += index.find(detectors, names[i % detectorCount]) >= 0;
+        ns = timer.nsecsElapsed();
+        if(indexedNs < 0 || ns < indexedNs)
+            indexedNs = ns;
+    }
+    if(found != 2 * lookups * rounds)
+    {
+        fprintf(stderr, "detectors: lookup missed\n");
+        return 1;
+    }
+
+    Settings settings;
+    settings.templateName = "NAILAB.TPL";
+    settings.sectionName = "Nailab";
+    settings.errorMultiplier = 2.0;
+
+    // Mode 0 compiles every script from scratch as before job templates, mode 1 uses them
+    qint64 scriptNs[2] = { -1, -1 }, fileNs[2] = { -1, -1 };
+    QString jobDirectory = QDir(positional[0]).absoluteFilePath("TEMP") + "/";
+    if(!QDir().mkpath(jobDirectory))
+    {
+        fprintf(stderr, "detectors: unable to create %s\n", qPrintable(jobDirectory));
+        return 1;
+    }
+
+    for(int mode=0; mode<2; mode++)
+    {
+        invalidateJobTemplates();
+        for(int r=0; r<rounds; r++)
+        {
+            QString script;
+            QElapsedTimer timer;
+            timer.start();
+            for(int i=0; i<scripts; i++)
+            {
+                const Detector& detector = detectors[i % detectorCount];
+                SampleInput sampleInput;
+                defaultSampleInput(detector, sampleInput);
+                if(mode == 0)
+                    invalidateJobTemplates();
+                script.clear();
+                QTextStream stream(&script);
+                writeJobScript(stream, jobDirectory + detector.name, sampleInput, detector, settings, "bench");
+            }
+            qint64 ns = timer.nsecsElapsed();
+            if(scriptNs[mode] < 0 || ns < scriptNs[mode])
+                scriptNs[mode] = ns;
+
+            // Job creation as startJob sees it, including the .BAT on disk
+            int files = qMin(scripts, 1000);
+            timer.restart();
+            for(int i=0; i<files; i++)
+            {
+                const Detector& detector = detectors[i % detectorCount];
+                SampleInput sampleInput;
+                defaultSampleInput(detector, sampleInput);
+                if(mode == 0)
+                    invalidateJobTemplates();
+                writeJobFile(jobDirectory + detector.name, sampleInput, detector, settings, "bench");
+            }
+            ns = timer.nsecsElapsed() / files;
+            if(fileNs[mode] < 0 || ns < fileNs[mode])
+                fileNs[mode] = ns;
+        }
+    }
+
+    printf("detectors            %d\n", detectorCount);
+    printf("load mca.xml         %lld us\n", loadUs);
+    printf("detector struct      %d bytes\n", int(sizeof(Detector)));
+    printf("string heap          %lld bytes (%lld per detector)\n",
+           stringBytes(detectors), stringBytes(detectors) / detectorCount);
+    printf("lookup linear        %.1f ns\n", double(linearNs) / lookups);
+    printf("lookup indexed       %.1f ns\n", double(indexedNs) / lookups);
+    printf("job scripts          %.0f /s (%.0f /s without templates)\n",
+           scripts * 1e9 / qMax(qint64(1), scriptNs[1]), scripts * 1e9 / qMax(qint64(1), scriptNs[0]));
+    printf("job file             %.1f us (%.1f us without templates)\n", fileNs[1] / 1000.0, fileNs[0] / 1000.0);
+    return 0;
+}
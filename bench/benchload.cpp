@@ -0,0 +1,254 @@
+#include <cstdio>
+#include <QDir>
+#include <QDateTime>
+#include <QElapsedTimer>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QThreadPool>
+#include <QRunnable>
+#include <QVector>
+#include <algorithm>
+#ifdef Q_OS_UNIX
+#include <sys/resource.h>
+#include <time.h>
+#endif
+#include "bench.h"
+#include "jobutils.h"
+#include "metrics.h"
+#include "simjob.h"
+#include "resultstore.h"
+#include "settings.h"
+#include "sampleinput.h"
+
+// Parts of a job's way through the system, timed separately
+enum LoadComponent
+{
+    LoadGenerate,   // writeJobFile, as startJob does
+    LoadRun,        // runMeasuredJob with the simulated runner, the supervised script
+    LoadArchive,    // storeJob or rejectJob
+    LoadIndex,      // result store append of stored reports
+    LoadComponentCount
+};
+
+static const char* componentNames[LoadComponentCount] = { "generate", "run", "archive", "index" };
+
+struct LoadStats
+{
+    QMutex mutex;
+    QVector<qint64> latencyMs;
+    qint64 wallMs[LoadComponentCount];
+    qint64 cpuUs[LoadComponentCount];
+    int stored, rejected, failed;
+
+    LoadStats() : stored(0), rejected(0), failed(0)
+    {
+        for(int c=0; c<LoadComponentCount; c++)
+            wallMs[c] = cpuUs[c] = 0;
+    }
+};
+
+static qint64 threadCpuUs()
+{
+#ifdef Q_OS_UNIX
+    timespec ts;
+    if(clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) == 0)
+        return qint64(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+#endif
+    return 0;
+}
+
+static long peakRssKb()
+{
+#ifdef Q_OS_UNIX
+    rusage usage;
+    if(getrusage(RUSAGE_SELF, &usage) == 0)
+        return usage.ru_maxrss;
+#endif
+    return 0;
+}
+
+// Wall and CPU time of one component on the calling thread
+class ComponentTimer
+{
+public:
+
+    ComponentTimer() : mCpu(threadCpuUs()) { mWall.start(); }
+
+    void add(LoadStats& stats, LoadComponent component)
+    {
+        qint64 cpu = threadCpuUs();
+        QMutexLocker lock(&stats.mutex);
+        stats.wallMs[component] += mWall.restart();
+        stats.cpuUs[component] += cpu - mCpu;
+        mCpu = cpu;
+    }
+
+private:
+
+    QElapsedTimer mWall;
+    qint64 mCpu;
+};
+
+// Runs the jobs of one detector back to back, like an operator who stores or rejects each
+// finished job before accepting the next sample
+class DetectorLoad : public QRunnable
+{
+public:
+
+    DetectorLoad(const QString& rootDirectory, const Detector& detector, const Settings& settings,
+                 int jobs, int rejectPercent, ResultStore *store, QMutex *storeMutex, LoadStats *stats)
+        : mRootDirectory(rootDirectory), mDetector(detector), mSettings(settings), mJobs(jobs),
+          mRejectPercent(rejectPercent), mStore(store), mStoreMutex(storeMutex), mStats(stats) {}
+
+    void run()
+    {
+        QString tempDirectory = mRootDirectory + "TEMP/";
+        QString archiveDirectory = mRootDirectory + "ARCHIVE/";
+        QString baseFilename = tempDirectory + mDetector.name;
+        uint seed = qHash(mDetector.name);
+
+        for(int j=0; j<mJobs; j++)
+        {
+            QDateTime accepted = QDateTime::currentDateTime();
+            ComponentTimer timer;
+
+            SampleInput sampleInput;
+            defaultSampleInput(mDetector, sampleInput);
+            sampleInput.title = "Load " + mDetector.name;
+            sampleInput.ID = QString("%1-%2").arg(mDetector.name).arg(j);
+            sampleInput.geometry = mDetector.beakers.constBegin().key();
+            sampleInput.quantity = "1";
+            sampleInput.units = "kg";
+            sampleInput.username = "bench";
+
+            bool ok = writeJobFile(baseFilename, sampleInput, mDetector, mSettings, "bench", accepted);
+            timer.add(*mStats, LoadGenerate);
+
+            ok = ok && runMeasuredJob(runSimulatedJob, baseFilename, mDetector.name) && QFile::exists(baseFilename + ".DONE");
+            timer.add(*mStats, LoadRun);
+
+            seed = seed * 1103515245u + 12345u;
+            bool reject = !ok || int((seed >> 8) % 100) < mRejectPercent;
+            QString archiveBase;
+            if(reject)
+                rejectJob(tempDirectory, mDetector.name);
+            else
+            {
+                mDetector.spectrumCounter++;
+                if(!storeJob(tempDirectory, archiveDirectory, mDetector, &archiveBase))
+                    ok = false;
+            }
+            timer.add(*mStats, LoadArchive);
+
+            if(ok && !reject)
+            {
+                QMutexLocker lock(mStoreMutex);
+                if(!mStore->appendReport(archiveBase + ".RPT"))
+                    ok = false;
+            }
+            timer.add(*mStats, LoadIndex);
+
+            QMutexLocker lock(&mStats->mutex);
+            mStats->latencyMs.append(accepted.msecsTo(QDateTime::currentDateTime()));
+            if(!ok)
+                mStats->failed++;
+            else if(reject)
+                mStats->rejected++;
+            else
+                mStats->stored++;
+        }
+    }
+
+private:
+
+    QString mRootDirectory;
+    Detector mDetector;
+    Settings mSettings;
+    int mJobs, mRejectPercent;
+    ResultStore *mStore;
+    QMutex *mStoreMutex;
+    LoadStats *mStats;
+};
+
+static qint64 percentile(const QVector<qint64>& sorted, double p)
+{
+    if(sorted.isEmpty())
+        return 0;
+    int index = qMin(sorted.count() - 1, int(p * sorted.count()));
+    return sorted[index];
+}
+
+int benchLoad(const QStringList& args)
+{
+    QStringList positional = positionalArguments(args);
+    if(positional.isEmpty())
+    {
+        fprintf(stderr, "load: missing directory\n");
+        return 2;
+    }
+
+    int detectorCount = qMax(1, option(args, "detectors", "12").toInt());
+    int jobs = qMax(1, option(args, "jobs", "20").toInt());
+    double liveTime = option(args, "live", "3600").toDouble();
+    double scale = option(args, "scale", "0.0001").toDouble();
+    int rejectPercent = qBound(0, option(args, "reject", "10").toInt(), 100);
+
+    QString rootDirectory = QDir(positional[0]).absolutePath() + "/";
+    if(!QDir().mkpath(rootDirectory + "TEMP") || !QDir().mkpath(rootDirectory + "ARCHIVE"))
+    {
+        fprintf(stderr, "load: unable to create %s\n", qPrintable(rootDirectory));
+        return 1;
+    }
+
+    ResultStore store(rootDirectory + "RESULTS");
+    if(!store.open())
+    {
+        fprintf(stderr, "load: unable to open result store in %sRESULTS\n", qPrintable(rootDirectory));
+        return 1;
+    }
+
+    Settings settings;
+    settings.templateName = "NAILAB.TPL";
+    settings.sectionName = "Nailab";
+    settings.errorMultiplier = 2.0;
+    setSimulatedJobTimeScale(scale);
+
+    LoadStats stats;
+    QMutex storeMutex;
+    QThreadPool pool;
+    pool.setMaxThreadCount(detectorCount);
+
+    long rssBefore = peakRssKb();
+    QElapsedTimer timer;
+    timer.start();
+    for(int i=0; i<detectorCount; i++)
+    {
+        Detector detector = syntheticDetector(i);
+        detector.presetType2 = TimePresetLive;
+        detector.presetType2Value = liveTime;
+        pool.start(new DetectorLoad(rootDirectory, detector, settings, jobs, rejectPercent, &store, &storeMutex, &stats));
+    }
+    pool.waitForDone();
+    qint64 elapsed = qMax(qint64(1), timer.elapsed());
+
+    std::sort(stats.latencyMs.begin(), stats.latencyMs.end());
+    int total = stats.latencyMs.count();
+    double simulatedMs = liveTime * scale * 1000.0;
+
+    printf("%d detectors x %d jobs, live time %.0f s simulated as %.1f ms\n", detectorCount, jobs, liveTime, simulatedMs);
+    printf("stored %d, rejected %d, failed %d in %lld ms\n", stats.stored, stats.rejected, stats.failed, elapsed);
+    printf("throughput %.0f jobs/hour\n", total * 3600000.0 / elapsed);
+    printf("latency ms: p50 %lld, p90 %lld, p99 %lld, max %lld (acquisition %.1f)\n",
+           percentile(stats.latencyMs, 0.50), percentile(stats.latencyMs, 0.90),
+           percentile(stats.latencyMs, 0.99), total ? stats.latencyMs.last() : 0, simulatedMs);
+
+    printf("\n%-10s %12s %12s %14s\n", "component", "wall ms", "cpu ms", "cpu us/job");
+    for(int c=0; c<LoadComponentCount; c++)
+    {
+        printf("%-10s %12lld %12lld %14lld\n", componentNames[c], stats.wallMs[c], stats.cpuUs[c] / 1000,
+               total ? stats.cpuUs[c] / total : 0);
+    }
+    printf("\npeak rss %ld kB (%ld kB before the run)\n", peakRssKb(), rssBefore);
+
+    return stats.failed ? 1 : 0;
+}
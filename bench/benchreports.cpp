@@ -0,0 +1,182 @@
+#include <cstdio>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QTextStream>
+#include <QElapsedTimer>
+#include <QMap>
+#include "bench.h"
+#include "reportparser.h"
+#include "simjob.h"
+#include "reporttemplate.h"
+
+static bool generateReports(const QString& directory, int count)
+{
+    static const char* geometries[] = { "MARI1L", "PETRI", "BOX250" };
+
+    QMap<QString, QString> sample;
+    sample["/stype="] = "Soil";
+    sample["/squant="] = "1.25";
+    sample["/sunits="] = "kg";
+    sample["/stime="] = "01.01.2014 12:00:00";
+
+    for(int i=0; i<count; i++)
+    {
+        QString id = QString::number(i);
+        sample["/stitle="] = "Benchmark sample " + id;
+        sample["/sident="] = "BENCH-" + id;
+        sample["/sgeomtry="] = geometries[i % 3];
+        QString detector = "DET" + QString::number(i % 12 + 1);
+        if(!writeSimulatedReport(QDir(directory).absoluteFilePath(QString("BENCH-%1.RPT").arg(i, 6, 10, QChar('0'))),
+                                 detector, sample, 3600.0))
+            return false;
+    }
+    return true;
+}
+
+// What a reader built from QTextStream and QString::split costs, for comparison
+static bool parseReportBaseline(const QString& filename, ReportResult& result)
+{
+    QFile file(filename);
+    if(!file.open(QIODevice::ReadOnly | QIODevice::Text))
+        return false;
+
+    result.clear();
+    QTextStream in(&file);
+    bool table = false;
+    while(!in.atEnd())
+    {
+        QString line = in.readLine().trimmed();
+        if(table)
+        {
+            if(line.isEmpty())
+            {
+                table = false;
+                continue;
+            }
+            QStringList tokens = line.split(' ', QString::SkipEmptyParts);
+            if(tokens.count() < 5)
+                continue;
+            ReportNuclide nuclide;
+            nuclide.name = tokens[0];
+            nuclide.energy = tokens[1].toDouble();
+            nuclide.activity = tokens[2].toDouble();
+            nuclide.uncertainty = tokens[3].toDouble();
+            nuclide.mda = tokens[4].toDouble();
+            nuclide.flags = tokens.count() > 5 && tokens[5].contains('<') ? ReportNuclide::BelowMDA : 0;
+            result.nuclides.append(nuclide);
+        }
+        else if(line.startsWith("---"))
+            table = true;
+        else if(line.startsWith("Sample Title"))
+            result.title = line.section(':', 1).trimmed();
+        else if(line.startsWith("Detector Name"))
+            result.detector = line.section(':', 1).trimmed();
+    }
+    return true;
+}
+
+static void printRun(const char* name, int files, qint64 bytes, qint64 nsecs, int nuclides, double activitySum)
+{
+    double secs = nsecs / 1e9;
+    printf("%-10s %8d reports %10.1f ms %10.0f reports/s %8.1f MB/s %8d nuclides (sum %.6g)\n",
+           name, files, nsecs / 1e6, files / secs, bytes / secs / (1024.0 * 1024.0), nuclides, activitySum);
+}
+
+int benchReports(const QStringList& args)
+{
+    QStringList positional = positionalArguments(args);
+    if(positional.isEmpty())
+    {
+        fprintf(stderr, "reports: missing directory\n");
+        return 2;
+    }
+
+    QString directory = positional[0];
+    int generate = option(args, "generate", "0").toInt();
+    int rounds = qMax(1, option(args, "rounds", "3").toInt());
+
+    if(!QDir().mkpath(directory))
+    {
+        fprintf(stderr, "reports: unable to create %s\n", qPrintable(directory));
+        return 1;
+    }
+
+    if(generate > 0 && !generateReports(directory, generate))
+    {
+        fprintf(stderr, "reports: unable to write reports to %s\n", qPrintable(directory));
+        return 1;
+    }
+
+    QDir dir(directory);
+    QStringList files;
+    qint64 bytes = 0;
+    foreach(const QFileInfo& info, dir.entryInfoList(QStringList() << "*.RPT", QDir::Files, QDir::Name))
+    {
+        files << info.absoluteFilePath();
+        bytes += info.size();
+    }
+    if(files.isEmpty())
+    {
+        fprintf(stderr, "reports: no .RPT files in %s\n", qPrintable(directory));
+        return 1;
+    }
+
+    ReportResult result;
+    QElapsedTimer timer;
+    for(int round=0; round<rounds; round++)
+    {
+        int nuclides = 0, failed = 0;
+        double activitySum = 0.0;
+        timer.start();
+        foreach(const QString& filename, files)
+        {
+            if(!parseReportBaseline(filename, result))
+            {
+                failed++;
+                continue;
+            }
+            nuclides += result.nuclides.count();
+            foreach(const ReportNuclide& n, result.nuclides)
+                activitySum += n.activity;
+        }
+        printRun("baseline", files.count() - failed, bytes, timer.nsecsElapsed(), nuclides, activitySum);
+
+        ReportParser parser;
+        nuclides = failed = 0;
+        activitySum = 0.0;
+        timer.start();
+        foreach(const QString& filename, files)
+        {
+            if(!parser.parseFile(filename, result))
+            {
+                failed++;
+                continue;
+            }
+            nuclides += result.nuclides.count();
+            foreach(const ReportNuclide& n, result.nuclides)
+                activitySum += n.activity;
+        }
+        printRun("parser", files.count() - failed, bytes, timer.nsecsElapsed(), nuclides, activitySum);
+
+        // Parse and render again with the built-in template, output bytes are counted
+        QSharedPointer<const ReportTemplate> tpl = loadReportTemplate(QString());
+        QByteArray rendered;
+        qint64 renderedBytes = 0;
+        nuclides = failed = 0;
+        timer.start();
+        foreach(const QString& filename, files)
+        {
+            if(!parser.parseFile(filename, result))
+            {
+                failed++;
+                continue;
+            }
+            tpl->render(result, rendered);
+            renderedBytes += rendered.size();
+            nuclides += result.nuclides.count();
+        }
+        printRun("render", files.count() - failed, renderedBytes, timer.nsecsElapsed(), nuclides, 0.0);
+    }
+    return 0;
+}
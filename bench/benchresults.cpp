@@ -0,0 +1,106 @@
+#include <cstdio>
+#include <QDir>
+#include <QElapsedTimer>
+#include "bench.h"
+#include "resultstore.h"
+
+static bool generateResults(ResultStore& store, int reports)
+{
+    static const char* nuclides[] = { "K-40", "CS-137", "CS-134", "BI-214", "PB-214", "TL-208", "AC-228" };
+    static const char* geometries[] = { "MARI1L", "PETRI", "BOX250" };
+
+    ReportResult result;
+    result.clear();
+    result.nuclides.resize(sizeof(nuclides) / sizeof(nuclides[0]));
+    for(int n=0; n<result.nuclides.count(); n++)
+    {
+        result.nuclides[n].name = nuclides[n];
+        result.nuclides[n].energy = 0.0;
+        result.nuclides[n].flags = 0;
+    }
+
+    // Spread the reports over four years, one project per 1000 samples
+    QDateTime start(QDate(2022, 1, 1), QTime(0, 0));
+    uint seed = 1;
+    for(int i=0; i<reports; i++)
+    {
+        result.sampleId = QString("P%1-%2").arg(i / 1000).arg(i);
+        result.detector = "DET" + QString::number(i % 12 + 1);
+        result.geometry = geometries[i % 3];
+        result.acquisitionStarted = start.addSecs(qint64(i) * 4 * 365 * 86400 / reports);
+        for(int n=0; n<result.nuclides.count(); n++)
+        {
+            seed = seed * 1103515245u + 12345u;
+            result.nuclides[n].activity = (seed % 10000) / 10.0;
+            result.nuclides[n].uncertainty = result.nuclides[n].activity * 0.08;
+            result.nuclides[n].mda = 1.0;
+        }
+        if(!store.append(result))
+            return false;
+    }
+    return true;
+}
+
+int benchResults(const QStringList& args)
+{
+    QStringList positional = positionalArguments(args);
+    if(positional.isEmpty())
+    {
+        fprintf(stderr, "results: missing directory\n");
+        return 2;
+    }
+
+    int generate = option(args, "generate", "0").toInt();
+    int rounds = qMax(1, option(args, "rounds", "3").toInt());
+
+    ResultStore store(positional[0]);
+    if(!store.open())
+    {
+        fprintf(stderr, "results: unable to open result store in %s\n", qPrintable(positional[0]));
+        return 1;
+    }
+
+    QElapsedTimer timer;
+    if(generate > 0)
+    {
+        timer.start();
+        if(!generateResults(store, generate))
+        {
+            fprintf(stderr, "results: unable to append results\n");
+            return 1;
+        }
+        printf("appended %d reports in %lld ms\n", generate, timer.elapsed());
+    }
+
+    ResultQuery all;
+    ResultQuery cs137;
+    cs137.nuclide = "CS-137";
+    ResultQuery project;
+    project.nuclide = "CS-137";
+    project.samplePrefix = "P1-";
+    project.from = QDateTime(QDate(2023, 1, 1), QTime(0, 0));
+    project.to = QDateTime(QDate(2024, 1, 1), QTime(0, 0));
+
+    for(int round=0; round<rounds; round++)
+    {
+        QVector<ResultGroup> groups;
+        QVector<ResultRow> rows;
+
+        timer.start();
+        store.aggregate(all, ResultStore::GroupNuclide, groups);
+        printf("%-32s %10lld rows %8.1f ms %6d groups\n", "all by nuclide", store.rowCount(), timer.nsecsElapsed() / 1e6, groups.count());
+
+        timer.start();
+        store.aggregate(cs137, ResultStore::GroupMonth, groups);
+        printf("%-32s %10lld rows %8.1f ms %6d groups\n", "CS-137 by month", store.rowCount(), timer.nsecsElapsed() / 1e6, groups.count());
+
+        timer.start();
+        store.aggregate(cs137, ResultStore::GroupDetector, groups);
+        printf("%-32s %10lld rows %8.1f ms %6d groups\n", "CS-137 by detector", store.rowCount(), timer.nsecsElapsed() / 1e6, groups.count());
+
+        timer.start();
+        store.select(project, rows);
+        printf("%-32s %10lld rows %8.1f ms %6d matches\n", "CS-137, project P1, 2023", store.rowCount(), timer.nsecsElapsed() / 1e6, rows.count());
+    }
+    return 0;
+}
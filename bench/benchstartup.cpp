@@ -0,0 +1,178 @@
+#include <cstdio>
+#include <QDir>
+#include <QFile>
+#include <QTextStream>
+#include <QThread>
+#include <QElapsedTimer>
+#include <QtConcurrent/QtConcurrent>
+#include "bench.h"
+#include "dbutils.h"
+#include "startupconfig.h"
+
+Detector syntheticDetector(int index)
+{
+    Detector detector;
+    detector.name = "DET" + QString::number(index + 1);
+    detector.enabled = true;
+    detector.inUse = index % 4 != 3;
+    detector.maxChannels = 0;
+    detector.searchRegionStart = 20;
+    detector.searchRegionEnd = 1024;
+    detector.significanceTreshold = 3.0;
+    detector.tolerance = 1.0;
+    detector.peakAreaRegionStart = 20;
+    detector.peakAreaRegionEnd = 1024;
+    detector.continuum = 4.0;
+    detector.continuumFunction = ContinuumLinear;
+    detector.criticalLevelTest = true;
+    detector.useFixedFWHM = false;
+    detector.useFixedTailParameter = false;
+    detector.fitSinglets = true;
+    detector.displayROIs = true;
+    detector.rejectZeroAreaPeaks = true;
+    detector.maxFWHMsBetweenPeaks = 2.0;
+    detector.maxFWHMsForLeftLimit = 1.0;
+    detector.maxFWHMsForRightLimit = 1.0;
+    detector.backgroundSubtract = "C:\\GENIE2K\\CAMFILES\\BACKGROUND.CNF";
+    detector.efficiencyCalibrationType = EfficiencyInterp;
+    detector.presetType1 = CountPresetNone;
+    detector.presetType1Value = 0.0;
+    detector.presetType1ChannelStart = 0;
+    detector.presetType1ChannelEnd = 0;
+    detector.presetType2 = TimePresetReal;
+    detector.presetType2Value = 3600.0;
+    detector.presetType2Unit = TimeSeconds;
+    detector.randomError = 0.0;
+    detector.systematicError = 0.0;
+    detector.spectrumCounter = index * 100;
+    for(int b=0; b<8; b++)
+        detector.beakers.insert("BEAKER" + QString::number(b), "CAL" + QString::number(b) + ".CAL");
+    detector.NIDLibrary = "C:\\GENIE2K\\CAMFILES\\NAILAB.NLB";
+    detector.NIDConfidenceTreshold = 0.3;
+    detector.MDAConfidenceFactor = 5.0;
+    detector.performMDATest = false;
+    detector.inhibitATDCorrection = false;
+    detector.useStoredLibrary = false;
+    return detector;
+}
+
+static bool generateConfig(const QString& directory, int detectorCount)
+{
+    if(!QDir().mkpath(directory))
+        return false;
+
+    Settings settings;
+    settings.templateName = "NAILAB.TPL";
+    settings.sectionName = "Nailab";
+    settings.errorMultiplier = 2.0;
+
+    QList<Beaker> beakers;
+    for(int b=0; b<8; b++)
+        beakers << Beaker("BEAKER" + QString::number(b), "Bench", true);
+
+    QList<Detector> detectors;
+    for(int i=0; i<detectorCount; i++)
+        detectors << syntheticDetector(i);
+
+    QFile settingsFile(directory + "settings.xml");
+    QFile beakerFile(directory + "beaker.xml");
+    QFile detectorFile(directory + "mca.xml");
+    if(!writeSettingsXml(settingsFile, settings) || !writeBeakerXml(beakerFile, beakers)
+            || !writeDetectorXml(detectorFile, detectors))
+        return false;
+
+    QFile unitsFile(directory + "quantity_units.xml");
+    if(!unitsFile.open(QIODevice::WriteOnly | QIODevice::Text))
+        return false;
+    QTextStream s(&unitsFile);
+    s << "<QuantityUnits><Unit>g</Unit><Unit>kg</Unit><Unit>l</Unit><Unit>m3</Unit></QuantityUnits>\n";
+    return true;
+}
+
+// Stands in for the VDM, which answers one detector at a time
+static int probeDetectors(const QList<Detector>& detectors, int probeMs)
+{
+    int probed = 0;
+    for(int i=0; i<detectors.count(); i++)
+    {
+        QThread::msleep(probeMs);
+        probed++;
+    }
+    return probed;
+}
+
+struct StartupTiming
+{
+    qint64 readyMs;     // configuration loaded, the window could be shown
+    qint64 probedMs;    // all detectors answered
+};
+
+static bool runStartup(const QString& directory, int probeMs, bool improved, StartupTiming& timing)
+{
+    QElapsedTimer timer;
+    timer.start();
+
+    StartupConfig config;
+    if(!loadStartupConfig(directory, config, improved))
+        return false;
+
+    if(improved)
+    {
+        QFuture<int> probe = QtConcurrent::run(probeDetectors, config.detectors, probeMs);
+        timing.readyMs = timer.elapsed();
+        probe.waitForFinished();
+    }
+    else
+    {
+        probeDetectors(config.detectors, probeMs);
+        timing.readyMs = timer.elapsed();
+    }
+    timing.probedMs = timer.elapsed();
+    return true;
+}
+
+int benchStartup(const QStringList& args)
+{
+    QStringList positional = positionalArguments(args);
+    if(positional.isEmpty())
+    {
+        fprintf(stderr, "startup: missing directory\n");
+        return 2;
+    }
+
+    QStringList counts = option(args, "detectors", "1,12,50").split(",", QString::SkipEmptyParts);
+    int probeMs = qMax(0, option(args, "probe-ms", "40").toInt());
+    int rounds = qMax(1, option(args, "rounds", "5").toInt());
+
+    printf("%-10s %-8s %12s %12s\n", "detectors", "mode", "ready ms", "probed ms");
+    foreach(const QString& count, counts)
+    {
+        int detectorCount = count.toInt();
+        QString directory = QDir(positional[0]).absoluteFilePath("startup-" + count) + "/";
+        if(detectorCount <= 0 || !generateConfig(directory, detectorCount))
+        {
+            fprintf(stderr, "startup: unable to generate configuration in %s\n", qPrintable(directory));
+            return 1;
+        }
+
+        for(int mode=0; mode<2; mode++)
+        {
+            // Best of the rounds, the first round also warms the file cache
+            StartupTiming best = { -1, -1 };
+            for(int r=0; r<rounds; r++)
+            {
+                StartupTiming timing;
+                if(!runStartup(directory, probeMs, mode == 1, timing))
+                {
+                    fprintf(stderr, "startup: unable to load configuration from %s\n", qPrintable(directory));
+                    return 1;
+                }
+                if(best.readyMs < 0 || timing.readyMs < best.readyMs)
+                    best = timing;
+            }
+            printf("%-10d %-8s %12lld %12lld\n", detectorCount, mode == 1 ? "after" : "before",
+                   best.readyMs, best.probedMs);
+        }
+    }
+    return 0;
+}
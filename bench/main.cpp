@@ -0,0 +1,76 @@
+#include <cstdio>
+#include <QCoreApplication>
+#include <QStringList>
+#include "bench.h"
+
+static void usage()
+{
+    fprintf(stderr,
+            "Usage: nailab-bench <benchmark> [arguments]\n\n"
+            "Benchmarks:\n"
+            "  reports [--generate=<n>] [--rounds=<n>] <directory>\n"
+            "                                   Parse all .RPT files in a directory, optionally\n"
+            "                                   generating <n> synthetic reports first\n"
+            "  results [--generate=<n>] [--rounds=<n>] <directory>\n"
+            "                                   Range and group-by queries on a result store,\n"
+            "                                   optionally appending <n> synthetic reports first\n"
+            "  startup [--detectors=1,12,50] [--probe-ms=<n>] [--rounds=<n>] <directory>\n"
+            "                                   Configuration load and MCA probe at startup, serial\n"
+            "                                   (before) against concurrent (after)\n"
+            "  load [--detectors=<n>] [--jobs=<n>] [--live=<s>] [--scale=<f>] [--reject=<%>] <directory>\n"
+            "                                   Runs <n> jobs per detector through job generation, the\n"
+            "                                   simulated Genie commands, store/reject and the result\n"
+            "                                   store; reports jobs/hour, latency and CPU per component\n"
+            "  detectors [--detectors=<n>] [--lookups=<n>] [--scripts=<n>] [--rounds=<n>] <directory>\n"
+            "                                   Detector configuration load, memory, lookup by name and\n"
+            "                                   job script and job file creation with and without\n"
+            "                                   job templates\n");
+}
+
+QString option(const QStringList& args, const QString& name, const QString& defaultValue)
+{
+    foreach(const QString& arg, args)
+    {
+        if(arg.startsWith("--" + name + "="))
+            return arg.mid(name.length() + 3);
+    }
+    return defaultValue;
+}
+
+QStringList positionalArguments(const QStringList& args)
+{
+    QStringList positional;
+    foreach(const QString& arg, args)
+    {
+        if(!arg.startsWith("--"))
+            positional << arg;
+    }
+    return positional;
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication a(argc, argv);
+
+    QStringList args = a.arguments().mid(1);
+    if(args.isEmpty())
+    {
+        usage();
+        return 2;
+    }
+
+    QString benchmark = args.takeFirst();
+    if(benchmark == "reports")
+        return benchReports(args);
+    if(benchmark == "results")
+        return benchResults(args);
+    if(benchmark == "startup")
+        return benchStartup(args);
+    if(benchmark == "load")
+        return benchLoad(args);
+    if(benchmark == "detectors")
+        return benchDetectors(args);
+
+    usage();
+    return 2;
+}
@@ -0,0 +1,52 @@
+#-------------------------------------------------
+#
+# Benchmarks for the nailab job core
+#
+#-------------------------------------------------
+
+CONFIG += c++11 console
+CONFIG -= app_bundle
+
+QT       += core xml concurrent
+QT       -= gui
+
+TARGET = nailab-bench
+TEMPLATE = app
+
+DEFINES += NAILAB_HEADLESS
+
+INCLUDEPATH += $$PWD/..
+DEPENDPATH += $$PWD/..
+
+SOURCES += main.cpp \
+    benchreports.cpp \
+    benchresults.cpp \
+    benchstartup.cpp \
+    benchload.cpp \
+    benchdetectors.cpp \
+    ../detector.cpp \
+    ../dbutils.cpp \
+    ../jobutils.cpp \
+    ../jobtrace.cpp \
+    ../jobjournal.cpp \
+    ../chunkstore.cpp \
+    ../metrics.cpp \
+    ../startupconfig.cpp \
+    ../reportparser.cpp \
+    ../resultstore.cpp \
+    ../reporttemplate.cpp \
+    ../simjob.cpp
+
+HEADERS  += bench.h \
+    ../detector.h \
+    ../dbutils.h \
+    ../jobutils.h \
+    ../jobtrace.h \
+    ../jobjournal.h \
+    ../chunkstore.h \
+    ../metrics.h \
+    ../startupconfig.h \
+    ../reportparser.h \
+    ../resultstore.h \
+    ../reporttemplate.h \
+    ../simjob.h
@@ -0,0 +1,419 @@
+#include <QFile>
+#include <QFileInfo>
+#include <QDir>
+#include <QDirIterator>
+#include <QHash>
+#include <QTextStream>
+#include <QStringList>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QCryptographicHash>
+#include <QCoreApplication>
+#include <QLockFile>
+#include "chunkstore.h"
+#include "jobutils.h"
+
+// Chunks of 256 bytes to 8 kB, about 1 kB on average: a job script is a handful of
+// chunks and the sample lines that differ between jobs end up in one or two of them
+static const int minChunk = 256;
+static const int maxChunk = 8192;
+static const quint32 boundaryMask = 0xFFC00000u;
+
+static const char* recipeHeader = "NAILAB-CHUNKS 1";
+
+static const int lockTimeoutMs = 60 * 1000;
+
+// Same table in every process and on every run, boundaries must be reproducible
+struct GearTable
+{
+    quint32 values[256];
+
+    GearTable()
+    {
+        quint32 x = 0x9E3779B9u;
+        for(int i=0; i<256; i++)
+        {
+            x ^= x << 13;
+            x ^= x >> 17;
+            x ^= x << 5;
+            values[i] = x;
+        }
+    }
+};
+
+static const GearTable gear;
+static QMutex chunkMutex;
+
+// Keeps other processes (Nailab and nailab-cli) out of the chunk store while references
+// are counted or collected, chunkMutex does the same within one
+class ChunkLock
+{
+public:
+
+    explicit ChunkLock(const QString& chunkDirectory)
+        : mLock(chunkDirectory + "REFS.LCK"), mLocked(false)
+    {
+        // Only the lock of a process that is gone is stale, a long garbage collection
+        // keeps its lock however old it gets
+        mLock.setStaleLockTime(0);
+        mLocked = QDir().mkpath(chunkDirectory) && mLock.tryLock(lockTimeoutMs);
+    }
+
+    bool isLocked() const { return mLocked; }
+
+private:
+
+    QLockFile mLock;
+    bool mLocked;
+
+    ChunkLock(const ChunkLock&);
+    ChunkLock& operator = (const ChunkLock&);
+};
+
+qint64 ChunkRecipe::size() const
+{
+    qint64 total = 0;
+    foreach(const ChunkRef& chunk, chunks)
+        total += chunk.size;
+    return total;
+}
+
+static QList<QByteArray> splitChunks(const QByteArray& data)
+{
+    QList<QByteArray> pieces;
+    int start = 0;
+    quint32 hash = 0;
+    for(int i=0; i<data.size(); i++)
+    {
+        hash = (hash << 1) + gear.values[uchar(data[i])];
+        int length = i - start + 1;
+        if((length >= minChunk && (hash & boundaryMask) == 0) || length >= maxChunk)
+        {
+            pieces << data.mid(start, length);
+            start = i + 1;
+            hash = 0;
+        }
+    }
+    if(start < data.size())
+        pieces << data.mid(start);
+    return pieces;
+}
+
+static QString chunkFilename(const QString& chunkDirectory, const QByteArray& hash)
+{
+    QString hex = hash.toHex();
+    return chunkDirectory + hex.left(2) + "/" + hex + ".CHK";
+}
+
+static bool appendReferences(const QString& chunkDirectory, const ChunkRecipe& recipe, char sign)
+{
+    if(recipe.chunks.isEmpty())
+        return true;
+
+    QByteArray lines;
+    foreach(const ChunkRef& chunk, recipe.chunks)
+        lines += sign + chunk.hash.toHex() + " " + QByteArray::number(chunk.size) + "\n";
+
+    // One write per recipe, appends from several processes do not interleave within it
+    QFile log(chunkDirectory + "REFS.LOG");
+    if(!log.open(QIODevice::WriteOnly | QIODevice::Append))
+        return false;
+    return log.write(lines) == lines.size() && syncFile(log);
+}
+
+bool storeChunks(const QString& chunkDirectory, const QByteArray& data, ChunkRecipe& recipe, QString* error)
+{
+    QMutexLocker lock(&chunkMutex);
+
+    recipe.chunkDirectory = chunkDirectory;
+    recipe.chunks.clear();
+
+    // A chunk found below must not be collected before its reference is counted
+    ChunkLock storeLock(chunkDirectory);
+    if(!storeLock.isLocked())
+    {
+        if(error)
+            *error = "Unable to lock " + chunkDirectory;
+        return false;
+    }
+
+    foreach(const QByteArray& piece, splitChunks(data))
+    {
+        ChunkRef chunk;
+        chunk.hash = QCryptographicHash::hash(piece, QCryptographicHash::Sha256);
+        chunk.size = piece.size();
+        recipe.chunks << chunk;
+
+        QString filename = chunkFilename(chunkDirectory, chunk.hash);
+        if(QFile::exists(filename))
+            continue;
+
+        QString dir = QFileInfo(filename).path();
+        if(!QDir(dir).exists() && !QDir().mkpath(dir))
+        {
+            if(error)
+                *error = "Unable to create " + dir;
+            return false;
+        }
+
+        // Written under a name of its own and renamed, another process may store the same chunk
+        QFile tmp(filename + "." + QString::number(QCoreApplication::applicationPid()) + ".tmp");
+        QByteArray compressed = qCompress(piece);
+        if(!tmp.open(QIODevice::WriteOnly | QIODevice::Truncate) || tmp.write(compressed) != compressed.size() || !syncFile(tmp))
+        {
+            if(error)
+                *error = "Unable to write " + tmp.fileName();
+            tmp.remove();
+            return false;
+        }
+        tmp.close();
+        if(!tmp.rename(filename))
+        {
+            tmp.remove();
+            if(!QFile::exists(filename))
+            {
+                if(error)
+                    *error = "Unable to write " + filename;
+                return false;
+            }
+        }
+    }
+
+    if(!appendReferences(chunkDirectory, recipe, '+'))
+    {
+        if(error)
+            *error = "Unable to count references in " + chunkDirectory + "REFS.LOG";
+        return false;
+    }
+    return true;
+}
+
+bool releaseChunks(const ChunkRecipe& recipe)
+{
+    QMutexLocker lock(&chunkMutex);
+    ChunkLock storeLock(recipe.chunkDirectory);
+    return storeLock.isLocked() && appendReferences(recipe.chunkDirectory, recipe, '-');
+}
+
+bool readChunks(const ChunkRecipe& recipe, QByteArray& data)
+{
+    data.clear();
+    data.reserve(int(recipe.size()));
+    foreach(const ChunkRef& chunk, recipe.chunks)
+    {
+        QFile file(chunkFilename(recipe.chunkDirectory, chunk.hash));
+        if(!file.open(QIODevice::ReadOnly))
+            return false;
+        QByteArray piece = qUncompress(file.readAll());
+        if(piece.size() != chunk.size)
+            return false;
+        data += piece;
+    }
+    return true;
+}
+
+bool writeChunkRecipe(const QString& filename, const ChunkRecipe& recipe)
+{
+    QString text;
+    QTextStream s(&text);
+    s << recipeHeader << "\n";
+    s << "directory " << QFileInfo(filename).dir().relativeFilePath(recipe.chunkDirectory) << "\n";
+    foreach(const ChunkRef& chunk, recipe.chunks)
+        s << chunk.hash.toHex() << " " << chunk.size << "\n";
+    s.flush();
+
+    QFile file(filename);
+    QByteArray data = text.toUtf8();
+    return file.open(QIODevice::WriteOnly | QIODevice::Truncate) && file.write(data) == data.size() && syncFile(file);
+}
+
+bool readChunkRecipe(const QString& filename, ChunkRecipe& recipe)
+{
+    QFile file(filename);
+    if(!file.open(QIODevice::ReadOnly | QIODevice::Text))
+        return false;
+
+    QTextStream s(&file);
+    if(s.readLine() != recipeHeader)
+        return false;
+
+    QString directory = s.readLine();
+    if(!directory.startsWith("directory "))
+        return false;
+    recipe.chunkDirectory = QDir::cleanPath(QFileInfo(filename).dir().absoluteFilePath(directory.mid(10))) + "/";
+
+    recipe.chunks.clear();
+    for(QString line = s.readLine(); !line.isNull(); line = s.readLine())
+    {
+        QStringList parts = line.split(' ');
+        if(parts.count() != 2)
+            return false;
+        ChunkRef chunk;
+        chunk.hash = QByteArray::fromHex(parts[0].toLatin1());
+        chunk.size = parts[1].toInt();
+        recipe.chunks << chunk;
+    }
+    return true;
+}
+
+bool readArchivedFile(const QString& filename, QByteArray& data)
+{
+    QFile file(filename);
+    if(file.open(QIODevice::ReadOnly))
+    {
+        data = file.readAll();
+        return true;
+    }
+
+    ChunkRecipe recipe;
+    return readChunkRecipe(filename + ".REF", recipe) && readChunks(recipe, data);
+}
+
+QByteArray archivedFileChecksum(const QString& filename, qint64* size)
+{
+    if(QFile::exists(filename))
+    {
+        if(size)
+            *size = QFileInfo(filename).size();
+        return fileChecksum(filename);
+    }
+
+    QByteArray data;
+    if(!readArchivedFile(filename, data))
+        return QByteArray();
+    if(size)
+        *size = data.size();
+    return QCryptographicHash::hash(data, QCryptographicHash::Sha256);
+}
+
+bool chunkArchivedFile(const QString& filename, const QString& chunkDirectory, QString* error)
+{
+    QFile file(filename);
+    if(!file.open(QIODevice::ReadOnly))
+    {
+        if(error)
+            *error = "Unable to open " + filename;
+        return false;
+    }
+    QByteArray data = file.readAll();
+    file.close();
+
+    ChunkRecipe recipe;
+    if(!storeChunks(chunkDirectory, data, recipe, error))
+        return false;
+
+    // The original is only removed once the recipe reads back to the same contents
+    QString part = filename + ".REF.PART";
+    QByteArray readBack;
+    ChunkRecipe stored;
+    if(!writeChunkRecipe(part, recipe) || !readChunkRecipe(part, stored) || !readChunks(stored, readBack)
+            || readBack != data || !QFile::rename(part, filename + ".REF"))
+    {
+        QFile::remove(part);
+        releaseChunks(recipe);
+        if(error)
+            *error = "Unable to verify chunks of " + filename;
+        return false;
+    }
+    return QFile::remove(filename);
+}
+
+// Net reference count and size of every chunk in REFS.LOG, keyed by hex hash
+static bool readReferences(const QString& chunkDirectory, QHash<QByteArray, int>& counts, QHash<QByteArray, int>& sizes)
+{
+    // A garbage collection stopped between removing the log and renaming the new one
+    QFile log(chunkDirectory + "REFS.LOG");
+    if(!log.exists() && QFile::exists(log.fileName() + ".tmp"))
+        QFile::rename(log.fileName() + ".tmp", log.fileName());
+    if(!log.exists())
+        return true;
+    if(!log.open(QIODevice::ReadOnly))
+        return false;
+
+    QList<QByteArray> lines = log.readAll().split('\n');
+    foreach(const QByteArray& line, lines)
+    {
+        int sep = line.indexOf(' ');
+        if(line.size() < 2 || sep < 0 || (line[0] != '+' && line[0] != '-'))
+            continue;
+        QByteArray hex = line.mid(1, sep - 1);
+        counts[hex] += line[0] == '+' ? 1 : -1;
+        sizes[hex] = line.mid(sep + 1).toInt();
+    }
+    return true;
+}
+
+bool chunkUsage(const QString& chunkDirectory, ChunkUsage& usage)
+{
+    QMutexLocker lock(&chunkMutex);
+
+    QHash<QByteArray, int> counts, sizes;
+    if(!readReferences(chunkDirectory, counts, sizes))
+        return false;
+
+    usage.chunks = usage.unreferencedChunks = 0;
+    usage.referencedBytes = usage.uniqueBytes = usage.storedBytes = 0;
+
+    QHashIterator<QByteArray, int> iter(counts);
+    while(iter.hasNext())
+    {
+        iter.next();
+        if(iter.value() > 0)
+            usage.referencedBytes += qint64(iter.value()) * sizes.value(iter.key());
+    }
+
+    QDirIterator files(chunkDirectory, QStringList() << "*.CHK", QDir::Files, QDirIterator::Subdirectories);
+    while(files.hasNext())
+    {
+        files.next();
+        QByteArray hex = files.fileInfo().completeBaseName().toLatin1();
+        usage.chunks++;
+        usage.storedBytes += files.fileInfo().size();
+        usage.uniqueBytes += sizes.value(hex);
+        if(counts.value(hex) <= 0)
+            usage.unreferencedChunks++;
+    }
+    return true;
+}
+
+int collectChunkGarbage(const QString& chunkDirectory)
+{
+    QMutexLocker lock(&chunkMutex);
+
+    // References counted by another process meanwhile would be lost with the rewritten log
+    ChunkLock storeLock(chunkDirectory);
+    if(!storeLock.isLocked())
+        return 0;
+
+    QHash<QByteArray, int> counts, sizes;
+    if(!readReferences(chunkDirectory, counts, sizes))
+        return 0;
+
+    int removed = 0;
+    QDirIterator files(chunkDirectory, QStringList() << "*.CHK", QDir::Files, QDirIterator::Subdirectories);
+    while(files.hasNext())
+    {
+        files.next();
+        if(counts.value(files.fileInfo().completeBaseName().toLatin1()) <= 0 && QFile::remove(files.filePath()))
+            removed++;
+    }
+
+    // Rewrites the log with one line per live reference
+    QByteArray lines;
+    QHashIterator<QByteArray, int> iter(counts);
+    while(iter.hasNext())
+    {
+        iter.next();
+        for(int i=0; i<iter.value(); i++)
+            lines += "+" + iter.key() + " " + QByteArray::number(sizes.value(iter.key())) + "\n";
+    }
+
+    QFile tmp(chunkDirectory + "REFS.LOG.tmp");
+    if(tmp.open(QIODevice::WriteOnly | QIODevice::Truncate) && tmp.write(lines) == lines.size() && syncFile(tmp))
+    {
+        tmp.close();
+        QFile::remove(chunkDirectory + "REFS.LOG");
+        tmp.rename(chunkDirectory + "REFS.LOG");
+    }
+    return removed;
+}
@@ -0,0 +1,60 @@
+#ifndef CHUNKSTORE_H
+#define CHUNKSTORE_H
+
+#include <QString>
+#include <QByteArray>
+#include <QList>
+
+// Content addressed storage for archived job scripts and logs. A file is split into
+// chunks at content defined boundaries (a gear rolling hash), so an edit in one line
+// only changes the chunk around it. Each chunk is stored once, compressed, as
+// <chunk directory>/<2 hex>/<sha256 hex>.CHK; the archive keeps a <file>.REF recipe
+// listing its chunks instead of the file. References are counted in an append-only
+// REFS.LOG in the chunk directory; storing, releasing and collecting hold the lock file
+// REFS.LCK in it, so Nailab and nailab-cli can use the same store.
+
+struct ChunkRef
+{
+    QByteArray hash;    // sha256 of the uncompressed chunk
+    int size;
+};
+
+struct ChunkRecipe
+{
+    QString chunkDirectory;
+    QList<ChunkRef> chunks;
+
+    qint64 size() const;
+};
+
+// Stores the chunks of data not stored yet and counts a reference to every chunk
+bool storeChunks(const QString& chunkDirectory, const QByteArray& data, ChunkRecipe& recipe, QString* error = 0);
+// Drops the references of a recipe, e.g. after a failed store
+bool releaseChunks(const ChunkRecipe& recipe);
+bool readChunks(const ChunkRecipe& recipe, QByteArray& data);
+
+// Recipes refer to the chunk directory relative to themselves, the archive can move
+bool writeChunkRecipe(const QString& filename, const ChunkRecipe& recipe);
+bool readChunkRecipe(const QString& filename, ChunkRecipe& recipe);
+
+// Reads an archived file, from filename or reassembled from filename.REF
+bool readArchivedFile(const QString& filename, QByteArray& data);
+// SHA-256 of an archived file as readArchivedFile returns it, empty if it is missing
+QByteArray archivedFileChecksum(const QString& filename, qint64* size = 0);
+// Replaces an archived file by filename.REF, for jobs archived before the chunk store
+bool chunkArchivedFile(const QString& filename, const QString& chunkDirectory, QString* error = 0);
+
+struct ChunkUsage
+{
+    int chunks;                 // chunk files
+    int unreferencedChunks;
+    qint64 referencedBytes;     // what the recipes would take as plain files
+    qint64 uniqueBytes;         // chunk contents, uncompressed
+    qint64 storedBytes;         // chunk files on disk
+};
+
+bool chunkUsage(const QString& chunkDirectory, ChunkUsage& usage);
+// Removes chunks without references, returns how many
+int collectChunkGarbage(const QString& chunkDirectory);
+
+#endif // CHUNKSTORE_H
@@ -0,0 +1,1052 @@
+#include <QCoreApplication>
+#include <QDir>
+#include <QDirIterator>
+#include <QFile>
+#include <QFileInfo>
+#include <QProcess>
+#include <QThread>
+#include <QEventLoop>
+#include <QElapsedTimer>
+#include <QMap>
+#include <QtConcurrent/QtConcurrent>
+#include <qmath.h>
+#include <cstdio>
+#include <algorithm>
+#include <limits>
+#include "clicommands.h"
+#include "dbutils.h"
+#include "sampleinput.h"
+#include "simjob.h"
+#include "jobapi.h"
+#include "naiimporter.h"
+#include "reportexporter.h"
+#include "resultstore.h"
+#include "reporttemplate.h"
+#include "jobtrace.h"
+#include "reanalysis.h"
+#include "chunkstore.h"
+#include "preflight.h"
+#include "scheduler.h"
+#include "qastore.h"
+#include "driftmonitor.h"
+#ifdef Q_OS_WIN
+#include "winutils.h"
+#endif
+
+#define NAILAB_ENVIRONMENT_VARIABLE "NAIROOT"
+
+static void printError(const QString& message)
+{
+    fprintf(stderr, "nailab-cli: %s\n", qPrintable(message));
+}
+
+bool setupCliEnvironment(CliEnvironment& env, bool simulate)
+{
+    env.rootDirectory = QDir::toNativeSeparators(qgetenv(NAILAB_ENVIRONMENT_VARIABLE).constData());
+    if(env.rootDirectory.isEmpty() || !QDir(env.rootDirectory).exists())
+    {
+        printError(QString("Environment variable not found, or invalid: ") + NAILAB_ENVIRONMENT_VARIABLE);
+        return false;
+    }
+
+    env.configurationDirectory = QDir::toNativeSeparators(env.rootDirectory + "/CONFIGURATION/");
+    env.archiveDirectory = QDir::toNativeSeparators(env.rootDirectory + "/ARCHIVE/");
+    env.tempDirectory = QDir::toNativeSeparators(env.rootDirectory + "/TEMP/");
+    env.libraryDirectory = QDir::toNativeSeparators(env.rootDirectory + "/LIBRARY/");
+    env.resultsDirectory = QDir::toNativeSeparators(env.rootDirectory + "/RESULTS/");
+    env.cacheDirectory = QDir::toNativeSeparators(env.rootDirectory + "/CACHE/ANALYSIS/");
+
+    QString traceDirectory = QDir::toNativeSeparators(env.rootDirectory + "/TRACE/");
+    if(QDir(traceDirectory).exists())
+        setJobTraceDirectory(traceDirectory);
+
+    if(!QDir(env.configurationDirectory).exists()
+        || !QDir(env.archiveDirectory).exists()
+        || !QDir(env.tempDirectory).exists())
+    {
+        printError("One or more nailab system directories not found (CONFIGURATION, ARCHIVE, TEMP)");
+        return false;
+    }
+
+    env.settingsFilename = env.configurationDirectory + "settings.xml";
+    env.detectorFilename = env.configurationDirectory + "mca.xml";
+
+    QFile settingsFile(env.settingsFilename);
+    if(!settingsFile.exists() || !readSettingsXml(settingsFile, env.settings))
+        return false;
+
+    QFile detectorFile(env.detectorFilename);
+    if(!detectorFile.exists() || !readDetectorXml(detectorFile, env.detectors))
+        return false;
+
+#ifdef Q_OS_WIN
+    if(!getWindowsUsername(env.username))
+        return false;
+    env.simulate = simulate;
+    env.runner = simulate ? runSimulatedJob : runJob;
+#else
+    // There is no Genie 2000 outside Windows, always use the stand-in executor
+    env.username = qgetenv("USER");
+    env.simulate = true;
+    env.runner = runSimulatedJob;
+#endif
+
+    QByteArray scale = qgetenv("NAILAB_SIM_TIMESCALE");
+    if(!scale.isEmpty())
+        setSimulatedJobTimeScale(scale.toDouble());
+
+    return true;
+}
+
+Detector* findDetector(CliEnvironment& env, const QString& name)
+{
+    for(int i=0; i<env.detectors.count(); i++)
+    {
+        if(env.detectors[i].name.compare(name, Qt::CaseInsensitive) == 0)
+            return &env.detectors[i];
+    }
+    return NULL;
+}
+
+static bool startSample(CliEnvironment& env, const Detector& detector, const SampleInput& sampleInput, bool wait)
+{
+    QString baseFilename = env.tempDirectory + detector.name;
+    QString username = sampleInput.username.isEmpty() ? env.username : sampleInput.username;
+
+    if(!writeJobFile(baseFilename, sampleInput, detector, env.settings, username))
+    {
+        printError("Unable to open job file: " + baseFilename + ".BAT");
+        return false;
+    }
+
+    if(wait)
+        return env.runner(jobCommandLine(baseFilename));
+
+    // Let a detached instance of ourselves supervise the job so this process can exit
+    QStringList args;
+    if(env.simulate)
+        args << "--simulate";
+    args << "run" << detector.name;
+    return QProcess::startDetached(QCoreApplication::applicationFilePath(), args);
+}
+
+static ResultStore* openResultStore(CliEnvironment& env)
+{
+    // Opened once per process, batch stores many jobs
+    static ResultStore* store = NULL;
+    if(!store)
+    {
+        store = new ResultStore(env.resultsDirectory);
+        if(!store->open())
+            printError("Unable to open result store " + env.resultsDirectory);
+    }
+    return store->isOpen() ? store : NULL;
+}
+
+static bool storeFinishedJob(CliEnvironment& env, Detector* detector)
+{
+    QFile detectorFile(env.detectorFilename);
+    if(!updateDetectorSpectrumCounter(detectorFile, detector))
+    {
+        printError("Unable to update spectrum counter for " + detector->name);
+        return false;
+    }
+
+    QString archiveBase, error;
+    if(!storeJob(env.tempDirectory, env.archiveDirectory, *detector, &archiveBase, &error))
+    {
+        printError("Unable to store job for " + detector->name + ": " + error);
+        return false;
+    }
+
+    // The job is archived at this point, failures below are reported but not fatal
+    ResultStore* store = openResultStore(env);
+    if(store && !store->appendReport(archiveBase + ".RPT"))
+        printError("Unable to add results for " + detector->name + " to the result store");
+
+    if(!env.settings.RPTExportFolder.isEmpty() && !exportReport(archiveBase + ".RPT", env.settings.RPTExportFolder))
+        printError("Unable to export report for " + detector->name);
+    return true;
+}
+
+int cliSubmit(CliEnvironment& env, const QStringList& args)
+{
+    if(args.isEmpty())
+    {
+        printError("submit: missing detector");
+        return 2;
+    }
+
+    Detector* detector = findDetector(env, args[0]);
+    if(!detector)
+    {
+        printError("Unknown detector: " + args[0]);
+        return 1;
+    }
+
+    if(detectorHasJob(env.tempDirectory, detector->name))
+    {
+        printError("Detector " + detector->name + " has a job");
+        return 1;
+    }
+
+    SampleInput sampleInput;
+    defaultSampleInput(*detector, sampleInput);
+
+    bool wait = false;
+    for(int i=1; i<args.count(); i++)
+    {
+        if(args[i] == "--wait")
+        {
+            wait = true;
+            continue;
+        }
+
+        int sep = args[i].indexOf('=');
+        if(sep <= 0 || !setSampleInputField(sampleInput, args[i].left(sep), args[i].mid(sep + 1)))
+        {
+            printError("Invalid sample field: " + args[i]);
+            return 2;
+        }
+    }
+    sampleInput.detector = detector->name;
+
+    if(!detector->beakers.contains(sampleInput.geometry))
+    {
+        printError("Detector " + detector->name + " has no calibration for geometry '" + sampleInput.geometry + "'");
+        return 1;
+    }
+
+    // The simulated executor never reads the Genie files
+    QStringList problems;
+    if(!preflightJob(sampleInput, *detector, env.settings, env.tempDirectory, problems, !env.simulate))
+    {
+        foreach(const QString& problem, problems)
+            printError(problem);
+        return 1;
+    }
+
+    if(!startSample(env, *detector, sampleInput, wait))
+        return 1;
+
+    printf("%s\n", qPrintable(detector->name));
+    return 0;
+}
+
+int cliRun(CliEnvironment& env, const QStringList& args)
+{
+    if(args.isEmpty())
+    {
+        printError("run: missing detector");
+        return 2;
+    }
+
+    QString baseFilename = env.tempDirectory + args[0];
+    if(!QFile::exists(baseFilename + ".BAT"))
+    {
+        printError("No job file for detector " + args[0]);
+        return 1;
+    }
+
+    return env.runner(jobCommandLine(baseFilename)) ? 0 : 1;
+}
+
+int cliWait(CliEnvironment& env, const QStringList& args)
+{
+    if(args.isEmpty())
+    {
+        printError("wait: missing detector");
+        return 2;
+    }
+
+    qint64 timeout = -1;
+    for(int i=1; i<args.count(); i++)
+    {
+        if(args[i].startsWith("--timeout="))
+            timeout = args[i].mid(10).toLongLong() * 1000;
+    }
+
+    if(!detectorHasJob(env.tempDirectory, args[0]))
+    {
+        printError("Detector " + args[0] + " has no job");
+        return 1;
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+    while(!detectorHasFinishedJob(env.tempDirectory, args[0]))
+    {
+        if(timeout >= 0 && timer.elapsed() > timeout)
+        {
+            printError("Timeout waiting for detector " + args[0]);
+            return 3;
+        }
+        QThread::msleep(250);
+    }
+    return 0;
+}
+
+int cliStore(CliEnvironment& env, const QStringList& args)
+{
+    if(args.isEmpty())
+    {
+        printError("store: missing detector");
+        return 2;
+    }
+
+    Detector* detector = findDetector(env, args[0]);
+    if(!detector)
+    {
+        printError("Unknown detector: " + args[0]);
+        return 1;
+    }
+
+    if(!detectorHasFinishedJob(env.tempDirectory, detector->name))
+    {
+        printError("Detector " + detector->name + " has no finished job");
+        return 1;
+    }
+
+    return storeFinishedJob(env, detector) ? 0 : 1;
+}
+
+int cliReject(CliEnvironment& env, const QStringList& args)
+{
+    if(args.isEmpty())
+    {
+        printError("reject: missing detector");
+        return 2;
+    }
+
+    if(!detectorHasFinishedJob(env.tempDirectory, args[0]))
+    {
+        printError("Detector " + args[0] + " has no finished job");
+        return 1;
+    }
+
+    return rejectJob(env.tempDirectory, args[0]) ? 0 : 1;
+}
+
+int cliStatus(CliEnvironment& env, const QStringList& args)
+{
+    Q_UNUSED(args);
+
+    foreach(const Detector& detector, env.detectors)
+    {
+        const char* state = "idle";
+        if(detectorHasFinishedJob(env.tempDirectory, detector.name))
+            state = "finished";
+        else if(detectorHasJob(env.tempDirectory, detector.name))
+            state = "running";
+
+        printf("%-10s %-8s %-8s %d\n", qPrintable(detector.name), detector.inUse ? "in-use" : "unused",
+               state, detector.spectrumCounter);
+    }
+    return 0;
+}
+
+static QString cliOption(const QStringList& args, const QString& name)
+{
+    foreach(const QString& arg, args)
+    {
+        if(arg.startsWith("--" + name + "="))
+            return arg.mid(name.length() + 3);
+    }
+    return QString();
+}
+
+int cliResults(CliEnvironment& env, const QStringList& args)
+{
+    // Read-only, a job may be stored meanwhile
+    ResultStore store(env.resultsDirectory);
+    if(!store.open(true))
+    {
+        printError("Unable to open result store " + env.resultsDirectory);
+        return 1;
+    }
+
+    ResultQuery query;
+    query.from = QDateTime(QDate::fromString(cliOption(args, "from"), "yyyy-MM-dd"));
+    query.to = QDateTime(QDate::fromString(cliOption(args, "to"), "yyyy-MM-dd"));
+    query.nuclide = cliOption(args, "nuclide");
+    query.detector = cliOption(args, "detector");
+    query.beaker = cliOption(args, "beaker");
+    query.samplePrefix = cliOption(args, "sample");
+
+    QElapsedTimer timer;
+    timer.start();
+
+    QString group = cliOption(args, "group");
+    if(!group.isEmpty())
+    {
+        static const char* groupNames[] = { "nuclide", "detector", "beaker", "sample", "month", "year" };
+        int groupBy = -1;
+        for(int i=0; i<6; i++)
+        {
+            if(group == groupNames[i])
+                groupBy = i;
+        }
+        if(groupBy < 0)
+        {
+            printError("results: unknown group " + group);
+            return 2;
+        }
+
+        QVector<ResultGroup> groups;
+        if(!store.aggregate(query, (ResultStore::GroupBy)groupBy, groups))
+            return 1;
+
+        foreach(const ResultGroup& g, groups)
+            printf("%s\t%lld\t%g\t%g\t%g\n", qPrintable(g.key), g.count, g.sum / g.count, g.min, g.max);
+    }
+    else
+    {
+        QString limit = cliOption(args, "limit");
+        QVector<ResultRow> rows;
+        if(!store.select(query, rows, limit.isEmpty() ? -1 : limit.toInt()))
+            return 1;
+
+        foreach(const ResultRow& r, rows)
+            printf("%s\t%s\t%s\t%s\t%s\t%g\t%g\t%g\t%s\n", qPrintable(r.time.toString("yyyy-MM-dd HH:mm:ss")),
+                   qPrintable(r.sampleId), qPrintable(r.detector), qPrintable(r.beaker), qPrintable(r.nuclide),
+                   r.activity, r.uncertainty, r.mda, (r.flags & ReportNuclide::BelowMDA) ? "<" : "");
+    }
+
+    fprintf(stderr, "%lld rows scanned in %lld ms\n", store.rowCount(), timer.elapsed());
+    return 0;
+}
+
+int cliRender(CliEnvironment& env, const QStringList& args)
+{
+    QString output = cliOption(args, "output");
+    if(output.isEmpty())
+    {
+        printError("render: missing --output directory");
+        return 2;
+    }
+
+    QString templateFile = cliOption(args, "template");
+    if(templateFile.isEmpty())
+        templateFile = nativeTemplateName(env.settings.templateName);
+
+    QString error;
+    QSharedPointer<const ReportTemplate> tpl = loadReportTemplate(templateFile, &error);
+    if(!tpl)
+    {
+        printError("render: " + error);
+        return 1;
+    }
+
+    // Directories are searched recursively, their layout is kept below the output directory
+    QList<QPair<QString, QString> > files;
+    foreach(const QString& arg, args)
+    {
+        if(arg.startsWith("--"))
+            continue;
+
+        QFileInfo info(arg);
+        if(info.isDir())
+        {
+            QDir base(info.absoluteFilePath());
+            QDirIterator iter(base.absolutePath(), QStringList() << "*.RPT", QDir::Files, QDirIterator::Subdirectories);
+            while(iter.hasNext())
+            {
+                QString filename = iter.next();
+                files.append(qMakePair(filename, base.relativeFilePath(filename)));
+            }
+        }
+        else
+            files.append(qMakePair(info.absoluteFilePath(), info.fileName()));
+    }
+
+    QDir outputDir(output);
+    ReportParser parser;
+    ReportResult result;
+    QByteArray rendered;
+    qint64 bytes = 0;
+    int failed = 0;
+    QElapsedTimer timer;
+    timer.start();
+
+    for(int i=0; i<files.count(); i++)
+    {
+        QString target = outputDir.absoluteFilePath(files[i].second);
+        if(!parser.parseFile(files[i].first, result) || !QDir().mkpath(QFileInfo(target).absolutePath()))
+        {
+            printError("Unable to read " + files[i].first);
+            failed++;
+            continue;
+        }
+
+        tpl->render(result, rendered);
+        QFile file(target);
+        if(!file.open(QIODevice::WriteOnly | QIODevice::Truncate) || file.write(rendered) != rendered.size())
+        {
+            printError("Unable to write " + target);
+            failed++;
+            continue;
+        }
+        bytes += rendered.size();
+    }
+
+    double secs = qMax<qint64>(1, timer.elapsed()) / 1000.0;
+    fprintf(stderr, "%d reports rendered, %d failed, %.0f reports/s, %.1f MB/s\n", files.count() - failed, failed,
+            (files.count() - failed) / secs, bytes / secs / (1024.0 * 1024.0));
+    return failed ? 1 : 0;
+}
+
+int cliReanalyse(CliEnvironment& env, const QStringList& args)
+{
+    if(args.isEmpty() || args[0].startsWith("--"))
+    {
+        printError("reanalyse: missing detector");
+        return 2;
+    }
+
+    Detector* detector = findDetector(env, args[0]);
+    if(!detector)
+    {
+        printError("Unknown detector: " + args[0]);
+        return 1;
+    }
+
+    QDate from = QDate::fromString(cliOption(args, "from"), "yyyy-MM-dd");
+    QDate to = QDate::fromString(cliOption(args, "to"), "yyyy-MM-dd");
+    if(!from.isValid())
+        from = QDate(QDate::currentDate().year(), 1, 1);
+    if(!to.isValid())
+        to = QDate::currentDate();
+
+    QString parallel = cliOption(args, "parallel");
+    int maxParallel = parallel.isEmpty() ? QThread::idealThreadCount() : parallel.toInt();
+
+    // --no-cache runs every stage again, e.g. after a Genie update
+    QString cacheDirectory = args.contains("--no-cache") ? QString() : env.cacheDirectory;
+    ReanalysisBatch batch(env.archiveDirectory, *detector, env.settings, env.username, env.runner, cacheDirectory);
+    QEventLoop loop;
+    int failed = 0;
+
+    QObject::connect(&batch, &ReanalysisBatch::progress, [](int done, int failedCount, int total, double perMinute)
+    {
+        fprintf(stderr, "\r%d/%d done, %d failed, %.1f spectra/min", done + failedCount, total, failedCount, perMinute);
+    });
+    QObject::connect(&batch, &ReanalysisBatch::spectrumFailed, [](const QString& spectrum, const QString& error)
+    {
+        fprintf(stderr, "\n%s: %s\n", qPrintable(spectrum), qPrintable(error));
+    });
+    QObject::connect(&batch, &ReanalysisBatch::finished, [&](int done, int failedCount, qint64 msecs)
+    {
+        failed = failedCount;
+        fprintf(stderr, "\n%d spectra re-analysed, %d failed in %.1f s\n", done, failedCount, msecs / 1000.0);
+        fprintf(stderr, "cached stages: %s\n", qPrintable(analysisCacheSummary(batch.cacheStats())));
+        loop.quit();
+    });
+
+    // finished may already have been emitted for an empty range
+    if(!batch.start(from, to, maxParallel))
+        return 1;
+    if(batch.isRunning())
+        loop.exec();
+    return failed ? 1 : 0;
+}
+
+struct BatchSample
+{
+    QString filename;
+    ScheduleSample schedule;
+};
+
+struct BatchJob
+{
+    QString filename;
+    QFuture<bool> future;
+    QElapsedTimer started;
+    double duration;
+};
+
+static bool readSchedulePolicy(const QStringList& args, SchedulePolicy& policy)
+{
+    QString name = cliOption(args, "policy");
+    if(name.isEmpty() || schedulePolicyFromName(name, policy))
+        return true;
+    printError("Unknown schedule policy: " + name + " (first-free or makespan)");
+    return false;
+}
+
+static JobDurationModel* durationModel(CliEnvironment& env)
+{
+    // Learned once per process from the last three months of stored reports
+    static JobDurationModel* model = NULL;
+    if(!model)
+    {
+        model = new JobDurationModel;
+        QDateTime now = QDateTime::currentDateTime();
+        loadDurationModel(env.archiveDirectory, now.addDays(-90), now, *model);
+    }
+    return model;
+}
+
+static void markSampleFile(const QString& filename, const QString& suffix)
+{
+    QFile::remove(filename + suffix);
+    QFile::rename(filename, filename + suffix);
+}
+
+int cliBatch(CliEnvironment& env, const QStringList& args)
+{
+    QStringList positional;
+    foreach(const QString& arg, args)
+    {
+        if(!arg.startsWith("--"))
+            positional << arg;
+    }
+    if(positional.isEmpty())
+    {
+        printError("batch: missing input directory");
+        return 2;
+    }
+
+    QDir dir(positional[0]);
+    if(!dir.exists())
+    {
+        printError("Directory not found: " + positional[0]);
+        return 1;
+    }
+
+    SchedulePolicy policy = ScheduleMakespan;
+    if(!readSchedulePolicy(args, policy))
+        return 2;
+    const JobDurationModel& model = *durationModel(env);
+
+    QList<ScheduleDetector> candidates;
+    foreach(const Detector& detector, env.detectors)
+        candidates << scheduleDetector(detector);
+
+    QList<BatchSample> pending;
+    int stored = 0, failed = 0;
+
+    foreach(const QString& name, dir.entryList(QStringList() << "*.nai", QDir::Files, QDir::Name))
+    {
+        BatchSample sample;
+        SampleInput sampleInput;
+        sample.filename = dir.absoluteFilePath(name);
+
+        QFile file(sample.filename);
+        if(!readSampleInputFile(file, sampleInput))
+        {
+            printError("Invalid sample file: " + name);
+            markSampleFile(sample.filename, ".err");
+            failed++;
+            continue;
+        }
+        sample.schedule = scheduleSample(sampleInput);
+
+        bool runnable = false;
+        foreach(const ScheduleDetector& detector, candidates)
+            runnable = runnable || model.canCount(sample.schedule, detector);
+        if(!runnable)
+        {
+            printError("No detector can run sample file: " + name);
+            markSampleFile(sample.filename, ".err");
+            failed++;
+            continue;
+        }
+        pending.append(sample);
+    }
+
+    QMap<QString, BatchJob> running;
+    QElapsedTimer timer;
+    timer.start();
+
+    while(!pending.isEmpty() || !running.isEmpty())
+    {
+        // Plan what is left whenever a detector is free, start the samples planned on one
+        QList<ScheduleDetector> detectors;
+        bool anyFree = false;
+        for(int k=0; k<env.detectors.count(); k++)
+        {
+            const Detector& detector = env.detectors[k];
+            double freeAt = 0.0;
+            if(running.contains(detector.name))
+                freeAt = qMax(1.0, running[detector.name].duration - running[detector.name].started.elapsed() / 1000.0);
+            else if(detectorHasJob(env.tempDirectory, detector.name))
+                freeAt = model.overhead();
+            detectors << scheduleDetector(detector, true, freeAt);
+            anyFree = anyFree || (detectors[k].available && freeAt <= 0.0);
+        }
+
+        QList<ScheduleSample> samples;
+        foreach(const BatchSample& sample, pending)
+            samples << sample.schedule;
+        QList<ScheduleAssignment> plan;
+        if(anyFree)
+            scheduleSamples(samples, detectors, model, policy, plan);
+
+        QList<BatchSample> waiting;
+        for(int i=0; i<pending.count(); i++)
+        {
+            if(i >= plan.count() || plan[i].detector < 0 || plan[i].start > 0.0 || detectors[plan[i].detector].freeAt > 0.0)
+            {
+                waiting << pending[i];
+                continue;
+            }
+            Detector* detector = &env.detectors[plan[i].detector];
+
+            SampleInput sampleInput;
+            defaultSampleInput(*detector, sampleInput);
+            QFile file(pending[i].filename);
+            readSampleInputFile(file, sampleInput);
+            sampleInput.detector = detector->name;
+
+            // An MDA target is counted as the live time this detector needed for it before
+            if(model.hasMDAReference(samples[i], detectors[plan[i].detector]))
+            {
+                sampleInput.presetType2 = timePresetName(TimePresetLive);
+                sampleInput.presetType2Value = QString::number(qCeil(plan[i].liveTime));
+            }
+
+            QString baseFilename = env.tempDirectory + detector->name;
+            QString username = sampleInput.username.isEmpty() ? env.username : sampleInput.username;
+            if(!writeJobFile(baseFilename, sampleInput, *detector, env.settings, username))
+            {
+                printError("Unable to open job file: " + baseFilename + ".BAT");
+                markSampleFile(pending[i].filename, ".err");
+                failed++;
+            }
+            else
+            {
+                BatchJob job;
+                job.filename = pending[i].filename;
+                job.future = QtConcurrent::run(env.runner, jobCommandLine(baseFilename));
+                job.started.start();
+                job.duration = plan[i].finish - plan[i].start;
+                running.insert(detector->name, job);
+                printf("started %s on %s\n", qPrintable(QFileInfo(job.filename).fileName()), qPrintable(detector->name));
+            }
+        }
+        pending = waiting;
+
+        QMap<QString, BatchJob>::iterator iter = running.begin();
+        while(iter != running.end())
+        {
+            if(!iter.value().future.isFinished())
+            {
+                ++iter;
+                continue;
+            }
+
+            Detector* detector = findDetector(env, iter.key());
+            if(iter.value().future.result() && detectorHasFinishedJob(env.tempDirectory, detector->name)
+                    && storeFinishedJob(env, detector))
+            {
+                markSampleFile(iter.value().filename, ".ok");
+                stored++;
+            }
+            else
+            {
+                printError("Job failed on detector " + detector->name);
+                rejectJob(env.tempDirectory, detector->name);
+                markSampleFile(iter.value().filename, ".err");
+                failed++;
+            }
+            iter = running.erase(iter);
+        }
+
+        // Samples may also wait for detectors busy with jobs from elsewhere
+        if(!running.isEmpty() || !pending.isEmpty())
+            QThread::msleep(50);
+    }
+
+    double hours = timer.elapsed() / 3600000.0;
+    printf("stored %d, failed %d, %.1f jobs/hour\n", stored, failed, hours > 0.0 ? stored / hours : 0.0);
+    return failed ? 1 : 0;
+}
+
+static bool reportStartedBefore(const ReportResult& a, const ReportResult& b)
+{
+    return a.acquisitionStarted < b.acquisitionStarted;
+}
+
+int cliSchedule(CliEnvironment& env, const QStringList& args)
+{
+    // Replays the samples of stored jobs on the current detectors, as if each window of
+    // samples had been queued at once at its start
+    QDateTime to = QDateTime(QDate::fromString(cliOption(args, "to"), "yyyy-MM-dd"));
+    if(!to.isValid())
+        to = QDateTime::currentDateTime();
+    QDateTime from = QDateTime(QDate::fromString(cliOption(args, "from"), "yyyy-MM-dd"));
+    if(!from.isValid())
+        from = to.addDays(-30);
+    double window = cliOption(args, "window").isEmpty() ? 24.0 * 3600.0 : cliOption(args, "window").toDouble() * 3600.0;
+    if(window <= 0.0)
+    {
+        printError("schedule: window must be greater than 0");
+        return 2;
+    }
+
+    JobDurationModel model;
+    if(!cliOption(args, "overhead").isEmpty())
+        model.setOverhead(cliOption(args, "overhead").toDouble());
+
+    QElapsedTimer timer;
+    timer.start();
+    QList<ReportResult> reports;
+    loadDurationModel(env.archiveDirectory, from, to, model, &reports);
+    if(reports.isEmpty())
+    {
+        printError("schedule: no stored reports between " + from.toString("yyyy-MM-dd") + " and " + to.toString("yyyy-MM-dd"));
+        return 1;
+    }
+    std::stable_sort(reports.begin(), reports.end(), reportStartedBefore);
+
+    // Every sample is counted for the live time it was counted for then, on any detector
+    QList<ScheduleSample> samples;
+    foreach(const ReportResult& report, reports)
+    {
+        ScheduleSample sample;
+        sample.geometry = report.geometry;
+        sample.mda = 0.0;
+        sample.preset = TimePresetLive;
+        sample.presetValue = report.liveTime;
+        sample.priority = 0;
+        sample.arrival = qFloor(from.secsTo(report.acquisitionStarted) / window) * window;
+        samples << sample;
+    }
+
+    QList<ScheduleDetector> detectors;
+    foreach(const Detector& detector, env.detectors)
+        detectors << scheduleDetector(detector);
+
+    fprintf(stderr, "%d reports read in %lld ms\n", reports.count(), timer.elapsed());
+    printf("policy\tsamples\tunscheduled\tmakespan h\tmean wait h\tutilisation %%\n");
+    for(int p=ScheduleFirstFree; p<=ScheduleMakespan; p++)
+    {
+        QList<ScheduleAssignment> plan;
+        scheduleSamples(samples, detectors, model, (SchedulePolicy)p, plan);
+        ScheduleStats stats = scheduleStats(samples, detectors, plan);
+        printf("%s\t%d\t%d\t%.1f\t%.2f\t%.1f\n", qPrintable(schedulePolicyName((SchedulePolicy)p)),
+               stats.scheduled, stats.unscheduled, stats.makespan / 3600.0, stats.meanWait / 3600.0, stats.utilisation * 100.0);
+    }
+    return 0;
+}
+
+int cliServe(CliEnvironment& env, const QStringList& args)
+{
+    QString name = NAILAB_API_SERVER_NAME;
+    for(int i=0; i<args.count(); i++)
+    {
+        if(args[i].startsWith("--name="))
+            name = args[i].mid(7);
+    }
+
+    SchedulePolicy policy = ScheduleMakespan;
+    if(!readSchedulePolicy(args, policy))
+        return 2;
+
+    // Without a GUI there is nothing to protect, so the server simply runs on the main thread
+    JobApiServer server(env.tempDirectory, env.settings, env.username, env.runner);
+    server.setCheckFiles(!env.simulate);
+    server.setArchiveDirectory(env.archiveDirectory);
+    server.setSchedulePolicy(policy);
+    server.setDetectors(env.detectors);
+    server.start(name);
+
+    NaiImporter importer(&server);
+    importer.start();
+
+    printf("serving job API on %s\n", qPrintable(name));
+    fflush(stdout);
+    return QCoreApplication::exec();
+}
+
+int cliDedup(CliEnvironment& env, const QStringList& args)
+{
+    QString chunkDirectory = env.archiveDirectory + "CHUNKS/";
+
+    // Jobs archived before the chunk store still have plain scripts and logs
+    if(args.contains("--migrate"))
+    {
+        int migrated = 0, failed = 0;
+        QDirIterator iter(env.archiveDirectory, QStringList() << "*.BAT" << "*.OUT" << "*.ERR",
+                          QDir::Files, QDirIterator::Subdirectories);
+        QStringList files;
+        while(iter.hasNext())
+            files << iter.next();
+
+        foreach(const QString& filename, files)
+        {
+            QString error;
+            if(chunkArchivedFile(filename, chunkDirectory, &error))
+                migrated++;
+            else
+            {
+                printError(error);
+                failed++;
+            }
+        }
+        printf("migrated %d files, %d failed\n", migrated, failed);
+    }
+
+    if(args.contains("--gc"))
+        printf("removed %d unreferenced chunks\n", collectChunkGarbage(chunkDirectory));
+
+    ChunkUsage usage;
+    if(!chunkUsage(chunkDirectory, usage))
+    {
+        printError("Unable to read " + chunkDirectory + "REFS.LOG");
+        return 1;
+    }
+
+    qint64 saved = usage.referencedBytes - usage.storedBytes;
+    printf("chunks:          %d (%d unreferenced)\n", usage.chunks, usage.unreferencedChunks);
+    printf("referenced:      %lld bytes\n", usage.referencedBytes);
+    printf("unique:          %lld bytes\n", usage.uniqueBytes);
+    printf("stored:          %lld bytes\n", usage.storedBytes);
+    printf("saved:           %lld bytes (%.1f%%)\n", saved,
+           usage.referencedBytes > 0 ? 100.0 * saved / usage.referencedBytes : 0.0);
+    return 0;
+}
+
+int cliQA(CliEnvironment& env, const QStringList& args)
+{
+    if(args.isEmpty() || args[0].startsWith("--"))
+    {
+        printError("qa: missing detector");
+        return 2;
+    }
+
+    Detector* detector = findDetector(env, args[0]);
+    if(!detector)
+    {
+        printError("Unknown detector: " + args[0]);
+        return 1;
+    }
+
+    QAStore store(QDir::toNativeSeparators(env.rootDirectory + "/QA/"));
+
+    // The measurements after this one establish new limits
+    if(args.contains("--rebaseline"))
+    {
+        if(!store.rebaseline(detector->name, QDateTime::currentDateTime()))
+        {
+            printError("Unable to start a new baseline for " + detector->name);
+            return 1;
+        }
+        printf("New limits are established from the next %d measurements\n", store.baseline());
+    }
+
+    // Records a measurement when any metric is given, metrics left out were not measured
+    QAMeasurement measurement;
+    measurement.time = QDateTime::currentDateTime();
+    bool record = false;
+    for(int m=0; m<QAMetricCount; m++)
+    {
+        measurement.values[m] = std::numeric_limits<double>::quiet_NaN();
+        QString value = cliOption(args, qaMetricName((QAMetric)m));
+        if(value.isEmpty())
+            continue;
+
+        bool ok;
+        measurement.values[m] = value.toDouble(&ok);
+        if(!ok)
+        {
+            printError("qa: invalid --" + qaMetricName((QAMetric)m) + ": " + value);
+            return 2;
+        }
+        record = true;
+    }
+
+    int rules[QAMetricCount] = { 0 };
+    if(record && !store.add(detector->name, measurement, rules))
+    {
+        printError("Unable to record the measurement for " + detector->name);
+        return 1;
+    }
+
+    bool outOfControl = false;
+    printf("%-16s %8s %14s %12s  %s\n", "metric", "n", "mean", "sd", record ? "violations" : "last");
+    for(int m=0; m<QAMetricCount; m++)
+    {
+        const QASeries* series = store.series(detector->name, (QAMetric)m);
+        const RunningStats& stats = series->limits();
+        int last = record ? rules[m] : (series->count() > 0 ? series->rules(series->count() - 1) : 0);
+        outOfControl = outOfControl || (last & QARejectRules);
+        printf("%-16s %8d %14.6g %12.4g  %s%s\n", qPrintable(qaMetricName((QAMetric)m)), stats.count(), stats.mean(),
+               stats.standardDeviation(), qPrintable(qaRuleNames(last)), series->established() ? "" : " (establishing limits)");
+    }
+    return outOfControl ? 1 : 0;
+}
+
+int cliDrift(CliEnvironment& env, const QStringList& args)
+{
+    QList<Detector> detectors = env.detectors;
+    if(!args.isEmpty() && !args[0].startsWith("--"))
+    {
+        Detector* detector = findDetector(env, args[0]);
+        if(!detector)
+        {
+            printError("Unknown detector: " + args[0]);
+            return 1;
+        }
+        detectors = QList<Detector>() << *detector;
+    }
+
+    QString parallel = cliOption(args, "parallel");
+    int maxParallel = parallel.isEmpty() ? QThread::idealThreadCount() : parallel.toInt();
+
+    DriftMonitor monitor(env.archiveDirectory, QDir::toNativeSeparators(env.rootDirectory + "/DRIFT/"), env.settings, env.runner);
+    monitor.setDetectors(detectors);
+    monitor.setCheckTemplate(!env.simulate);
+
+    // --lines=1460.82,609.31 replaces the reference lines
+    QString lines = cliOption(args, "lines");
+    if(!lines.isEmpty())
+    {
+        QVector<double> energies;
+        foreach(const QString& line, lines.split(',', QString::SkipEmptyParts))
+        {
+            bool ok;
+            energies << line.toDouble(&ok);
+            if(!ok)
+            {
+                printError("drift: invalid line energy: " + line);
+                return 2;
+            }
+        }
+        monitor.setReferenceLines(energies);
+    }
+
+    QEventLoop loop;
+    QObject::connect(&monitor, &DriftMonitor::progress, [](int done, int failed, int total)
+    {
+        fprintf(stderr, "\r%d/%d spectra measured, %d failed", done + failed, total, failed);
+    });
+    QObject::connect(&monitor, &DriftMonitor::spectrumFailed, [](const QString& spectrum, const QString& error)
+    {
+        fprintf(stderr, "\n%s: %s\n", qPrintable(spectrum), qPrintable(error));
+    });
+    QObject::connect(&monitor, &DriftMonitor::finished, [&](int done, int failed, qint64 msecs)
+    {
+        if(done + failed > 0)
+            fprintf(stderr, "\n%d spectra measured, %d failed in %.1f s\n", done, failed, msecs / 1000.0);
+        loop.quit();
+    });
+
+    // finished may already have been emitted when there is no backlog
+    if(!monitor.start(maxParallel))
+    {
+        printError("Peak report template not found: " + peakTemplateFilename(env.settings));
+        return 1;
+    }
+    if(monitor.isRunning())
+        loop.exec();
+
+    bool recalibrate = false;
+    foreach(const Detector& detector, detectors)
+    {
+        DriftStatus status = monitor.status(detector.name);
+        recalibrate = recalibrate || status.alert == DriftStatus::AlertRecalibrate;
+        printf("%s\n", qPrintable(monitor.describe(detector.name)));
+    }
+    return recalibrate ? 1 : 0;
+}
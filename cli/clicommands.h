@@ -0,0 +1,41 @@
+#ifndef CLICOMMANDS_H
+#define CLICOMMANDS_H
+
+#include <QList>
+#include <QString>
+#include <QStringList>
+#include "settings.h"
+#include "detector.h"
+#include "jobutils.h"
+
+struct CliEnvironment
+{
+    QString rootDirectory, configurationDirectory, archiveDirectory, tempDirectory, libraryDirectory, resultsDirectory, cacheDirectory;
+    QString settingsFilename, detectorFilename;
+    QString username;
+    Settings settings;
+    QList<Detector> detectors;
+    JobRunner runner;
+    bool simulate;
+};
+
+bool setupCliEnvironment(CliEnvironment& env, bool simulate);
+Detector* findDetector(CliEnvironment& env, const QString& name);
+
+int cliSubmit(CliEnvironment& env, const QStringList& args);
+int cliRun(CliEnvironment& env, const QStringList& args);
+int cliWait(CliEnvironment& env, const QStringList& args);
+int cliStore(CliEnvironment& env, const QStringList& args);
+int cliReject(CliEnvironment& env, const QStringList& args);
+int cliStatus(CliEnvironment& env, const QStringList& args);
+int cliBatch(CliEnvironment& env, const QStringList& args);
+int cliSchedule(CliEnvironment& env, const QStringList& args);
+int cliServe(CliEnvironment& env, const QStringList& args);
+int cliResults(CliEnvironment& env, const QStringList& args);
+int cliRender(CliEnvironment& env, const QStringList& args);
+int cliReanalyse(CliEnvironment& env, const QStringList& args);
+int cliDedup(CliEnvironment& env, const QStringList& args);
+int cliQA(CliEnvironment& env, const QStringList& args);
+int cliDrift(CliEnvironment& env, const QStringList& args);
+
+#endif // CLICOMMANDS_H
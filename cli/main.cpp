@@ -0,0 +1,124 @@
+#include <exception>
+#include <cstdio>
+#include <QCoreApplication>
+#include <QStringList>
+#include "exceptions.h"
+#include "clicommands.h"
+
+static void usage()
+{
+    fprintf(stderr,
+            "Usage: nailab-cli [--simulate] <command> [arguments]\n\n"
+            "Commands:\n"
+            "  submit <detector> [Key=Value ...] [--wait]  Start a job on a detector\n"
+            "  run <detector>                              Run the job written for a detector and wait for it,\n"
+            "                                              used by submit without --wait\n"
+            "  wait <detector> [--timeout=<seconds>]       Wait until the job on a detector has finished\n"
+            "  store <detector>                            Store a finished job in the archive\n"
+            "  reject <detector>                           Reject a finished job\n"
+            "  status                                      Show job state for all detectors\n"
+            "  batch [--policy=makespan|first-free] <directory>\n"
+            "                                              Run and store all .nai sample files in a directory\n"
+            "  schedule [--from=<yyyy-MM-dd>] [--to=<yyyy-MM-dd>] [--window=<hours>] [--overhead=<seconds>]\n"
+            "                                              Compare the schedule policies on the samples of stored\n"
+            "                                              jobs, each window of them queued at once\n"
+            "  serve [--name=<server>] [--policy=makespan|first-free]\n"
+            "                                              Serve the local job submission API\n"
+            "  results [--from=<yyyy-MM-dd>] [--to=<yyyy-MM-dd>] [--nuclide=<name>] [--detector=<name>]\n"
+            "          [--beaker=<name>] [--sample=<id prefix>] [--group=nuclide|detector|beaker|sample|month|year]\n"
+            "          [--limit=<n>]                       Query stored nuclide results\n"
+            "  render --output=<directory> [--template=<file>] <report or directory> ...\n"
+            "                                              Regenerate reports with a native template\n"
+            "  reanalyse <detector> [--from=<yyyy-MM-dd>] [--to=<yyyy-MM-dd>] [--parallel=<n>] [--no-cache]\n"
+            "                                              Re-analyse archived spectra with current parameters\n"
+            "  dedup [--migrate] [--gc]                    Space used by archived job scripts and logs; --migrate\n"
+            "                                              moves plain ones to the chunk store, --gc removes\n"
+            "                                              unreferenced chunks\n"
+            "  qa <detector> [--centroid=<keV>] [--fwhm=<keV>] [--net-rate=<cps>] [--background-rate=<cps>]\n"
+            "     [--rebaseline]                           Record a check source measurement and show the control\n"
+            "                                              limits; exits with 1 when out of control. --rebaseline\n"
+            "                                              lets the next measurements establish new limits\n"
+            "  drift [<detector>] [--parallel=<n>] [--lines=<keV>,...]\n"
+            "                                              Measure the energy calibration drift of archived spectra\n"
+            "                                              not measured yet; exits with 1 when a detector needs\n"
+            "                                              recalibration\n\n"
+            "Sample fields are the same as in .nai files (Title, ID, Geometry, PresetType2Value, ...).\n"
+            "Priority=<n> and MDA=<nuclide>:<Bq> are only used to schedule samples.\n"
+            "The NAIROOT environment variable must point to the nailab root directory.\n");
+}
+
+int main(int argc, char *argv[])
+{
+    int retVal = 0;
+    try
+    {
+        QCoreApplication a(argc, argv);
+
+        QStringList args = a.arguments().mid(1);
+        bool simulate = false;
+        if(!args.isEmpty() && args[0] == "--simulate")
+        {
+            simulate = true;
+            args.removeFirst();
+        }
+
+        if(args.isEmpty())
+        {
+            usage();
+            return 2;
+        }
+
+        CliEnvironment env;
+        if(!setupCliEnvironment(env, simulate))
+            return 1;
+
+        QString command = args.takeFirst();
+        if(command == "submit")
+            retVal = cliSubmit(env, args);
+        else if(command == "run")
+            retVal = cliRun(env, args);
+        else if(command == "wait")
+            retVal = cliWait(env, args);
+        else if(command == "store")
+            retVal = cliStore(env, args);
+        else if(command == "reject")
+            retVal = cliReject(env, args);
+        else if(command == "status")
+            retVal = cliStatus(env, args);
+        else if(command == "batch")
+            retVal = cliBatch(env, args);
+        else if(command == "schedule")
+            retVal = cliSchedule(env, args);
+        else if(command == "serve")
+            retVal = cliServe(env, args);
+        else if(command == "results")
+            retVal = cliResults(env, args);
+        else if(command == "render")
+            retVal = cliRender(env, args);
+        else if(command == "reanalyse")
+            retVal = cliReanalyse(env, args);
+        else if(command == "dedup")
+            retVal = cliDedup(env, args);
+        else if(command == "qa")
+            retVal = cliQA(env, args);
+        else if(command == "drift")
+            retVal = cliDrift(env, args);
+        else
+        {
+            usage();
+            retVal = 2;
+        }
+    }
+    catch(BaseException& bex)
+    {
+        retVal = 1;
+        fprintf(stderr, "%s - %s: line %d\n\n%s\n", bex.file(), bex.function(), bex.line(), bex.what());
+    }
+    catch(std::exception& ex)
+    {
+        retVal = 1;
+        fprintf(stderr, "%s\n", ex.what());
+    }
+
+    return retVal;
+}
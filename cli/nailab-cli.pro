@@ -0,0 +1,74 @@
+#-------------------------------------------------
+#
+# Headless command line runner for nailab jobs
+#
+#-------------------------------------------------
+
+CONFIG += c++11 console
+CONFIG -= app_bundle
+
+QT       += core xml concurrent network
+QT       -= gui
+
+TARGET = nailab-cli
+TEMPLATE = app
+
+DEFINES += NAILAB_HEADLESS
+
+INCLUDEPATH += $$PWD/..
+DEPENDPATH += $$PWD/..
+
+SOURCES += main.cpp \
+    clicommands.cpp \
+    ../detector.cpp \
+    ../dbutils.cpp \
+    ../jobutils.cpp \
+    ../sampleinput.cpp \
+    ../preflight.cpp \
+    ../jobtrace.cpp \
+    ../jobjournal.cpp \
+    ../chunkstore.cpp \
+    ../metrics.cpp \
+    ../simjob.cpp \
+    ../jobapi.cpp \
+    ../scheduler.cpp \
+    ../naiimporter.cpp \
+    ../reportexporter.cpp \
+    ../reportparser.cpp \
+    ../resultstore.cpp \
+    ../reporttemplate.cpp \
+    ../reanalysis.cpp \
+    ../analysiscache.cpp \
+    ../stagegraph.cpp \
+    ../qastore.cpp \
+    ../driftmonitor.cpp
+
+HEADERS  += clicommands.h \
+    ../dbutils.h \
+    ../jobutils.h \
+    ../preflight.h \
+    ../jobtrace.h \
+    ../jobjournal.h \
+    ../chunkstore.h \
+    ../metrics.h \
+    ../simjob.h \
+    ../jobapi.h \
+    ../scheduler.h \
+    ../naiimporter.h \
+    ../reportexporter.h \
+    ../reportparser.h \
+    ../resultstore.h \
+    ../reporttemplate.h \
+    ../reanalysis.h \
+    ../analysiscache.h \
+    ../stagegraph.h \
+    ../qastore.h \
+    ../driftmonitor.h \
+    ../settings.h \
+    ../detector.h \
+    ../sampleinput.h \
+    ../exceptions.h
+
+win32: SOURCES += ../winutils.cpp
+win32: HEADERS += ../winutils.h
+win32: LIBS += -lAdvapi32
@@ -0,0 +1,195 @@
+#include <QPainter>
+#include <QPaintEvent>
+#include <QWheelEvent>
+#include <QMouseEvent>
+#include "controlchart.h"
+
+ControlChart::ControlChart(QWidget *parent)
+    : QWidget(parent), mSeries(NULL), mFrom(0), mTo(0), mFollow(true), mDragX(0), mDragFrom(0)
+{
+    setMinimumSize(300, 200);
+    setBackgroundRole(QPalette::Base);
+    setAutoFillBackground(true);
+}
+
+void ControlChart::setSeries(const QASeries* series, const QString& title)
+{
+    mSeries = series;
+    mTitle = title;
+    showAll();
+}
+
+void ControlChart::seriesChanged()
+{
+    if(mSeries && mFollow && mFrom == 0)
+        showAll();
+    else if(mSeries && mFollow)
+        setRange(mFrom + mSeries->count() - mTo, mSeries->count());
+    else
+        update();
+}
+
+void ControlChart::showAll()
+{
+    setRange(0, mSeries ? mSeries->count() : 0);
+}
+
+void ControlChart::setRange(int from, int to)
+{
+    int count = mSeries ? mSeries->count() : 0;
+    int span = qMin(qMax(to - from, qMin(count, 10)), count);
+    mFrom = qBound(0, from, count - span);
+    mTo = mFrom + span;
+    mFollow = mTo == count;
+    update();
+}
+
+QRect ControlChart::plotRect() const
+{
+    return rect().adjusted(70, 24, -12, -28);
+}
+
+void ControlChart::paintEvent(QPaintEvent *event)
+{
+    Q_UNUSED(event);
+
+    QPainter painter(this);
+    QRect plot = plotRect();
+    painter.drawText(rect().adjusted(4, 4, -4, -4), Qt::AlignLeft | Qt::AlignTop, mTitle);
+    if(!mSeries || mSeries->count() == 0 || plot.width() < 10 || plot.height() < 10)
+    {
+        painter.drawText(rect(), Qt::AlignCenter, tr("No measurements"));
+        return;
+    }
+
+    mSeries->downsample(mFrom, mTo, plot.width(), mBuckets);
+
+    // Value range covers the 3 SD limits and every visible value
+    const RunningStats& baseline = mSeries->limits();
+    double mean = baseline.mean(), sd = baseline.standardDeviation();
+    double low = mBuckets[0].min, high = mBuckets[0].max;
+    for(int i=1; i<mBuckets.count(); i++)
+    {
+        low = qMin(low, mBuckets[i].min);
+        high = qMax(high, mBuckets[i].max);
+    }
+    if(baseline.count() > 1)
+    {
+        low = qMin(low, mean - 3.5 * sd);
+        high = qMax(high, mean + 3.5 * sd);
+    }
+    if(high <= low)
+    {
+        low -= 1.0;
+        high += 1.0;
+    }
+
+    double span = mTo - mFrom;
+    double xScale = plot.width() / span, yScale = plot.height() / (high - low);
+    auto xAt = [&](double i) { return plot.left() + (i - mFrom + 0.5) * xScale; };
+    auto yAt = [&](double v) { return plot.bottom() - (v - low) * yScale; };
+
+    painter.setPen(palette().color(QPalette::Mid));
+    painter.drawRect(plot);
+
+    QString status = tr("n %1, mean %2, SD %3").arg(baseline.count()).arg(mean, 0, 'g', 6).arg(sd, 0, 'g', 3);
+    if(!mSeries->established())
+        status += tr(", establishing limits");
+    painter.setPen(palette().color(QPalette::Text));
+    painter.drawText(rect().adjusted(4, 4, -12, -4), Qt::AlignRight | Qt::AlignTop, status);
+
+    if(baseline.count() > 1)
+    {
+        struct Limit { double sd; QColor color; Qt::PenStyle style; };
+        const Limit limits[] = {
+            { 0.0, Qt::darkGreen, Qt::SolidLine },
+            { 2.0, QColor(230, 150, 0), Qt::DashLine }, { -2.0, QColor(230, 150, 0), Qt::DashLine },
+            { 3.0, Qt::red, Qt::DashLine }, { -3.0, Qt::red, Qt::DashLine }
+        };
+        for(unsigned int i=0; i<sizeof(limits) / sizeof(limits[0]); i++)
+        {
+            double v = mean + limits[i].sd * sd;
+            painter.setPen(QPen(limits[i].color, 1, limits[i].style));
+            painter.drawLine(QPointF(plot.left(), yAt(v)), QPointF(plot.right(), yAt(v)));
+            painter.setPen(palette().color(QPalette::Text));
+            painter.drawText(QRectF(0, yAt(v) - 8, plot.left() - 4, 16), Qt::AlignRight | Qt::AlignVCenter,
+                             QString::number(v, 'g', 6));
+        }
+    }
+
+    // Single values are joined by a line, buckets drawn as their min to max range
+    painter.setRenderHint(QPainter::Antialiasing);
+    QPointF last;
+    for(int i=0; i<mBuckets.count(); i++)
+    {
+        const QABucket& bucket = mBuckets[i];
+        QColor color = palette().color(QPalette::Text);
+        if(bucket.rules & QARejectRules)
+            color = Qt::red;
+        else if(bucket.rules & QARule12s)
+            color = QColor(230, 150, 0);
+
+        double x = xAt(bucket.first + (bucket.count - 1) / 2.0);
+        if(bucket.count == 1)
+        {
+            QPointF point(x, yAt(bucket.min));
+            if(i > 0)
+            {
+                painter.setPen(palette().color(QPalette::Mid));
+                painter.drawLine(last, point);
+            }
+            painter.setPen(color);
+            painter.setBrush(color);
+            painter.drawEllipse(point, 2.5, 2.5);
+            last = point;
+        }
+        else
+        {
+            painter.setPen(color);
+            painter.drawLine(QPointF(x, yAt(bucket.min)), QPointF(x, yAt(bucket.max)));
+        }
+    }
+
+    painter.setPen(palette().color(QPalette::Text));
+    QRect axis(plot.left(), plot.bottom() + 4, plot.width(), 20);
+    painter.drawText(axis, Qt::AlignLeft | Qt::AlignTop, mSeries->time(mFrom).toString("yyyy-MM-dd HH:mm"));
+    painter.drawText(axis, Qt::AlignRight | Qt::AlignTop, mSeries->time(mTo - 1).toString("yyyy-MM-dd HH:mm"));
+}
+
+void ControlChart::wheelEvent(QWheelEvent *event)
+{
+    if(!mSeries || mTo <= mFrom)
+        return;
+
+    // Zooms around the value under the cursor
+    QRect plot = plotRect();
+    double span = mTo - mFrom;
+    double anchor = mFrom + qBound(0.0, double(event->pos().x() - plot.left()) / qMax(1, plot.width()), 1.0) * span;
+    double factor = event->angleDelta().y() > 0 ? 0.8 : 1.25;
+    double newSpan = qMax(10.0, span * factor);
+    int from = int(anchor - (anchor - mFrom) * newSpan / span);
+    setRange(from, from + int(newSpan));
+    event->accept();
+}
+
+void ControlChart::mousePressEvent(QMouseEvent *event)
+{
+    mDragX = event->x();
+    mDragFrom = mFrom;
+}
+
+void ControlChart::mouseMoveEvent(QMouseEvent *event)
+{
+    if(!mSeries || !(event->buttons() & Qt::LeftButton))
+        return;
+
+    int span = mTo - mFrom;
+    int shift = int(double(mDragX - event->x()) * span / qMax(1, plotRect().width()));
+    setRange(mDragFrom + shift, mDragFrom + shift + span);
+}
+
+void ControlChart::mouseDoubleClickEvent(QMouseEvent *event)
+{
+    Q_UNUSED(event);
+    showAll();
+}
@@ -0,0 +1,50 @@
+#ifndef CONTROLCHART_H
+#define CONTROLCHART_H
+
+#include <QWidget>
+#include <QVector>
+#include "qastore.h"
+
+// Shewhart chart of a QA series: the values against the mean and the 2 and 3 SD
+// limits, out of control values in red. Only the buckets of the visible range are
+// drawn (QASeries::downsample), about one per pixel column. The wheel zooms, dragging
+// pans and a double click shows the whole series again.
+class ControlChart : public QWidget
+{
+    Q_OBJECT
+
+public:
+
+    explicit ControlChart(QWidget *parent = 0);
+
+    // The series is not owned, NULL clears the chart
+    void setSeries(const QASeries* series, const QString& title);
+    // Call after values were added, a chart showing the newest values keeps doing so
+    void seriesChanged();
+
+public slots:
+
+    void showAll();
+
+protected:
+
+    void paintEvent(QPaintEvent *event);
+    void wheelEvent(QWheelEvent *event);
+    void mousePressEvent(QMouseEvent *event);
+    void mouseMoveEvent(QMouseEvent *event);
+    void mouseDoubleClickEvent(QMouseEvent *event);
+
+private:
+
+    const QASeries *mSeries;
+    QString mTitle;
+    int mFrom, mTo;             // visible values [mFrom, mTo)
+    bool mFollow;
+    int mDragX, mDragFrom;
+    QVector<QABucket> mBuckets;
+
+    QRect plotRect() const;
+    void setRange(int from, int to);
+};
+
+#endif // CONTROLCHART_H
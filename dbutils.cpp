@@ -1,20 +1,67 @@
 #include <QFile>
 #include <QTextStream>
 #include <QtXml>
+#ifndef NAILAB_HEADLESS
 #include <QMessageBox>
+#include <QCoreApplication>
+#include <QThread>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QStringList>
+#endif
 #include "dbutils.h"
 #include "settings.h"
 #include "beaker.h"
 #include "detector.h"
+#include "sampleinput.h"
+#include "jobutils.h"
+
+#ifndef NAILAB_HEADLESS
+static QMutex deferredMutex;
+static QStringList deferredErrors;
+#endif
+
+static void reportError(const QString& message)
+{
+#ifdef NAILAB_HEADLESS
+    qWarning("%s", qPrintable(message));
+#else
+    // Message boxes only work on the GUI thread, see showDeferredDbErrors
+    if(QThread::currentThread() != QCoreApplication::instance()->thread())
+    {
+        QMutexLocker lock(&deferredMutex);
+        deferredErrors.append(message);
+        return;
+    }
+
+    QMessageBox msgBox;
+    msgBox.setText(message);
+    msgBox.exec();
+#endif
+}
+
+void showDeferredDbErrors()
+{
+#ifndef NAILAB_HEADLESS
+    QStringList errors;
+    {
+        QMutexLocker lock(&deferredMutex);
+        errors.swap(deferredErrors);
+    }
+    foreach(const QString& error, errors)
+        reportError(error);
+#endif
+}
 
 bool readSettingsXml(QFile &file, Settings& settings)
 {
+    // Job templates hold settings and detector parameters, see jobTemplate
+    invalidateJobTemplates();
+
     QDomDocument document;
     if(!file.open(QIODevice::ReadOnly | QIODevice::Text))
     {
-        QMessageBox msgBox;
-        msgBox.setText("Unable to open file: " + file.fileName());
-        msgBox.exec();
+        reportError("Unable to open file: " + file.fileName());
         return false;
     }
     document.setContent(&file);
@@ -23,9 +70,7 @@ bool readSettingsXml(QFile &file, Settings& settings)
     QDomElement xroot = document.documentElement();
     if(xroot.tagName() != "Settings")
     {
-        QMessageBox msgBox;
-        msgBox.setText("Invalid root element: " + file.fileName());
-        msgBox.exec();
+        reportError("Invalid root element: " + file.fileName());
         return false;
     }
 
@@ -81,9 +126,7 @@ bool writeSettingsXml(QFile &file, const Settings& settings)
 
     if(!file.open(QIODevice::WriteOnly | QIODevice::Text))
     {
-        QMessageBox msgBox;
-        msgBox.setText("Unable to open file: " + file.fileName());
-        msgBox.exec();
+        reportError("Unable to open file: " + file.fileName());
         return false;
     }
     QTextStream stream(&file);
@@ -97,9 +140,7 @@ bool readBeakerXml(QFile& file, QList<Beaker>& beakers)
     QDomDocument document;    
     if(!file.open(QIODevice::ReadOnly | QIODevice::Text))
     {
-        QMessageBox msgBox;
-        msgBox.setText("Unable to open file: " + file.fileName());
-        msgBox.exec();
+        reportError("Unable to open file: " + file.fileName());
         return false;
     }
     document.setContent(&file);
@@ -138,9 +179,7 @@ bool writeBeakerXml(QFile& file, const QList<Beaker>& beakers)
 
     if(!file.open(QIODevice::WriteOnly | QIODevice::Text))
     {
-        QMessageBox msgBox;
-        msgBox.setText("Unable to open file: " + file.fileName());
-        msgBox.exec();
+        reportError("Unable to open file: " + file.fileName());
         return false;
     }
     QTextStream stream(&file);
@@ -151,12 +190,12 @@ bool writeBeakerXml(QFile& file, const QList<Beaker>& beakers)
 
 bool readDetectorXml(QFile& file, QList<Detector>& detectors)
 {
+    invalidateJobTemplates();
+
     QDomDocument document;    
     if(!file.open(QIODevice::ReadOnly | QIODevice::Text))
     {
-        QMessageBox msgBox;
-        msgBox.setText("Unable to open file: " + file.fileName());
-        msgBox.exec();
+        reportError("Unable to open file: " + file.fileName());
         return false;
     }
     document.setContent(&file);
@@ -171,7 +210,7 @@ bool readDetectorXml(QFile& file, QList<Detector>& detectors)
         Detector detector;
         QDomElement xdetector = xdetectors.at(i).toElement();
 
-        detector.name = xdetector.attribute("Name");
+        detector.name = internString(xdetector.attribute("Name"));
         detector.enabled = xdetector.attribute("Enabled") == "true" ? true : false;
         detector.inUse = xdetector.attribute("InUse") == "true" ? true : false;
         detector.searchRegionStart = xdetector.attribute("SearchRegionStart").toInt();
@@ -181,7 +220,7 @@ bool readDetectorXml(QFile& file, QList<Detector>& detectors)
         detector.peakAreaRegionStart = xdetector.attribute("PeakAreaRegionStart").toInt();
         detector.peakAreaRegionEnd = xdetector.attribute("PeakAreaRegionEnd").toInt();
         detector.continuum = xdetector.attribute("Continuum").toDouble();
-        detector.continuumFunction = xdetector.attribute("ContinuumFunction");
+        detector.continuumFunction = continuumFunctionFromName(xdetector.attribute("ContinuumFunction"));
         detector.criticalLevelTest = xdetector.attribute("CriticalLevelTest") == "true" ? true : false;
         detector.useFixedFWHM = xdetector.attribute("UseFixedFWHM") == "true" ? true : false;
         detector.useFixedTailParameter = xdetector.attribute("UseFixedTailParameter") == "true" ? true : false;
@@ -191,15 +230,15 @@ bool readDetectorXml(QFile& file, QList<Detector>& detectors)
         detector.maxFWHMsBetweenPeaks = xdetector.attribute("MaxFWHMsBetweenPeaks").toDouble();
         detector.maxFWHMsForLeftLimit = xdetector.attribute("MaxFWHMsForLeftLimit").toDouble();
         detector.maxFWHMsForRightLimit = xdetector.attribute("MaxFWHMsForRightLimit").toDouble();
-        detector.backgroundSubtract = xdetector.attribute("BackgroundSubtract");
-        detector.efficiencyCalibrationType = xdetector.attribute("EfficiencyCalibrationType");
-        detector.presetType1 = xdetector.attribute("PresetType1");
+        detector.backgroundSubtract = internString(xdetector.attribute("BackgroundSubtract"));
+        detector.efficiencyCalibrationType = efficiencyCalibrationFromName(xdetector.attribute("EfficiencyCalibrationType"));
+        detector.presetType1 = countPresetFromName(xdetector.attribute("PresetType1"));
         detector.presetType1Value = xdetector.attribute("PresetType1Value").toDouble();
         detector.presetType1ChannelStart = xdetector.attribute("PresetType1ChannelStart").toInt();
         detector.presetType1ChannelEnd = xdetector.attribute("PresetType1ChannelEnd").toInt();
-        detector.presetType2 = xdetector.attribute("PresetType2");
+        detector.presetType2 = timePresetFromName(xdetector.attribute("PresetType2"));
         detector.presetType2Value = xdetector.attribute("PresetType2Value").toDouble();
-        detector.presetType2Unit = xdetector.attribute("PresetType2Unit");
+        detector.presetType2Unit = timeUnitFromName(xdetector.attribute("PresetType2Unit"));
         detector.randomError = xdetector.attribute("RandomError").toDouble();
         detector.systematicError = xdetector.attribute("SystematicError").toDouble();
         detector.spectrumCounter = xdetector.attribute("SpectrumCounter").toInt();        
@@ -208,10 +247,10 @@ bool readDetectorXml(QFile& file, QList<Detector>& detectors)
         for(int j=0; j<xbeakers.count(); j++)
         {
             QDomElement xbeaker = xbeakers.at(j).toElement();
-            detector.beakers[xbeaker.attribute("BeakerName")] = xbeaker.attribute("CalFile");
+            detector.beakers[internString(xbeaker.attribute("BeakerName"))] = internString(xbeaker.attribute("CalFile"));
         }
 
-        detector.NIDLibrary = xdetector.attribute("NIDLibrary");
+        detector.NIDLibrary = internString(xdetector.attribute("NIDLibrary"));
         detector.NIDConfidenceTreshold = xdetector.attribute("NIDConfidenceTreshold").toDouble();
         detector.MDAConfidenceFactor = xdetector.attribute("MDAConfidenceFactor").toDouble();
         detector.performMDATest = xdetector.attribute("PerformMDATest") == "true" ? true : false;
@@ -242,7 +281,7 @@ bool writeDetectorXml(QFile& file, const QList<Detector>& detectors)
         xdetector.setAttribute("PeakAreaRegionStart", detectors[i].peakAreaRegionStart);
         xdetector.setAttribute("PeakAreaRegionEnd", detectors[i].peakAreaRegionEnd);
         xdetector.setAttribute("Continuum", detectors[i].continuum);
-        xdetector.setAttribute("ContinuumFunction", detectors[i].continuumFunction);
+        xdetector.setAttribute("ContinuumFunction", continuumFunctionName(detectors[i].continuumFunction));
         xdetector.setAttribute("CriticalLevelTest", detectors[i].criticalLevelTest ? "true" : "false");
         xdetector.setAttribute("UseFixedFWHM", detectors[i].useFixedFWHM ? "true" : "false");
         xdetector.setAttribute("UseFixedTailParameter", detectors[i].useFixedTailParameter ? "true" : "false");
@@ -253,14 +292,14 @@ bool writeDetectorXml(QFile& file, const QList<Detector>& detectors)
         xdetector.setAttribute("MaxFWHMsForLeftLimit", detectors[i].maxFWHMsForLeftLimit);
         xdetector.setAttribute("MaxFWHMsForRightLimit", detectors[i].maxFWHMsForRightLimit);
         xdetector.setAttribute("BackgroundSubtract", detectors[i].backgroundSubtract);
-        xdetector.setAttribute("EfficiencyCalibrationType", detectors[i].efficiencyCalibrationType);
-        xdetector.setAttribute("PresetType1", detectors[i].presetType1);
+        xdetector.setAttribute("EfficiencyCalibrationType", efficiencyCalibrationName(detectors[i].efficiencyCalibrationType));
+        xdetector.setAttribute("PresetType1", countPresetName(detectors[i].presetType1));
         xdetector.setAttribute("PresetType1Value", detectors[i].presetType1Value);
         xdetector.setAttribute("PresetType1ChannelStart", detectors[i].presetType1ChannelStart);
         xdetector.setAttribute("PresetType1ChannelEnd", detectors[i].presetType1ChannelEnd);
-        xdetector.setAttribute("PresetType2", detectors[i].presetType2);
+        xdetector.setAttribute("PresetType2", timePresetName(detectors[i].presetType2));
         xdetector.setAttribute("PresetType2Value", detectors[i].presetType2Value);
-        xdetector.setAttribute("PresetType2Unit", detectors[i].presetType2Unit);
+        xdetector.setAttribute("PresetType2Unit", timeUnitName(detectors[i].presetType2Unit));
         xdetector.setAttribute("RandomError", detectors[i].randomError);
         xdetector.setAttribute("SystematicError", detectors[i].systematicError);
         xdetector.setAttribute("SpectrumCounter", detectors[i].spectrumCounter);        
@@ -287,9 +326,7 @@ bool writeDetectorXml(QFile& file, const QList<Detector>& detectors)
 
     if(!file.open(QIODevice::WriteOnly | QIODevice::Text))
     {
-        QMessageBox msgBox;
-        msgBox.setText("Unable to open file: " + file.fileName());
-        msgBox.exec();
+        reportError("Unable to open file: " + file.fileName());
         return false;
     }
     QTextStream stream(&file);
@@ -299,14 +336,17 @@ bool writeDetectorXml(QFile& file, const QList<Detector>& detectors)
 }
 
 bool updateDetectorSpectrumCounter(QFile& file, Detector* detector)
-{    
-    bool found = false;
+{
+    return updateDetectorSpectrumCounters(file, QList<Detector*>() << detector);
+}
+
+bool updateDetectorSpectrumCounters(QFile& file, const QList<Detector*>& detectors)
+{
+    // All counters go in one write, the detectors are only touched once it succeeded
     QDomDocument document;
     if(!file.open(QIODevice::ReadOnly | QIODevice::Text))
     {
-        QMessageBox msgBox;
-        msgBox.setText("Unable to open file: " + file.fileName());
-        msgBox.exec();
+        reportError("Unable to open file: " + file.fileName());
         return false;
     }
     document.setContent(&file);
@@ -314,34 +354,42 @@ bool updateDetectorSpectrumCounter(QFile& file, Detector* detector)
 
     QDomElement xroot = document.firstChildElement();
     QDomNodeList xdetectors = xroot.elementsByTagName("Detector");
-    for(int i=0; i<xdetectors.count(); i++)
+    foreach(Detector* detector, detectors)
     {
-        QDomElement xdetector = xdetectors.at(i).toElement();
-        if(detector->name == xdetector.attribute("Name"))
+        bool found = false;
+        for(int i=0; i<xdetectors.count() && !found; i++)
         {
-            xdetector.setAttribute("SpectrumCounter", detector->spectrumCounter + 1);
-            detector->spectrumCounter++;
-            found = true;
-            break;
+            QDomElement xdetector = xdetectors.at(i).toElement();
+            if(detector->name == xdetector.attribute("Name"))
+            {
+                xdetector.setAttribute("SpectrumCounter", detector->spectrumCounter + 1);
+                found = true;
+            }
         }
-    }        
+        if(!found)
+            return false;
+    }
 
-    if(found)
+    if(!file.open(QIODevice::WriteOnly | QIODevice::Text))
     {
-        if(!file.open(QIODevice::WriteOnly | QIODevice::Text))
-        {
-            QMessageBox msgBox;
-            msgBox.setText("Failed to open file for writing: " + file.fileName());
-            msgBox.exec();
-            return false;
-        }
+        reportError("Failed to open file for writing: " + file.fileName());
+        return false;
+    }
 
-        QTextStream stream(&file);
-        stream << document.toString();
-        file.close();
+    QTextStream stream(&file);
+    stream << document.toString();
+    stream.flush();
+    bool ok = stream.status() == QTextStream::Ok;
+    file.close();
+    if(!ok)
+    {
+        reportError("Failed to write file: " + file.fileName());
+        return false;
     }
 
-    return found;
+    foreach(Detector* detector, detectors)
+        detector->spectrumCounter++;
+    return true;
 }
 
 bool readQuantityUnitsXml(QFile &file, QStringList& units)
@@ -349,9 +397,7 @@ bool readQuantityUnitsXml(QFile &file, QStringList& units)
     QDomDocument document;
     if(!file.open(QIODevice::ReadOnly | QIODevice::Text))
     {
-        QMessageBox msgBox;
-        msgBox.setText("Unable to open file: " + file.fileName());
-        msgBox.exec();
+        reportError("Unable to open file: " + file.fileName());
         return false;
     }
     document.setContent(&file);
@@ -366,3 +412,85 @@ bool readQuantityUnitsXml(QFile &file, QStringList& units)
 
     return true;
 }
+
+bool setSampleInputField(SampleInput& sampleInput, const QString& key, const QString& value)
+{
+    QString k = key.trimmed().toLower();
+    if(k == "detector")
+        sampleInput.detector = value;
+    else if(k == "title")
+        sampleInput.title = value;
+    else if(k == "collector")
+        sampleInput.username = value;
+    else if(k == "description")
+        sampleInput.description = value;
+    else if(k == "specterref")
+        sampleInput.specterref = value;
+    else if(k == "id")
+        sampleInput.ID = value;
+    else if(k == "type")
+        sampleInput.type = value;
+    else if(k == "quantity")
+        sampleInput.quantity = value;
+    else if(k == "quantityerror")
+        sampleInput.quantityError = value;
+    else if(k == "units")
+        sampleInput.units = value;
+    else if(k == "geometry")
+        sampleInput.geometry = value;
+    else if(k == "builduptype")
+        sampleInput.builduptype = value.toUpper();
+    else if(k == "starttime")
+        sampleInput.startTime = value;
+    else if(k == "endtime")
+        sampleInput.endTime = value;
+    else if(k == "randomerror")
+        sampleInput.randomError = value;
+    else if(k == "systematicerror")
+        sampleInput.systematicError = value;
+    else if(k == "presettype1")
+        sampleInput.presetType1 = value.toUpper();
+    else if(k == "presettype1value")
+        sampleInput.presetType1Value = value;
+    else if(k == "presettype1startchannel")
+        sampleInput.presetType1StartChannel = value;
+    else if(k == "presettype1endchannel")
+        sampleInput.presetType1EndChannel = value;
+    else if(k == "presettype2")
+        sampleInput.presetType2 = value.toUpper();
+    else if(k == "presettype2value")
+        sampleInput.presetType2Value = value;
+    else if(k == "priority")
+        sampleInput.priority = value;
+    else if(k == "mda")
+        sampleInput.mda = value;
+    else
+        return false;
+    return true;
+}
+
+bool readSampleInputFile(QFile &file, SampleInput& sampleInput)
+{
+    // Sample files (.nai) are plain text with one "Key=Value" pair per line, '#' starts a comment
+    if(!file.open(QIODevice::ReadOnly | QIODevice::Text))
+        return false;
+
+    QTextStream stream(&file);
+    while(!stream.atEnd())
+    {
+        QString line = stream.readLine().trimmed();
+        if(line.isEmpty() || line.startsWith('#'))
+            continue;
+
+        int sep = line.indexOf('=');
+        if(sep <= 0)
+        {
+            file.close();
+            return false;
+        }
+
+        setSampleInputField(sampleInput, line.left(sep), line.mid(sep + 1).trimmed());
+    }
+    file.close();
+    return true;
+}
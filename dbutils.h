@@ -7,6 +7,10 @@ class QFile;
 struct Settings;
 struct Beaker;
 struct Detector;
+struct SampleInput;
+
+// Shows errors from reads on worker threads, call on the GUI thread after joining them
+void showDeferredDbErrors();
 
 bool readSettingsXml(QFile &file, Settings& settings);
 bool writeSettingsXml(QFile &file, const Settings& settings);
@@ -17,7 +21,11 @@ bool writeBeakerXml(QFile &file, const QList<Beaker>& beakers);
 bool readDetectorXml(QFile &file, QList<Detector>& detectors);
 bool writeDetectorXml(QFile &file, const QList<Detector>& detectors);
 bool updateDetectorSpectrumCounter(QFile& file, Detector* detector);
+bool updateDetectorSpectrumCounters(QFile& file, const QList<Detector*>& detectors);
 
 bool readQuantityUnitsXml(QFile &file, QStringList& units);
 
+bool setSampleInputField(SampleInput& sampleInput, const QString& key, const QString& value);
+bool readSampleInputFile(QFile &file, SampleInput& sampleInput);
+
 #endif // DBUTILS_H
@@ -0,0 +1,107 @@
+#include <QSet>
+#include <QMutex>
+#include <QMutexLocker>
+#include "detector.h"
+
+static const char* continuumNames[] = { "", "LINEAR", "STEP" };
+static const char* efficiencyNames[] = { "", "INTERP", "LINEAR", "DUAL", "EMP" };
+static const char* countPresetNames[] = { "", "AREA", "INTEGRAL", "COUNT" };
+static const char* timePresetNames[] = { "", "REALTIME", "LIVETIME" };
+static const char* timeUnitNames[] = { "", "SECONDS", "MINUTES", "HOURS" };
+
+// Unknown names, including "NONE", map to the first entry
+template<int N>
+static int indexOfName(const char* (&names)[N], const QString& name)
+{
+    for(int i=1; i<N; i++)
+    {
+        if(name.compare(QLatin1String(names[i]), Qt::CaseInsensitive) == 0)
+            return i;
+    }
+    return 0;
+}
+
+QString continuumFunctionName(ContinuumFunction function)
+{
+    return QLatin1String(continuumNames[function]);
+}
+
+ContinuumFunction continuumFunctionFromName(const QString& name)
+{
+    return ContinuumFunction(indexOfName(continuumNames, name));
+}
+
+QString efficiencyCalibrationName(EfficiencyCalibration type)
+{
+    return QLatin1String(efficiencyNames[type]);
+}
+
+EfficiencyCalibration efficiencyCalibrationFromName(const QString& name)
+{
+    return EfficiencyCalibration(indexOfName(efficiencyNames, name));
+}
+
+QString countPresetName(CountPreset preset)
+{
+    return QLatin1String(countPresetNames[preset]);
+}
+
+CountPreset countPresetFromName(const QString& name)
+{
+    return CountPreset(indexOfName(countPresetNames, name));
+}
+
+QString timePresetName(TimePreset preset)
+{
+    return QLatin1String(timePresetNames[preset]);
+}
+
+TimePreset timePresetFromName(const QString& name)
+{
+    return TimePreset(indexOfName(timePresetNames, name));
+}
+
+QString timeUnitName(TimeUnit unit)
+{
+    return QLatin1String(timeUnitNames[unit]);
+}
+
+TimeUnit timeUnitFromName(const QString& name)
+{
+    return TimeUnit(indexOfName(timeUnitNames, name));
+}
+
+QString internString(const QString& value)
+{
+    static QMutex mutex;
+    static QSet<QString> strings;
+
+    if(value.isEmpty())
+        return QString();
+
+    QMutexLocker lock(&mutex);
+    QSet<QString>::const_iterator iter = strings.constFind(value);
+    if(iter != strings.constEnd())
+        return *iter;
+    strings.insert(value);
+    return value;
+}
+
+int DetectorIndex::find(const QList<Detector>& detectors, const QString& name)
+{
+    int row = mRows.value(name, -1);
+    if(row >= 0 && row < detectors.count() && detectors[row].name == name)
+        return row;
+
+    // Misses are rare (names from Genie that are not configured), rebuild and look again
+    rebuild(detectors);
+    return mRows.value(name, -1);
+}
+
+void DetectorIndex::rebuild(const QList<Detector>& detectors)
+{
+    mRows.clear();
+    mRows.reserve(detectors.count());
+    for(int i=0; i<detectors.count(); i++)
+        mRows.insert(detectors[i].name, i);
+}
@@ -2,50 +2,118 @@
 #define DETECTOR_H
 
 #include <QMap>
+#include <QHash>
+#include <QList>
 #include <QString>
 
+// Closed sets of the detector configuration. The names are the Genie 2000 keywords
+// stored in mca.xml and shown in the combo boxes; they are only converted at those
+// boundaries, see the *Name and *FromName functions.
+
+enum ContinuumFunction
+{
+    ContinuumNone, ContinuumLinear, ContinuumStep
+};
+
+enum EfficiencyCalibration
+{
+    EfficiencyNone, EfficiencyInterp, EfficiencyLinear, EfficiencyDual, EfficiencyEmp
+};
+
+// Count based acquisition preset (preset type 1)
+enum CountPreset
+{
+    CountPresetNone, CountPresetArea, CountPresetIntegral, CountPresetCount
+};
+
+// Time based acquisition preset (preset type 2)
+enum TimePreset
+{
+    TimePresetNone, TimePresetReal, TimePresetLive
+};
+
+enum TimeUnit
+{
+    TimeUnitNone, TimeSeconds, TimeMinutes, TimeHours
+};
+
+// Strings first, then numbers, enums and flags, so the struct is not padded out
+// around every bool. Fields not in mca.xml keep their defaults, e.g. maxChannels is 0
+// until the MCA was probed (channelsProbed).
 struct Detector
 {
-    QString name;
-    bool enabled;
-    bool inUse;
-    int maxChannels;
-    int searchRegionStart;
-    int searchRegionEnd;
-    double significanceTreshold;
-    double tolerance;
-    int peakAreaRegionStart;
-    int peakAreaRegionEnd;
-    double continuum;
-    QString continuumFunction;
-    bool criticalLevelTest;
-    bool useFixedFWHM;
-    bool useFixedTailParameter;
-    bool fitSinglets;
-    bool displayROIs;
-    bool rejectZeroAreaPeaks;
-    double maxFWHMsBetweenPeaks;
-    double maxFWHMsForLeftLimit;
-    double maxFWHMsForRightLimit;
-    QString backgroundSubtract;
-    QString efficiencyCalibrationType;
-    QString presetType1;
-    QString presetType2;
-    double presetType1Value;    
-    int presetType1ChannelStart;
-    int presetType1ChannelEnd;
-    double presetType2Value;
-    QString presetType2Unit;
-    double randomError;
-    double systematicError;
-    int spectrumCounter;
-    QMap<QString, QString> beakers;
-    QString NIDLibrary;
-    double NIDConfidenceTreshold;
-    double MDAConfidenceFactor;
-    bool performMDATest;
-    bool inhibitATDCorrection;
-    bool useStoredLibrary;
+    QString name;                               // interned
+    QString backgroundSubtract;                 // interned
+    QString NIDLibrary;                         // interned
+    QMap<QString, QString> beakers;             // beaker name to calibration file, interned
+    double significanceTreshold = 0.0;
+    double tolerance = 0.0;
+    double continuum = 0.0;
+    double maxFWHMsBetweenPeaks = 0.0;
+    double maxFWHMsForLeftLimit = 0.0;
+    double maxFWHMsForRightLimit = 0.0;
+    double presetType1Value = 0.0;
+    double presetType2Value = 0.0;
+    double randomError = 0.0;
+    double systematicError = 0.0;
+    double NIDConfidenceTreshold = 0.0;
+    double MDAConfidenceFactor = 0.0;
+    int maxChannels = 0;
+    int searchRegionStart = 0;
+    int searchRegionEnd = 0;
+    int peakAreaRegionStart = 0;
+    int peakAreaRegionEnd = 0;
+    int presetType1ChannelStart = 0;
+    int presetType1ChannelEnd = 0;
+    int spectrumCounter = 0;
+    ContinuumFunction continuumFunction = ContinuumNone;
+    EfficiencyCalibration efficiencyCalibrationType = EfficiencyNone;
+    CountPreset presetType1 = CountPresetNone;
+    TimePreset presetType2 = TimePresetNone;
+    TimeUnit presetType2Unit = TimeUnitNone;
+    bool enabled = false;
+    bool inUse = false;
+    bool criticalLevelTest = false;
+    bool useFixedFWHM = false;
+    bool useFixedTailParameter = false;
+    bool fitSinglets = false;
+    bool displayROIs = false;
+    bool rejectZeroAreaPeaks = false;
+    bool performMDATest = false;
+    bool inhibitATDCorrection = false;
+    bool useStoredLibrary = false;
+    bool channelsProbed = false;                // maxChannels was read from the MCA
+};
+
+QString continuumFunctionName(ContinuumFunction function);
+ContinuumFunction continuumFunctionFromName(const QString& name);
+QString efficiencyCalibrationName(EfficiencyCalibration type);
+EfficiencyCalibration efficiencyCalibrationFromName(const QString& name);
+QString countPresetName(CountPreset preset);
+CountPreset countPresetFromName(const QString& name);
+QString timePresetName(TimePreset preset);
+TimePreset timePresetFromName(const QString& name);
+QString timeUnitName(TimeUnit unit);
+TimeUnit timeUnitFromName(const QString& name);
+
+// Returns a copy sharing its data with every other interned string of the same value.
+// Paths repeat across detectors (libraries, calibration files, backgrounds), interned
+// they are kept in memory once.
+QString internString(const QString& value);
+
+// Name to position in a detector list. Every hit is checked against the list and the
+// index is rebuilt when it no longer matches, e.g. after detectors were added.
+class DetectorIndex
+{
+public:
+
+    int find(const QList<Detector>& detectors, const QString& name);
+
+private:
+
+    QHash<QString, int> mRows;
+
+    void rebuild(const QList<Detector>& detectors);
 };
 
 #endif // DETECTOR_H
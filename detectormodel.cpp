@@ -0,0 +1,215 @@
+#include <iterator>
+#include "detectormodel.h"
+
+DetectorModel::DetectorModel(QObject *parent)
+    : QAbstractListModel(parent), mDetectors(NULL)
+{
+    // Both detector views share this model, let the view pick the pixmap matching its icon size
+    mIcon.addFile(":/Nailab/Resources/detector16.png");
+    mIcon.addFile(":/Nailab/Resources/detector64.png");
+}
+
+int DetectorModel::rowCount(const QModelIndex &parent) const
+{
+    if(parent.isValid() || !mDetectors)
+        return 0;
+    return mDetectors->count();
+}
+
+QVariant DetectorModel::data(const QModelIndex &index, int role) const
+{
+    if(!index.isValid() || !mDetectors || index.row() >= mDetectors->count())
+        return QVariant();
+
+    const Detector &detector = mDetectors->at(index.row());
+
+    switch(role)
+    {
+    case Qt::DisplayRole:
+        return detector.name;
+    case Qt::DecorationRole:
+        return mIcon;
+    case Qt::ToolTipRole:
+        switch(mStatus[index.row()])
+        {
+        case Busy:
+            return tr("Detector is busy");
+        case Offline:
+            return tr("Detector not found in Genie configuration");
+        default:
+            return tr("Detector is available");
+        }
+    case StatusRole:
+        return (int)mStatus[index.row()];
+    case InUseRole:
+        return detector.inUse;
+    }
+    return QVariant();
+}
+
+Qt::ItemFlags DetectorModel::flags(const QModelIndex &index) const
+{
+    if(!index.isValid())
+        return Qt::NoItemFlags;
+    return Qt::ItemIsEnabled | Qt::ItemIsSelectable;
+}
+
+void DetectorModel::setDetectors(QList<Detector> *detectors)
+{
+    beginResetModel();
+    mDetectors = detectors;
+    mStatus.fill(Available, mDetectors ? mDetectors->count() : 0);
+    endResetModel();
+}
+
+bool DetectorModel::appendDetector(const Detector &detector)
+{
+    if(!mDetectors)
+        return false;
+
+    int row = mDetectors->count();
+    beginInsertRows(QModelIndex(), row, row);
+    mDetectors->append(detector);
+    mStatus.append(Available);
+    endInsertRows();
+    return true;
+}
+
+void DetectorModel::detectorChanged(int row)
+{
+    if(row < 0 || row >= mStatus.count())
+        return;
+    QModelIndex idx = index(row);
+    emit dataChanged(idx, idx);
+}
+
+void DetectorModel::setStatus(int row, Status status)
+{
+    if(row < 0 || row >= mStatus.count() || mStatus[row] == status)
+        return;
+    mStatus[row] = status;
+    QModelIndex idx = index(row);
+    emit dataChanged(idx, idx);
+}
+
+DetectorModel::Status DetectorModel::status(int row) const
+{
+    return mStatus.value(row, Offline);
+}
+
+int DetectorModel::rowForName(const QString &name) const
+{
+    if(!mDetectors)
+        return -1;
+    for(int i=0; i<mDetectors->count(); i++)
+    {
+        if(mDetectors->at(i).name == name)
+            return i;
+    }
+    return -1;
+}
+
+Detector* DetectorModel::detectorAt(const QModelIndex &index) const
+{
+    if(!index.isValid() || !mDetectors || index.row() >= mDetectors->count())
+        return NULL;
+    return &(*mDetectors)[index.row()];
+}
+
+DetectorInUseFilter::DetectorInUseFilter(QObject *parent)
+    : QSortFilterProxyModel(parent)
+{
+    setDynamicSortFilter(true);
+}
+
+bool DetectorInUseFilter::filterAcceptsRow(int sourceRow, const QModelIndex &sourceParent) const
+{
+    QModelIndex idx = sourceModel()->index(sourceRow, 0, sourceParent);
+    return sourceModel()->data(idx, DetectorModel::InUseRole).toBool();
+}
+
+Qt::ItemFlags DetectorInUseFilter::flags(const QModelIndex &index) const
+{
+    // Busy and offline detectors are shown, but can not be selected for a new job
+    if(!index.isValid() || index.data(DetectorModel::StatusRole).toInt() != DetectorModel::Available)
+        return Qt::NoItemFlags;
+    return QSortFilterProxyModel::flags(index);
+}
+
+DetectorBeakerModel::DetectorBeakerModel(QObject *parent)
+    : QAbstractTableModel(parent), mDetector(NULL)
+{
+}
+
+int DetectorBeakerModel::rowCount(const QModelIndex &parent) const
+{
+    if(parent.isValid() || !mDetector)
+        return 0;
+    return mDetector->beakers.count();
+}
+
+int DetectorBeakerModel::columnCount(const QModelIndex &parent) const
+{
+    if(parent.isValid())
+        return 0;
+    return 2;
+}
+
+QVariant DetectorBeakerModel::data(const QModelIndex &index, int role) const
+{
+    if(!index.isValid() || !mDetector || role != Qt::DisplayRole || index.row() >= mDetector->beakers.count())
+        return QVariant();
+
+    QMap<QString, QString>::const_iterator iter = std::next(mDetector->beakers.constBegin(), index.row());
+    return index.column() == 0 ? iter.key() : iter.value();
+}
+
+void DetectorBeakerModel::setDetector(Detector *detector)
+{
+    beginResetModel();
+    mDetector = detector;
+    endResetModel();
+}
+
+void DetectorBeakerModel::setBeaker(const QString &beaker, const QString &calfile)
+{
+    if(!mDetector)
+        return;
+
+    QMap<QString, QString>::iterator iter = mDetector->beakers.lowerBound(beaker);
+    int row = std::distance(mDetector->beakers.begin(), iter);
+
+    if(iter != mDetector->beakers.end() && iter.key() == beaker)
+    {
+        iter.value() = calfile;
+        emit dataChanged(index(row, 1), index(row, 1));
+    }
+    else
+    {
+        beginInsertRows(QModelIndex(), row, row);
+        mDetector->beakers.insert(internString(beaker), internString(calfile));
+        endInsertRows();
+    }
+}
+
+void DetectorBeakerModel::removeBeaker(const QString &beaker)
+{
+    if(!mDetector)
+        return;
+
+    QMap<QString, QString>::iterator iter = mDetector->beakers.find(beaker);
+    if(iter == mDetector->beakers.end())
+        return;
+
+    int row = std::distance(mDetector->beakers.begin(), iter);
+    beginRemoveRows(QModelIndex(), row, row);
+    mDetector->beakers.erase(iter);
+    endRemoveRows();
+}
+
+QString DetectorBeakerModel::beakerAt(int row) const
+{
+    if(!mDetector || row < 0 || row >= mDetector->beakers.count())
+        return QString();
+    return std::next(mDetector->beakers.constBegin(), row).key();
+}
@@ -0,0 +1,101 @@
+#ifndef DETECTORMODEL_H
+#define DETECTORMODEL_H
+
+#include <QAbstractListModel>
+#include <QAbstractTableModel>
+#include <QSortFilterProxyModel>
+#include <QVector>
+#include <QString>
+#include <QIcon>
+#include "detector.h"
+
+class DetectorModel : public QAbstractListModel
+{
+    Q_OBJECT
+
+public:
+
+    enum Status
+    {
+        Available,
+        Busy,
+        Offline
+    };
+
+    enum Roles
+    {
+        StatusRole = Qt::UserRole + 1,
+        InUseRole
+    };
+
+    explicit DetectorModel(QObject *parent = 0);
+
+    int rowCount(const QModelIndex &parent = QModelIndex()) const;
+    QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const;
+    Qt::ItemFlags flags(const QModelIndex &index) const;
+
+    // Replaces the whole detector list, only used when the configuration is (re)loaded
+    void setDetectors(QList<Detector> *detectors);
+
+    // Appends to the detector list, which must not be appended to directly once it is
+    // set. False without a list.
+    bool appendDetector(const Detector &detector);
+
+    // Must be called after the configuration of an existing detector has been modified
+    void detectorChanged(int row);
+
+    void setStatus(int row, Status status);
+    Status status(int row) const;
+
+    int rowForName(const QString &name) const;
+    Detector* detectorAt(const QModelIndex &index) const;
+
+private:
+
+    QList<Detector> *mDetectors;
+    QVector<Status> mStatus;
+    QIcon mIcon;
+};
+
+class DetectorInUseFilter : public QSortFilterProxyModel
+{
+    Q_OBJECT
+
+public:
+
+    explicit DetectorInUseFilter(QObject *parent = 0);
+
+    Qt::ItemFlags flags(const QModelIndex &index) const;
+
+protected:
+
+    bool filterAcceptsRow(int sourceRow, const QModelIndex &sourceParent) const;
+};
+
+class DetectorBeakerModel : public QAbstractTableModel
+{
+    Q_OBJECT
+
+public:
+
+    explicit DetectorBeakerModel(QObject *parent = 0);
+
+    int rowCount(const QModelIndex &parent = QModelIndex()) const;
+    int columnCount(const QModelIndex &parent = QModelIndex()) const;
+    QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const;
+
+    void setDetector(Detector *detector);
+    Detector* detector() const { return mDetector; }
+
+    // Inserts or updates a beaker calibration, emitting only the affected row
+    void setBeaker(const QString &beaker, const QString &calfile);
+    void removeBeaker(const QString &beaker);
+
+    QString beakerAt(int row) const;
+
+private:
+
+    Detector *mDetector;
+};
+
+#endif // DETECTORMODEL_H
@@ -0,0 +1,596 @@
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QTextStream>
+#include <QRunnable>
+#include <QThread>
+#include <QMetaObject>
+#include <cmath>
+#include <limits>
+#include <algorithm>
+#include "driftmonitor.h"
+#include "reportparser.h"
+
+bool parsePeakReport(const QString& filename, QVector<DriftPeak>& peaks)
+{
+    peaks.clear();
+    QFile file(filename);
+    if(!file.open(QIODevice::ReadOnly | QIODevice::Text))
+        return false;
+
+    // Same layout as the nuclide table of the reports: dashed line, rows, blank line
+    QTextStream stream(&file);
+    bool table = false;
+    while(!stream.atEnd())
+    {
+        QString line = stream.readLine().trimmed();
+        if(!table)
+        {
+            table = line.startsWith("---");
+            continue;
+        }
+        if(line.isEmpty() || line.startsWith('*'))
+            break;
+
+        QStringList fields = line.split(' ', QString::SkipEmptyParts);
+        if(fields.count() < 5)
+            continue;
+
+        bool ok[5];
+        fields[0].toInt(&ok[0]);
+        DriftPeak peak;
+        peak.energy = fields[1].toDouble(&ok[1]);
+        peak.centroid = fields[2].toDouble(&ok[2]);
+        peak.fwhm = fields[3].toDouble(&ok[3]);
+        peak.area = fields[4].toDouble(&ok[4]);
+        if(ok[0] && ok[1] && ok[2] && ok[3] && ok[4])
+            peaks.append(peak);
+    }
+    return table;
+}
+
+QString peakTemplateFilename(const Settings& settings)
+{
+    return QDir::toNativeSeparators(settings.genieFolder + "/CTLFILES/NAIPEAKS.TPL");
+}
+
+QVector<double> defaultReferenceLines()
+{
+    QVector<double> lines;
+    lines << 351.93 << 609.31 << 661.66 << 1460.82 << 2614.51;
+    return lines;
+}
+
+bool fitDrift(const QVector<DriftPeak>& peaks, const QVector<double>& referenceLines, double tolerance,
+              double trackedEnergy, DriftPoint& point)
+{
+    point.peaks = 0;
+    point.offset = point.gain = 0.0;
+    point.shift = std::numeric_limits<double>::quiet_NaN();
+
+    // The largest peak near each line, with a window wide enough for a drift well past
+    // the tolerance; centroids are better the more counts and the narrower the peak
+    double s = 0.0, sx = 0.0, sxx = 0.0, sy = 0.0, sxy = 0.0;
+    foreach(double line, referenceLines)
+    {
+        double window = qMax(2.0 * tolerance, 0.04 * line);
+        int best = -1;
+        for(int i=0; i<peaks.count(); i++)
+        {
+            if(peaks[i].area > 0.0 && std::fabs(peaks[i].energy - line) <= window
+                    && (best < 0 || peaks[i].area > peaks[best].area))
+                best = i;
+        }
+        if(best < 0)
+            continue;
+
+        double w = peaks[best].area / qMax(1e-6, peaks[best].fwhm * peaks[best].fwhm);
+        double d = peaks[best].energy - line;
+        s += w;
+        sx += w * line;
+        sxx += w * line * line;
+        sy += w * d;
+        sxy += w * line * d;
+        point.peaks++;
+    }
+    if(point.peaks == 0)
+        return false;
+
+    // NaI drift is mostly gain, the offset needs lines spread over the spectrum
+    double det = s * sxx - sx * sx;
+    if(point.peaks >= 2 && det > 0.01 * s * sxx)
+    {
+        point.gain = (s * sxy - sx * sy) / det;
+        point.offset = (sy - point.gain * sx) / s;
+    }
+    else
+        point.gain = sxy / sxx;
+
+    point.shift = point.offset + point.gain * trackedEnergy;
+    return true;
+}
+
+DriftTrend::DriftTrend(double halfLifeDays)
+    : mDecay(std::log(2.0) / qMax(0.1, halfLifeDays))
+{
+    clear();
+}
+
+void DriftTrend::clear()
+{
+    mCount = 0;
+    mLast = QDateTime();
+    mW = mWt = mWtt = mWy = mWty = 0.0;
+}
+
+void DriftTrend::add(const QDateTime& time, double shift)
+{
+    // Moves the sums to the new point's time, so it sits at t = 0, and fades them
+    double dt = mLast.isValid() ? qMax<qint64>(0, mLast.msecsTo(time)) / 86400000.0 : 0.0;
+    double f = std::exp(-mDecay * dt);
+    mWtt = f * (mWtt - 2.0 * dt * mWt + dt * dt * mW);
+    mWt = f * (mWt - dt * mW);
+    mWty = f * (mWty - dt * mWy);
+    mW *= f;
+    mWy *= f;
+
+    mW += 1.0;
+    mWy += shift;
+    mCount++;
+    if(!mLast.isValid() || time > mLast)
+        mLast = time;
+}
+
+double DriftTrend::slope() const
+{
+    double det = mW * mWtt - mWt * mWt;
+    if(mCount < 3 || det <= 1e-12)
+        return 0.0;
+    return (mW * mWty - mWt * mWy) / det;
+}
+
+double DriftTrend::level() const
+{
+    if(mCount == 0)
+        return 0.0;
+    return (mWy - slope() * mWt) / mW;
+}
+
+// Every .CNF below the archive years of the detector
+static QStringList archivedSpectra(const QString& archiveDirectory, const QString& detectorName)
+{
+    QStringList spectra;
+    foreach(const QString& year, QDir(archiveDirectory).entryList(QDir::Dirs | QDir::NoDotAndDotDot, QDir::Name))
+    {
+        bool ok;
+        int y = year.toInt(&ok);
+        if(!ok)
+            continue;
+
+        // Stored jobs get upper case paths, see storeJob
+        QString path = archivePath(archiveDirectory, detectorName, y);
+        if(!QDir(path).exists())
+            path = path.toUpper();
+
+        foreach(const QFileInfo& info, QDir(path).entryInfoList(QStringList() << "*.CNF", QDir::Files, QDir::Name))
+            spectra << info.absoluteFilePath();
+    }
+    return spectra;
+}
+
+class DriftRunnable : public QRunnable
+{
+public:
+
+    DriftRunnable(DriftMonitor *monitor, DriftMonitor::DriftJob *job, int id)
+        : mMonitor(monitor), mJob(job), mId(id) {}
+
+    void run()
+    {
+        // Works through the backlog behind the jobs and the GUI. The job carries everything
+        // it needs, so the monitor can be reconfigured while the backlog runs
+        QThread::currentThread()->setPriority(QThread::LowPriority);
+        mMonitor->measure(*mJob, mId);
+        QMetaObject::invokeMethod(mMonitor, "onSpectrumDone", Qt::QueuedConnection, Q_ARG(int, mId));
+    }
+
+private:
+
+    DriftMonitor *mMonitor;
+    DriftMonitor::DriftJob *mJob;
+    int mId;
+};
+
+DriftMonitor::DriftMonitor(const QString& archiveDirectory, const QString& driftDirectory, const Settings& settings,
+                           JobRunner runner, QObject *parent)
+    : QObject(parent), mArchiveDirectory(archiveDirectory), mDriftDirectory(driftDirectory), mSettings(settings),
+      mRunner(runner), mReferenceLines(defaultReferenceLines()), mCancelled(0), mNextId(0),
+      mPending(0), mTotal(0), mDone(0), mFailed(0), mBacklog(false), mCheckTemplate(true)
+{
+}
+
+DriftMonitor::~DriftMonitor()
+{
+    cancel();
+    mPool.waitForDone();
+    qDeleteAll(mJobs);
+}
+
+void DriftMonitor::setDetectors(const QList<Detector>& detectors)
+{
+    mTolerances.clear();
+    foreach(const Detector& detector, detectors)
+        mTolerances.insert(detector.name, detector.tolerance);
+}
+
+void DriftMonitor::setSettings(const Settings& settings)
+{
+    mSettings = settings;
+}
+
+void DriftMonitor::setReferenceLines(const QVector<double>& energies)
+{
+    if(!energies.isEmpty())
+        mReferenceLines = energies;
+}
+
+double DriftMonitor::trackedEnergy(const QVector<double>& referenceLines)
+{
+    return *std::max_element(referenceLines.constBegin(), referenceLines.constEnd());
+}
+
+bool DriftMonitor::hasPeakTemplate() const
+{
+    return !mCheckTemplate || QFile::exists(peakTemplateFilename(mSettings));
+}
+
+bool DriftMonitor::start(int maxParallel)
+{
+    if(mBacklog)
+        return false;
+
+    // Every spectrum would fail without it, and be recorded as failed
+    if(!hasPeakTemplate())
+    {
+        qWarning("Drift monitor: %s not found", qPrintable(peakTemplateFilename(mSettings)));
+        return false;
+    }
+
+    // Stored jobs already being measured become part of the backlog
+    mCancelled.store(0);
+    if(!isRunning())
+    {
+        mTotal = mDone = mFailed = 0;
+        mTimer.start();
+    }
+    mPool.setMaxThreadCount(qMax(1, maxParallel));
+
+    mBacklog = true;
+    foreach(const QString& detectorName, mTolerances.keys())
+    {
+        History& history = load(detectorName);
+        foreach(const QString& spectrum, archivedSpectra(mArchiveDirectory, detectorName))
+        {
+            if(!history.spectra.contains(spectrum) && !mQueued.contains(spectrum))
+                queue(detectorName, spectrum);
+        }
+    }
+
+    if(mPending == 0)
+    {
+        mBacklog = false;
+        emit finished(0, 0, 0);
+    }
+    return true;
+}
+
+void DriftMonitor::cancel()
+{
+    mCancelled.store(1);
+}
+
+void DriftMonitor::addSpectrum(const QString& detectorName, const QString& spectrumFile)
+{
+    QString spectrum = QFileInfo(spectrumFile).absoluteFilePath();
+    if(!hasPeakTemplate() || load(detectorName).spectra.contains(spectrum) || mQueued.contains(spectrum))
+        return;
+
+    if(!isRunning())
+    {
+        mCancelled.store(0);
+        mTotal = mDone = mFailed = 0;
+        mTimer.start();
+    }
+    queue(detectorName, spectrum);
+}
+
+void DriftMonitor::queue(const QString& detectorName, const QString& spectrumFile)
+{
+    DriftJob *job = new DriftJob;
+    job->detectorName = detectorName;
+    job->tolerance = mTolerances.value(detectorName, 0.0);
+    job->templateFilename = peakTemplateFilename(mSettings);
+    job->referenceLines = mReferenceLines;
+    job->point.spectrum = spectrumFile;
+    job->point.peaks = 0;
+    job->point.offset = job->point.gain = 0.0;
+    job->point.shift = std::numeric_limits<double>::quiet_NaN();
+
+    int id = mNextId++;
+    mJobs.insert(id, job);
+    mQueued.insert(spectrumFile);
+    mPending++;
+    mTotal++;
+    mPool.start(new DriftRunnable(this, job, id));
+}
+
+bool DriftMonitor::measure(DriftJob& job, int id)
+{
+    if(mCancelled.load())
+    {
+        job.error = "Cancelled";
+        return false;
+    }
+
+    ReportParser parser;
+    ReportResult result;
+    QString report = QFileInfo(job.point.spectrum).absolutePath() + "/" + QFileInfo(job.point.spectrum).completeBaseName() + ".RPT";
+    if(parser.parseFile(report, result) && result.acquisitionStarted.isValid())
+        job.point.time = result.acquisitionStarted;
+    else
+        job.point.time = QFileInfo(job.point.spectrum).lastModified();
+
+    // Only a spectrum that cannot be read at all is recorded as failed, see onSpectrumDone
+    QFileInfo spectrumInfo(job.point.spectrum);
+    if(!spectrumInfo.isReadable() || spectrumInfo.size() == 0)
+    {
+        job.point.peaks = -1;
+        job.error = "Unable to read " + job.point.spectrum;
+        return false;
+    }
+
+    QString workDirectory = mDriftDirectory + "WORK/";
+    if(!QDir().mkpath(workDirectory))
+    {
+        job.error = "Unable to create " + workDirectory;
+        return false;
+    }
+
+    // Only reads the peaks stored in the spectrum, the archived file is left as it is
+    QString baseFilename = QDir::toNativeSeparators(workDirectory + QString::number(id) + "_"
+                                                    + QFileInfo(job.point.spectrum).completeBaseName());
+    QFile script(baseFilename + ".BAT");
+    if(!script.open(QIODevice::WriteOnly | QIODevice::Text | QIODevice::Truncate))
+    {
+        job.error = "Unable to write " + script.fileName();
+        return false;
+    }
+    QTextStream stream(&script);
+    startJobCommand(stream, "report");
+    addJobParamQuoted(stream, "", QDir::toNativeSeparators(job.point.spectrum));
+    addJobParamQuoted(stream, "/template=", job.templateFilename);
+    addJobParamSingle(stream, "/newfile");
+    addJobParamQuoted(stream, "/outfile=", baseFilename + ".PKS");
+    addJobParamQuoted(stream, "/section=", "");
+    endJobCommand(stream);
+    stream.flush();
+    script.close();
+
+    QFile::remove(baseFilename + ".PKS");
+    QVector<DriftPeak> peaks;
+    if(!mRunner(jobCommandLine(baseFilename)) || !parsePeakReport(baseFilename + ".PKS", peaks))
+    {
+        // Genie or the report may fail for reasons of their own, the spectrum is tried again next time
+        job.error = "Peak report failed, see " + baseFilename + ".ERR";
+        return false;
+    }
+
+    // A spectrum without reference peaks is kept in the history, so it is not measured again
+    fitDrift(peaks, job.referenceLines, job.tolerance, trackedEnergy(job.referenceLines), job.point);
+
+    QStringList suffixes;
+    suffixes << ".BAT" << ".OUT" << ".ERR" << ".PKS";
+    foreach(const QString& suffix, suffixes)
+        QFile::remove(baseFilename + suffix);
+    return true;
+}
+
+// <ISO time> <peaks> <offset> <gain> <shift> <spectrum>, tab separated, "-" for no fit
+DriftMonitor::History& DriftMonitor::load(const QString& detectorName)
+{
+    History& history = mHistories[detectorName];
+    if(history.loaded)
+        return history;
+    history.loaded = true;
+
+    QFile file(mDriftDirectory + detectorName + ".DRF");
+    if(file.open(QIODevice::ReadOnly | QIODevice::Text))
+    {
+        QTextStream stream(&file);
+        while(!stream.atEnd())
+        {
+            QStringList fields = stream.readLine().split('\t');
+            if(fields.count() != 6)
+                continue;
+
+            DriftPoint point;
+            point.time = QDateTime::fromString(fields[0], Qt::ISODate);
+            point.peaks = fields[1].toInt();
+            point.offset = fields[2].toDouble();
+            point.gain = fields[3].toDouble();
+            bool ok;
+            point.shift = fields[4].toDouble(&ok);
+            if(!ok)
+                point.shift = std::numeric_limits<double>::quiet_NaN();
+            point.spectrum = fields[5];
+            if(!point.time.isValid())
+                continue;
+
+            history.points.append(point);
+            history.spectra.insert(point.spectrum);
+        }
+        file.close();
+    }
+
+    std::stable_sort(history.points.begin(), history.points.end(), [](const DriftPoint& a, const DriftPoint& b)
+    {
+        return a.time < b.time;
+    });
+    foreach(const DriftPoint& point, history.points)
+    {
+        if(point.peaks > 0)
+            history.trend.add(point.time, point.shift);
+    }
+    return history;
+}
+
+bool DriftMonitor::append(const QString& detectorName, const DriftPoint& point)
+{
+    History& history = load(detectorName);
+
+    if(!QDir().mkpath(mDriftDirectory))
+        return false;
+    QFile file(mDriftDirectory + detectorName + ".DRF");
+    if(!file.open(QIODevice::WriteOnly | QIODevice::Append | QIODevice::Text))
+        return false;
+
+    QTextStream stream(&file);
+    stream << point.time.toString(Qt::ISODate) << '\t' << point.peaks << '\t'
+           << QString::number(point.offset, 'g', 8) << '\t' << QString::number(point.gain, 'g', 8) << '\t'
+           << (point.peaks > 0 ? QString::number(point.shift, 'g', 8) : QString("-")) << '\t' << point.spectrum << '\n';
+    stream.flush();
+    if(file.error() != QFile::NoError)
+        return false;
+    file.close();
+
+    // Backlog results come in any order, the trend is only rebuilt for a point in the past
+    history.spectra.insert(point.spectrum);
+    if(history.points.isEmpty() || point.time >= history.points.last().time)
+    {
+        history.points.append(point);
+        if(point.peaks > 0)
+            history.trend.add(point.time, point.shift);
+    }
+    else
+    {
+        QVector<DriftPoint>::iterator pos = std::upper_bound(history.points.begin(), history.points.end(), point,
+                                                             [](const DriftPoint& a, const DriftPoint& b) { return a.time < b.time; });
+        history.points.insert(pos, point);
+        history.trend.clear();
+        foreach(const DriftPoint& p, history.points)
+        {
+            if(p.peaks > 0)
+                history.trend.add(p.time, p.shift);
+        }
+    }
+    return true;
+}
+
+const QVector<DriftPoint>& DriftMonitor::history(const QString& detectorName)
+{
+    return load(detectorName).points;
+}
+
+DriftStatus DriftMonitor::status(const QString& detectorName)
+{
+    History& history = load(detectorName);
+    double tolerance = mTolerances.value(detectorName, 0.0);
+
+    DriftStatus status;
+    status.points = history.trend.count();
+    status.shift = history.trend.level();
+    status.slope = history.trend.slope();
+    status.daysToTolerance = -1.0;
+    status.gainCorrection = 1.0;
+    status.alert = DriftStatus::AlertNone;
+
+    for(int i=history.points.count() - 1; i>=0; i--)
+    {
+        if(history.points[i].peaks > 0)
+        {
+            status.gainCorrection = 1.0 / (1.0 + history.points[i].gain);
+            break;
+        }
+    }
+
+    if(status.points == 0 || tolerance <= 0.0)
+        return status;
+
+    double distance = std::fabs(status.shift);
+    if(distance >= tolerance)
+        status.daysToTolerance = 0.0;
+    else if(status.slope != 0.0 && status.slope * status.shift >= 0.0)
+        status.daysToTolerance = (tolerance - distance) / std::fabs(status.slope);
+
+    // Warns at half the tolerance, or two weeks before the trend gets there
+    if(distance >= tolerance)
+        status.alert = DriftStatus::AlertRecalibrate;
+    else if(distance >= 0.5 * tolerance || (status.daysToTolerance >= 0.0 && status.daysToTolerance <= 14.0))
+        status.alert = DriftStatus::AlertWarning;
+    return status;
+}
+
+QString DriftMonitor::describe(const QString& detectorName)
+{
+    DriftStatus s = status(detectorName);
+    if(s.points == 0)
+        return QString("%1: no reference peaks measured").arg(detectorName);
+
+    QString text = QString("%1: shift %2 keV at %3 keV (tolerance %4), %5 keV/day")
+            .arg(detectorName).arg(s.shift, 0, 'f', 2).arg(trackedEnergy(), 0, 'f', 1)
+            .arg(mTolerances.value(detectorName, 0.0)).arg(s.slope, 0, 'f', 3);
+    if(s.daysToTolerance > 0.0)
+        text += QString(", tolerance reached in %1 days").arg(s.daysToTolerance, 0, 'f', 0);
+    if(s.alert != DriftStatus::AlertNone)
+        text += QString(". Recalibrate the energy, or adjust the fine gain by a factor %1").arg(s.gainCorrection, 0, 'f', 4);
+    return text;
+}
+
+void DriftMonitor::checkAlert(const QString& detectorName)
+{
+    History& history = load(detectorName);
+    int alert = status(detectorName).alert;
+    if(alert > history.alert)
+        emit driftAlert(detectorName, alert, describe(detectorName));
+    // Lower again after a recalibration, so the next drift is reported
+    history.alert = alert;
+}
+
+void DriftMonitor::onSpectrumDone(int id)
+{
+    DriftJob *job = mJobs.take(id);
+    if(!job)
+        return;
+    mPending--;
+    mQueued.remove(job->point.spectrum);
+
+    // An unreadable spectrum is kept in the history as well, so the backlog does not try
+    // it again at every start
+    if((job->error.isEmpty() || job->point.peaks < 0) && !append(job->detectorName, job->point))
+        job->error = "Unable to write " + mDriftDirectory + job->detectorName + ".DRF";
+
+    if(job->error.isEmpty())
+        mDone++;
+    else
+    {
+        mFailed++;
+        emit spectrumFailed(job->point.spectrum, job->error);
+    }
+    emit progress(mDone, mFailed, mTotal);
+
+    // Old spectra of the backlog only count once the whole history is in
+    if(!mBacklog && job->error.isEmpty())
+        checkAlert(job->detectorName);
+
+    if(mPending == 0)
+    {
+        if(mBacklog)
+        {
+            mBacklog = false;
+            foreach(const QString& detectorName, mHistories.keys())
+                checkAlert(detectorName);
+        }
+        emit finished(mDone, mFailed, mTimer.elapsed());
+    }
+    delete job;
+}
@@ -0,0 +1,194 @@
+#ifndef DRIFTMONITOR_H
+#define DRIFTMONITOR_H
+
+#include <QObject>
+#include <QString>
+#include <QStringList>
+#include <QDateTime>
+#include <QVector>
+#include <QMap>
+#include <QSet>
+#include <QThreadPool>
+#include <QElapsedTimer>
+#include <QAtomicInt>
+#include "settings.h"
+#include "detector.h"
+#include "jobutils.h"
+
+// Energy calibration drift of the detectors, measured on every archived spectrum. The
+// peaks found by peak_dif are already in the spectrum, a Genie report with the peak
+// template (peakTemplateFilename) lists them without touching the archived file. Peaks
+// near the reference lines give the calibration shift, measured = reference * (1 + gain)
+// + offset, and the shift at the highest reference line is followed per detector until
+// it gets close to the detector's peak tolerance.
+
+// One row of the peak list, the table after the dashed line:
+// <peak> <energy keV> <centroid channel> <FWHM keV> <net area> ...
+struct DriftPeak
+{
+    double energy;
+    double centroid;
+    double fwhm;
+    double area;
+};
+
+bool parsePeakReport(const QString& filename, QVector<DriftPeak>& peaks);
+
+// <Genie folder>/CTLFILES/NAIPEAKS.TPL
+QString peakTemplateFilename(const Settings& settings);
+
+// K-40, Tl-208, Bi-214, Cs-137 and Pb-214, present in most NaI spectra
+QVector<double> defaultReferenceLines();
+
+struct DriftPoint
+{
+    QDateTime time;         // acquisition start
+    QString spectrum;       // archived .CNF
+    int peaks;              // reference lines matched, the fit is empty without any;
+                            // -1 if the spectrum itself could not be read
+    double offset;          // keV
+    double gain;            // relative
+    double shift;           // keV at the tracked energy
+};
+
+// Fits the shift of the peaks matched to the reference lines, weighted by peak area over
+// FWHM squared. A single line, or lines too close together, only give the gain.
+bool fitDrift(const QVector<DriftPeak>& peaks, const QVector<double>& referenceLines, double tolerance,
+              double trackedEnergy, DriftPoint& point);
+
+// Level and slope of the shift over time, least squares with older points fading out
+// with the given half-life. Each point is O(1), points have to come in time order.
+class DriftTrend
+{
+public:
+
+    explicit DriftTrend(double halfLifeDays = 14.0);
+
+    void clear();
+    void add(const QDateTime& time, double shift);
+
+    int count() const { return mCount; }
+    double level() const;           // keV at the last point
+    double slope() const;           // keV per day
+
+private:
+
+    double mDecay;                  // per day
+    int mCount;
+    QDateTime mLast;
+    double mW, mWt, mWtt, mWy, mWty;    // times in days before the last point
+};
+
+struct DriftStatus
+{
+    enum Alert { AlertNone, AlertWarning, AlertRecalibrate };
+
+    int points;
+    double shift;               // keV, trend level
+    double slope;               // keV per day
+    double daysToTolerance;     // negative if the shift is not heading for the tolerance
+    double gainCorrection;      // fine gain factor that would take the last shift out
+    Alert alert;
+};
+
+// Measures archived spectra on its own thread pool and keeps the history of each detector
+// in <drift directory>/<detector>.DRF. start() measures every spectrum not in a history
+// yet, addSpectrum one stored job; both do nothing without the peak template. Signals
+// arrive in the thread the monitor lives in, which needs an event loop.
+class DriftMonitor : public QObject
+{
+    Q_OBJECT
+
+public:
+
+    DriftMonitor(const QString& archiveDirectory, const QString& driftDirectory, const Settings& settings,
+                 JobRunner runner, QObject *parent = 0);
+    ~DriftMonitor();
+
+    // Used for spectra queued from then on
+    void setDetectors(const QList<Detector>& detectors);
+    void setSettings(const Settings& settings);
+    void setReferenceLines(const QVector<double>& energies);
+    // Whether start and addSpectrum look for the peak template, not with the simulated runner
+    void setCheckTemplate(bool checkTemplate) { mCheckTemplate = checkTemplate; }
+
+    bool start(int maxParallel);
+    void cancel();
+    bool isRunning() const { return mPending > 0; }
+
+    QStringList detectors() const { return mHistories.keys(); }
+    const QVector<DriftPoint>& history(const QString& detectorName);
+    DriftStatus status(const QString& detectorName);
+    QString describe(const QString& detectorName);
+
+public slots:
+
+    void addSpectrum(const QString& detectorName, const QString& spectrumFile);
+
+signals:
+
+    void progress(int done, int failed, int total);
+    void spectrumFailed(const QString& spectrumFile, const QString& error);
+    void finished(int done, int failed, qint64 msecs);
+    // The alert of a detector went up, message proposes what to do about it
+    void driftAlert(const QString& detectorName, int alert, const QString& message);
+
+private slots:
+
+    void onSpectrumDone(int id);
+
+private:
+
+    friend class DriftRunnable;
+
+    struct DriftJob
+    {
+        QString detectorName;
+        double tolerance;
+        QString templateFilename;
+        QVector<double> referenceLines;
+        DriftPoint point;
+        QString error;
+    };
+
+    struct History
+    {
+        bool loaded;
+        QVector<DriftPoint> points;     // time order
+        QSet<QString> spectra;
+        DriftTrend trend;
+        int alert;
+        History() : loaded(false), alert(DriftStatus::AlertNone) {}
+    };
+
+    QString mArchiveDirectory;
+    QString mDriftDirectory;
+    Settings mSettings;
+    JobRunner mRunner;
+    QMap<QString, double> mTolerances;
+    QVector<double> mReferenceLines;
+    QMap<QString, History> mHistories;
+    QMap<int, DriftJob*> mJobs;
+    QSet<QString> mQueued;
+    QThreadPool mPool;
+    QElapsedTimer mTimer;
+    QAtomicInt mCancelled;
+    int mNextId;
+    int mPending, mTotal, mDone, mFailed;
+    bool mBacklog;
+    bool mCheckTemplate;
+
+    DriftMonitor(const DriftMonitor&);
+    DriftMonitor& operator = (const DriftMonitor&);
+
+    bool hasPeakTemplate() const;
+    History& load(const QString& detectorName);
+    void queue(const QString& detectorName, const QString& spectrumFile);
+    bool measure(DriftJob& job, int id);
+    bool append(const QString& detectorName, const DriftPoint& point);
+    void checkAlert(const QString& detectorName);
+    double trackedEnergy() const { return trackedEnergy(mReferenceLines); }
+    static double trackedEnergy(const QVector<double>& referenceLines);
+};
+
+#endif // DRIFTMONITOR_H
@@ -0,0 +1,588 @@
+#include <QLocalServer>
+#include <QLocalSocket>
+#include <QTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QRunnable>
+#include <QJsonDocument>
+#include <QJsonValue>
+#include <QVariant>
+#include <qmath.h>
+#include "jobapi.h"
+#include "dbutils.h"
+#include "metrics.h"
+#include "preflight.h"
+
+// Closed and failed jobs stay queryable for a day, and at most this many of them
+static const int closedJobRetentionSecs = 24 * 3600;
+static const int closedJobRetentionCount = 1000;
+
+class ApiJobRunnable : public QRunnable
+{
+public:
+
+    ApiJobRunnable(JobRunner runner, const QString& baseFilename, const QString& detectorName)
+        : mRunner(runner), mBaseFilename(baseFilename), mDetectorName(detectorName) {}
+
+    void run() { runMeasuredJob(mRunner, mBaseFilename, mDetectorName); }
+
+private:
+
+    JobRunner mRunner;
+    QString mBaseFilename;
+    QString mDetectorName;
+};
+
+JobApiServer::JobApiServer(const QString& tempDirectory, const Settings& settings, const QString& username,
+                           JobRunner runner, QObject *parent)
+    : QObject(parent), mTempDirectory(tempDirectory), mUsername(username), mSettings(settings),
+      mRunner(runner), mCheckFiles(true), mPolicy(ScheduleMakespan), mServer(NULL), mDispatchTimer(NULL), mNextId(1)
+{
+    qRegisterMetaType<Detector>("Detector");
+    qRegisterMetaType<QList<Detector> >("QList<Detector>");
+    qRegisterMetaType<Settings>("Settings");
+}
+
+JobApiServer::~JobApiServer()
+{
+    stop();
+    mPool.waitForDone();
+}
+
+void JobApiServer::start(const QString& name)
+{
+    // Created here and not in the constructor so the server belongs to the API thread
+    mServer = new QLocalServer(this);
+    connect(mServer, SIGNAL(newConnection()), this, SLOT(onNewConnection()));
+
+    QLocalServer::removeServer(name);
+    if(!mServer->listen(name))
+    {
+        qWarning("Unable to start job API server %s: %s", qPrintable(name), qPrintable(mServer->errorString()));
+        emit started(false);
+        return;
+    }
+
+    // Durations of the last three months, finished jobs are added as they come in
+    if(!mArchiveDirectory.isEmpty())
+    {
+        QDateTime now = QDateTime::currentDateTime();
+        loadDurationModel(mArchiveDirectory, now.addDays(-90), now, mModel);
+    }
+
+    mDispatchTimer = new QTimer(this);
+    connect(mDispatchTimer, SIGNAL(timeout()), this, SLOT(onDispatch()));
+    mDispatchTimer->start(250);
+
+    emit started(true);
+}
+
+void JobApiServer::stop()
+{
+    if(mDispatchTimer)
+        mDispatchTimer->stop();
+    if(mServer)
+        mServer->close();
+}
+
+void JobApiServer::setDetectors(const QList<Detector>& detectors)
+{
+    mDetectors = detectors;
+    mPool.setMaxThreadCount(qMax(mDetectors.count(), 1));
+}
+
+void JobApiServer::setSettings(const Settings& settings)
+{
+    mSettings = settings;
+    // A job written before this would have cached a template with the old settings
+    invalidateJobTemplates();
+}
+
+void JobApiServer::setPoweredOff(const QStringList& detectors)
+{
+    mPoweredOff = detectors.toSet();
+}
+
+void JobApiServer::onNewConnection()
+{
+    while(mServer->hasPendingConnections())
+    {
+        QLocalSocket *socket = mServer->nextPendingConnection();
+        connect(socket, SIGNAL(readyRead()), this, SLOT(onReadyRead()));
+        connect(socket, SIGNAL(disconnected()), this, SLOT(onDisconnected()));
+        mBuffers.insert(socket, QByteArray());
+    }
+}
+
+void JobApiServer::onReadyRead()
+{
+    QLocalSocket *socket = qobject_cast<QLocalSocket*>(sender());
+    if(!socket)
+        return;
+
+    QByteArray& buffer = mBuffers[socket];
+    buffer.append(socket->readAll());
+
+    bool submitted = false;
+    int eol;
+    while((eol = buffer.indexOf('\n')) >= 0)
+    {
+        QByteArray line = buffer.left(eol).trimmed();
+        buffer.remove(0, eol + 1);
+        if(line.isEmpty())
+            continue;
+
+        QJsonObject response;
+        QJsonParseError error;
+        QJsonDocument doc = QJsonDocument::fromJson(line, &error);
+        if(error.error != QJsonParseError::NoError || !doc.isObject())
+        {
+            response["ok"] = false;
+            response["error"] = QString("Invalid request: ") + error.errorString();
+        }
+        else
+        {
+            QJsonObject request = doc.object();
+            submitted |= request["cmd"].toString() == "submit";
+            response = handleRequest(request);
+        }
+
+        socket->write(QJsonDocument(response).toJson(QJsonDocument::Compact));
+        socket->write("\n");
+    }
+
+    // Start what can be started right away instead of waiting for the next tick
+    if(submitted)
+        onDispatch();
+}
+
+void JobApiServer::onDisconnected()
+{
+    QLocalSocket *socket = qobject_cast<QLocalSocket*>(sender());
+    if(!socket)
+        return;
+
+    mBuffers.remove(socket);
+    socket->deleteLater();
+}
+
+QJsonObject JobApiServer::handleRequest(const QJsonObject& request)
+{
+    QString cmd = request["cmd"].toString();
+
+    if(cmd == "submit")
+        return submit(request["samples"].toArray());
+    else if(cmd == "detectors")
+        return detectors();
+    else if(cmd == "job")
+        return job((qint64)request["id"].toDouble());
+    else if(cmd == "result")
+        return result((qint64)request["id"].toDouble());
+
+    QJsonObject response;
+    response["ok"] = false;
+    response["error"] = "Unknown command: " + cmd;
+    return response;
+}
+
+QJsonObject JobApiServer::submit(const QJsonArray& samples)
+{
+    QJsonArray accepted, rejected;
+
+    for(int i=0; i<samples.count(); i++)
+    {
+        QJsonObject sample = samples[i].toObject();
+        SampleInput sampleInput;
+        qint64 id = 0;
+
+        QString error;
+        for(QJsonObject::const_iterator iter = sample.constBegin(); iter != sample.constEnd(); ++iter)
+        {
+            if(!setSampleInputField(sampleInput, iter.key(), iter.value().toVariant().toString()))
+            {
+                error = "Unknown sample field: " + iter.key();
+                break;
+            }
+        }
+
+        if(error.isEmpty())
+            id = enqueue(sampleInput, QString(), error);
+
+        if(!id)
+        {
+            QJsonObject r;
+            r["index"] = i;
+            r["error"] = error;
+            rejected.append(r);
+            continue;
+        }
+
+        QJsonObject a;
+        a["index"] = i;
+        a["id"] = (double)id;
+        accepted.append(a);
+    }
+
+    QJsonObject response;
+    response["ok"] = rejected.isEmpty();
+    response["accepted"] = accepted;
+    response["rejected"] = rejected;
+    response["queued"] = mQueue.count();
+    return response;
+}
+
+qint64 JobApiServer::enqueue(const SampleInput& sampleInput, const QString& sourceFile, QString& error)
+{
+    if(!sampleInput.detector.isEmpty() && !findDetector(sampleInput.detector))
+    {
+        error = "Unknown detector: " + sampleInput.detector;
+        return 0;
+    }
+
+    if(!selectDetector(sampleInput))
+    {
+        error = "No detector in use has a calibration for geometry '" + sampleInput.geometry + "'";
+        return 0;
+    }
+
+    ApiJob job;
+    job.id = mNextId++;
+    job.sampleInput = sampleInput;
+    job.sourceFile = sourceFile;
+    job.state = Queued;
+    job.queuedAt = QDateTime::currentDateTime();
+    job.duration = job.liveTime = 0.0;
+    mJobs.insert(job.id, job);
+    mQueue.enqueue(job.id);
+    return job.id;
+}
+
+int JobApiServer::queuedCount() const
+{
+    return mQueue.count();
+}
+
+int JobApiServer::detectorsInUse() const
+{
+    int count = 0;
+    foreach(const Detector& detector, mDetectors)
+    {
+        if(detector.inUse)
+            count++;
+    }
+    return count;
+}
+
+QJsonObject JobApiServer::detectors()
+{
+    QJsonArray list;
+    foreach(const Detector& detector, mDetectors)
+    {
+        QJsonObject d;
+        d["name"] = detector.name;
+        d["inUse"] = detector.inUse;
+
+        QString state = "idle";
+        if(detectorHasFinishedJob(mTempDirectory, detector.name))
+            state = "finished";
+        else if(detectorHasJob(mTempDirectory, detector.name))
+            state = "running";
+        d["state"] = state;
+        d["beakers"] = QJsonArray::fromStringList(detector.beakers.keys());
+        list.append(d);
+    }
+
+    QJsonObject response;
+    response["ok"] = true;
+    response["detectors"] = list;
+    response["queued"] = mQueue.count();
+    return response;
+}
+
+QJsonObject JobApiServer::job(qint64 id)
+{
+    QJsonObject response;
+    if(!mJobs.contains(id))
+    {
+        response["ok"] = false;
+        response["error"] = "Unknown job: " + QString::number(id);
+        return response;
+    }
+
+    const ApiJob& j = mJobs[id];
+    response["ok"] = true;
+    response["id"] = (double)j.id;
+    response["state"] = stateName(j.state);
+    response["detector"] = j.detector;
+    if(!j.error.isEmpty())
+        response["error"] = j.error;
+    return response;
+}
+
+QJsonObject JobApiServer::result(qint64 id)
+{
+    QJsonObject response = job(id);
+    if(!response["ok"].toBool())
+        return response;
+
+    const ApiJob& j = mJobs[id];
+    if(j.state != Finished)
+    {
+        response["ok"] = false;
+        response["error"] = "Job has no result available, state is " + stateName(j.state);
+        return response;
+    }
+
+    QFile report(mTempDirectory + j.detector + ".RPT");
+    if(!report.open(QIODevice::ReadOnly | QIODevice::Text))
+    {
+        response["ok"] = false;
+        response["error"] = "Unable to open report: " + report.fileName();
+        return response;
+    }
+    response["report"] = QString::fromLocal8Bit(report.readAll());
+    report.close();
+    return response;
+}
+
+void JobApiServer::onDispatch()
+{
+    // Track jobs started by the API until the operator stores or rejects them
+    QMap<QString, qint64>::iterator iter = mActive.begin();
+    while(iter != mActive.end())
+    {
+        ApiJob& j = mJobs[iter.value()];
+        if(j.state == Running && detectorHasFinishedJob(mTempDirectory, j.detector))
+        {
+            j.state = Finished;
+            ReportParser parser;
+            ReportResult result;
+            if(parser.parseFile(mTempDirectory + j.detector + ".RPT", result))
+                mModel.addReport(result);
+            emit jobFinished(j.detector);
+        }
+
+        if(!detectorHasJob(mTempDirectory, j.detector))
+        {
+            if(j.state == Running)
+            {
+                j.state = Failed;
+                j.error = "Job files removed before the job finished";
+            }
+            else
+                j.state = Closed;
+            j.closedAt = QDateTime::currentDateTime();
+            iter = mActive.erase(iter);
+        }
+        else
+            ++iter;
+    }
+
+    // Check detector files once per tick, not once per queued sample
+    QDateTime now = QDateTime::currentDateTime();
+    if(!mPrunedAt.isValid() || mPrunedAt.secsTo(now) >= 60)
+        pruneJobs(now);
+
+    if(mQueue.isEmpty())
+        return;
+
+    QList<ScheduleDetector> detectors;
+    bool anyFree = false;
+    for(int i=0; i<mDetectors.count(); i++)
+    {
+        const Detector& detector = mDetectors[i];
+        detectors << scheduleDetector(detector, !mPoweredOff.contains(detector.name), expectedFreeAt(detector, now));
+        if(detectors[i].available && detectors[i].freeAt <= 0.0)
+            anyFree = true;
+    }
+    if(!anyFree)
+        return;
+
+    // The whole queue is planned, only the samples planned on a free detector start now.
+    // A sample may wait for a busy detector when it would still finish earlier there.
+    QList<ScheduleSample> samples;
+    for(int i=0; i<mQueue.count(); i++)
+        samples << scheduleSample(mJobs[mQueue[i]].sampleInput);
+    QList<ScheduleAssignment> plan;
+    scheduleSamples(samples, detectors, mModel, mPolicy, plan);
+
+    QList<qint64> queue = mQueue;
+    for(int i=0; i<plan.count(); i++)
+    {
+        const ScheduleAssignment& assignment = plan[i];
+        if(assignment.detector < 0 || assignment.start > 0.0 || detectors[assignment.detector].freeAt > 0.0)
+            continue;
+
+        ApiJob& j = mJobs[queue[i]];
+        mQueue.removeOne(j.id);
+        j.duration = assignment.finish - assignment.start;
+        j.liveTime = mModel.hasMDAReference(samples[i], detectors[assignment.detector]) ? assignment.liveTime : 0.0;
+
+        QString error;
+        if(!startJob(j, mDetectors[assignment.detector], error))
+        {
+            j.state = Failed;
+            j.error = error;
+            j.closedAt = QDateTime::currentDateTime();
+            emit jobFailed(j.id, j.sourceFile);
+        }
+    }
+}
+
+void JobApiServer::pruneJobs(const QDateTime& now)
+{
+    // Job ids only grow, so the oldest closed jobs come first
+    mPrunedAt = now;
+    QList<qint64> closed;
+    for(QMap<qint64, ApiJob>::const_iterator iter = mJobs.constBegin(); iter != mJobs.constEnd(); ++iter)
+    {
+        if(iter.value().state == Closed || iter.value().state == Failed)
+            closed << iter.key();
+    }
+
+    int excess = closed.count() - closedJobRetentionCount;
+    for(int i=0; i<closed.count(); i++)
+    {
+        if(i < excess || mJobs[closed[i]].closedAt.secsTo(now) >= closedJobRetentionSecs)
+            mJobs.remove(closed[i]);
+    }
+}
+
+double JobApiServer::expectedFreeAt(const Detector& detector, const QDateTime& now) const
+{
+    // Seconds until the detector is expected to be free, finished jobs wait for the operator
+    if(mActive.contains(detector.name))
+    {
+        const ApiJob& j = mJobs[mActive[detector.name]];
+        if(j.state != Running)
+            return mModel.overhead();
+        return qMax(1.0, j.duration - j.startedAt.msecsTo(now) / 1000.0);
+    }
+
+    if(!detectorHasJob(mTempDirectory, detector.name))
+        return 0.0;
+    if(detectorHasFinishedJob(mTempDirectory, detector.name))
+        return mModel.overhead();
+
+    // Started from the GUI, assume the detector's default count
+    ScheduleSample sample;
+    sample.mda = 0.0;
+    sample.preset = TimePresetNone;
+    sample.presetValue = 0.0;
+    ScheduleDetector d = scheduleDetector(detector);
+    QDateTime started = QFileInfo(mTempDirectory + detector.name + ".BAT").lastModified();
+    return qMax(1.0, mModel.duration(sample, d) - started.msecsTo(now) / 1000.0);
+}
+
+const Detector* JobApiServer::findDetector(const QString& name) const
+{
+    for(int i=0; i<mDetectors.count(); i++)
+    {
+        if(mDetectors[i].name.compare(name, Qt::CaseInsensitive) == 0)
+            return &mDetectors[i];
+    }
+    return NULL;
+}
+
+const Detector* JobApiServer::selectDetector(const SampleInput& sampleInput) const
+{
+    for(int i=0; i<mDetectors.count(); i++)
+    {
+        const Detector& detector = mDetectors[i];
+        if(!detector.inUse || !detector.beakers.contains(sampleInput.geometry))
+            continue;
+        if(!sampleInput.detector.isEmpty() && detector.name.compare(sampleInput.detector, Qt::CaseInsensitive) != 0)
+            continue;
+        return &detector;
+    }
+    return NULL;
+}
+
+bool JobApiServer::startJob(ApiJob& job, const Detector& detector, QString& error)
+{
+    SampleInput sampleInput;
+    defaultSampleInput(detector, sampleInput);
+
+    // Fields given by the client override the detector defaults
+    const SampleInput& s = job.sampleInput;
+    if(!s.title.isEmpty()) sampleInput.title = s.title;
+    if(!s.username.isEmpty()) sampleInput.username = s.username;
+    if(!s.description.isEmpty()) sampleInput.description = s.description;
+    if(!s.specterref.isEmpty()) sampleInput.specterref = s.specterref;
+    if(!s.ID.isEmpty()) sampleInput.ID = s.ID;
+    if(!s.type.isEmpty()) sampleInput.type = s.type;
+    if(!s.quantity.isEmpty()) sampleInput.quantity = s.quantity;
+    if(!s.quantityError.isEmpty()) sampleInput.quantityError = s.quantityError;
+    if(!s.units.isEmpty()) sampleInput.units = s.units;
+    if(!s.geometry.isEmpty()) sampleInput.geometry = s.geometry;
+    if(!s.builduptype.isEmpty()) sampleInput.builduptype = s.builduptype;
+    if(!s.startTime.isEmpty()) sampleInput.startTime = s.startTime;
+    if(!s.endTime.isEmpty()) sampleInput.endTime = s.endTime;
+    if(!s.randomError.isEmpty()) sampleInput.randomError = s.randomError;
+    if(!s.systematicError.isEmpty()) sampleInput.systematicError = s.systematicError;
+    if(!s.presetType1.isEmpty()) sampleInput.presetType1 = s.presetType1;
+    if(!s.presetType1Value.isEmpty()) sampleInput.presetType1Value = s.presetType1Value;
+    if(!s.presetType1StartChannel.isEmpty()) sampleInput.presetType1StartChannel = s.presetType1StartChannel;
+    if(!s.presetType1EndChannel.isEmpty()) sampleInput.presetType1EndChannel = s.presetType1EndChannel;
+    if(!s.presetType2.isEmpty()) sampleInput.presetType2 = s.presetType2;
+    if(!s.presetType2Value.isEmpty()) sampleInput.presetType2Value = s.presetType2Value;
+    sampleInput.detector = detector.name;
+
+    // An MDA target is counted as the live time this detector needed for it before
+    if(job.liveTime > 0.0)
+    {
+        sampleInput.presetType2 = timePresetName(TimePresetLive);
+        sampleInput.presetType2Value = QString::number(qCeil(job.liveTime));
+    }
+
+    // A refused sample fails here, before its sample file is marked as processed
+    QStringList problems;
+    if(!preflightJob(sampleInput, detector, mSettings, mTempDirectory, problems, mCheckFiles))
+    {
+        countMetric(MetricJobsRefused, detector.name);
+        error = problems.join("; ");
+        return false;
+    }
+
+    error = "Unable to start job";
+
+    // Mark imported sample files as processed before the job exists, a crash in between
+    // loses one sample file to .ok rather than running the same sample twice
+    if(!job.sourceFile.isEmpty())
+    {
+        QFile::remove(job.sourceFile + ".ok");
+        if(!QFile::rename(job.sourceFile, job.sourceFile + ".ok"))
+            return false;
+    }
+
+    QString baseFilename = mTempDirectory + detector.name;
+    QString username = sampleInput.username.isEmpty() ? mUsername : sampleInput.username;
+    if(!writeJobFile(baseFilename, sampleInput, detector, mSettings, username, job.queuedAt))
+        return false;
+
+    job.detector = detector.name;
+    job.state = Running;
+    job.startedAt = QDateTime::currentDateTime();
+    mActive.insert(detector.name, job.id);
+    mPool.start(new ApiJobRunnable(mRunner, baseFilename, detector.name));
+
+    emit jobStarted(detector.name);
+    return true;
+}
+
+QString JobApiServer::stateName(JobState state)
+{
+    switch(state)
+    {
+    case Queued:
+        return "queued";
+    case Running:
+        return "running";
+    case Finished:
+        return "finished";
+    case Closed:
+        return "closed";
+    default:
+        return "failed";
+    }
+}
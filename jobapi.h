@@ -0,0 +1,147 @@
+#ifndef JOBAPI_H
+#define JOBAPI_H
+
+#include <QObject>
+#include <QList>
+#include <QMap>
+#include <QSet>
+#include <QQueue>
+#include <QString>
+#include <QByteArray>
+#include <QDateTime>
+#include <QThreadPool>
+#include <QJsonObject>
+#include <QJsonArray>
+#include <QMetaType>
+#include "settings.h"
+#include "detector.h"
+#include "sampleinput.h"
+#include "jobutils.h"
+#include "scheduler.h"
+
+#define NAILAB_API_SERVER_NAME "nailab-api"
+
+Q_DECLARE_METATYPE(Detector)
+Q_DECLARE_METATYPE(Settings)
+
+class QLocalServer;
+class QLocalSocket;
+class QTimer;
+
+// Local job submission API, newline separated JSON requests over a local socket
+// (a Unix domain socket, or a named pipe on Windows). Lives in its own thread, the
+// GUI only hands it configuration snapshots and listens for job start/finish signals.
+// Queued samples are planned onto the detectors with scheduleSamples every dispatch
+// tick, a sample starts once the detector it is planned on is free. Closed and failed
+// jobs can be queried for a day, the newest 1000 of them at most.
+//
+// Requests:
+//   {"cmd":"submit","samples":[{"Title":...,"ID":...,"Geometry":...}, ...]}
+//   {"cmd":"detectors"}
+//   {"cmd":"job","id":<id>}
+//   {"cmd":"result","id":<id>}
+class JobApiServer : public QObject
+{
+    Q_OBJECT
+
+public:
+
+    enum JobState
+    {
+        Queued,
+        Running,
+        Finished,
+        Closed,
+        Failed
+    };
+
+    JobApiServer(const QString& tempDirectory, const Settings& settings, const QString& username,
+                 JobRunner runner, QObject *parent = 0);
+    ~JobApiServer();
+
+    // Queues a sample for the next free detector, returns the job id or 0 with error set
+    qint64 enqueue(const SampleInput& sampleInput, const QString& sourceFile, QString& error);
+    int queuedCount() const;
+    int detectorsInUse() const;
+    const Settings& settings() const { return mSettings; }
+    // Whether preflightJob looks for the Genie files, not with the simulated executor
+    void setCheckFiles(bool checkFiles) { mCheckFiles = checkFiles; }
+    // Stored reports the job durations are learned from when the server starts
+    void setArchiveDirectory(const QString& archiveDirectory) { mArchiveDirectory = archiveDirectory; }
+    void setSchedulePolicy(SchedulePolicy policy) { mPolicy = policy; }
+
+public slots:
+
+    void start(const QString& name = NAILAB_API_SERVER_NAME);
+    void stop();
+    void setDetectors(const QList<Detector>& detectors);
+    void setSettings(const Settings& settings);
+    // Detectors with the high voltage off are not planned
+    void setPoweredOff(const QStringList& detectors);
+
+signals:
+
+    void started(bool ok);
+    void jobStarted(const QString& detector);
+    void jobFinished(const QString& detector);
+    void jobFailed(qint64 id, const QString& sourceFile);
+
+private slots:
+
+    void onNewConnection();
+    void onReadyRead();
+    void onDisconnected();
+    void onDispatch();
+
+private:
+
+    struct ApiJob
+    {
+        qint64 id;
+        SampleInput sampleInput;
+        QString sourceFile;
+        QString detector;
+        JobState state;
+        QString error;
+        QDateTime queuedAt;
+        QDateTime startedAt;
+        double duration;        // predicted, seconds
+        double liveTime;        // planned, the preset of samples with an MDA target
+        QDateTime closedAt;     // when it was closed or failed, see pruneJobs
+    };
+
+    QString mTempDirectory, mUsername, mArchiveDirectory;
+    Settings mSettings;
+    JobRunner mRunner;
+    bool mCheckFiles;
+    QList<Detector> mDetectors;
+    QSet<QString> mPoweredOff;
+    SchedulePolicy mPolicy;
+    JobDurationModel mModel;
+
+    QLocalServer *mServer;
+    QTimer *mDispatchTimer;
+    QThreadPool mPool;
+    QMap<QLocalSocket*, QByteArray> mBuffers;
+
+    qint64 mNextId;
+    QMap<qint64, ApiJob> mJobs;
+    QQueue<qint64> mQueue;
+    QMap<QString, qint64> mActive;
+    QDateTime mPrunedAt;
+
+    QJsonObject handleRequest(const QJsonObject& request);
+    QJsonObject submit(const QJsonArray& samples);
+    QJsonObject detectors();
+    QJsonObject job(qint64 id);
+    QJsonObject result(qint64 id);
+    void pruneJobs(const QDateTime& now);
+
+    const Detector* findDetector(const QString& name) const;
+    const Detector* selectDetector(const SampleInput& sampleInput) const;
+    double expectedFreeAt(const Detector& detector, const QDateTime& now) const;
+    bool startJob(ApiJob& job, const Detector& detector, QString& error);
+    static QString stateName(JobState state);
+};
+
+#endif // JOBAPI_H
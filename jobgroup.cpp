@@ -0,0 +1,183 @@
+#include <QFile>
+#include <QFileInfo>
+#include <QDir>
+#include <QTextStream>
+#include "jobgroup.h"
+#include "jobutils.h"
+
+static QString groupDirectory(const QString& tempDirectory)
+{
+    return tempDirectory + "GROUPS/";
+}
+
+QString newJobGroupId()
+{
+    return "G" + QDateTime::currentDateTime().toString("yyyyMMdd-HHmmss-zzz");
+}
+
+QString jobGroupBarrier(const QString& tempDirectory, const QString& id)
+{
+    return groupDirectory(tempDirectory) + id + ".GO";
+}
+
+// Written to a .tmp and renamed, a group file is never half written
+static bool writeGroupFile(const QString& filename, const QString& text)
+{
+    QFile tmp(filename + ".tmp");
+    QByteArray data = text.toUtf8();
+    if(!tmp.open(QIODevice::WriteOnly | QIODevice::Truncate) || tmp.write(data) != data.size() || !syncFile(tmp))
+        return false;
+    tmp.close();
+    QFile::remove(filename);
+    return tmp.rename(filename);
+}
+
+bool writeJobGroup(const QString& tempDirectory, const JobGroup& group)
+{
+    QString dir = groupDirectory(tempDirectory);
+    if(!QDir(dir).exists() && !QDir().mkpath(dir))
+        return false;
+
+    // id <id>, created <ISO time>, detector <name> and stored <name> <archive base>
+    QString text;
+    QTextStream s(&text);
+    s << "id " << group.id << "\n";
+    s << "created " << group.created.toString(Qt::ISODate) << "\n";
+    foreach(const QString& detector, group.detectors)
+        s << "detector " << detector << "\n";
+    QMapIterator<QString, QString> iter(group.stored);
+    while(iter.hasNext())
+    {
+        iter.next();
+        s << "stored " << iter.key() << " " << iter.value() << "\n";
+    }
+    s.flush();
+    return writeGroupFile(dir + group.id + ".GRP", text);
+}
+
+static bool readJobGroup(const QString& filename, JobGroup& group)
+{
+    QFile file(filename);
+    if(!file.open(QIODevice::ReadOnly | QIODevice::Text))
+        return false;
+
+    group = JobGroup();
+    QTextStream s(&file);
+    for(QString line = s.readLine(); !line.isNull(); line = s.readLine())
+    {
+        QString key = line.section(' ', 0, 0);
+        QString value = line.section(' ', 1);
+        if(key == "id")
+            group.id = value;
+        else if(key == "created")
+            group.created = QDateTime::fromString(value, Qt::ISODate);
+        else if(key == "detector")
+            group.detectors << value;
+        else if(key == "stored")
+            group.stored.insert(value.section(' ', 0, 0), value.section(' ', 1));
+    }
+    return !group.id.isEmpty();
+}
+
+bool readJobGroups(const QString& tempDirectory, QList<JobGroup>& groups)
+{
+    groups.clear();
+    QDir dir(groupDirectory(tempDirectory));
+    if(!dir.exists())
+        return true;
+
+    foreach(const QString& name, dir.entryList(QStringList() << "*.GRP", QDir::Files, QDir::Name))
+    {
+        JobGroup group;
+        if(readJobGroup(dir.absoluteFilePath(name), group))
+            groups << group;
+    }
+    return true;
+}
+
+bool findJobGroup(const QString& tempDirectory, const QString& detectorName, JobGroup& group)
+{
+    QList<JobGroup> groups;
+    readJobGroups(tempDirectory, groups);
+    foreach(const JobGroup& g, groups)
+    {
+        if(g.detectors.contains(detectorName) || g.stored.contains(detectorName))
+        {
+            group = g;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool removeJobGroup(const QString& tempDirectory, const QString& id)
+{
+    QString dir = groupDirectory(tempDirectory);
+    QFile::remove(dir + id + ".GO");
+    return QFile::remove(dir + id + ".GRP");
+}
+
+bool releaseJobGroup(const QString& tempDirectory, const JobGroup& group, bool force, int* missing)
+{
+    if(missing)
+        *missing = 0;
+    QString barrier = jobGroupBarrier(tempDirectory, group.id);
+    if(QFile::exists(barrier))
+        return true;
+
+    int absent = 0;
+    foreach(const QString& detector, group.detectors)
+    {
+        QString baseFilename = tempDirectory + detector;
+        if(QFile::exists(baseFilename + ".RDY"))
+            continue;
+        if(!force && QFile::exists(baseFilename + ".BAT"))
+            return false;
+        absent++;
+    }
+
+    QFile file(barrier);
+    if(!file.open(QIODevice::WriteOnly))
+        return false;
+    file.close();
+
+    foreach(const QString& detector, group.detectors)
+        QFile::remove(tempDirectory + detector + ".RDY");
+    if(missing)
+        *missing = absent;
+    return true;
+}
+
+bool jobGroupFinished(const QString& tempDirectory, const JobGroup& group)
+{
+    foreach(const QString& detector, group.detectors)
+    {
+        if(!group.stored.contains(detector) && !detectorHasFinishedJob(tempDirectory, detector))
+            return false;
+    }
+    return true;
+}
+
+bool archiveJobGroup(const QString& tempDirectory, const QString& archiveDirectory, const JobGroup& group)
+{
+    QString dir = archiveDirectory + "GROUPS/";
+    if(!QDir(dir).exists() && !QDir().mkpath(dir))
+        return false;
+
+    // <detector> <archive base relative to the archive>
+    QString text;
+    QTextStream s(&text);
+    s << "id " << group.id << "\n";
+    s << "created " << group.created.toString(Qt::ISODate) << "\n";
+    QMapIterator<QString, QString> iter(group.stored);
+    while(iter.hasNext())
+    {
+        iter.next();
+        s << "stored " << iter.key() << " " << QDir(archiveDirectory).relativeFilePath(iter.value()) << "\n";
+    }
+    s.flush();
+
+    if(!writeGroupFile(dir + group.id + ".GRP", text))
+        return false;
+    return removeJobGroup(tempDirectory, group.id);
+}
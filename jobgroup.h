@@ -0,0 +1,47 @@
+#ifndef JOBGROUP_H
+#define JOBGROUP_H
+
+#include <QString>
+#include <QStringList>
+#include <QDateTime>
+#include <QMap>
+#include <QList>
+
+// One sample counted on several detectors at the same time, e.g. a split sample or a
+// parallel count campaign. The group is kept in TEMP/GROUPS/<id>.GRP. Each job of the
+// group touches <detector>.RDY and then waits before startmca until TEMP/GROUPS/<id>.GO
+// exists, polling it once a second; releaseJobGroup creates it once every job is
+// waiting, so the acquisitions start within a second of each other however long each
+// job took to get there. A group is stored together
+// once all its jobs have finished, see archiveJobGroup.
+
+struct JobGroup
+{
+    QString id;                         // G<yyyyMMdd-HHmmss-zzz>
+    QDateTime created;
+    QStringList detectors;              // jobs still in the group
+    QMap<QString, QString> stored;      // detector to archive base of stored jobs
+};
+
+QString newJobGroupId();
+QString jobGroupBarrier(const QString& tempDirectory, const QString& id);
+
+bool writeJobGroup(const QString& tempDirectory, const JobGroup& group);
+bool readJobGroups(const QString& tempDirectory, QList<JobGroup>& groups);
+// The group detectorName is counting in, false if it has a job of its own
+bool findJobGroup(const QString& tempDirectory, const QString& detectorName, JobGroup& group);
+bool removeJobGroup(const QString& tempDirectory, const QString& id);
+
+// Creates the barrier once every job of the group waits at it, jobs that are gone do
+// not count. With force set it is created anyway, e.g. for groups left behind by a
+// crash. Returns true once the barrier exists, missing is set to the number of jobs
+// that were not waiting at it.
+bool releaseJobGroup(const QString& tempDirectory, const JobGroup& group, bool force = false, int* missing = 0);
+// True once every job of the group has finished
+bool jobGroupFinished(const QString& tempDirectory, const JobGroup& group);
+
+// Records where each job of the group was archived in ARCHIVE/GROUPS/<id>.GRP and
+// removes the group from TEMP
+bool archiveJobGroup(const QString& tempDirectory, const QString& archiveDirectory, const JobGroup& group);
+
+#endif // JOBGROUP_H
@@ -0,0 +1,352 @@
+#include <QFile>
+#include <QFileInfo>
+#include <QTextStream>
+#include <QUrl>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QAtomicInt>
+#ifdef Q_OS_WIN
+#include <windows.h>
+#endif
+#include "jobjournal.h"
+#include "jobutils.h"
+
+static const int compactAfter = 1024;
+
+static const char* stateNames[] = { "ACCEPTED", "STARTED", "FINISHED", "STORED", "REJECTED", "FAILED" };
+static const int stateCount = sizeof(stateNames) / sizeof(stateNames[0]);
+
+struct Journal
+{
+    QMutex mutex;
+    QFile file;
+    QMap<QString, JournalJob> jobs;
+    qint64 nextSequence;
+    int appended;
+};
+
+static QAtomicInt journalEnabled(0);
+
+static Journal& journal()
+{
+    // Never destroyed, jobs may still finish on pool threads while the application exits
+    static Journal *j = new Journal;
+    return *j;
+}
+
+QString journalStateName(JournalState state)
+{
+    return QString(stateNames[state]).toLower();
+}
+
+bool jobJournalEnabled()
+{
+    return journalEnabled.load() != 0;
+}
+
+static bool isTerminal(JournalState state)
+{
+    return state == JournalStored || state == JournalRejected || state == JournalFailed;
+}
+
+// Boot time in ms since the epoch, to tell a job that died with the PC from one that
+// is still running while Nailab restarted. 0 if unknown.
+static qint64 bootTime()
+{
+#ifdef Q_OS_WIN
+    return QDateTime::currentMSecsSinceEpoch() - qint64(GetTickCount64());
+#else
+    QFile stat("/proc/stat");
+    if(!stat.open(QIODevice::ReadOnly | QIODevice::Text))
+        return 0;
+    QTextStream s(&stat);
+    for(QString line = s.readLine(); !line.isNull(); line = s.readLine())
+    {
+        if(line.startsWith("btime "))
+            return line.mid(6).trimmed().toLongLong() * 1000;
+    }
+    return 0;
+#endif
+}
+
+static bool sameBoot(const QString& recorded)
+{
+    // The tick count drifts against the wall clock, a minute is far below any reboot
+    qint64 then = recorded.toLongLong(), now = bootTime();
+    return then == 0 || now == 0 || qAbs(now - then) < 60000;
+}
+
+// <sequence> <ms since epoch> <STATE> <detector> [key=value ...] #<crc>, with detector,
+// keys and values percent encoded
+static QByteArray formatRecord(const JournalJob& job, const QMap<QString, QString>& fields)
+{
+    QByteArray line = QByteArray::number(job.sequence) + " " + QByteArray::number(job.changed.toMSecsSinceEpoch())
+            + " " + stateNames[job.state] + " " + QUrl::toPercentEncoding(job.detector);
+
+    QMapIterator<QString, QString> iter(fields);
+    while(iter.hasNext())
+    {
+        iter.next();
+        line += " " + QUrl::toPercentEncoding(iter.key()) + "=" + QUrl::toPercentEncoding(iter.value());
+    }
+
+    quint16 crc = qChecksum(line.constData(), line.size());
+    return line + " #" + QByteArray::number(crc, 16) + "\n";
+}
+
+static bool parseRecord(const QByteArray& record, JournalJob& job, QMap<QString, QString>& fields)
+{
+    QByteArray line = record.trimmed();
+    int hash = line.lastIndexOf(" #");
+    if(hash < 0)
+        return false;
+
+    bool ok;
+    quint16 crc = line.mid(hash + 2).toUShort(&ok, 16);
+    line.truncate(hash);
+    if(!ok || crc != qChecksum(line.constData(), line.size()))
+        return false;
+
+    QList<QByteArray> parts = line.split(' ');
+    if(parts.count() < 4)
+        return false;
+
+    job.sequence = parts[0].toLongLong(&ok);
+    if(!ok)
+        return false;
+    job.changed = QDateTime::fromMSecsSinceEpoch(parts[1].toLongLong());
+
+    int state = -1;
+    for(int s=0; s<stateCount; s++)
+    {
+        if(parts[2] == stateNames[s])
+            state = s;
+    }
+    if(state < 0)
+        return false;
+    job.state = JournalState(state);
+
+    job.detector = QUrl::fromPercentEncoding(parts[3]);
+    fields.clear();
+    for(int i=4; i<parts.count(); i++)
+    {
+        int sep = parts[i].indexOf('=');
+        if(sep > 0)
+            fields.insert(QUrl::fromPercentEncoding(parts[i].left(sep)), QUrl::fromPercentEncoding(parts[i].mid(sep + 1)));
+    }
+    return true;
+}
+
+static void applyRecord(QMap<QString, JournalJob>& jobs, const JournalJob& record, const QMap<QString, QString>& fields)
+{
+    // A new job on a detector starts from an accepted record
+    JournalJob& job = jobs[record.detector];
+    if(record.state == JournalAccepted)
+        job.fields.clear();
+
+    job.detector = record.detector;
+    job.state = record.state;
+    job.sequence = record.sequence;
+    job.changed = record.changed;
+    QMapIterator<QString, QString> iter(fields);
+    while(iter.hasNext())
+    {
+        iter.next();
+        job.fields.insert(iter.key(), iter.value());
+    }
+
+    if(isTerminal(job.state))
+        jobs.remove(record.detector);
+}
+
+static bool writeRecords(QFile& file, const QMap<QString, JournalJob>& jobs)
+{
+    foreach(const JournalJob& job, jobs)
+    {
+        QByteArray record = formatRecord(job, job.fields);
+        if(file.write(record) != record.size())
+            return false;
+    }
+    return syncFile(file);
+}
+
+// Rewrites the journal with one record per open job. Called with the mutex held. The
+// journal is open for appending afterwards whether it was compacted or not, unless
+// error also says it could not be opened.
+static bool compact(Journal& j, QString& error)
+{
+    QString filename = j.file.fileName();
+    QString tmpFilename = filename + ".tmp";
+    j.appended = 0;
+    error.clear();
+
+    QFile tmp(tmpFilename);
+    if(!tmp.open(QIODevice::WriteOnly | QIODevice::Truncate) || !writeRecords(tmp, j.jobs))
+    {
+        // The journal was not touched, appending goes on in it
+        error = "Unable to write " + tmpFilename + ": " + tmp.errorString();
+        tmp.close();
+        QFile::remove(tmpFilename);
+    }
+    else
+    {
+        tmp.close();
+        j.file.close();
+
+        // Recovery falls back to the .tmp if the journal is gone, see openJobJournal
+        QFile old(filename);
+        if(old.exists() && !old.remove())
+            error = "Unable to replace " + filename + ": " + old.errorString();
+        else if(!QFile::rename(tmpFilename, filename))
+        {
+            // Nothing to go back to, the open jobs are written in place of the journal
+            error = "Unable to rename " + tmpFilename + " to " + filename;
+            if(j.file.open(QIODevice::WriteOnly | QIODevice::Truncate) && writeRecords(j.file, j.jobs))
+                QFile::remove(tmpFilename);
+        }
+    }
+
+    if(!j.file.isOpen() && !j.file.open(QIODevice::WriteOnly | QIODevice::Append))
+        error += (error.isEmpty() ? "" : "; ") + QString("Unable to open ") + filename + ": " + j.file.errorString();
+    return error.isEmpty();
+}
+
+bool openJobJournal(const QString& filename, QMap<QString, JournalJob>& jobs)
+{
+    Journal& j = journal();
+    QMutexLocker lock(&j.mutex);
+
+    journalEnabled.store(0);
+    j.file.close();
+    j.file.setFileName(filename);
+    j.jobs.clear();
+    j.nextSequence = 1;
+    j.appended = 0;
+
+    // Compaction was interrupted between removing the journal and renaming the new one
+    if(!QFile::exists(filename) && QFile::exists(filename + ".tmp"))
+        QFile::rename(filename + ".tmp", filename);
+
+    QFile file(filename);
+    if(file.open(QIODevice::ReadOnly))
+    {
+        // Records are only ever appended, the first bad one is a torn write and
+        // everything from it on is discarded
+        QByteArray data = file.readAll();
+        file.close();
+
+        int pos = 0;
+        while(pos < data.size())
+        {
+            int end = data.indexOf('\n', pos);
+            if(end < 0)
+                break;
+
+            JournalJob record;
+            QMap<QString, QString> fields;
+            if(!parseRecord(data.mid(pos, end - pos), record, fields))
+                break;
+            applyRecord(j.jobs, record, fields);
+            j.nextSequence = qMax(j.nextSequence, record.sequence + 1);
+            pos = end + 1;
+        }
+
+        // Records appended after a torn one would never be replayed, even if the
+        // compaction below fails
+        if(pos < data.size())
+            QFile::resize(filename, pos);
+    }
+
+    // Also drops the records of closed jobs
+    QString error;
+    if(!compact(j, error))
+        qWarning("Job journal: %s", qPrintable(error));
+    if(!j.file.isOpen())
+        return false;
+
+    jobs = j.jobs;
+    journalEnabled.store(1);
+    return true;
+}
+
+void closeJobJournal()
+{
+    Journal& j = journal();
+    QMutexLocker lock(&j.mutex);
+    journalEnabled.store(0);
+    j.file.close();
+}
+
+bool journalJob(const QString& detectorName, JournalState state, const QMap<QString, QString>& fields)
+{
+    if(!jobJournalEnabled())
+        return true;
+
+    Journal& j = journal();
+    QMutexLocker lock(&j.mutex);
+    if(!j.file.isOpen())
+        return true;
+
+    JournalJob record;
+    record.detector = detectorName;
+    record.state = state;
+    record.sequence = j.nextSequence++;
+    record.changed = QDateTime::currentDateTime();
+
+    QMap<QString, QString> recordFields = fields;
+    if(state == JournalStarted)
+        recordFields.insert("boot", QString::number(bootTime()));
+
+    // The transition only counts once it is on disk, a partial record is cut off again
+    qint64 size = j.file.size();
+    QByteArray line = formatRecord(record, recordFields);
+    if(j.file.write(line) != line.size() || !syncFile(j.file))
+    {
+        qWarning("Job journal: unable to write %s: %s", qPrintable(j.file.fileName()), qPrintable(j.file.errorString()));
+        j.file.resize(size);
+        j.file.seek(size);
+        return false;
+    }
+    applyRecord(j.jobs, record, recordFields);
+
+    QString error;
+    if(++j.appended >= compactAfter && !compact(j, error))
+        qWarning("Job journal: %s", qPrintable(error));
+    return true;
+}
+
+void recoverJobs(const QString& tempDirectory, const QMap<QString, JournalJob>& jobs,
+                 QStringList& resume, QStringList& messages)
+{
+    foreach(const JournalJob& job, jobs)
+    {
+        QString baseFilename = tempDirectory + job.detector;
+        bool done = QFile::exists(baseFilename + ".DONE");
+
+        if(job.state == JournalFinished)
+            continue;
+
+        if(done)
+        {
+            journalJob(job.detector, JournalFinished);
+            messages << job.detector + ": job finished while Nailab was not running";
+        }
+        else if(!QFile::exists(baseFilename + ".BAT"))
+        {
+            QMap<QString, QString> fields;
+            fields.insert("error", "job files missing");
+            journalJob(job.detector, JournalFailed, fields);
+            messages << job.detector + ": job files missing, job closed";
+        }
+        else if(job.state == JournalAccepted)
+        {
+            resume << job.detector;
+            messages << job.detector + ": job was never started, starting it again";
+        }
+        else if(!sameBoot(job.fields.value("boot")))
+        {
+            failJob(tempDirectory, job.detector, "interrupted by a restart");
+            messages << job.detector + ": job interrupted by a restart, files moved to FAILED";
+        }
+    }
+}
@@ -0,0 +1,62 @@
+#ifndef JOBJOURNAL_H
+#define JOBJOURNAL_H
+
+#include <QString>
+#include <QStringList>
+#include <QMap>
+#include <QDateTime>
+
+// Append-only journal of job state transitions. Every transition is written as one
+// checksummed line and synced to disk before the job moves on, so after a crash or a
+// power cut the journal tells which job each detector had and how far it got. Jobs
+// that are stored, rejected or failed are dropped when the journal is compacted,
+// which happens when it is opened and after every 1024 records. A compaction that
+// fails is logged and the journal goes on uncompacted.
+//
+// The journal is written by the process that opened it only (Nailab); jobs started
+// from nailab-cli are not journaled. Every call below returns after a single flag
+// test while no journal is open.
+
+enum JournalState
+{
+    JournalAccepted,    // job script written
+    JournalStarted,     // job script started
+    JournalFinished,    // job script ran to the end (.DONE)
+    JournalStored,
+    JournalRejected,
+    JournalFailed
+};
+
+struct JournalJob
+{
+    QString detector;
+    JournalState state;
+    qint64 sequence;
+    QDateTime changed;
+    QMap<QString, QString> fields;  // accumulated over all records, e.g. "id", "boot", "error"
+};
+
+QString journalStateName(JournalState state);
+
+// Replays the journal into jobs (open jobs only, keyed by detector), drops a torn last
+// record and compacts. A missing journal is created.
+bool openJobJournal(const QString& filename, QMap<QString, JournalJob>& jobs);
+void closeJobJournal();
+bool jobJournalEnabled();
+
+// False if the record could not be written and synced, nothing is recorded then
+bool journalJob(const QString& detectorName, JournalState state,
+                const QMap<QString, QString>& fields = QMap<QString, QString>());
+
+// Brings the replayed jobs in line with the files in the temp directory, journaling
+// what it decides:
+//  - a .DONE that is not journaled yet makes the job finished
+//  - a job that was started during an earlier boot and has no .DONE died with the PC,
+//    it is failed and its files are moved to TEMP/FAILED (see failJob)
+//  - a job that was started during this boot is still running, only Nailab restarted
+//  - a job that was accepted but never started is returned in resume to be started again
+// messages describe every job that was not left as it was.
+void recoverJobs(const QString& tempDirectory, const QMap<QString, JournalJob>& jobs,
+                 QStringList& resume, QStringList& messages);
+
+#endif // JOBJOURNAL_H
@@ -0,0 +1,259 @@
+#include <QFile>
+#include <QFileInfo>
+#include <QDir>
+#include <QTextStream>
+#include <QStringList>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QAtomicInt>
+#include <QHash>
+#include <QJsonObject>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include "jobtrace.h"
+
+static QAtomicInt traceEnabled(0);
+static QMutex traceMutex;
+static QString traceDirectory;
+
+static const char* isoFormat = "yyyy-MM-ddTHH:mm:ss.zzz";
+
+void setJobTraceDirectory(const QString& directory)
+{
+    QMutexLocker lock(&traceMutex);
+    traceDirectory = directory;
+    traceEnabled.store(directory.isEmpty() ? 0 : 1);
+}
+
+bool jobTraceEnabled()
+{
+    return traceEnabled.load() != 0;
+}
+
+static void appendTraceLine(const QString& baseFilename, const QString& line, bool truncate)
+{
+    QFile file(baseFilename + ".JTR");
+    QIODevice::OpenMode mode = QIODevice::WriteOnly | QIODevice::Text | (truncate ? QIODevice::Truncate : QIODevice::Append);
+    if(!file.open(mode))
+        return;
+    file.write(line.toLocal8Bit());
+}
+
+void beginJobTrace(const QString& baseFilename, const QDateTime& accepted)
+{
+    if(!jobTraceEnabled())
+        return;
+
+    QDateTime time = accepted.isValid() ? accepted : QDateTime::currentDateTime();
+    appendTraceLine(baseFilename, "i " + time.toString(isoFormat) + " sample accepted\n", true);
+}
+
+void traceJobEvent(const QString& baseFilename, char phase, const QString& name, const QDateTime& time)
+{
+    if(!jobTraceEnabled())
+        return;
+
+    QDateTime t = time.isValid() ? time : QDateTime::currentDateTime();
+    appendTraceLine(baseFilename, QString(QChar(phase)) + " " + t.toString(isoFormat) + " " + name + "\n", false);
+}
+
+static QString traceEcho(const QString& traceFile, char phase, const QString& name)
+{
+    // Redirection first, "echo ... nl1>>file" would read as a redirect of handle 1
+    return ">>\"" + traceFile + "\" echo " + QChar(phase) + " %TIME% " + name + "\n";
+}
+
+QString instrumentJobScript(const QString& script, const QString& baseFilename)
+{
+    QString traceFile = baseFilename + ".JTR";
+    QString output;
+    QTextStream s(&output);
+
+    s << traceEcho(traceFile, 'B', "job");
+    foreach(const QString& line, script.split('\n'))
+    {
+        QString trimmed = line.trimmed();
+        if(trimmed.isEmpty())
+            continue;
+
+        QString command = trimmed.section(' ', 0, 0).toLower();
+
+        // Labels and the loop of a group start barrier, traced lines would repeat with it
+        if(command.startsWith(':') || command == "if")
+        {
+            s << line << "\n";
+            continue;
+        }
+
+        if(command == "startmca")
+            s << traceEcho(traceFile, 'B', "acquisition");
+        else if(command == "peak_dif")
+            s << traceEcho(traceFile, 'B', "analysis");
+
+        s << traceEcho(traceFile, 'B', command) << line << "\n" << traceEcho(traceFile, 'E', command);
+
+        if(command == "wait")
+            s << traceEcho(traceFile, 'E', "acquisition");
+        else if(command == "report")
+            s << traceEcho(traceFile, 'E', "analysis");
+    }
+    s << traceEcho(traceFile, 'E', "job");
+    s.flush();
+    return output;
+}
+
+static QString eventCategory(const QString& name)
+{
+    static QHash<QString, QString> categories;
+    static QMutex mutex;
+
+    QMutexLocker lock(&mutex);
+    if(categories.isEmpty())
+    {
+        categories["startmca"] = categories["wait"] = categories["acquisition"] = "acquisition";
+        categories["peak_dif"] = categories["area_nl1"] = categories["areacor"] = categories["effcor"] = "analysis";
+        categories["nid_intf"] = categories["mda"] = categories["report"] = categories["analysis"] = "analysis";
+        categories["pars"] = categories["movedata"] = "genie";
+    }
+    return categories.value(name, "nailab");
+}
+
+static qint64 parseScriptTime(const QString& text)
+{
+    // %TIME% is H:mm:ss.cc, with a comma in some locales
+    QStringList parts = QString(text).replace(',', '.').split(':');
+    if(parts.count() != 3)
+        return -1;
+    return qint64(parts[0].toInt() * 3600000.0 + parts[1].toInt() * 60000.0 + parts[2].toDouble() * 1000.0 + 0.5);
+}
+
+static bool readTraceEvents(const QString& baseFilename, const QString& detectorName, int tid, QJsonArray& events)
+{
+    QFile file(baseFilename + ".JTR");
+    if(!file.open(QIODevice::ReadOnly | QIODevice::Text))
+        return false;
+
+    QJsonObject meta;
+    meta["name"] = QString("thread_name");
+    meta["ph"] = QString("M");
+    meta["pid"] = 1;
+    meta["tid"] = tid;
+    QJsonObject metaArgs;
+    metaArgs["name"] = detectorName;
+    meta["args"] = metaArgs;
+    events.append(meta);
+
+    QJsonObject args;
+    args["job"] = QFileInfo(baseFilename).fileName();
+
+    // Script events only have a time of day, they take the date of the last full
+    // timestamp and roll over at midnight
+    QDate date;
+    qint64 lastMsecs = 0;
+
+    QTextStream in(&file);
+    while(!in.atEnd())
+    {
+        QStringList parts = in.readLine().split(' ', QString::SkipEmptyParts);
+        if(parts.count() < 3 || parts[0].length() != 1)
+            continue;
+
+        QDateTime time;
+        if(parts[1].contains('T'))
+        {
+            time = QDateTime::fromString(parts[1], isoFormat);
+            date = time.date();
+            lastMsecs = QTime(0, 0).msecsTo(time.time());
+        }
+        else if(date.isValid())
+        {
+            qint64 msecs = parseScriptTime(parts[1]);
+            if(msecs < 0)
+                continue;
+            if(msecs + 3600000 < lastMsecs)
+                date = date.addDays(1);
+            lastMsecs = msecs;
+            time = QDateTime(date, QTime(0, 0).addMSecs(msecs));
+        }
+        if(!time.isValid())
+            continue;
+
+        QString name = parts.mid(2).join(" ");
+        QJsonObject event;
+        event["name"] = name;
+        event["cat"] = eventCategory(name);
+        event["ph"] = parts[0];
+        event["ts"] = double(time.toMSecsSinceEpoch()) * 1000.0;
+        event["pid"] = 1;
+        event["tid"] = tid;
+        event["args"] = args;
+        if(parts[0] == "i")
+            event["s"] = QString("t");
+        events.append(event);
+    }
+    return true;
+}
+
+static bool writeJobJson(const QString& baseFilename, const QString& detectorName, QJsonArray& events)
+{
+    // One lane per detector, the same one every day
+    int tid = int(qHash(detectorName.toUpper()) & 0xffff);
+    if(!readTraceEvents(baseFilename, detectorName, tid, events))
+        return false;
+
+    QJsonObject root;
+    root["traceEvents"] = events;
+    root["displayTimeUnit"] = QString("ms");
+    QFile jobFile(baseFilename + ".JSON");
+    if(!jobFile.open(QIODevice::WriteOnly | QIODevice::Truncate))
+        return false;
+    jobFile.write(QJsonDocument(root).toJson(QJsonDocument::Compact));
+    jobFile.close();
+    return true;
+}
+
+bool writeJobTrace(const QString& baseFilename, const QString& detectorName)
+{
+    if(!jobTraceEnabled())
+        return true;
+
+    QJsonArray events;
+    return writeJobJson(baseFilename, detectorName, events);
+}
+
+bool finishJobTrace(const QString& baseFilename, const QString& detectorName)
+{
+    if(!jobTraceEnabled())
+        return true;
+
+    QString directory;
+    {
+        QMutexLocker lock(&traceMutex);
+        directory = traceDirectory;
+    }
+
+    QJsonArray events;
+    if(!writeJobJson(baseFilename, detectorName, events))
+        return false;
+
+    // The array format allows a missing ']', so the file of the day is only ever appended to
+    QFile dayFile(QDir(directory).absoluteFilePath(QDate::currentDate().toString("yyyy-MM-dd") + ".json"));
+    bool isNew = !dayFile.exists();
+    if(!dayFile.open(QIODevice::WriteOnly | QIODevice::Append))
+        return false;
+
+    QByteArray buffer;
+    if(isNew)
+        buffer.append("[\n");
+    for(int i=0; i<events.count(); i++)
+    {
+        QJsonDocument doc(events[i].toObject());
+        buffer.append(doc.toJson(QJsonDocument::Compact));
+        buffer.append(",\n");
+    }
+    bool ok = dayFile.write(buffer) == buffer.size();
+    dayFile.close();
+
+    QFile::remove(baseFilename + ".JTR");
+    return ok;
+}
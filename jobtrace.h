@@ -0,0 +1,36 @@
+#ifndef JOBTRACE_H
+#define JOBTRACE_H
+
+#include <QString>
+#include <QDateTime>
+
+// Job lifecycle tracing. While a job runs its events are appended as lines to
+// <baseFilename>.JTR, by Nailab for its own steps and by the job script itself for
+// each command (see instrumentJobScript). When the job is stored or rejected the
+// events are converted to Chrome trace JSON (chrome://tracing, ui.perfetto.dev):
+// <baseFilename>.JSON, archived with the job, and one file per day in the trace
+// directory. Tracing is off until a trace directory is set; every call below then
+// returns after a single flag test.
+
+void setJobTraceDirectory(const QString& directory);
+bool jobTraceEnabled();
+
+// Starts a new .JTR for the job, with the time the sample was accepted
+void beginJobTrace(const QString& baseFilename, const QDateTime& accepted);
+
+// phase is 'B' (begin), 'E' (end) or 'i' (instant), as in the Chrome trace format
+void traceJobEvent(const QString& baseFilename, char phase, const QString& name,
+                   const QDateTime& time = QDateTime());
+
+// Returns the script with every command wrapped in lines that append begin and end
+// events to <baseFilename>.JTR
+QString instrumentJobScript(const QString& script, const QString& baseFilename);
+
+// Converts <baseFilename>.JTR to <baseFilename>.JSON, the .JTR is kept
+bool writeJobTrace(const QString& baseFilename, const QString& detectorName);
+
+// Converts <baseFilename>.JTR to <baseFilename>.JSON and appends the events to the
+// trace file of the day, then removes the .JTR
+bool finishJobTrace(const QString& baseFilename, const QString& detectorName);
+
+#endif // JOBTRACE_H
@@ -0,0 +1,799 @@
+#include <QFile>
+#include <QFileInfo>
+#include <QDir>
+#include <QDate>
+#include <QDateTime>
+#include <QTextStream>
+#include <QStringList>
+#include <QCryptographicHash>
+#include <QDataStream>
+#include <QHash>
+#include <QMutex>
+#include <QMutexLocker>
+#ifdef Q_OS_WIN
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+#include "jobutils.h"
+#include "settings.h"
+#include "detector.h"
+#include "sampleinput.h"
+#include "jobtrace.h"
+#include "metrics.h"
+#include "jobjournal.h"
+#include "chunkstore.h"
+
+static const char* jobFileExtensions[] = { ".RPT", ".BAT", ".OUT", ".ERR", ".CNF", ".JSON" };
+static const char* jobTempExtensions[] = { ".DONE", ".PNT", ".JTR", ".RDY" };
+// Nearly the same for every job of a detector, archived as chunk recipes (.REF)
+static const char* jobChunkedExtensions[] = { ".BAT", ".OUT", ".ERR" };
+
+void startJobCommand(QTextStream& s, const QString& cmd)
+{
+    s << cmd << " ";
+}
+
+void endJobCommand(QTextStream& s)
+{
+    s << "\n";
+}
+
+void addJobParam(QTextStream& s, const QString& p, const QString& v)
+{
+    s << p << v << " ";
+}
+
+void addJobParamSingle(QTextStream& s, const QString& v)
+{
+    s << v << " ";
+}
+
+void addJobParamQuoted(QTextStream& s, const QString& p, const QString& v)
+{
+    s << p << "\"" << v << "\" ";
+}
+
+void defaultSampleInput(const Detector& detector, SampleInput& sampleInput)
+{
+    // Same defaults as the sample input page is initialized with
+    sampleInput.detector = detector.name;
+    sampleInput.specterref = QString::number(detector.spectrumCounter);
+    sampleInput.builduptype = "NONE";
+    sampleInput.startTime = QDateTime::currentDateTime().toString("dd.MM.yyyy HH:mm:ss");
+    sampleInput.randomError = QString::number(detector.randomError);
+    sampleInput.systematicError = QString::number(detector.systematicError);
+    sampleInput.presetType1 = countPresetName(detector.presetType1);
+    sampleInput.presetType1Value = QString::number(detector.presetType1Value);
+    sampleInput.presetType1StartChannel = QString::number(detector.presetType1ChannelStart);
+    sampleInput.presetType1EndChannel = QString::number(detector.presetType1ChannelEnd);
+    sampleInput.presetType2 = timePresetName(detector.presetType2);
+    sampleInput.presetType2Value = QString::number(detector.presetType2Value);
+    if(detector.beakers.count() == 1)
+        sampleInput.geometry = detector.beakers.constBegin().key();
+}
+
+static void addDataSource(QTextStream& s, const QString& dataSource)
+{
+    // Either a detector ("det:NAME") or a spectrum file
+    if(dataSource.startsWith("det:", Qt::CaseInsensitive))
+        addJobParam(s, "det:", dataSource.mid(4));
+    else
+        addJobParamQuoted(s, "", dataSource);
+}
+
+void writeAnalysisStage(QTextStream& stream, AnalysisStage stage, const QString& dataSource, const QString& baseFilename,
+                        const Detector& detector, const Settings& settings)
+{
+    switch(stage)
+    {
+    case StagePeakSearch:
+        startJobCommand(stream, "peak_dif");
+        addDataSource(stream, dataSource);
+        addJobParam(stream, "/channels=", QString::number(detector.searchRegionStart) + "," + QString::number(detector.searchRegionEnd));
+        addJobParam(stream, "/signif=", QString::number(detector.significanceTreshold));
+        addJobParam(stream, "/ftol=", QString::number(detector.tolerance));
+        endJobCommand(stream);
+        break;
+    case StagePeakArea:
+        startJobCommand(stream, "area_nl1");
+        addDataSource(stream, dataSource);
+        addJobParam(stream, "/channels=", QString::number(detector.peakAreaRegionStart) + "," + QString::number(detector.peakAreaRegionEnd));
+        addJobParam(stream, "/fcont=", QString::number(detector.continuum));
+        if(detector.criticalLevelTest)
+            addJobParamSingle(stream, "/critlevel");
+        if(detector.useFixedFWHM)
+            addJobParamSingle(stream, "/fixfwhm");
+        if(detector.useFixedTailParameter)
+            addJobParamSingle(stream, "/fixtail");
+        if(detector.fitSinglets)
+            addJobParamSingle(stream, "/fit");
+        if(detector.displayROIs)
+            addJobParamSingle(stream, "/display_rois");
+        endJobCommand(stream);
+
+        startJobCommand(stream, "pars");
+        addDataSource(stream, dataSource);
+        addJobParam(stream, "/roipsbtyp=", continuumFunctionName(detector.continuumFunction));
+        addJobParam(stream, "/prreject0pks=", detector.rejectZeroAreaPeaks ? "1" : "0");
+        addJobParam(stream, "/prfwhmpkmult=", QString::number(detector.maxFWHMsBetweenPeaks));
+        addJobParam(stream, "/prfwhmpkleft=", QString::number(detector.maxFWHMsForLeftLimit));
+        addJobParam(stream, "/prfwhmpkrght=", QString::number(detector.maxFWHMsForRightLimit));
+        endJobCommand(stream);
+        break;
+    case StageBackground:
+        startJobCommand(stream, "areacor");
+        addDataSource(stream, dataSource);
+        addJobParamQuoted(stream, "/bkgnd=", detector.backgroundSubtract);
+        endJobCommand(stream);
+        break;
+    case StageEfficiency:
+        startJobCommand(stream, "effcor");
+        addDataSource(stream, dataSource);
+        addJobParamSingle(stream, "/" + efficiencyCalibrationName(detector.efficiencyCalibrationType));
+        endJobCommand(stream);
+        break;
+    case StageNuclideId:
+        startJobCommand(stream, "nid_intf");
+        addDataSource(stream, dataSource);
+        addJobParamQuoted(stream, "/LIBRARY=", detector.NIDLibrary);
+        addJobParam(stream, "/CONFID=", QString::number(detector.NIDConfidenceTreshold));
+        if(detector.performMDATest)
+            addJobParamSingle(stream, "/MDA_TEST");
+        if(detector.inhibitATDCorrection)
+            addJobParamSingle(stream, "/NOACQDECAY");
+        endJobCommand(stream);
+        break;
+    case StageMDA:
+        startJobCommand(stream, "pars");
+        addDataSource(stream, dataSource);
+        addJobParam(stream, "/PRUSESTRLIB=", detector.useStoredLibrary ? "1" : "0");
+        addJobParam(stream, "/MDACONFID=", QString::number(detector.MDAConfidenceFactor));
+        endJobCommand(stream);
+
+        startJobCommand(stream, "MDA");
+        addDataSource(stream, dataSource);
+        endJobCommand(stream);
+        break;
+    case StageReport:
+        startJobCommand(stream, "pars");
+        addDataSource(stream, dataSource);
+        addJobParamQuoted(stream, "/activunits=", "Bq");
+        addJobParam(stream, "/ACTIVMULT=", "37000");
+        endJobCommand(stream);
+
+        startJobCommand(stream, "report");
+        addDataSource(stream, dataSource);
+        addJobParamQuoted(stream, "/template=", settings.templateName);
+        addJobParamSingle(stream, "/newfile");
+        addJobParamSingle(stream, "/firstpg");
+        addJobParamSingle(stream, "/newpg");
+        addJobParamQuoted(stream, "/outfile=", baseFilename + ".RPT");
+        addJobParamQuoted(stream, "/section=", "");
+        addJobParam(stream, "/EM=", QString::number(settings.errorMultiplier));
+        endJobCommand(stream);
+        break;
+    default:
+        break;
+    }
+}
+
+void writeAnalysisCommands(QTextStream& stream, const QString& dataSource, const QString& baseFilename,
+                           const Detector& detector, const Settings& settings)
+{
+    for(int stage=0; stage<AnalysisStageCount; stage++)
+        writeAnalysisStage(stream, (AnalysisStage)stage, dataSource, baseFilename, detector, settings);
+}
+
+// Analysis, saving the spectrum and the .DONE marker, the part of a job script
+// after the acquisition
+static void writeJobTemplate(QTextStream& stream, const QString& baseFilename, const QString& detectorName,
+                             const Detector& detector, const Settings& settings)
+{
+    writeAnalysisCommands(stream, "det:" + detectorName, baseFilename, detector, settings);
+
+    /*startJobCommand(stream, "dataplot");
+    addJobParam(stream, "det:", detectorName);
+    addJobParam(stream, "/scale=", "log");
+    addJobParamSingle(stream, "/enhplot");
+    endJobCommand(stream);*/
+
+    startJobCommand(stream, "movedata");
+    addJobParam(stream, "det:", detectorName);
+    addJobParamQuoted(stream, "", baseFilename + ".CNF");
+    addJobParamSingle(stream, "/overwrite");
+    endJobCommand(stream);
+
+    startJobCommand(stream, "copy");
+    addJobParamSingle(stream, "/y NUL \"" + baseFilename + ".DONE\" >NUL");
+    endJobCommand(stream);
+}
+
+struct JobTemplate
+{
+    QByteArray fingerprint;
+    QString script;
+};
+
+static QMutex templateMutex;
+static QHash<QString, JobTemplate> jobTemplates;
+
+// Everything a template is built from. The whole detector configuration is in it, not
+// only the fields the analysis uses today; the spectrum counter, the channel count and
+// the in use and enabled flags change without changing any job script.
+static QByteArray templateFingerprint(const QString& baseFilename, const Detector& detector, const Settings& settings)
+{
+    QByteArray data;
+    QDataStream s(&data, QIODevice::WriteOnly);
+    s << baseFilename << detector.name << detector.backgroundSubtract << detector.NIDLibrary << detector.beakers
+      << detector.significanceTreshold << detector.tolerance << detector.continuum << detector.maxFWHMsBetweenPeaks
+      << detector.maxFWHMsForLeftLimit << detector.maxFWHMsForRightLimit << detector.presetType1Value
+      << detector.presetType2Value << detector.randomError << detector.systematicError << detector.NIDConfidenceTreshold
+      << detector.MDAConfidenceFactor << qint32(detector.searchRegionStart) << qint32(detector.searchRegionEnd)
+      << qint32(detector.peakAreaRegionStart) << qint32(detector.peakAreaRegionEnd)
+      << qint32(detector.presetType1ChannelStart) << qint32(detector.presetType1ChannelEnd)
+      << qint32(detector.continuumFunction) << qint32(detector.efficiencyCalibrationType) << qint32(detector.presetType1)
+      << qint32(detector.presetType2) << qint32(detector.presetType2Unit) << detector.criticalLevelTest
+      << detector.useFixedFWHM << detector.useFixedTailParameter << detector.fitSinglets << detector.displayROIs
+      << detector.rejectZeroAreaPeaks << detector.performMDATest << detector.inhibitATDCorrection
+      << detector.useStoredLibrary
+      << settings.genieFolder << settings.templateName << settings.sectionName << settings.errorMultiplier
+      << settings.NAIImportFolder << settings.RPTExportFolder;
+    return QCryptographicHash::hash(data, QCryptographicHash::Md5);
+}
+
+static QString buildJobTemplate(const QString& baseFilename, const Detector& detector, const Settings& settings)
+{
+    QString script;
+    QTextStream stream(&script);
+    writeJobTemplate(stream, baseFilename, detector.name, detector, settings);
+    stream.flush();
+    return script;
+}
+
+static void storeJobTemplate(const QString& detectorName, const QByteArray& fingerprint, const QString& script)
+{
+    JobTemplate t;
+    t.fingerprint = fingerprint;
+    t.script = script;
+    jobTemplates.insert(detectorName, t);
+}
+
+void compileJobTemplate(const QString& baseFilename, const Detector& detector, const Settings& settings)
+{
+    QByteArray fingerprint = templateFingerprint(baseFilename, detector, settings);
+    QString script = buildJobTemplate(baseFilename, detector, settings);
+    QMutexLocker lock(&templateMutex);
+    storeJobTemplate(detector.name, fingerprint, script);
+}
+
+void invalidateJobTemplates()
+{
+    QMutexLocker lock(&templateMutex);
+    jobTemplates.clear();
+}
+
+QString jobTemplate(const QString& baseFilename, const Detector& detector, const Settings& settings)
+{
+    // A template cached from another configuration, e.g. by a thread that had not seen
+    // the new settings yet, does not match and is built again
+    QByteArray fingerprint = templateFingerprint(baseFilename, detector, settings);
+    {
+        QMutexLocker lock(&templateMutex);
+        QHash<QString, JobTemplate>::const_iterator iter = jobTemplates.constFind(detector.name);
+        if(iter != jobTemplates.constEnd() && iter->fingerprint == fingerprint)
+            return iter->script;
+    }
+
+    QString script = buildJobTemplate(baseFilename, detector, settings);
+    QMutexLocker lock(&templateMutex);
+    storeJobTemplate(detector.name, fingerprint, script);
+    return script;
+}
+
+bool writeJobScript(QTextStream& stream, const QString& baseFilename, const SampleInput& sampleInput,
+                    const Detector& detector, const Settings& settings, const QString& username,
+                    const QString& startBarrier)
+{
+    startJobCommand(stream, "pars");
+    addJobParam(stream, "det:", sampleInput.detector);
+    addJobParamQuoted(stream, "/stitle=", sampleInput.title);
+    addJobParamQuoted(stream, "/scollname=", username);
+    addJobParamQuoted(stream, "/sdesc1=", sampleInput.description);
+    addJobParamQuoted(stream, "/sdesc4=", sampleInput.specterref);
+    addJobParamQuoted(stream, "/sident=", sampleInput.ID);
+    addJobParamQuoted(stream, "/stype=", sampleInput.type);
+    addJobParam(stream, "/squant=", sampleInput.quantity);
+    addJobParam(stream, "/squanterr=", sampleInput.quantityError);
+    addJobParamQuoted(stream, "/sunits=", sampleInput.units);
+    addJobParamQuoted(stream, "/sgeomtry=", sampleInput.geometry);
+    addJobParamQuoted(stream, "/builduptype=", sampleInput.builduptype);
+    addJobParamQuoted(stream, "/stime=", sampleInput.startTime);
+    if(sampleInput.builduptype == "IRRAD" || sampleInput.builduptype == "DEPOSIT")
+        addJobParamQuoted(stream, "/sdeposit=", sampleInput.endTime);
+    endJobCommand(stream);
+
+    startJobCommand(stream, "pars");
+    addJobParam(stream, "det:", sampleInput.detector);
+    addJobParam(stream, "/ssyserr=", sampleInput.randomError);
+    addJobParam(stream, "/ssysterr=", sampleInput.systematicError);
+    endJobCommand(stream);
+
+    startJobCommand(stream, "movedata");
+    addJobParamQuoted(stream, "", detector.beakers.value(sampleInput.geometry));
+    addJobParam(stream, "det:", sampleInput.detector);
+    addJobParamSingle(stream, "/effcal");
+    addJobParamSingle(stream, "/overwrite");
+    endJobCommand(stream);
+
+    if(!startBarrier.isEmpty())
+    {
+        startJobCommand(stream, "copy");
+        addJobParamSingle(stream, "/y NUL \"" + baseFilename + ".RDY\" >NUL");
+        endJobCommand(stream);
+
+        // Polled once a second, ping is the one sleep cmd has that works without a
+        // console (timeout fails with redirected input); the acquisitions of a group
+        // start within a second of each other
+        stream << ":startbarrier\n";
+        startJobCommand(stream, "if");
+        addJobParamSingle(stream, "not exist \"" + startBarrier + "\" (ping -n 2 127.0.0.1 >NUL & goto startbarrier)");
+        endJobCommand(stream);
+    }
+
+    startJobCommand(stream, "startmca");
+    addJobParam(stream, "det:", sampleInput.detector);
+
+    QString presetType = "";
+    if(sampleInput.presetType1 == "AREA")
+        presetType = "/AREAPRESET=";
+    else if(sampleInput.presetType1 == "INTEGRAL")
+        presetType = "/INTPRESET=";
+    else if(sampleInput.presetType1 == "COUNT")
+        presetType = "/CNTSPRESET=";
+
+    if(!presetType.isEmpty())
+        addJobParam(stream, presetType, sampleInput.presetType1Value + "," +
+                    sampleInput.presetType1StartChannel + "," + sampleInput.presetType1EndChannel);
+
+    presetType = "";
+    if(sampleInput.presetType2 == "REALTIME")
+        presetType = "/REALPRESET=";
+    else if(sampleInput.presetType2 == "LIVETIME")
+        presetType = "/LIVEPRESET=";
+
+    if(!presetType.isEmpty())
+        addJobParam(stream, presetType, sampleInput.presetType2Value);
+
+    endJobCommand(stream);
+
+    startJobCommand(stream, "wait");
+    addJobParam(stream, "det:", sampleInput.detector);
+    addJobParamSingle(stream, "/acq");
+    endJobCommand(stream);
+
+    // Everything from here on only depends on the detector configuration
+    if(sampleInput.detector == detector.name)
+        stream << jobTemplate(baseFilename, detector, settings);
+    else
+        writeJobTemplate(stream, baseFilename, sampleInput.detector, detector, settings);
+
+    return stream.status() == QTextStream::Ok;
+}
+
+bool writeJobFile(const QString& baseFilename, const SampleInput& sampleInput,
+                  const Detector& detector, const Settings& settings, const QString& username,
+                  const QDateTime& accepted, const QString& startBarrier)
+{
+    QFile jobfile(baseFilename + ".BAT");
+    if(!jobfile.open(QIODevice::WriteOnly | QIODevice::Text | QIODevice::Truncate))
+        return false;
+
+    QTextStream stream(&jobfile);
+    bool ok;
+    if(jobTraceEnabled())
+    {
+        beginJobTrace(baseFilename, accepted);
+
+        QString script;
+        QTextStream scriptStream(&script);
+        ok = writeJobScript(scriptStream, baseFilename, sampleInput, detector, settings, username, startBarrier);
+        scriptStream.flush();
+        stream << instrumentJobScript(script, baseFilename);
+
+        traceJobEvent(baseFilename, 'i', "script written");
+    }
+    else
+        ok = writeJobScript(stream, baseFilename, sampleInput, detector, settings, username, startBarrier);
+    stream.flush();
+    jobfile.close();
+
+    if(ok)
+    {
+        QMap<QString, QString> fields;
+        fields.insert("id", sampleInput.ID);
+        fields.insert("title", sampleInput.title);
+        fields.insert("spectrum", sampleInput.specterref);
+        journalJob(detector.name, JournalAccepted, fields);
+    }
+    return ok;
+}
+
+bool writePrintFile(const QString& baseFilename, const QString& detectorName, const Settings& settings)
+{
+    QFile jobfile(baseFilename + ".PNT");
+    if(!jobfile.open(QIODevice::WriteOnly | QIODevice::Text | QIODevice::Truncate))
+        return false;
+
+    QTextStream stream(&jobfile);
+
+    startJobCommand(stream, "report");
+    addJobParam(stream, "det:", detectorName);
+    addJobParamQuoted(stream, "/template=", settings.templateName);
+    addJobParamSingle(stream, "/newfile");
+    addJobParamSingle(stream, "/firstpg");
+    addJobParamSingle(stream, "/newpg");
+    addJobParamQuoted(stream, "/outfile=", baseFilename + ".RPT"); // FIXME
+    addJobParamQuoted(stream, "/section=", "");
+    addJobParam(stream, "/EM=", QString::number(settings.errorMultiplier));
+    addJobParamSingle(stream, "/PRINT");
+    endJobCommand(stream);
+
+    startJobCommand(stream, "dataplot");
+    addJobParam(stream, "det:", detectorName);
+    addJobParam(stream, "/scale=", "log");
+    addJobParamSingle(stream, "/enhplot");
+    endJobCommand(stream);
+
+    stream.flush();
+    jobfile.close();
+    return true;
+}
+
+// Only paths with spaces are quoted, the command lines of other jobs stay as they were
+static QString commandLinePath(const QString& path)
+{
+    return path.contains(' ') ? "\"" + path + "\"" : path;
+}
+
+QString jobCommandLine(const QString& baseFilename)
+{
+    return commandLinePath(baseFilename + ".BAT") + " >" + commandLinePath(baseFilename + ".OUT")
+            + " 2>" + commandLinePath(baseFilename + ".ERR");
+}
+
+bool detectorHasJob(const QString& tempDirectory, const QString& detectorName)
+{
+    return QFile::exists(tempDirectory + detectorName + ".BAT");
+}
+
+bool detectorHasFinishedJob(const QString& tempDirectory, const QString& detectorName)
+{
+    return QFile::exists(tempDirectory + detectorName + ".DONE");
+}
+
+QString archivePath(const QString& archiveDirectory, const QString& detectorName, int year)
+{
+    return archiveDirectory + QString::number(year) + QDir::separator() + detectorName + QDir::separator();
+}
+
+QString archiveBaseName(const QString& detectorName, int year, int spectrumCounter)
+{
+    return QString("%1%2%3").arg(detectorName).arg(year % 1000, 2, 10, QChar('0')).arg(spectrumCounter, 4, 10, QChar('0'));
+}
+
+bool syncFile(QFile& file)
+{
+    if(!file.flush())
+        return false;
+#ifdef Q_OS_WIN
+    return _commit(file.handle()) == 0;
+#else
+    return fsync(file.handle()) == 0;
+#endif
+}
+
+static bool syncDirectory(const QString& path)
+{
+#ifdef Q_OS_WIN
+    // NTFS commits renames with its own log, directories cannot be flushed
+    Q_UNUSED(path);
+    return true;
+#else
+    int fd = ::open(QFile::encodeName(path).constData(), O_RDONLY);
+    if(fd < 0)
+        return false;
+    bool ok = fsync(fd) == 0;
+    ::close(fd);
+    return ok;
+#endif
+}
+
+QByteArray fileChecksum(const QString& filename)
+{
+    QFile file(filename);
+    if(!file.open(QIODevice::ReadOnly))
+        return QByteArray();
+
+    QCryptographicHash hash(QCryptographicHash::Sha256);
+    while(!file.atEnd())
+    {
+        QByteArray chunk = file.read(1 << 16);
+        if(chunk.isEmpty())
+            return QByteArray();
+        hash.addData(chunk);
+    }
+    return hash.result();
+}
+
+// Copies source to target, syncs it and reads it back against the checksum of the source
+static bool copyVerified(const QString& source, const QString& target, QByteArray& checksum, QString* error)
+{
+    QFile in(source), out(target);
+    if(!in.open(QIODevice::ReadOnly) || !out.open(QIODevice::WriteOnly | QIODevice::Truncate))
+    {
+        if(error)
+            *error = "Unable to open " + (in.isOpen() ? target : source);
+        return false;
+    }
+
+    QCryptographicHash hash(QCryptographicHash::Sha256);
+    while(!in.atEnd())
+    {
+        QByteArray chunk = in.read(1 << 16);
+        hash.addData(chunk);
+        if(chunk.isEmpty() || out.write(chunk) != chunk.size())
+        {
+            if(error)
+                *error = "Unable to copy " + source + " to " + target;
+            return false;
+        }
+    }
+
+    if(!syncFile(out))
+    {
+        if(error)
+            *error = "Unable to sync " + target;
+        return false;
+    }
+    out.close();
+
+    checksum = hash.result();
+    if(fileChecksum(target) != checksum)
+    {
+        if(error)
+            *error = "Checksum mismatch after copying " + source + " to " + target;
+        return false;
+    }
+    return true;
+}
+
+static bool isChunkedExtension(const QString& ext)
+{
+    for(unsigned int i=0; i<sizeof(jobChunkedExtensions) / sizeof(jobChunkedExtensions[0]); i++)
+    {
+        if(ext == jobChunkedExtensions[i])
+            return true;
+    }
+    return false;
+}
+
+// Stores the chunks of source and writes its recipe to target, reads it back through
+// the chunk store against the checksum of the source
+static bool chunkVerified(const QString& source, const QString& target, const QString& chunkDirectory,
+                          QByteArray& checksum, ChunkRecipe& recipe, QString* error)
+{
+    QFile in(source);
+    if(!in.open(QIODevice::ReadOnly))
+    {
+        if(error)
+            *error = "Unable to open " + source;
+        return false;
+    }
+    QByteArray data = in.readAll();
+    checksum = QCryptographicHash::hash(data, QCryptographicHash::Sha256);
+
+    if(!storeChunks(chunkDirectory, data, recipe, error))
+        return false;
+
+    ChunkRecipe stored;
+    QByteArray readBack;
+    if(!writeChunkRecipe(target, recipe) || !readChunkRecipe(target, stored) || !readChunks(stored, readBack)
+            || QCryptographicHash::hash(readBack, QCryptographicHash::Sha256) != checksum)
+    {
+        releaseChunks(recipe);
+        recipe.chunks.clear();
+        if(error)
+            *error = "Unable to verify chunks of " + source + " in " + chunkDirectory;
+        return false;
+    }
+    return true;
+}
+
+bool storeJob(const QString& tempDirectory, const QString& archiveDirectory, const Detector& detector,
+              QString* archiveBaseFilename, QString* error, StoreProgress progress)
+{
+    // The spectrum counter must already be incremented for the job being stored
+    QString baseFilename = tempDirectory + detector.name;
+    QDate date = QDate::currentDate();
+    QString fname = archiveBaseName(detector.name, date.year(), detector.spectrumCounter);
+    QString currPath = archivePath(archiveDirectory, detector.name, date.year());
+    QString targetBase = (currPath + fname).toUpper();
+
+    if(!QDir(currPath).exists() && !QDir().mkpath(currPath))
+    {
+        if(error)
+            *error = "Unable to create " + currPath;
+        return false;
+    }
+
+    // The job trace (.JSON) is archived with the job. The .JTR is kept until the store
+    // has committed, so a failed store can be retried without losing the trace.
+    traceJobEvent(baseFilename, 'i', "store");
+    writeJobTrace(baseFilename, detector.name);
+
+    QStringList extensions;
+    for(unsigned int i=0; i<sizeof(jobFileExtensions) / sizeof(jobFileExtensions[0]); i++)
+    {
+        QString ext = jobFileExtensions[i];
+        if(QFile::exists(baseFilename + ext))
+        {
+            if(QFile::exists(targetBase + ext) || QFile::exists(targetBase + ext + ".REF"))
+            {
+                if(error)
+                    *error = targetBase + ext + " is already archived";
+                return false;
+            }
+            extensions << ext;
+        }
+    }
+
+    // Stage: verified copies next to their final names, TEMP stays as it is until the
+    // job is committed. The archive may be on another volume, so nothing is renamed
+    // across directories.
+    // The manifest has the checksums of the original contents, for recipes too, under
+    // the name of the file the recipe stands for.
+    QString chunkDirectory = archiveDirectory + "CHUNKS/";
+    QString manifest;
+    QStringList written;
+    QList<ChunkRecipe> recipes;
+    bool ok = true;
+    for(int i=0; ok && i<extensions.count(); i++)
+    {
+        QByteArray checksum;
+        if(isChunkedExtension(extensions[i]))
+        {
+            QString part = targetBase + extensions[i] + ".REF.PART";
+            written << part;
+            ChunkRecipe recipe;
+            ok = chunkVerified(baseFilename + extensions[i], part, chunkDirectory, checksum, recipe, error);
+            recipes << recipe;
+        }
+        else
+        {
+            QString part = targetBase + extensions[i] + ".PART";
+            written << part;
+            ok = copyVerified(baseFilename + extensions[i], part, checksum, error);
+        }
+        manifest += checksum.toHex() + "  " + QFileInfo(targetBase + extensions[i]).fileName() + "\n";
+        if(progress)
+            progress(i + 1, extensions.count() + 1);
+    }
+
+    if(ok)
+    {
+        QFile sum(targetBase + ".SUM.PART");
+        written << sum.fileName();
+        ok = sum.open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Text)
+                && sum.write(manifest.toUtf8()) == manifest.toUtf8().size() && syncFile(sum);
+        if(!ok && error)
+            *error = "Unable to write " + sum.fileName();
+    }
+
+    // Commit: renames within the archive directory, the manifest last. An archived
+    // job without its .SUM was never completely stored.
+    for(int i=0; ok && i<written.count(); i++)
+    {
+        QString target = written[i].left(written[i].length() - 5);
+        ok = QFile::rename(written[i], target);
+        if(ok)
+            written[i] = target;
+        else if(error)
+            *error = "Unable to rename " + written[i];
+    }
+
+    if(!ok)
+    {
+        // Nothing in TEMP was touched, removing what was written undoes the store
+        foreach(const QString& file, written)
+            QFile::remove(file);
+        foreach(const ChunkRecipe& recipe, recipes)
+            releaseChunks(recipe);
+        return false;
+    }
+    syncDirectory(currPath);
+    if(progress)
+        progress(extensions.count() + 1, extensions.count() + 1);
+
+    closeJobMetrics(baseFilename, detector.name, true);
+    finishJobTrace(baseFilename, detector.name);
+
+    foreach(const QString& ext, extensions)
+        QFile::remove(baseFilename + ext);
+
+    for(unsigned int i=0; i<sizeof(jobTempExtensions) / sizeof(jobTempExtensions[0]); i++)
+    {
+        QString ext = jobTempExtensions[i];
+        if(QFile::exists(baseFilename + ext))
+            QFile::remove(baseFilename + ext);
+    }
+
+    if(archiveBaseFilename)
+        *archiveBaseFilename = targetBase;
+
+    QMap<QString, QString> fields;
+    fields.insert("archive", targetBase);
+    journalJob(detector.name, JournalStored, fields);
+    return true;
+}
+
+bool rejectJob(const QString& tempDirectory, const QString& detectorName)
+{
+    QString baseFilename = tempDirectory + detectorName;
+    bool ok = true;
+
+    closeJobMetrics(baseFilename, detectorName, false);
+    traceJobEvent(baseFilename, 'i', "reject");
+    finishJobTrace(baseFilename, detectorName);
+
+    for(unsigned int i=0; i<sizeof(jobFileExtensions) / sizeof(jobFileExtensions[0]); i++)
+    {
+        QString ext = jobFileExtensions[i];
+        if(QFile::exists(baseFilename + ext) && !QFile::remove(baseFilename + ext))
+            ok = false;
+    }
+
+    for(unsigned int i=0; i<sizeof(jobTempExtensions) / sizeof(jobTempExtensions[0]); i++)
+    {
+        QString ext = jobTempExtensions[i];
+        if(QFile::exists(baseFilename + ext) && !QFile::remove(baseFilename + ext))
+            ok = false;
+    }
+
+    journalJob(detectorName, JournalRejected);
+    return ok;
+}
+
+bool failJob(const QString& tempDirectory, const QString& detectorName, const QString& reason)
+{
+    QString baseFilename = tempDirectory + detectorName;
+    QString failedPath = tempDirectory + "FAILED/";
+    if(!QDir(failedPath).exists() && !QDir().mkpath(failedPath))
+        return false;
+
+    traceJobEvent(baseFilename, 'i', "failed: " + reason);
+    finishJobTrace(baseFilename, detectorName);
+
+    // Kept for inspection, the detector is free again
+    QString failedBase = failedPath + detectorName + QDateTime::currentDateTime().toString("-yyyyMMdd-HHmmss");
+    bool ok = true;
+    for(unsigned int i=0; i<sizeof(jobFileExtensions) / sizeof(jobFileExtensions[0]); i++)
+    {
+        QString ext = jobFileExtensions[i];
+        if(QFile::exists(baseFilename + ext) && !QFile::rename(baseFilename + ext, (failedBase + ext).toUpper()))
+            ok = false;
+    }
+
+    for(unsigned int i=0; i<sizeof(jobTempExtensions) / sizeof(jobTempExtensions[0]); i++)
+    {
+        QString ext = jobTempExtensions[i];
+        if(QFile::exists(baseFilename + ext) && !QFile::remove(baseFilename + ext))
+            ok = false;
+    }
+
+    QMap<QString, QString> fields;
+    fields.insert("error", reason);
+    journalJob(detectorName, JournalFailed, fields);
+    return ok;
+}
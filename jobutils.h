@@ -0,0 +1,88 @@
+#ifndef JOBUTILS_H
+#define JOBUTILS_H
+
+#include <QString>
+#include <QDateTime>
+#include <QByteArray>
+#include <functional>
+
+class QFile;
+class QTextStream;
+struct Settings;
+struct Detector;
+struct SampleInput;
+
+// Signature shared by the Genie job runner (winutils) and the simulated runner (simjob)
+typedef bool (*JobRunner)(const QString& cmd);
+
+void startJobCommand(QTextStream& s, const QString& cmd);
+void endJobCommand(QTextStream& s);
+void addJobParam(QTextStream& s, const QString& p, const QString& v);
+void addJobParamSingle(QTextStream& s, const QString& v);
+void addJobParamQuoted(QTextStream& s, const QString& p, const QString& v);
+
+void defaultSampleInput(const Detector& detector, SampleInput& sampleInput);
+
+// Analysis steps of a job in script order. Each stage only reads what earlier stages
+// left in the spectrum, see analysiscache.h
+enum AnalysisStage
+{
+    StagePeakSearch, StagePeakArea, StageBackground, StageEfficiency, StageNuclideId, StageMDA, StageReport,
+    AnalysisStageCount
+};
+
+// dataSource is "det:<name>" or the path of a spectrum file
+void writeAnalysisStage(QTextStream& stream, AnalysisStage stage, const QString& dataSource, const QString& baseFilename,
+                        const Detector& detector, const Settings& settings);
+void writeAnalysisCommands(QTextStream& stream, const QString& dataSource, const QString& baseFilename,
+                           const Detector& detector, const Settings& settings);
+// The part of a job script that only depends on the detector and settings is compiled
+// once per detector and reused by writeJobScript. Each template is kept with a hash of
+// the configuration it was built from and built again when the hash differs;
+// compileJobTemplate builds it ahead when the detector configuration is saved and
+// invalidateJobTemplates frees the cache.
+void compileJobTemplate(const QString& baseFilename, const Detector& detector, const Settings& settings);
+void invalidateJobTemplates();
+QString jobTemplate(const QString& baseFilename, const Detector& detector, const Settings& settings);
+
+// With startBarrier set the job touches <baseFilename>.RDY before startmca and waits
+// until the startBarrier file exists, see jobgroup.h
+bool writeJobScript(QTextStream& stream, const QString& baseFilename, const SampleInput& sampleInput,
+                    const Detector& detector, const Settings& settings, const QString& username,
+                    const QString& startBarrier = QString());
+// accepted is when the sample was accepted, for the job trace (now if invalid)
+bool writeJobFile(const QString& baseFilename, const SampleInput& sampleInput,
+                  const Detector& detector, const Settings& settings, const QString& username,
+                  const QDateTime& accepted = QDateTime(), const QString& startBarrier = QString());
+bool writePrintFile(const QString& baseFilename, const QString& detectorName, const Settings& settings);
+QString jobCommandLine(const QString& baseFilename);
+
+bool detectorHasJob(const QString& tempDirectory, const QString& detectorName);
+bool detectorHasFinishedJob(const QString& tempDirectory, const QString& detectorName);
+
+QString archivePath(const QString& archiveDirectory, const QString& detectorName, int year);
+QString archiveBaseName(const QString& detectorName, int year, int spectrumCounter);
+
+// Flushes the file and its data to disk
+bool syncFile(QFile& file);
+// SHA-256 of a file's contents, empty if it cannot be read
+QByteArray fileChecksum(const QString& filename);
+
+// done of total artifacts staged, the last step is the commit
+typedef std::function<void(int done, int total)> StoreProgress;
+
+// Stores a finished job in the archive as one transaction: every job file is copied
+// next to its archive name as .PART, synced and read back against its checksum, then
+// all are renamed into place followed by a <archive base>.SUM manifest (sha256sum
+// format). The job script and logs go to the chunk store in <archive>/CHUNKS and are
+// archived as .REF recipes, see chunkstore.h; the manifest lists them under their own
+// names with the checksums of their contents, which only archivedFileChecksum can
+// verify (sha256sum -c reports them missing). TEMP is only cleaned after the commit;
+// on failure nothing is left behind in the archive and the job stays in TEMP.
+bool storeJob(const QString& tempDirectory, const QString& archiveDirectory, const Detector& detector,
+              QString* archiveBaseFilename = 0, QString* error = 0, StoreProgress progress = StoreProgress());
+bool rejectJob(const QString& tempDirectory, const QString& detectorName);
+// Moves the files of a job that cannot finish to <tempDirectory>/FAILED/<detector>-<time>.*
+bool failJob(const QString& tempDirectory, const QString& detectorName, const QString& reason);
+
+#endif // JOBUTILS_H
@@ -0,0 +1,362 @@
+#include <QFile>
+#include <QFileInfo>
+#include <QDateTime>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QSet>
+#include <QList>
+#include <QStringList>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QThreadStorage>
+#include <QTimer>
+#include <QTextStream>
+#include <atomic>
+#include "metrics.h"
+#include "reportparser.h"
+#include "jobjournal.h"
+
+static const int maxDetectors = 64;
+
+// Upper bounds in seconds, from short analyses to day long acquisitions
+static const double bucketBounds[] = { 1, 10, 30, 60, 300, 600, 1800, 3600, 7200, 14400, 43200, 86400 };
+static const int bucketCount = sizeof(bucketBounds) / sizeof(bucketBounds[0]);
+
+static const char* counterNames[MetricCounterCount][2] = {
+    { "nailab_jobs_started_total", "Jobs started" },
+    { "nailab_jobs_finished_total", "Jobs whose script ran to the end" },
+    { "nailab_jobs_failed_total", "Jobs whose script stopped before the end" },
+    { "nailab_jobs_stored_total", "Finished jobs stored to the archive" },
+    { "nailab_jobs_rejected_total", "Finished jobs rejected" },
+    { "nailab_jobs_refused_total", "Jobs refused by the preflight checks" },
+    { "nailab_qa_violations_total", "Check source measurements out of control" },
+    { "nailab_drift_alerts_total", "Energy calibration drift alerts" },
+    { "nailab_journal_errors_total", "Job transitions the journal could not write" }
+};
+
+static const char* histogramNames[MetricHistogramCount][2] = {
+    { "nailab_acquisition_live_time_seconds", "Acquisition live time" },
+    { "nailab_acquisition_real_time_seconds", "Acquisition real time" },
+    { "nailab_job_duration_seconds", "Job script duration" },
+    { "nailab_analysis_duration_seconds", "Job duration minus acquisition real time" },
+    { "nailab_detector_idle_seconds", "Time a detector was free before its next job" },
+    { "nailab_store_delay_seconds", "Time from a finished job to it being stored or rejected" }
+};
+
+// Written by one thread at a time, read by the exporter
+struct MetricShard
+{
+    std::atomic<quint64> counters[maxDetectors][MetricCounterCount];
+    std::atomic<quint64> buckets[maxDetectors][MetricHistogramCount][bucketCount + 1];
+    std::atomic<quint64> sumMs[maxDetectors][MetricHistogramCount];
+
+    MetricShard()
+    {
+        for(int d=0; d<maxDetectors; d++)
+        {
+            for(int c=0; c<MetricCounterCount; c++)
+                counters[d][c].store(0);
+            for(int h=0; h<MetricHistogramCount; h++)
+            {
+                sumMs[d][h].store(0);
+                for(int b=0; b<=bucketCount; b++)
+                    buckets[d][h][b].store(0);
+            }
+        }
+    }
+};
+
+struct MetricRegistry
+{
+    QMutex mutex;
+    QHash<QString, int> detectorSlots;
+    QStringList detectorNames;
+    QSet<QString> droppedDetectors;
+    QList<MetricShard*> shards;
+    QList<MetricShard*> freeShards;
+    std::atomic<qint64> lastClosedMs[maxDetectors];
+
+    MetricRegistry()
+    {
+        for(int i=0; i<maxDetectors; i++)
+            lastClosedMs[i].store(0);
+    }
+};
+
+static MetricRegistry& registry()
+{
+    // Never destroyed, thread storage cleanup at exit still returns shards to it
+    static MetricRegistry *r = new MetricRegistry;
+    return *r;
+}
+
+// Shards outlive their threads and go back to the free list, pool threads come and go.
+// The detector slots a thread has looked up are cached in its handle, a slot never
+// changes once it is given out.
+class ShardHandle
+{
+public:
+
+    explicit ShardHandle(MetricShard *shard) : mShard(shard) {}
+
+    ~ShardHandle()
+    {
+        MetricRegistry& r = registry();
+        QMutexLocker lock(&r.mutex);
+        r.freeShards.append(mShard);
+    }
+
+    MetricShard *shard() const { return mShard; }
+    QHash<QString, int>& detectorSlots() { return mSlots; }
+
+private:
+
+    MetricShard *mShard;
+    QHash<QString, int> mSlots;
+};
+
+static QThreadStorage<ShardHandle*> threadShards;
+
+static ShardHandle* localHandle()
+{
+    if(!threadShards.hasLocalData())
+    {
+        MetricRegistry& r = registry();
+        MetricShard *shard;
+        {
+            QMutexLocker lock(&r.mutex);
+            if(r.freeShards.isEmpty())
+            {
+                shard = new MetricShard;
+                r.shards.append(shard);
+            }
+            else
+                shard = r.freeShards.takeLast();
+        }
+        threadShards.setLocalData(new ShardHandle(shard));
+    }
+    return threadShards.localData();
+}
+
+static MetricShard* localShard()
+{
+    return localHandle()->shard();
+}
+
+static int registerDetector(const QString& detectorName)
+{
+    MetricRegistry& r = registry();
+    QString key = detectorName.toUpper();
+
+    QMutexLocker lock(&r.mutex);
+    QHash<QString, int>::const_iterator iter = r.detectorSlots.constFind(key);
+    if(iter != r.detectorSlots.constEnd())
+        return iter.value();
+
+    if(r.detectorNames.count() >= maxDetectors)
+    {
+        if(!r.droppedDetectors.contains(key))
+        {
+            r.droppedDetectors.insert(key);
+            qWarning("Metrics are not recorded for detector %s, more than %d detectors", qPrintable(key), maxDetectors);
+        }
+        return -1;
+    }
+    r.detectorSlots.insert(key, r.detectorNames.count());
+    r.detectorNames.append(key);
+    return r.detectorNames.count() - 1;
+}
+
+// Only the first lookup of a detector in a thread takes the registry lock
+static int detectorSlot(const QString& detectorName)
+{
+    QHash<QString, int>& cache = localHandle()->detectorSlots();
+    QHash<QString, int>::const_iterator iter = cache.constFind(detectorName);
+    if(iter != cache.constEnd())
+        return iter.value();
+
+    int slot = registerDetector(detectorName);
+    cache.insert(detectorName, slot);
+    return slot;
+}
+
+static void countSlot(MetricCounter counter, int slot)
+{
+    if(slot >= 0)
+        localShard()->counters[slot][counter].fetch_add(1, std::memory_order_relaxed);
+}
+
+static void observeSlot(MetricHistogram histogram, int slot, double seconds)
+{
+    if(slot < 0)
+        return;
+
+    int bucket = 0;
+    while(bucket < bucketCount && seconds > bucketBounds[bucket])
+        bucket++;
+
+    MetricShard *shard = localShard();
+    shard->buckets[slot][histogram][bucket].fetch_add(1, std::memory_order_relaxed);
+    shard->sumMs[slot][histogram].fetch_add(quint64(qMax(0.0, seconds) * 1000.0 + 0.5), std::memory_order_relaxed);
+}
+
+void countMetric(MetricCounter counter, const QString& detectorName)
+{
+    countSlot(counter, detectorSlot(detectorName));
+}
+
+void observeMetric(MetricHistogram histogram, const QString& detectorName, double seconds)
+{
+    observeSlot(histogram, detectorSlot(detectorName), seconds);
+}
+
+bool runMeasuredJob(JobRunner runner, const QString& baseFilename, const QString& detectorName)
+{
+    int slot = detectorSlot(detectorName);
+    if(slot >= 0)
+    {
+        qint64 closed = registry().lastClosedMs[slot].exchange(0);
+        if(closed > 0)
+            observeSlot(MetricIdleTime, slot, (QDateTime::currentMSecsSinceEpoch() - closed) / 1000.0);
+    }
+    countSlot(MetricJobsStarted, slot);
+
+    // The job still runs, without the record it is not resumed after a crash
+    if(!journalJob(detectorName, JournalStarted))
+        countSlot(MetricJournalErrors, slot);
+
+    QElapsedTimer timer;
+    timer.start();
+    bool ok = runner(jobCommandLine(baseFilename));
+    double seconds = timer.elapsed() / 1000.0;
+
+    // The runner only fails if the script could not be started, a job that got to
+    // the end has written its .DONE. A script that stopped early stays journaled as
+    // started until it is rejected.
+    if(!ok || !QFile::exists(baseFilename + ".DONE"))
+    {
+        countSlot(MetricJobsFailed, slot);
+        return ok;
+    }
+
+    if(!journalJob(detectorName, JournalFinished))
+        countSlot(MetricJournalErrors, slot);
+    countSlot(MetricJobsFinished, slot);
+    observeSlot(MetricJobDuration, slot, seconds);
+
+    ReportParser parser;
+    ReportResult result;
+    if(parser.parseFile(baseFilename + ".RPT", result))
+    {
+        observeSlot(MetricLiveTime, slot, result.liveTime);
+        observeSlot(MetricRealTime, slot, result.realTime);
+        observeSlot(MetricAnalysisDuration, slot, qMax(0.0, seconds - result.realTime));
+    }
+    return ok;
+}
+
+void closeJobMetrics(const QString& baseFilename, const QString& detectorName, bool stored)
+{
+    int slot = detectorSlot(detectorName);
+    qint64 now = QDateTime::currentMSecsSinceEpoch();
+
+    QFileInfo done(baseFilename + ".DONE");
+    if(done.exists())
+        observeSlot(MetricStoreDelay, slot, (now - done.lastModified().toMSecsSinceEpoch()) / 1000.0);
+
+    countSlot(stored ? MetricJobsStored : MetricJobsRejected, slot);
+    if(slot >= 0)
+        registry().lastClosedMs[slot].store(now);
+}
+
+static QString escapeLabel(const QString& value)
+{
+    return QString(value).replace("\\", "\\\\").replace("\"", "\\\"");
+}
+
+bool writeMetricsFile(const QString& filename)
+{
+    MetricRegistry& r = registry();
+    QStringList names;
+    QList<MetricShard*> shards;
+    {
+        QMutexLocker lock(&r.mutex);
+        names = r.detectorNames;
+        shards = r.shards;
+    }
+
+    QString text;
+    QTextStream s(&text);
+
+    for(int c=0; c<MetricCounterCount; c++)
+    {
+        s << "# HELP " << counterNames[c][0] << " " << counterNames[c][1] << "\n";
+        s << "# TYPE " << counterNames[c][0] << " counter\n";
+        for(int d=0; d<names.count(); d++)
+        {
+            quint64 total = 0;
+            foreach(MetricShard *shard, shards)
+                total += shard->counters[d][c].load(std::memory_order_relaxed);
+            s << counterNames[c][0] << "{detector=\"" << escapeLabel(names[d]) << "\"} " << total << "\n";
+        }
+    }
+
+    for(int h=0; h<MetricHistogramCount; h++)
+    {
+        const char* name = histogramNames[h][0];
+        s << "# HELP " << name << " " << histogramNames[h][1] << "\n";
+        s << "# TYPE " << name << " histogram\n";
+        for(int d=0; d<names.count(); d++)
+        {
+            QString label = "detector=\"" + escapeLabel(names[d]) + "\"";
+            quint64 cumulative = 0, sumMs = 0;
+            for(int b=0; b<=bucketCount; b++)
+            {
+                foreach(MetricShard *shard, shards)
+                    cumulative += shard->buckets[d][h][b].load(std::memory_order_relaxed);
+                QString le = b < bucketCount ? QString::number(bucketBounds[b]) : QString("+Inf");
+                s << name << "_bucket{" << label << ",le=\"" << le << "\"} " << cumulative << "\n";
+            }
+            foreach(MetricShard *shard, shards)
+                sumMs += shard->sumMs[d][h].load(std::memory_order_relaxed);
+            s << name << "_sum{" << label << "} " << QString::number(sumMs / 1000.0, 'f', 3) << "\n";
+            s << name << "_count{" << label << "} " << cumulative << "\n";
+        }
+    }
+    s.flush();
+
+    // Scrapers must never see a half written file
+    QString tmp = filename + ".tmp";
+    QFile file(tmp);
+    if(!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+        return false;
+    QByteArray data = text.toUtf8();
+    bool ok = file.write(data) == data.size();
+    file.close();
+    if(!ok)
+        return false;
+
+    QFile::remove(filename);
+    return QFile::rename(tmp, filename);
+}
+
+MetricsExporter::MetricsExporter(const QString& filename, int intervalMs, QObject *parent)
+    : QObject(parent), mFilename(filename), mIntervalMs(intervalMs), mTimer(NULL)
+{
+}
+
+void MetricsExporter::start()
+{
+    if(mTimer)
+        return;
+
+    mTimer = new QTimer(this);
+    connect(mTimer, SIGNAL(timeout()), this, SLOT(write()));
+    mTimer->start(mIntervalMs);
+    write();
+}
+
+void MetricsExporter::write()
+{
+    writeMetricsFile(mFilename);
+}
@@ -0,0 +1,71 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <QObject>
+#include <QString>
+#include "jobutils.h"
+
+class QTimer;
+
+// Per detector job counters and duration histograms. Every thread adds to its own
+// set of atomic accumulators and caches the detector slots it has used, so recording
+// never waits on a lock or on the GUI; the exporter sums all sets when it writes the
+// Prometheus text file. Detectors past the first 64 are not recorded.
+
+enum MetricCounter
+{
+    MetricJobsStarted, MetricJobsFinished, MetricJobsFailed, MetricJobsStored, MetricJobsRejected,
+    MetricJobsRefused,      // refused by preflightJob before they were written
+    MetricQAViolations,     // check source measurements out of control
+    MetricDriftAlerts,      // calibration drift warnings and recalibration proposals
+    MetricJournalErrors,    // job transitions the journal could not write
+    MetricCounterCount
+};
+
+enum MetricHistogram
+{
+    MetricLiveTime,         // acquisition live time from the report
+    MetricRealTime,         // acquisition real time from the report
+    MetricJobDuration,      // job script start to end
+    MetricAnalysisDuration, // job duration minus acquisition real time
+    MetricIdleTime,         // detector free until its next job started
+    MetricStoreDelay,       // .DONE written until the job was stored or rejected
+    MetricHistogramCount
+};
+
+void countMetric(MetricCounter counter, const QString& detectorName);
+void observeMetric(MetricHistogram histogram, const QString& detectorName, double seconds);
+
+// Runs a job script with runner and records it as started, finished (or failed),
+// with job, acquisition and analysis durations and the detector's idle time before it
+bool runMeasuredJob(JobRunner runner, const QString& baseFilename, const QString& detectorName);
+
+// Records a finished job as stored or rejected, called before its files are moved
+void closeJobMetrics(const QString& baseFilename, const QString& detectorName, bool stored);
+
+// Prometheus text exposition format, written to a temporary file and renamed
+bool writeMetricsFile(const QString& filename);
+
+// Writes the metrics file periodically in the thread it lives in, e.g. for the
+// node_exporter textfile collector
+class MetricsExporter : public QObject
+{
+    Q_OBJECT
+
+public:
+
+    MetricsExporter(const QString& filename, int intervalMs, QObject *parent = 0);
+
+public slots:
+
+    void start();
+    void write();
+
+private:
+
+    QString mFilename;
+    int mIntervalMs;
+    QTimer *mTimer;
+};
+
+#endif // METRICS_H
@@ -0,0 +1,114 @@
+#include <QFileSystemWatcher>
+#include <QTimer>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QStringList>
+#include <QDateTime>
+#include "naiimporter.h"
+#include "jobapi.h"
+#include "dbutils.h"
+#include "sampleinput.h"
+
+NaiImporter::NaiImporter(JobApiServer *server, QObject *parent)
+    : QObject(parent), mServer(server), mWatcher(NULL), mTimer(NULL)
+{
+}
+
+void NaiImporter::start()
+{
+    mWatcher = new QFileSystemWatcher(this);
+    connect(mWatcher, SIGNAL(directoryChanged(QString)), this, SLOT(scan()));
+    connect(mServer, SIGNAL(jobFailed(qint64,QString)), this, SLOT(onJobFailed(qint64,QString)));
+
+    // Detectors becoming free do not touch the import folder, so poll as well
+    mTimer = new QTimer(this);
+    connect(mTimer, SIGNAL(timeout()), this, SLOT(scan()));
+    mTimer->start(1000);
+
+    scan();
+}
+
+void NaiImporter::updateFolder()
+{
+    QString folder = mServer->settings().NAIImportFolder;
+    if(folder == mFolder)
+        return;
+
+    if(!mFolder.isEmpty())
+        mWatcher->removePath(mFolder);
+    mFolder = folder;
+    mQueued.clear();
+    if(!mFolder.isEmpty() && QDir(mFolder).exists())
+        mWatcher->addPath(mFolder);
+}
+
+void NaiImporter::scan()
+{
+    updateFolder();
+    if(mFolder.isEmpty())
+        return;
+
+    // Back-pressure: the queue holds two samples per detector, enough for the scheduler
+    // to choose from, the rest waits on disk
+    int capacity = 2 * mServer->detectorsInUse() - mServer->queuedCount();
+    if(capacity <= 0)
+        return;
+
+    QDir dir(mFolder);
+    QStringList files = dir.entryList(QStringList() << "*.nai", QDir::Files, QDir::Time | QDir::Reversed);
+    foreach(const QString& name, files)
+    {
+        if(capacity <= 0)
+            break;
+
+        QString filename = dir.absoluteFilePath(name);
+        if(mQueued.contains(filename))
+            continue;
+
+        // Give writers a moment to finish, the poll timer picks the file up later
+        if(QFileInfo(filename).lastModified().msecsTo(QDateTime::currentDateTime()) < 1000)
+            continue;
+
+        SampleInput sampleInput;
+        QFile file(filename);
+        QString error;
+        if(!readSampleInputFile(file, sampleInput))
+            error = "Invalid sample file";
+        else if(mServer->enqueue(sampleInput, filename, error))
+        {
+            mQueued.insert(filename);
+            capacity--;
+            continue;
+        }
+
+        qWarning("Rejected sample file %s: %s", qPrintable(filename), qPrintable(error));
+        QFile::remove(filename + ".err");
+        QFile::rename(filename, filename + ".err");
+    }
+
+    // Forget files that have been renamed by the server
+    QSet<QString>::iterator iter = mQueued.begin();
+    while(iter != mQueued.end())
+    {
+        if(!QFile::exists(*iter))
+            iter = mQueued.erase(iter);
+        else
+            ++iter;
+    }
+}
+
+void NaiImporter::onJobFailed(qint64 id, const QString& sourceFile)
+{
+    Q_UNUSED(id);
+
+    if(sourceFile.isEmpty())
+        return;
+
+    mQueued.remove(sourceFile);
+    if(QFile::exists(sourceFile))
+    {
+        QFile::remove(sourceFile + ".err");
+        QFile::rename(sourceFile, sourceFile + ".err");
+    }
+}
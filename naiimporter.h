@@ -0,0 +1,44 @@
+#ifndef NAIIMPORTER_H
+#define NAIIMPORTER_H
+
+#include <QObject>
+#include <QSet>
+#include <QString>
+
+class QFileSystemWatcher;
+class QTimer;
+class JobApiServer;
+
+// Watches Settings::NAIImportFolder for .nai sample files and feeds them to the
+// job API queue. Must live in the same (worker) thread as the server. Files are only
+// read while the queue is shorter than twice the number of detectors in use, the rest
+// waits on disk. Dispatched files are renamed to .nai.ok, invalid ones to .nai.err.
+class NaiImporter : public QObject
+{
+    Q_OBJECT
+
+public:
+
+    explicit NaiImporter(JobApiServer *server, QObject *parent = 0);
+
+public slots:
+
+    void start();
+    void scan();
+
+private slots:
+
+    void onJobFailed(qint64 id, const QString& sourceFile);
+
+private:
+
+    JobApiServer *mServer;
+    QFileSystemWatcher *mWatcher;
+    QTimer *mTimer;
+    QString mFolder;
+    QSet<QString> mQueued;
+
+    void updateFolder();
+};
+
+#endif // NAIIMPORTER_H
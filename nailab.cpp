@@ -5,6 +5,7 @@
 #include <QDir>
 #include <QDate>
 #include <QFileDialog>
+#include <QInputDialog>
 #include <QListWidgetItem>
 #include <QTreeWidgetItem>
 #include <QTreeWidgetItemIterator>
@@ -13,11 +14,23 @@
 #include "nailab.h"
 #include "dbutils.h"
 #include "winutils.h"
+#include "jobutils.h"
+#include "jobtrace.h"
+#include "jobjournal.h"
+#include "archivestore.h"
+#include "chunkstore.h"
+#include "preflight.h"
+#include "startupconfig.h"
+#include "naiimporter.h"
 #include "sampleinput.h"
 #include "exceptions.h"
 
 Nailab::Nailab(QWidget *parent)
-    : QMainWindow(parent)
+    : QMainWindow(parent), vdm(NULL), dlgNewBeaker(NULL), dlgNewDetector(NULL), dlgNewDetectorBeaker(NULL), dlgEditDetectorBeaker(NULL),
+      apiThread(NULL), apiServer(NULL), exportThread(NULL), reportExporter(NULL), metricsExporter(NULL),
+      archiveThread(NULL), archiveStore(NULL), scrubThread(NULL), archiveScrubber(NULL), resultStore(NULL), reanalysis(NULL),
+      qaStore(NULL), qaPanel(NULL), driftMonitor(NULL), modelArchive(NULL), modelDetectors(NULL),
+      modelDetectorsInUse(NULL), modelDetectorBeakers(NULL), bMCAReady(false)
 {
     ui.setupUi(this);    
     //qApp->setStyle("fusion");
@@ -25,31 +38,93 @@ Nailab::Nailab(QWidget *parent)
 
 Nailab::~Nailab()
 {
+    mcaProbe.waitForFinished();
+
+    if(apiThread)
+    {
+        apiThread->quit();
+        apiThread->wait();
+        delete apiServer;
+    }
+
+    if(exportThread)
+    {
+        exportThread->quit();
+        exportThread->wait();
+        delete reportExporter;
+        delete metricsExporter;
+    }
+
+    if(archiveThread)
+    {
+        archiveThread->quit();
+        archiveThread->wait();
+        delete archiveStore;
+    }
+
+    if(scrubThread)
+    {
+        scrubThread->quit();
+        scrubThread->wait();
+        delete archiveScrubber;
+    }
+
+    delete resultStore;
+    delete qaStore;
 }
 
 bool Nailab::Initialize()
 {	            
     if(!setupEnvironment())
         return false;
-
-    setupDialogs();
-
-    if(!readSettingsXml(envSettingsFile, settings))
-        return false;
-
-    if(!readBeakerXml(envBeakerFile, beakers))
-        return false;
-
-    if(!readDetectorXml(envDetectorFile, detectors))
+    startupProfile.mark("environment");
+
+    // Jobs that were open when Nailab or the PC went down
+    QStringList resumeJobs;
+    QString journalDirectory = QDir::toNativeSeparators(rootDirectory + "/JOURNAL/");
+    QMap<QString, JournalJob> openJobs;
+    if(QDir().mkpath(journalDirectory) && openJobJournal(journalDirectory + "jobs.jnl", openJobs))
+        recoverJobs(tempDirectory, openJobs, resumeJobs, recoveryMessages);
+    else
+        recoveryMessages << tr("Unable to open the job journal in ") + journalDirectory;
+    startupProfile.mark("job journal");
+
+    // The configuration files are independent of each other, read them side by side
+    StartupConfig config;
+    bool configOk = loadStartupConfig(configurationDirectory, config, true);
+    showDeferredDbErrors();
+    if(!configOk)
         return false;
+    settings = config.settings;
+    beakers = config.beakers;
+    detectors = config.detectors;
+    quantityUnits = config.quantityUnits;
+    startupProfile.mark("configuration");
 
     if(!setupMCA())
         return false;
+    startupProfile.mark("detector configuration");
 
     configureWidgets();
     updateSettings();
     updateBeakerViews();
     updateDetectorViews();    
+    startupProfile.mark("widgets");
+
+    setupJobApi();
+    setupArchive();
+    startupProfile.mark("job api");
+
+    // Results are indexed as jobs are stored, a missing store only disables the index
+    resultStore = new ResultStore(resultsDirectory);
+    if(!resultStore->open())
+        ui.statusbar->showMessage(tr("Unable to open result store: ") + resultsDirectory);
+    startupProfile.mark("result store");
+
+    // Calibration drift of every stored spectrum, the backlog is measured once the window is up
+    driftMonitor = new DriftMonitor(archiveDirectory, QDir::toNativeSeparators(rootDirectory + "/DRIFT/"), settings, runJob, this);
+    connect(driftMonitor, SIGNAL(progress(int,int,int)), this, SLOT(onDriftProgress(int,int,int)));
+    connect(driftMonitor, SIGNAL(driftAlert(QString,int,QString)), this, SLOT(onDriftAlert(QString,int,QString)));
 
     onPagesChanged(ui.pages->currentIndex());
 
@@ -59,9 +134,40 @@ bool Nailab::Initialize()
     connect(idleTimer, SIGNAL(timeout()), this, SLOT(onIdle()));
     idleTimer->start(32);
 
+    // Groups that were still waiting at their start barrier
+    QList<JobGroup> groups;
+    readJobGroups(tempDirectory, groups);
+    foreach(const JobGroup& group, groups)
+    {
+        if(!QFile::exists(jobGroupBarrier(tempDirectory, group.id)))
+            pendingGroups << group;
+    }
+
+    // Sizes the job pool before any job is resumed
+    publishDetectors();
+
+    foreach(const QString& detectorName, resumeJobs)
+        QtConcurrent::run(runMeasuredJob, runJob, tempDirectory + detectorName, detectorName);
+
+    // Runs once the window has been shown and the event loop is up
+    QTimer::singleShot(0, this, SLOT(onStartupFinished()));
+
     return true;
 }
 
+void Nailab::onStartupFinished()
+{
+    startupProfile.mark("first window");
+    startupProfile.write(QDir::toNativeSeparators(rootDirectory + "/METRICS/startup.txt"));
+    ui.statusbar->showMessage(tr("Started in %1 ms").arg(startupProfile.elapsedMs()), 5000);
+
+    if(!recoveryMessages.isEmpty())
+        QMessageBox::information(this, tr("Recovered jobs"), recoveryMessages.join("\n"));
+
+    // Leaves half the cores to the jobs, the peak reports only read the archive
+    driftMonitor->start(qMax(1, QThread::idealThreadCount() / 2));
+}
+
 bool Nailab::setupEnvironment()
 {    
     rootDirectory = QDir::toNativeSeparators(qgetenv(NAILAB_ENVIRONMENT_VARIABLE).constData());
@@ -75,6 +181,13 @@ bool Nailab::setupEnvironment()
     archiveDirectory = QDir::toNativeSeparators(rootDirectory + "/ARCHIVE/");
     tempDirectory = QDir::toNativeSeparators(rootDirectory + "/TEMP/");
     libraryDirectory = QDir::toNativeSeparators(rootDirectory + "/LIBRARY/");
+    resultsDirectory = QDir::toNativeSeparators(rootDirectory + "/RESULTS/");
+    cacheDirectory = QDir::toNativeSeparators(rootDirectory + "/CACHE/ANALYSIS/");
+
+    // Job tracing is switched on by creating the TRACE directory
+    QString traceDirectory = QDir::toNativeSeparators(rootDirectory + "/TRACE/");
+    if(QDir(traceDirectory).exists())
+        setJobTraceDirectory(traceDirectory);
 
     if(!QDir(configurationDirectory).exists()
         || !QDir(archiveDirectory).exists()
@@ -119,19 +232,69 @@ bool Nailab::setupEnvironment()
     return true;
 }
 
-void Nailab::setupDialogs()
+// Dialogs are created the first time they are needed, most sessions never open them
+
+CreateBeaker* Nailab::newBeakerDialog()
+{
+    if(!dlgNewBeaker)
+    {
+        dlgNewBeaker = new CreateBeaker(this);
+        connect(dlgNewBeaker, SIGNAL(accepted()), this, SLOT(onNewBeakerAccepted()));
+    }
+    return dlgNewBeaker;
+}
+
+CreateDetector* Nailab::newDetectorDialog()
 {
-    dlgNewBeaker = new CreateBeaker(this);
-    connect(dlgNewBeaker, SIGNAL(accepted()), this, SLOT(onNewBeakerAccepted()));
+    if(!dlgNewDetector)
+    {
+        dlgNewDetector = new CreateDetector(this);
+        connect(dlgNewDetector, SIGNAL(accepted()), this, SLOT(onNewDetectorAccepted()));
+    }
+    return dlgNewDetector;
+}
 
-    dlgNewDetector = new CreateDetector(this);
-    connect(dlgNewDetector, SIGNAL(accepted()), this, SLOT(onNewDetectorAccepted()));        
+createdetectorbeaker* Nailab::newDetectorBeakerDialog()
+{
+    if(!dlgNewDetectorBeaker)
+    {
+        dlgNewDetectorBeaker = new createdetectorbeaker(this);
+        connect(dlgNewDetectorBeaker, SIGNAL(accepted()), this, SLOT(onNewDetectorBeakerAccepted()));
+    }
+    return dlgNewDetectorBeaker;
+}
 
-    dlgNewDetectorBeaker = new createdetectorbeaker(this);
-    connect(dlgNewDetectorBeaker, SIGNAL(accepted()), this, SLOT(onNewDetectorBeakerAccepted()));
+editdetectorbeaker* Nailab::editDetectorBeakerDialog()
+{
+    if(!dlgEditDetectorBeaker)
+    {
+        dlgEditDetectorBeaker = new editdetectorbeaker(this);
+        connect(dlgEditDetectorBeaker, SIGNAL(accepted()), this, SLOT(onEditDetectorBeakerAccepted()));
+    }
+    return dlgEditDetectorBeaker;
+}
 
-    dlgEditDetectorBeaker = new editdetectorbeaker(this);
-    connect(dlgEditDetectorBeaker, SIGNAL(accepted()), this, SLOT(onEditDetectorBeakerAccepted()));
+static MCAProbe probeMCA(const QStringList& detectorNames, const QStringList& inUse)
+{
+    // One VDM handle is shared by all queries, so the detectors are probed one by one
+    MCAProbe probe;
+    try
+    {
+        VDM* vdm = VDM::instance();
+        vdm->initialize();
+        foreach(const QString& name, detectorNames)
+            probe.maxChannels[name] = vdm->maxChannels(name);
+        foreach(const QString& name, inUse)
+        {
+            probe.busy[name] = vdm->isBusy(name);
+            probe.highVoltage[name] = vdm->hasHighVoltage(name);
+        }
+    }
+    catch(BaseException& ex)
+    {
+        probe.error = ex.what();
+    }
+    return probe;
 }
 
 bool Nailab::setupMCA()
@@ -159,19 +322,128 @@ bool Nailab::setupMCA()
 
     foreach(const QString& dn, newDetectorNames)
     {
-        dlgNewDetector->setName(dn);
-        dlgNewDetector->exec();
+        newDetectorDialog()->setName(dn);
+        newDetectorDialog()->exec();
     }
 
+    // Querying the MCAs takes a while per detector, the window does not wait for it
     vdm = VDM::instance();
-    vdm->initialize();
-
-    for(int i=0; i<detectors.count(); i++)    
-        detectors[i].maxChannels = vdm->maxChannels(detectors[i].name);    
+    QStringList names, inUse;
+    for(int i=0; i<detectors.count(); i++)
+    {
+        names << detectors[i].name;
+        if(detectors[i].inUse && detectorNames.contains(detectors[i].name))
+            inUse << detectors[i].name;
+    }
+    connect(&mcaProbeWatcher, SIGNAL(finished()), this, SLOT(onMCAProbed()));
+    mcaProbe = QtConcurrent::run(probeMCA, names, inUse);
+    mcaProbeWatcher.setFuture(mcaProbe);
 
     return true;
 }
 
+void Nailab::waitForMCA()
+{
+    // Everything that talks to the VDM on the GUI thread waits for the startup probe first
+    if(!bMCAReady)
+        mcaProbe.waitForFinished();
+}
+
+void Nailab::onMCAProbed()
+{
+    MCAProbe probe = mcaProbe.result();
+    for(int i=0; i<detectors.count(); i++)
+    {
+        if(probe.maxChannels.contains(detectors[i].name))
+        {
+            detectors[i].maxChannels = probe.maxChannels.value(detectors[i].name);
+            detectors[i].channelsProbed = true;
+        }
+    }
+    bMCAReady = true;
+
+    for(int i=0; i<detectors.count(); i++)
+    {
+        if(probe.busy.value(detectors[i].name))
+            modelDetectors->setStatus(i, DetectorModel::Busy);
+        if(probe.highVoltage.contains(detectors[i].name))
+            setDetectorPowered(detectors[i].name, probe.highVoltage.value(detectors[i].name));
+    }
+
+    if(!probe.error.isEmpty())
+        ui.statusbar->showMessage(tr("MCA query failed: ") + probe.error);
+    startupProfile.mark("mca probe");
+}
+
+void Nailab::setupJobApi()
+{
+    // The API server gets its own thread so client traffic never blocks the GUI
+    apiThread = new QThread(this);
+    apiServer = new JobApiServer(tempDirectory, settings, username, runJob);
+    apiServer->setDetectors(detectors);
+    apiServer->setArchiveDirectory(archiveDirectory);
+
+    // Parented to the server so it moves to the API thread as well
+    NaiImporter *importer = new NaiImporter(apiServer, apiServer);
+    apiServer->moveToThread(apiThread);
+
+    connect(apiThread, SIGNAL(started()), apiServer, SLOT(start()));
+    connect(apiThread, SIGNAL(started()), importer, SLOT(start()));
+    connect(apiServer, SIGNAL(jobStarted(QString)), this, SLOT(onApiJobStarted(QString)));
+    apiThread->start();
+
+    // Report copies to the export folder can be slow on network shares
+    exportThread = new QThread(this);
+    reportExporter = new ReportExporter;
+    reportExporter->moveToThread(exportThread);
+    connect(exportThread, SIGNAL(started()), reportExporter, SLOT(start()));
+    connect(reportExporter, SIGNAL(exported(QString,qint64,int)), this, SLOT(onReportExported(QString,qint64,int)));
+    connect(reportExporter, SIGNAL(exportFailed(QString,QString)), this, SLOT(onReportExportFailed(QString,QString)));
+
+    // Metrics are written from the same thread, recording them never involves the GUI
+    QString metricsDirectory = QDir::toNativeSeparators(rootDirectory + "/METRICS/");
+    if(QDir().mkpath(metricsDirectory))
+    {
+        metricsExporter = new MetricsExporter(metricsDirectory + "nailab.prom", 15000);
+        metricsExporter->moveToThread(exportThread);
+        connect(exportThread, SIGNAL(started()), metricsExporter, SLOT(start()));
+    }
+    exportThread->start();
+}
+
+void Nailab::setupArchive()
+{
+    // Stores copy, sync and verify every file, the archive may be on a network volume
+    archiveThread = new QThread(this);
+    archiveStore = new ArchiveStore(tempDirectory, archiveDirectory);
+    archiveStore->moveToThread(archiveThread);
+    connect(archiveStore, SIGNAL(progress(QString,int,int)), this, SLOT(onStoreProgress(QString,int,int)));
+    connect(archiveStore, SIGNAL(stored(QString,QString)), this, SLOT(onJobStored(QString,QString)));
+    connect(archiveStore, SIGNAL(storeFailed(QString,QString)), this, SLOT(onJobStoreFailed(QString,QString)));
+    archiveThread->start();
+
+    // Checks the whole archive once a day at 4 MB/s
+    scrubThread = new QThread(this);
+    archiveScrubber = new ArchiveScrubber(archiveDirectory, archiveDirectory + "SCRUB.LOG", 4 * 1024 * 1024, 24);
+    archiveScrubber->moveToThread(scrubThread);
+    connect(scrubThread, SIGNAL(started()), archiveScrubber, SLOT(start()));
+    connect(archiveScrubber, SIGNAL(corrupted(QString,QString)), this, SLOT(onArchiveCorrupted(QString,QString)));
+    scrubThread->start(QThread::IdlePriority);
+}
+
+void Nailab::publishDetectors()
+{
+    // Every running job holds a pool thread for its whole count, a group needs them all at once
+    QThreadPool::globalInstance()->setMaxThreadCount(qMax(QThread::idealThreadCount(), detectors.count() + 4));
+
+    if(apiServer)
+        QMetaObject::invokeMethod(apiServer, "setDetectors", Qt::QueuedConnection, Q_ARG(QList<Detector>, detectors));
+
+    // Tolerances the drift is compared against
+    if(driftMonitor)
+        driftMonitor->setDetectors(detectors);
+}
+
 void Nailab::configureWidgets()
 {
     // ToolGroups
@@ -189,6 +461,17 @@ void Nailab::configureWidgets()
 
     toolGroups[ui.tabAdminBeakers]->addAction(ui.actionNewBeaker);
     toolGroups[ui.tabAdminDetectors]->addAction(ui.actionNewDetector);
+    toolGroups[ui.tabAdminDetectors]->addAction(ui.actionReanalyseDetector);
+    toolGroups[ui.pageDetectors]->addAction(ui.actionGroupSample);
+
+    ui.lwDetectors->setSelectionMode(QAbstractItemView::ExtendedSelection);
+
+    // Check source control charts, the series are read when a detector is first shown
+    qaStore = new QAStore(QDir::toNativeSeparators(rootDirectory + "/QA/"));
+    qaPanel = new QAPanel(qaStore);
+    QVBoxLayout *qaLayout = new QVBoxLayout(ui.tabAdminQA);
+    qaLayout->addWidget(qaPanel);
+    connect(qaPanel, SIGNAL(outOfControl(QString,QString)), this, SLOT(onQAOutOfControl(QString,QString)));
 
     // Static menus
     QMenu* menu = new QMenu("File");
@@ -219,9 +502,7 @@ void Nailab::configureWidgets()
     ui.cboxAdminDetectorPresetType2Unit->addItems(items);
     ui.cboxInputSamplePresetType2Unit->addItems(items);
 
-    QStringList quantityUnitList;
-    readQuantityUnitsXml(envQuantityUnitFile, quantityUnitList);
-    ui.cbInputSampleQuantityUnits->addItems(quantityUnitList);
+    ui.cbInputSampleQuantityUnits->addItems(quantityUnits);
 
     // Default tab pages
     ui.pages->setCurrentWidget(ui.pageMenu);
@@ -236,12 +517,8 @@ void Nailab::configureWidgets()
     connect(ui.lwMenu, SIGNAL(itemClicked(QListWidgetItem*)),
             this, SLOT(onMenuSelect(QListWidgetItem*)));
 
-    // Archive view
-    modelArchive = new QFileSystemModel(this);
-    modelArchive->setNameFilters(QStringList() << "*.RPT");
-    modelArchive->setNameFilterDisables(false);
-    ui.tvArchive->setModel(modelArchive);
-    ui.tvArchive->setRootIndex(modelArchive->setRootPath(archiveDirectory));
+    // The archive view is set up when the archive page is first shown, watching the
+    // whole archive is expensive
 
     // Running Jobs view
     modelRunningJobs = new QFileSystemModel(this);
@@ -259,6 +536,20 @@ void Nailab::configureWidgets()
     ui.lvFinishedJobs->setRootIndex(modelFinishedJobs->setRootPath(tempDirectory));
     //ui.lvFinishedJobs->setStyleSheet("QListView::item {image: url(:/Nailab/Resources/jobs64.png);}");
 
+    // Detector views
+    modelDetectors = new DetectorModel(this);
+    ui.lvAdminDetectors->setModel(modelDetectors);
+    connect(ui.lvAdminDetectors->selectionModel(), SIGNAL(currentChanged(QModelIndex,QModelIndex)),
+            this, SLOT(onLvAdminDetectorsCurrentChanged(QModelIndex,QModelIndex)));
+
+    modelDetectorsInUse = new DetectorInUseFilter(this);
+    modelDetectorsInUse->setSourceModel(modelDetectors);
+    ui.lwDetectors->setModel(modelDetectorsInUse);
+    connect(ui.lwDetectors, SIGNAL(clicked(QModelIndex)), this, SLOT(onDetectorSelect(QModelIndex)));
+
+    modelDetectorBeakers = new DetectorBeakerModel(this);
+    ui.twAdminDetectorBeaker->setModel(modelDetectorBeakers);
+
     // Dates
     ui.dtInputSampleNoneSampleDate->setDate(QDate::currentDate());
     ui.dtInputSampleDepositBeginDate->setDate(QDate::currentDate());
@@ -300,55 +591,84 @@ void Nailab::updateBeakerViews()
 
 void Nailab::updateDetectorViews()
 {    
-    // Remove existing items
-    ui.lvAdminDetectors->clear();        
-    ui.lwDetectors->clear();
+    // Full reset, only needed when the detector list itself is replaced
+    modelDetectors->setDetectors(&detectors);
 
-    bool found;
-    QListWidgetItem *item = 0;
+    for(int i=0; i<detectors.count(); i++)
+        updateDetectorStatus(i);
 
-    // Set up admin detector list and detector buttons
-    foreach(const Detector &detector, detectors)
-    {
-        found = false;
-        item = new QListWidgetItem(QIcon(":/Nailab/Resources/detector16.png"), detector.name, ui.lvAdminDetectors);
-        item = new QListWidgetItem(QIcon(":/Nailab/Resources/detector64.png"), detector.name, ui.lwDetectors);
+    QStringList names;
+    foreach(const Detector& detector, detectors)
+        names << detector.name;
+    qaPanel->setDetectors(names);
+}
 
-        foreach(const QString& d, detectorNames)
-        {
-            if(detector.name == d)
-                found = true;
-        }
+void Nailab::updateDetectorStatus(int row)
+{
+    const Detector& detector = detectors[row];
 
-        if(!detector.inUse)        
-            item->setHidden(true);        
-        else if(!found)        
-            disableListWidgetItem(item);        
-        else if(vdm->isBusy(detector.name))
-            disableListWidgetItem(item);
-    }
-    connect(ui.lwDetectors, SIGNAL(itemClicked(QListWidgetItem*)), this, SLOT(onDetectorSelect(QListWidgetItem*)));
+    DetectorModel::Status status = DetectorModel::Available;
+    if(!detectorNames.contains(detector.name))
+        status = DetectorModel::Offline;
+    else if(!bMCAReady)
+        return; // Busy detectors are marked by onMCAProbed
+    else if(detector.inUse && vdm->isBusy(detector.name))
+        status = DetectorModel::Busy;
+
+    // Only emits dataChanged for this row if the status actually changed
+    modelDetectors->setStatus(row, status);
+
+    if(status != DetectorModel::Offline && detector.inUse)
+        setDetectorPowered(detector.name, vdm->hasHighVoltage(detector.name));
 }
 
-void Nailab::disableListWidgetItem(QListWidgetItem *item)
-{            
-    item->setFlags(item->flags() & ~(Qt::ItemIsEnabled | Qt::ItemIsSelectable));
+void Nailab::setDetectorPowered(const QString& name, bool powered)
+{
+    // The scheduler of the API server leaves detectors without high voltage out
+    if(powered == !poweredOff.contains(name))
+        return;
+
+    if(powered)
+        poweredOff.removeAll(name);
+    else
+        poweredOff << name;
+
+    if(apiServer)
+        QMetaObject::invokeMethod(apiServer, "setPoweredOff", Qt::QueuedConnection, Q_ARG(QStringList, poweredOff));
 }
 
 Detector* Nailab::getDetectorByName(const QString& name)
 {
-    for(int i=0; i<detectors.count(); i++)
-    {
-        if(detectors[i].name == name)
-            return &detectors[i];
-    }
-    return NULL;
+    int row = detectorIndex.find(detectors, name);
+    return row < 0 ? NULL : &detectors[row];
 }
 
-bool Nailab::validateSampleInput()
+Detector* Nailab::selectedAdminDetector()
 {
-    // FIXME: Not implemented
-    return true;
+    if(!ui.lvAdminDetectors->selectionModel()->hasSelection())
+        return NULL;
+    return modelDetectors->detectorAt(ui.lvAdminDetectors->selectionModel()->currentIndex());
+}
+
+bool Nailab::validateSampleInput(const SampleInput& sampleInput)
+{
+    Detector* detector = getDetectorByName(sampleInput.detector);
+    if(!detector)
+        return false;
+
+    QStringList problems;
+    preflightJob(sampleInput, *detector, settings, tempDirectory, problems);
+
+    // The VDM is only asked on this thread, and not before the startup probe is done
+    if(bMCAReady && vdm->isBusy(detector->name))
+        problems << tr("Detector %1 is busy").arg(detector->name);
+
+    if(problems.isEmpty())
+        return true;
+
+    countMetric(MetricJobsRefused, detector->name);
+    QMessageBox::warning(this, tr("Sample not started"), problems.join("\n"));
+    return false;
 }
 
 void Nailab::storeSampleInput(SampleInput& sampleInput)
@@ -395,242 +715,121 @@ bool Nailab::startJob(SampleInput& sampleInput)
 {
     QString baseFilename = tempDirectory + sampleInput.detector;
 
-    QFile jobfile(baseFilename + ".BAT");
-    if(!jobfile.open(QIODevice::WriteOnly | QIODevice::Text | QIODevice::Truncate))
+    Detector* detector = getDetectorByName(sampleInput.detector);
+    if(!detector)
+        return false;
+
+    if(!writeJobFile(baseFilename, sampleInput, *detector, settings, username))
     {
         QMessageBox::information(this, tr("Error"), tr("Unable to open job file"));
         return false;
     }
-    QTextStream stream(&jobfile);    
 
-    Detector* detector = getDetectorByName(sampleInput.detector);
-    QString specname = detector->name + "-" + QString::number(detector->spectrumCounter + 1);
-
-    startJobCommand(stream, "pars");
-    addJobParam(stream, "det:", sampleInput.detector);
-    addJobParamQuoted(stream, "/stitle=", sampleInput.title);
-    addJobParamQuoted(stream, "/scollname=", username);
-    addJobParamQuoted(stream, "/sdesc1=", sampleInput.description);
-    addJobParamQuoted(stream, "/sdesc4=", sampleInput.specterref);
-    addJobParamQuoted(stream, "/sident=", sampleInput.ID);
-    addJobParamQuoted(stream, "/stype=", sampleInput.type);
-    addJobParam(stream, "/squant=", sampleInput.quantity);
-    addJobParam(stream, "/squanterr=", sampleInput.quantityError);
-    addJobParamQuoted(stream, "/sunits=", sampleInput.units);
-    addJobParamQuoted(stream, "/sgeomtry=", sampleInput.geometry);
-    addJobParamQuoted(stream, "/builduptype=", sampleInput.builduptype);    
-    addJobParamQuoted(stream, "/stime=", sampleInput.startTime);
-    if(sampleInput.builduptype == "IRRAD" || sampleInput.builduptype == "DEPOSIT")
-        addJobParamQuoted(stream, "/sdeposit=", sampleInput.endTime);
-    endJobCommand(stream);
-
-    startJobCommand(stream, "pars");
-    addJobParam(stream, "det:", sampleInput.detector);
-    addJobParam(stream, "/ssyserr=", sampleInput.randomError);
-    addJobParam(stream, "/ssysterr=", sampleInput.systematicError);
-    endJobCommand(stream);    
-
-    startJobCommand(stream, "movedata");    
-    addJobParamQuoted(stream, "", detector->beakers[sampleInput.geometry]);
-    addJobParam(stream, "det:", sampleInput.detector);
-    addJobParamSingle(stream, "/effcal");
-    addJobParamSingle(stream, "/overwrite");
-    endJobCommand(stream);
-
-    startJobCommand(stream, "startmca");
-    addJobParam(stream, "det:", sampleInput.detector);
-
-    QString presetType = "";
-    if(sampleInput.presetType1 == "AREA")
-        presetType = "/AREAPRESET=";
-    else if(sampleInput.presetType1 == "INTEGRAL")
-        presetType = "/INTPRESET=";
-    else if(sampleInput.presetType1 == "COUNT")
-        presetType = "/CNTSPRESET=";        
-
-    if(!presetType.isEmpty())
-        addJobParam(stream, presetType, sampleInput.presetType1Value + "," +
-                    sampleInput.presetType1StartChannel + "," + sampleInput.presetType1EndChannel);
-
-    presetType = "";
-    if(sampleInput.presetType2 == "REALTIME")
-        presetType = "/REALPRESET=";
-    else if(sampleInput.presetType2 == "LIVETIME")
-        presetType = "/LIVEPRESET=";
-
-    if(!presetType.isEmpty())
-        addJobParam(stream, presetType, sampleInput.presetType2Value);
-
-    endJobCommand(stream);
-
-    startJobCommand(stream, "wait");
-    addJobParam(stream, "det:", sampleInput.detector);
-    addJobParamSingle(stream, "/acq");
-    endJobCommand(stream);    
-
-    startJobCommand(stream, "peak_dif");
-    addJobParam(stream, "det:", sampleInput.detector);
-    addJobParam(stream, "/channels=", QString::number(detector->searchRegionStart) + "," + QString::number(detector->searchRegionEnd));
-    addJobParam(stream, "/signif=", QString::number(detector->significanceTreshold));
-    addJobParam(stream, "/ftol=", QString::number(detector->tolerance));
-    endJobCommand(stream);    
-
-    startJobCommand(stream, "area_nl1");
-    addJobParam(stream, "det:", sampleInput.detector);    
-    addJobParam(stream, "/channels=", QString::number(detector->peakAreaRegionStart) + "," + QString::number(detector->peakAreaRegionEnd));
-    addJobParam(stream, "/fcont=", QString::number(detector->continuum));
-    if(detector->criticalLevelTest)
-        addJobParamSingle(stream, "/critlevel");
-    if(detector->useFixedFWHM)
-        addJobParamSingle(stream, "/fixfwhm");
-    if(detector->useFixedTailParameter)
-        addJobParamSingle(stream, "/fixtail");
-    if(detector->fitSinglets)
-        addJobParamSingle(stream, "/fit");
-    if(detector->displayROIs)
-        addJobParamSingle(stream, "/display_rois");
-    endJobCommand(stream);
-
-    startJobCommand(stream, "pars");
-    addJobParam(stream, "det:", sampleInput.detector);
-    addJobParam(stream, "/roipsbtyp=", detector->continuumFunction);
-    addJobParam(stream, "/prreject0pks=", detector->rejectZeroAreaPeaks ? "1" : "0");
-    addJobParam(stream, "/prfwhmpkmult=", QString::number(detector->maxFWHMsBetweenPeaks));
-    addJobParam(stream, "/prfwhmpkleft=", QString::number(detector->maxFWHMsForLeftLimit));
-    addJobParam(stream, "/prfwhmpkrght=", QString::number(detector->maxFWHMsForRightLimit));
-    endJobCommand(stream);
-
-    startJobCommand(stream, "areacor");
-    addJobParam(stream, "det:", sampleInput.detector);
-    addJobParamQuoted(stream, "/bkgnd=", detector->backgroundSubtract);
-    endJobCommand(stream);
-
-    startJobCommand(stream, "effcor");
-    addJobParam(stream, "det:", sampleInput.detector);
-    addJobParamSingle(stream, "/" + detector->efficiencyCalibrationType);
-    endJobCommand(stream);
-
-    startJobCommand(stream, "nid_intf");
-    addJobParam(stream, "det:", sampleInput.detector);
-    addJobParamQuoted(stream, "/LIBRARY=", detector->NIDLibrary);
-    addJobParam(stream, "/CONFID=", QString::number(detector->NIDConfidenceTreshold));
-    if(detector->performMDATest)
-        addJobParamSingle(stream, "/MDA_TEST");
-    if(detector->inhibitATDCorrection)
-        addJobParamSingle(stream, "/NOACQDECAY");
-    endJobCommand(stream);
-
-    startJobCommand(stream, "pars");
-    addJobParam(stream, "det:", sampleInput.detector);
-    addJobParam(stream, "/PRUSESTRLIB=", detector->useStoredLibrary ? "1" : "0");
-    addJobParam(stream, "/MDACONFID=", QString::number(detector->MDAConfidenceFactor));
-    endJobCommand(stream);
-
-    startJobCommand(stream, "MDA");
-    addJobParam(stream, "det:", sampleInput.detector);
-    endJobCommand(stream);
-
-    startJobCommand(stream, "pars");
-    addJobParam(stream, "det:", sampleInput.detector);
-    addJobParamQuoted(stream, "/activunits=", "Bq");
-    addJobParam(stream, "/ACTIVMULT=", "37000");
-    endJobCommand(stream);
-
-    startJobCommand(stream, "report");
-    addJobParam(stream, "det:", sampleInput.detector);
-    addJobParamQuoted(stream, "/template=", settings.templateName);
-    addJobParamSingle(stream, "/newfile");
-    addJobParamSingle(stream, "/firstpg");
-    addJobParamSingle(stream, "/newpg");
-    addJobParamQuoted(stream, "/outfile=", baseFilename + ".RPT");
-    addJobParamQuoted(stream, "/section=", "");
-    addJobParam(stream, "/EM=", QString::number(settings.errorMultiplier));
-    endJobCommand(stream);
-
-    /*startJobCommand(stream, "dataplot");
-    addJobParam(stream, "det:", sampleInput.detector);
-    addJobParam(stream, "/scale=", "log");
-    addJobParamSingle(stream, "/enhplot");
-    endJobCommand(stream);*/
-
-    startJobCommand(stream, "movedata");
-    addJobParam(stream, "det:", sampleInput.detector);
-    addJobParamQuoted(stream, "", baseFilename + ".CNF");
-    addJobParamSingle(stream, "/overwrite");
-    endJobCommand(stream);
-
-    startJobCommand(stream, "copy");
-    addJobParamSingle(stream, "/y NUL \"" + baseFilename + ".DONE\" >NUL");
-    endJobCommand(stream);
-
-    jobfile.close();    
-
-    QtConcurrent::run(runJob, baseFilename + ".BAT >" + baseFilename + ".OUT " + "2>" + baseFilename + ".ERR");    
+    QtConcurrent::run(runMeasuredJob, runJob, baseFilename, sampleInput.detector);
 
     return true;
 }
 
-void Nailab::startJobCommand(QTextStream& s, const QString& cmd)
+bool Nailab::startGroupJob(const SampleInput& sampleInput)
 {
-    s << cmd << " ";
-}
+    // All or nothing, no job of the group is written unless every one would start
+    QList<SampleInput> inputs;
+    QStringList problems;
+    foreach(const QString& name, groupDetectors)
+    {
+        Detector* detector = getDetectorByName(name);
+        if(!detector)
+            return false;
+
+        SampleInput input = sampleInput;
+        input.detector = name;
+        input.specterref = QString::number(detector->spectrumCounter);
+        inputs << input;
+
+        QStringList detectorProblems;
+        preflightJob(input, *detector, settings, tempDirectory, detectorProblems);
+        if(bMCAReady && vdm->isBusy(name))
+            detectorProblems << tr("Detector %1 is busy").arg(name);
+        if(!detectorProblems.isEmpty())
+            countMetric(MetricJobsRefused, name);
+        foreach(const QString& problem, detectorProblems)
+            problems << name + ": " + problem;
+    }
+    if(!problems.isEmpty())
+    {
+        QMessageBox::warning(this, tr("Group sample not started"), problems.join("\n"));
+        return false;
+    }
 
-void Nailab::endJobCommand(QTextStream& s)
-{
-    s << "\n";
-}
+    JobGroup group;
+    group.id = newJobGroupId();
+    group.created = QDateTime::currentDateTime();
+    group.detectors = groupDetectors;
+    QString barrier = jobGroupBarrier(tempDirectory, group.id);
 
-void Nailab::addJobParam(QTextStream& s, const QString& p, const QString& v)
-{
-    s << p << v << " ";
-}
+    bool ok = writeJobGroup(tempDirectory, group);
+    QStringList written;
+    for(int i=0; ok && i<inputs.count(); i++)
+    {
+        Detector* detector = getDetectorByName(inputs[i].detector);
+        ok = writeJobFile(tempDirectory + detector->name, inputs[i], *detector, settings, username, QDateTime(), barrier);
+        written << detector->name;
+    }
+    if(!ok)
+    {
+        foreach(const QString& name, written)
+            failJob(tempDirectory, name, "group not started");
+        removeJobGroup(tempDirectory, group.id);
+        QMessageBox::information(this, tr("Error"), tr("Unable to write the jobs of the group"));
+        return false;
+    }
 
-void Nailab::addJobParamSingle(QTextStream& s, const QString& v)
-{
-    s << v << " ";
-}
+    // Every job now runs up to the start barrier, releasePendingGroups lets them count
+    foreach(const QString& name, groupDetectors)
+        QtConcurrent::run(runMeasuredJob, runJob, tempDirectory + name, name);
 
-void Nailab::addJobParamQuoted(QTextStream& s, const QString& p, const QString& v)
-{
-    s << p << "\"" << v << "\" ";
+    pendingGroups << group;
+    groupDetectors.clear();
+    ui.statusbar->showMessage(tr("Group %1 waiting for %2 detectors").arg(group.id).arg(group.detectors.count()));
+    return true;
 }
 
-bool Nailab::detectorHasJob(const Detector* det)
+void Nailab::releasePendingGroups()
 {
-    QString filename = tempDirectory + det->name + ".BAT";
-
-    if(QFile::exists(filename))
-        return true;
+    for(int i=0; i<pendingGroups.count();)
+    {
+        // A job that died before the barrier would keep the others waiting forever
+        const JobGroup& group = pendingGroups[i];
+        bool late = group.created.secsTo(QDateTime::currentDateTime()) > 120;
+        int missing = 0;
+        if(!releaseJobGroup(tempDirectory, group, late, &missing))
+        {
+            i++;
+            continue;
+        }
 
-    return false;
+        if(missing > 0)
+            ui.statusbar->showMessage(tr("Group %1 started without %2 of its detectors").arg(group.id).arg(missing));
+        else
+            ui.statusbar->showMessage(tr("Group %1 started on %2 detectors").arg(group.id).arg(group.detectors.count()), 5000);
+        pendingGroups.removeAt(i);
+    }
 }
 
 void Nailab::showBeakersForDetector(Detector *detector)
 {
-    for(int i=0; i<ui.twAdminDetectorBeaker->rowCount(); i++)
-        ui.twAdminDetectorBeaker->removeRow(i);
-
-    ui.twAdminDetectorBeaker->setRowCount(detector->beakers.count());
-
-    QMapIterator<QString, QString> iter(detector->beakers);
-    int i = 0;
-    while (iter.hasNext())
-    {
-        iter.next();
-        ui.twAdminDetectorBeaker->setCellWidget(i, 0, new QLabel(iter.key()));
-        ui.twAdminDetectorBeaker->setCellWidget(i, 1, new QLabel(iter.value()));
-        i++;
-    }
+    if(modelDetectorBeakers->detector() != detector)
+        modelDetectorBeakers->setDetector(detector);
 }
 
 void Nailab::onIdle()
 {
-    if(ui.lvAdminDetectors->selectedItems().count() > 0 && !bAdminDetectorsEnabled)
+    if(ui.lvAdminDetectors->selectionModel()->hasSelection() && !bAdminDetectorsEnabled)
     {
         enableControlTree(ui.tabsAdminDetectors, true);
         bAdminDetectorsEnabled = true;
     }
-    else if(ui.lvAdminDetectors->selectedItems().count() <= 0 && bAdminDetectorsEnabled)
+    else if(!ui.lvAdminDetectors->selectionModel()->hasSelection() && bAdminDetectorsEnabled)
     {
         enableControlTree(ui.tabsAdminDetectors, false);
         bAdminDetectorsEnabled = false;
@@ -663,10 +862,32 @@ void Nailab::onIdle()
         ui.btnJobReject->setEnabled(false);
         bFinishedJobsSelected = false;
     }
+
+    if(!pendingGroups.isEmpty())
+        releasePendingGroups();
+}
+
+void Nailab::onApiJobStarted(const QString& detectorName)
+{
+    int row = modelDetectors->rowForName(detectorName);
+    if(row >= 0)
+        updateDetectorStatus(row);
+}
+
+void Nailab::onReportExported(const QString& reportFile, qint64 latencyMs, int queueDepth)
+{
+    ui.statusbar->showMessage(tr("Exported %1 (%2 ms, %3 queued)")
+                              .arg(QFileInfo(reportFile).fileName()).arg(latencyMs).arg(queueDepth), 5000);
+}
+
+void Nailab::onReportExportFailed(const QString& reportFile, const QString& error)
+{
+    ui.statusbar->showMessage(tr("Export of %1 failed: %2").arg(QFileInfo(reportFile).fileName()).arg(error));
 }
 
 void Nailab::onQuit()
 {
+    waitForMCA();
     vdm->close();
     qApp->quit();
 }
@@ -697,47 +918,120 @@ void Nailab::onMenuSelect(QListWidgetItem *item)
     item->setSelected(false);
 }
 
-void Nailab::onDetectorSelect(QListWidgetItem *item)
+bool Nailab::checkDetectorFree(const Detector* detector)
+{
+    if(detectorHasJob(tempDirectory, detector->name))
+    {
+        QMessageBox::information(this, tr("Message"), tr("Detector ") + detector->name + tr(" has a job"));
+        return false;
+    }
+
+    waitForMCA();
+    bool powered = vdm->hasHighVoltage(detector->name);
+    setDetectorPowered(detector->name, powered);
+    if(!powered)
+    {
+        QMessageBox::information(this, tr("Message"), tr("Detector ") + detector->name + tr(" is powered off"));
+        return false;
+    }
+    return true;
+}
+
+void Nailab::showSampleInput(const Detector* det)
+{
+    ui.pages->setCurrentWidget(ui.pageInput);
+    ui.tabsInput->setCurrentWidget(ui.tabInputSample);
+    ui.toolsInputSample->setCurrentIndex(0); // Parameters
+    ui.tabsInputSampleBuildupType->setCurrentIndex(2); // None
+    ui.lblInputSampleDetector->setText(det->name);        
+    ui.tbInputSampleCollector->setText(username);
+    ui.tbInputSampleSpecterRef->setText(QString::number(det->spectrumCounter));
+    ui.tbInputSampleSpecterRef->setEnabled(true);
+    ui.cbInputSampleGeometry->clear();        
+    ui.cbInputSampleGeometry->addItems(det->beakers.keys());
+    ui.cboxInputSamplePresetType1->setCurrentText(countPresetName(det->presetType1));
+    ui.tbInputSamplePresetType1->setText(QString::number(det->presetType1Value));        
+    ui.cboxInputSamplePresetType2->setCurrentText(timePresetName(det->presetType2));
+    ui.tbInputSamplePresetType2->setText(QString::number(det->presetType2Value));        
+    ui.tbInputSampleStartChannel->setText(QString::number(det->presetType1ChannelStart));
+    ui.tbInputSampleEndChannel->setText(QString::number(det->presetType1ChannelEnd));
+    ui.tbInputSampleRandomError->setText(QString::number(det->randomError));
+    ui.tbInputSampleSystematicError->setText(QString::number(det->systematicError));
+    // FIXME: Not finished...
+}
+
+void Nailab::onDetectorSelect(const QModelIndex& index)
 {    
-    if(item->flags() & Qt::ItemIsSelectable)
+    // Ctrl and Shift select detectors for a group sample, see onGroupSample
+    if(QApplication::keyboardModifiers() & (Qt::ControlModifier | Qt::ShiftModifier))
+        return;
+
+    if(index.flags() & Qt::ItemIsSelectable)
     {
-        item->setSelected(false);
+        ui.lwDetectors->clearSelection();
 
-        const Detector* det = getDetectorByName(item->text());
+        const Detector* det = modelDetectors->detectorAt(modelDetectorsInUse->mapToSource(index));
         if(!det)
             return; // FIXME: report error
 
-        if(detectorHasJob(det))
-        {
-            QMessageBox::information(this, tr("Message"), tr("Detector ") + det->name + tr(" has a job"));
+        if(!checkDetectorFree(det))
             return;
-        }
 
-        if(!vdm->hasHighVoltage(det->name))
-        {
-            QMessageBox::information(this, tr("Message"), tr("Detector ") + det->name + tr(" is powered off"));
+        groupDetectors.clear();
+        showSampleInput(det);
+    }
+}
+
+void Nailab::onGroupSample()
+{
+    QList<const Detector*> group;
+    foreach(const QModelIndex& index, ui.lwDetectors->selectionModel()->selectedIndexes())
+    {
+        const Detector* det = modelDetectors->detectorAt(modelDetectorsInUse->mapToSource(index));
+        if(det)
+            group << det;
+    }
+
+    if(group.count() < 2)
+    {
+        QMessageBox::information(this, tr("Message"), tr("Select two or more detectors with Ctrl+click"));
+        return;
+    }
+
+    foreach(const Detector* det, group)
+    {
+        if(!checkDetectorFree(det))
             return;
-        }
+    }
 
-        ui.pages->setCurrentWidget(ui.pageInput);
-        ui.tabsInput->setCurrentWidget(ui.tabInputSample);
-        ui.toolsInputSample->setCurrentIndex(0); // Parameters
-        ui.tabsInputSampleBuildupType->setCurrentIndex(2); // None
-        ui.lblInputSampleDetector->setText(item->text());        
-        ui.tbInputSampleCollector->setText(username);
-        ui.tbInputSampleSpecterRef->setText(QString::number(det->spectrumCounter));
-        ui.cbInputSampleGeometry->clear();        
-        ui.cbInputSampleGeometry->addItems(det->beakers.keys());
-        ui.cboxInputSamplePresetType1->setCurrentText(det->presetType1);
-        ui.tbInputSamplePresetType1->setText(QString::number(det->presetType1Value));        
-        ui.cboxInputSamplePresetType2->setCurrentText(det->presetType2);
-        ui.tbInputSamplePresetType2->setText(QString::number(det->presetType2Value));        
-        ui.tbInputSampleStartChannel->setText(QString::number(det->presetType1ChannelStart));
-        ui.tbInputSampleEndChannel->setText(QString::number(det->presetType1ChannelEnd));
-        ui.tbInputSampleRandomError->setText(QString::number(det->randomError));
-        ui.tbInputSampleSystematicError->setText(QString::number(det->systematicError));
-        // FIXME: Not finished...
+    // Only geometries every detector of the group is calibrated for
+    QStringList geometries = group.first()->beakers.keys();
+    QStringList names;
+    foreach(const Detector* det, group)
+    {
+        names << det->name;
+        foreach(const QString& geometry, geometries)
+        {
+            if(!det->beakers.contains(geometry))
+                geometries.removeAll(geometry);
+        }
     }
+    if(geometries.isEmpty())
+    {
+        QMessageBox::information(this, tr("Message"), tr("The selected detectors have no calibrated geometry in common"));
+        return;
+    }
+
+    ui.lwDetectors->clearSelection();
+    groupDetectors = names;
+    showSampleInput(group.first());
+    ui.lblInputSampleDetector->setText(names.join(", "));
+    ui.cbInputSampleGeometry->clear();
+    ui.cbInputSampleGeometry->addItems(geometries);
+
+    // Every job gets the spectrum counter of its own detector
+    ui.tbInputSampleSpecterRef->clear();
+    ui.tbInputSampleSpecterRef->setEnabled(false);
 }
 
 void Nailab::onPagesChanged(int index)
@@ -750,6 +1044,16 @@ void Nailab::onPagesChanged(int index)
 
     if(ui.pages->currentWidget() == ui.pageAdmin)
         onTabsAdminChanged(ui.tabsAdmin->currentIndex());    
+
+    if(ui.pages->currentWidget() == ui.pageArchive && !modelArchive)
+    {
+        modelArchive = new QFileSystemModel(this);
+        modelArchive->setNameFilters(QStringList() << "*.RPT" << "*.REF");
+        modelArchive->setNameFilterDisables(false);
+        ui.tvArchive->setModel(modelArchive);
+        ui.tvArchive->setRootIndex(modelArchive->setRootPath(archiveDirectory));
+        connect(ui.tvArchive, SIGNAL(doubleClicked(QModelIndex)), this, SLOT(onArchiveActivated(QModelIndex)));
+    }
 }
 
 void Nailab::onTabsAdminChanged(int index)
@@ -772,11 +1076,17 @@ void Nailab::onAdminGeneralAccepted()
     settings.RPTExportFolder = ui.tbAdminGeneralRPTExport->text();
 
     writeSettingsXml(envSettingsFile, settings);
+    invalidateJobTemplates();
+
+    if(apiServer)
+        QMetaObject::invokeMethod(apiServer, "setSettings", Qt::QueuedConnection, Q_ARG(Settings, settings));
+    if(driftMonitor)
+        driftMonitor->setSettings(settings);
 }
 
 void Nailab::onNewBeaker()
 {    
-    dlgNewBeaker->exec();
+    newBeakerDialog()->exec();
 }
 
 void Nailab::onNewBeakerAccepted()
@@ -811,6 +1121,58 @@ void Nailab::onNewDetector()
     //dlgNewDetector->exec();
 }
 
+void Nailab::onReanalyseDetector()
+{
+    Detector* det = selectedAdminDetector();
+    if(!det)
+    {
+        QMessageBox::information(this, tr("Information"), tr("No detector selected"));
+        return;
+    }
+
+    if(reanalysis && reanalysis->isRunning())
+    {
+        QMessageBox::information(this, tr("Information"), tr("A re-analysis is already running"));
+        return;
+    }
+
+    bool ok;
+    QDate today = QDate::currentDate();
+    QString range = QInputDialog::getText(this, tr("Re-analyse archive"),
+                                          tr("Re-analyse spectra of %1 acquired from/to (yyyy-MM-dd yyyy-MM-dd)").arg(det->name),
+                                          QLineEdit::Normal, QDate(today.year(), 1, 1).toString("yyyy-MM-dd") + " " + today.toString("yyyy-MM-dd"), &ok);
+    if(!ok)
+        return;
+
+    QStringList dates = range.split(' ', QString::SkipEmptyParts);
+    QDate from = dates.count() == 2 ? QDate::fromString(dates[0], "yyyy-MM-dd") : QDate();
+    QDate to = dates.count() == 2 ? QDate::fromString(dates[1], "yyyy-MM-dd") : QDate();
+    if(!from.isValid() || !to.isValid() || from > to)
+    {
+        QMessageBox::information(this, tr("Error"), tr("Invalid date range"));
+        return;
+    }
+
+    delete reanalysis;
+    reanalysis = new ReanalysisBatch(archiveDirectory, *det, settings, username, runJob, cacheDirectory, this);
+    connect(reanalysis, SIGNAL(progress(int,int,int,double)), this, SLOT(onReanalysisProgress(int,int,int,double)));
+    connect(reanalysis, SIGNAL(finished(int,int,qint64)), this, SLOT(onReanalysisFinished(int,int,qint64)));
+    reanalysis->start(from, to, QThread::idealThreadCount());
+}
+
+void Nailab::onReanalysisProgress(int done, int failed, int total, double spectraPerMinute)
+{
+    ui.statusbar->showMessage(tr("Re-analysis: %1 of %2 spectra, %3 failed, %4 spectra/min")
+                              .arg(done + failed).arg(total).arg(failed).arg(spectraPerMinute, 0, 'f', 1));
+}
+
+void Nailab::onReanalysisFinished(int done, int failed, qint64 msecs)
+{
+    ui.statusbar->showMessage(tr("Re-analysis finished: %1 spectra, %2 failed in %3 s. Cached stages: %4")
+                              .arg(done).arg(failed).arg(msecs / 1000.0, 0, 'f', 1)
+                              .arg(analysisCacheSummary(reanalysis->cacheStats())));
+}
+
 void Nailab::onNewDetectorAccepted()
 {
     // FIXME: Validate input...
@@ -825,7 +1187,7 @@ void Nailab::onNewDetectorAccepted()
     detector.peakAreaRegionStart = dlgNewDetector->peakAreaRegionStart();
     detector.peakAreaRegionEnd = dlgNewDetector->peakAreaRegionEnd();
     detector.continuum = dlgNewDetector->continuum();
-    detector.continuumFunction = dlgNewDetector->continuumFunction();
+    detector.continuumFunction = continuumFunctionFromName(dlgNewDetector->continuumFunction());
     detector.criticalLevelTest = dlgNewDetector->criticalLevelTest();
     detector.useFixedFWHM = dlgNewDetector->useFixedFWHM();
     detector.useFixedTailParameter = dlgNewDetector->useFixedTailParameter();
@@ -835,15 +1197,15 @@ void Nailab::onNewDetectorAccepted()
     detector.maxFWHMsBetweenPeaks = dlgNewDetector->maxFWHMsBetweenPeaks();
     detector.maxFWHMsForLeftLimit = dlgNewDetector->maxFWHMsForLeftLimit();
     detector.maxFWHMsForRightLimit = dlgNewDetector->maxFWHMsForRightLimit();
-    detector.backgroundSubtract = dlgNewDetector->backgroundSubtract();
-    detector.efficiencyCalibrationType = dlgNewDetector->efficiencyCalibrationType();    
-    detector.presetType1 = dlgNewDetector->presetType1();
+    detector.backgroundSubtract = internString(dlgNewDetector->backgroundSubtract());
+    detector.efficiencyCalibrationType = efficiencyCalibrationFromName(dlgNewDetector->efficiencyCalibrationType());    
+    detector.presetType1 = countPresetFromName(dlgNewDetector->presetType1());
     detector.presetType1Value = dlgNewDetector->presetType1Value();
     detector.presetType1ChannelStart = 1; // FIXME
     detector.presetType1ChannelEnd = 1024; // FIXME
-    detector.presetType2 = dlgNewDetector->presetType2();
+    detector.presetType2 = timePresetFromName(dlgNewDetector->presetType2());
     detector.presetType2Value = dlgNewDetector->presetType2Value();
-    detector.presetType2Unit = dlgNewDetector->presetType2Unit();
+    detector.presetType2Unit = timeUnitFromName(dlgNewDetector->presetType2Unit());
     detector.randomError = dlgNewDetector->randomError();
     detector.systematicError = dlgNewDetector->systematicError();
     detector.spectrumCounter = 0;
@@ -855,16 +1217,32 @@ void Nailab::onNewDetectorAccepted()
     detector.inhibitATDCorrection = false;
     detector.useStoredLibrary = false;
 
-    detectors.push_back(detector);
+    // Detectors found by setupMCA are added before the VDM is set up, the startup probe
+    // queries them along with the others and onMCAProbed fills in maxChannels
+    detector.maxChannels = 0;
+    if(vdm)
+    {
+        waitForMCA();
+        detector.maxChannels = vdm->maxChannels(detector.name);
+        detector.channelsProbed = true;
+    }
+
+    // Before configureWidgets the views are filled by updateDetectorViews
+    bool modelled = modelDetectors && modelDetectors->appendDetector(detector);
+    if(!modelled)
+        detectors.push_back(detector);
     writeDetectorXml(envDetectorFile, detectors);
-    updateDetectorViews();
+    compileJobTemplate(tempDirectory + detector.name, detector, settings);
+    publishDetectors();
 
-    detector.maxChannels = vdm->maxChannels(detector.name);
+    if(modelled)
+        updateDetectorStatus(detectors.count() - 1);
 }
 
 void Nailab::onNewDetectorBeakerAccepted()
 {
-    if(ui.lvAdminDetectors->selectedItems().count() < 1)
+    Detector* d = selectedAdminDetector();
+    if(!d)
         return;
 
     QString beaker = dlgNewDetectorBeaker->beaker();
@@ -872,15 +1250,16 @@ void Nailab::onNewDetectorBeakerAccepted()
     if(beaker.isEmpty() || calfile.isEmpty())
         return;
 
-    Detector* d = getDetectorByName(ui.lvAdminDetectors->selectedItems()[0]->text());
-    d->beakers[beaker] = calfile;
-    writeDetectorXml(envDetectorFile, detectors);
     showBeakersForDetector(d);
+    modelDetectorBeakers->setBeaker(beaker, calfile);
+    writeDetectorXml(envDetectorFile, detectors);
+    publishDetectors();
 }
 
 void Nailab::onEditDetectorBeakerAccepted()
 {
-    if(ui.lvAdminDetectors->selectedItems().count() < 1)
+    Detector* d = selectedAdminDetector();
+    if(!d)
         return;
 
     QString beaker = dlgEditDetectorBeaker->beaker();
@@ -888,20 +1267,18 @@ void Nailab::onEditDetectorBeakerAccepted()
     if(beaker.isEmpty() || calfile.isEmpty())
         return;
 
-    Detector* d = getDetectorByName(ui.lvAdminDetectors->selectedItems()[0]->text());
-    d->beakers[beaker] = calfile;
-    writeDetectorXml(envDetectorFile, detectors);
     showBeakersForDetector(d);
+    modelDetectorBeakers->setBeaker(beaker, calfile);
+    writeDetectorXml(envDetectorFile, detectors);
+    publishDetectors();
 }
 
 void Nailab::onAdminDetectorsAccepted()
 {
-    if(ui.lvAdminDetectors->selectedItems().count() < 1)
+    Detector* detector = selectedAdminDetector();
+    if(!detector)
         return;    
 
-    QString detectorName = ui.lvAdminDetectors->selectedItems()[0]->text();
-    Detector* detector = getDetectorByName(detectorName);
-
     detector->inUse = ui.cbAdminDetectorInUse->isChecked();
     detector->searchRegionStart = ui.tbAdminDetectorSearchRegionStart->text().toInt();
     detector->searchRegionEnd = ui.tbAdminDetectorSearchRegionEnd->text().toInt();
@@ -910,7 +1287,7 @@ void Nailab::onAdminDetectorsAccepted()
     detector->peakAreaRegionStart = ui.tbAdminDetectorPeakAreaRegionStart->text().toInt();
     detector->peakAreaRegionEnd = ui.tbAdminDetectorPeakAreaRegionEnd->text().toInt();
     detector->continuum = ui.tbAdminDetectorContinuum->text().toDouble();
-    detector->continuumFunction = ui.cboxAdminDetectorContinuumFunction->currentText();
+    detector->continuumFunction = continuumFunctionFromName(ui.cboxAdminDetectorContinuumFunction->currentText());
     detector->criticalLevelTest = ui.cbAdminDetectorCriticalLevelTest->isChecked();
     detector->useFixedFWHM = ui.cbAdminDetectorUseFixedFWHM->isChecked();
     detector->useFixedTailParameter = ui.cbAdminDetectorUseFixedTailParameter->isChecked();
@@ -920,18 +1297,18 @@ void Nailab::onAdminDetectorsAccepted()
     detector->maxFWHMsBetweenPeaks = ui.tbAdminDetectorMaxFWHMsBetweenPeaks->text().toDouble();
     detector->maxFWHMsForLeftLimit = ui.tbAdminDetectorMaxFWHMsForLeftLimit->text().toDouble();
     detector->maxFWHMsForRightLimit = ui.tbAdminDetectorMaxFWHMsForRightLimit->text().toDouble();
-    detector->backgroundSubtract = ui.tbAdminDetectorBackgroundSubtract->text();
-    detector->efficiencyCalibrationType = ui.cboxAdminDetectorEfficiencyCalibrationType->currentText();
-    detector->presetType1 = ui.cboxAdminDetectorPresetType1->currentText();
+    detector->backgroundSubtract = internString(ui.tbAdminDetectorBackgroundSubtract->text());
+    detector->efficiencyCalibrationType = efficiencyCalibrationFromName(ui.cboxAdminDetectorEfficiencyCalibrationType->currentText());
+    detector->presetType1 = countPresetFromName(ui.cboxAdminDetectorPresetType1->currentText());
     detector->presetType1Value = ui.tbAdminDetectorPresetType1Value->text().toDouble();
     detector->presetType1ChannelStart = ui.tbAdminDetectorPresetType1StartChannel->text().toInt();
     detector->presetType1ChannelEnd = ui.tbAdminDetectorPresetType1EndChannel->text().toInt();
-    detector->presetType2 = ui.cboxAdminDetectorPresetType2->currentText();
+    detector->presetType2 = timePresetFromName(ui.cboxAdminDetectorPresetType2->currentText());
     detector->presetType2Value = ui.tbAdminDetectorPresetType2Value->text().toDouble();
-    detector->presetType2Unit = ui.cboxAdminDetectorPresetType2Unit->currentText();
+    detector->presetType2Unit = timeUnitFromName(ui.cboxAdminDetectorPresetType2Unit->currentText());
     detector->randomError = ui.tbAdminDetectorRandomError->text().toDouble();
     detector->systematicError = ui.tbAdminDetectorSystematicError->text().toDouble();    
-    detector->NIDLibrary = ui.tbAdminDetectorNIDLibrary->text();
+    detector->NIDLibrary = internString(ui.tbAdminDetectorNIDLibrary->text());
     detector->NIDConfidenceTreshold = ui.tbAdminDetectorNIDConfidenceTreshold->text().toDouble();
     detector->MDAConfidenceFactor = ui.tbAdminDetectorMDAConfidenceFactor->text().toDouble();
     detector->performMDATest = ui.cbAdminDetectorPerformMDATest->isChecked();
@@ -939,7 +1316,12 @@ void Nailab::onAdminDetectorsAccepted()
     detector->useStoredLibrary = ui.cbAdminDetectorUseStoredLibrary->isChecked();
 
     writeDetectorXml(envDetectorFile, detectors);
-    updateDetectorViews();
+    compileJobTemplate(tempDirectory + detector->name, *detector, settings);
+    publishDetectors();
+
+    int row = ui.lvAdminDetectors->selectionModel()->currentIndex().row();
+    modelDetectors->detectorChanged(row);
+    updateDetectorStatus(row);
 }
 
 void Nailab::onLvAdminBeakersCurrentItemChanged(QListWidgetItem *current, QListWidgetItem *previous)
@@ -962,14 +1344,11 @@ void Nailab::onLvAdminBeakersCurrentItemChanged(QListWidgetItem *current, QListW
     }
 }
 
-void Nailab::onLvAdminDetectorsCurrentItemChanged(QListWidgetItem *current, QListWidgetItem *previous)
+void Nailab::onLvAdminDetectorsCurrentChanged(const QModelIndex& current, const QModelIndex& previous)
 {
     Q_UNUSED(previous);        
 
-    if(!current)
-        return;        
-
-    Detector* detector = getDetectorByName(current->text());
+    Detector* detector = modelDetectors->detectorAt(current);
     if(!detector)
         return;
 
@@ -982,7 +1361,7 @@ void Nailab::onLvAdminDetectorsCurrentItemChanged(QListWidgetItem *current, QLis
     ui.tbAdminDetectorPeakAreaRegionStart->setText(QString::number(detector->peakAreaRegionStart));
     ui.tbAdminDetectorPeakAreaRegionEnd->setText(QString::number(detector->peakAreaRegionEnd));
     ui.tbAdminDetectorContinuum->setText(QString::number(detector->continuum));
-    ui.cboxAdminDetectorContinuumFunction->setCurrentText(detector->continuumFunction);
+    ui.cboxAdminDetectorContinuumFunction->setCurrentText(continuumFunctionName(detector->continuumFunction));
     ui.cbAdminDetectorCriticalLevelTest->setChecked(detector->criticalLevelTest);
     ui.cbAdminDetectorUseFixedFWHM->setChecked(detector->useFixedFWHM);
     ui.cbAdminDetectorUseFixedTailParameter->setChecked(detector->useFixedTailParameter);
@@ -993,14 +1372,14 @@ void Nailab::onLvAdminDetectorsCurrentItemChanged(QListWidgetItem *current, QLis
     ui.tbAdminDetectorMaxFWHMsForLeftLimit->setText(QString::number(detector->maxFWHMsForLeftLimit));
     ui.tbAdminDetectorMaxFWHMsForRightLimit->setText(QString::number(detector->maxFWHMsForRightLimit));
     ui.tbAdminDetectorBackgroundSubtract->setText(detector->backgroundSubtract);
-    ui.cboxAdminDetectorEfficiencyCalibrationType->setCurrentText(detector->efficiencyCalibrationType);
-    ui.cboxAdminDetectorPresetType1->setCurrentText(detector->presetType1);
+    ui.cboxAdminDetectorEfficiencyCalibrationType->setCurrentText(efficiencyCalibrationName(detector->efficiencyCalibrationType));
+    ui.cboxAdminDetectorPresetType1->setCurrentText(countPresetName(detector->presetType1));
     ui.tbAdminDetectorPresetType1Value->setText(QString::number(detector->presetType1Value));
     ui.tbAdminDetectorPresetType1StartChannel->setText(QString::number(detector->presetType1ChannelStart));
     ui.tbAdminDetectorPresetType1EndChannel->setText(QString::number(detector->presetType1ChannelEnd));
-    ui.cboxAdminDetectorPresetType2->setCurrentText(detector->presetType2);
+    ui.cboxAdminDetectorPresetType2->setCurrentText(timePresetName(detector->presetType2));
     ui.tbAdminDetectorPresetType2Value->setText(QString::number(detector->presetType2Value));
-    ui.cboxAdminDetectorPresetType2Unit->setCurrentText(detector->presetType2Unit);
+    ui.cboxAdminDetectorPresetType2Unit->setCurrentText(timeUnitName(detector->presetType2Unit));
     ui.tbAdminDetectorRandomError->setText(QString::number(detector->randomError));
     ui.tbAdminDetectorSystematicError->setText(QString::number(detector->systematicError));
     ui.tbAdminDetectorNIDLibrary->setText(detector->NIDLibrary);
@@ -1060,28 +1439,33 @@ void Nailab::onBrowseRPTExport()
 
 void Nailab::onInputSampleAccepted()
 {
-    if(!validateSampleInput())
-        return;
-
     SampleInput sampleInput;
 
     storeSampleInput(sampleInput);
 
+    if(!groupDetectors.isEmpty())
+    {
+        startGroupJob(sampleInput);
+        return;
+    }
+
+    if(!validateSampleInput(sampleInput))
+        return;
+
     if(!startJob(sampleInput))
         return;
 }
 
 void Nailab::onAddDetectorBeaker()
 {
-    if(ui.lvAdminDetectors->selectedItems().count() < 1)
+    Detector* detector = selectedAdminDetector();
+    if(!detector)
         return;
 
     QStringList beakerlist;
     for(int j=0; j<beakers.count(); j++)
         beakerlist.append(beakers[j].name);
 
-    Detector* detector = getDetectorByName(ui.lvAdminDetectors->selectedItems()[0]->text());
-
     foreach(QString key, detector->beakers.keys())
     {
         if(beakerlist.contains(key))
@@ -1090,57 +1474,54 @@ void Nailab::onAddDetectorBeaker()
 
     if(beakerlist.count() > 0)
     {
-        dlgNewDetectorBeaker->setDetector(detector->name);
-        dlgNewDetectorBeaker->setBeakers(beakerlist);
-        dlgNewDetectorBeaker->setCalFilePath(libraryDirectory);
-        dlgNewDetectorBeaker->exec();
+        createdetectorbeaker* dialog = newDetectorBeakerDialog();
+        dialog->setDetector(detector->name);
+        dialog->setBeakers(beakerlist);
+        dialog->setCalFilePath(libraryDirectory);
+        dialog->exec();
     }
 }
 
 void Nailab::onDeleteDetectorBeaker()
 {
-    if(ui.lvAdminDetectors->selectedItems().count() < 1)
+    Detector* detector = selectedAdminDetector();
+    if(!detector)
         return;
 
-    int row = ui.twAdminDetectorBeaker->currentRow();
+    int row = ui.twAdminDetectorBeaker->currentIndex().row();
     if(row < 0)
         return;
 
-    Detector* detector = getDetectorByName(ui.lvAdminDetectors->selectedItems()[0]->text());
-
-    QLabel *lbl = dynamic_cast<QLabel*>(ui.twAdminDetectorBeaker->cellWidget(row, 0));
-    QString doe = lbl->text();
-
-    if(detector->beakers.contains(doe))
-        detector->beakers.remove(doe);    
+    showBeakersForDetector(detector);
+    modelDetectorBeakers->removeBeaker(modelDetectorBeakers->beakerAt(row));
 
     writeDetectorXml(envDetectorFile, detectors);
-    showBeakersForDetector(detector);
+    publishDetectors();
 }
 
 void Nailab::onEditDetectorBeaker()
 {
-    if(ui.lvAdminDetectors->selectedItems().count() < 1)
+    Detector* detector = selectedAdminDetector();
+    if(!detector)
         return;
 
-    int row = ui.twAdminDetectorBeaker->currentRow();
+    int row = ui.twAdminDetectorBeaker->currentIndex().row();
     if(row < 0)
         return;
 
-    Detector* detector = getDetectorByName(ui.lvAdminDetectors->selectedItems()[0]->text());
-
-    QLabel *lbl = dynamic_cast<QLabel*>(ui.twAdminDetectorBeaker->cellWidget(row, 0));
-    QString beakerName = lbl->text();
+    QString beakerName = modelDetectorBeakers->beakerAt(row);
 
-    dlgEditDetectorBeaker->setDetector(detector->name);
-    dlgEditDetectorBeaker->setBeaker(beakerName);
-    dlgEditDetectorBeaker->setCalFilePath(libraryDirectory);
-    dlgEditDetectorBeaker->exec();
+    editdetectorbeaker* dialog = editDetectorBeakerDialog();
+    dialog->setDetector(detector->name);
+    dialog->setBeaker(beakerName);
+    dialog->setCalFilePath(libraryDirectory);
+    dialog->exec();
 }
 
 void Nailab::onSampleBeakerChanged(QString beaker)
 {
-    QString detectorName = ui.lblInputSampleDetector->text();
+    // A group sample shows the calibrations of its first detector
+    QString detectorName = groupDetectors.isEmpty() ? ui.lblInputSampleDetector->text() : groupDetectors.first();
     QString filter = detectorName + beaker + "*.cal";
     QStringList filters;
     filters.append(filter);
@@ -1150,7 +1531,8 @@ void Nailab::onSampleBeakerChanged(QString beaker)
     for(int i=0; i<calfiles.count(); i++)
         ui.cboxInputSampleCalFiles->addItem(libraryDirectory + calfiles[i]);
     Detector* det = getDetectorByName(detectorName);
-    ui.cboxInputSampleCalFiles->setCurrentText(det->beakers[beaker]);
+    if(det)
+        ui.cboxInputSampleCalFiles->setCurrentText(det->beakers.value(beaker));
 }
 
 void Nailab::onShowJob()
@@ -1162,6 +1544,31 @@ void Nailab::onShowJob()
         QProcess::startDetached("notepad.exe", QStringList() << rptFile);
 }
 
+void Nailab::onArchiveActivated(const QModelIndex& index)
+{
+    QString filename = modelArchive->filePath(index);
+    if(modelArchive->isDir(index))
+        return;
+
+    // Chunked scripts and logs are put back together in a temporary copy
+    if(filename.endsWith(".REF", Qt::CaseInsensitive))
+    {
+        QString original = filename.left(filename.length() - 4);
+        QByteArray data;
+        QFile copy(QDir::temp().absoluteFilePath(QFileInfo(original).fileName()));
+        if(!readArchivedFile(original, data) || !copy.open(QIODevice::WriteOnly | QIODevice::Truncate))
+        {
+            ui.statusbar->showMessage(tr("Unable to read ") + QDir::toNativeSeparators(original));
+            return;
+        }
+        copy.write(data);
+        copy.close();
+        filename = copy.fileName();
+    }
+
+    QProcess::startDetached("notepad.exe", QStringList() << QDir::toNativeSeparators(filename));
+}
+
 void Nailab::onPrintJob()
 {
     QModelIndex idx = ui.lvFinishedJobs->selectionModel()->currentIndex();
@@ -1169,33 +1576,11 @@ void Nailab::onPrintJob()
     QString detName = QFileInfo(doneFile).completeBaseName();
     QString baseFilename = tempDirectory + detName;
 
-    QFile jobfile(baseFilename + ".PNT");
-    if(!jobfile.open(QIODevice::WriteOnly | QIODevice::Text | QIODevice::Truncate))
+    if(!writePrintFile(baseFilename, detName, settings))
     {
         QMessageBox::information(this, tr("Error"), tr("Unable to open print file"));
         return;
     }
-    QTextStream stream(&jobfile);
-
-    startJobCommand(stream, "report");
-    addJobParam(stream, "det:", detName);
-    addJobParamQuoted(stream, "/template=", settings.templateName);
-    addJobParamSingle(stream, "/newfile");
-    addJobParamSingle(stream, "/firstpg");
-    addJobParamSingle(stream, "/newpg");
-    addJobParamQuoted(stream, "/outfile=", baseFilename + ".RPT"); // FIXME
-    addJobParamQuoted(stream, "/section=", "");
-    addJobParam(stream, "/EM=", QString::number(settings.errorMultiplier));
-    addJobParamSingle(stream, "/PRINT");
-    endJobCommand(stream);
-
-    startJobCommand(stream, "dataplot");
-    addJobParam(stream, "det:", detName);
-    addJobParam(stream, "/scale=", "log");
-    addJobParamSingle(stream, "/enhplot");
-    endJobCommand(stream);
-
-    jobfile.close();
 
     QtConcurrent::run(runJob, baseFilename + ".PNT");
 }
@@ -1205,45 +1590,98 @@ void Nailab::onStoreJob()
     QModelIndex idx = ui.lvFinishedJobs->selectionModel()->currentIndex();
     QString doneFile = modelFinishedJobs->filePath(idx);
     QString detName = QFileInfo(doneFile).completeBaseName();
-    QString baseFilename = tempDirectory + detName;
 
+    // The job stays in the finished list until its store has committed
     Detector* det = getDetectorByName(detName);
-    if(!updateDetectorSpectrumCounter(envDetectorFile, det))
-        return; // FIXME
-    QDate date = QDate::currentDate();
-    int iyear = date.year() % 1000;
-    QString fname = QString("%1%2%3").arg(detName).arg(iyear, 2, 10, QChar('0')).arg(det->spectrumCounter, 4, 10, QChar('0'));
-
-    QString reportFilename = baseFilename + ".RPT";
-    QString batchFilename = baseFilename + ".BAT";
-    QString outFilename = baseFilename + ".OUT";
-    QString errFilename = baseFilename + ".ERR";
-    QString specFilename = baseFilename + ".CNF";
-    QString doneFilename = baseFilename + ".DONE";
-    QString printFilename = baseFilename + ".PNT";
-
-    QString currPath = archiveDirectory + QString::number(date.year()) + QDir::separator() + detName + QDir::separator();
-
-    if(!QDir(archiveDirectory + QString::number(date.year())).exists())
-        QDir().mkdir(archiveDirectory + QString::number(date.year()));
-
-    if(!QDir(currPath).exists())
-        QDir().mkdir(currPath);
-
-    if(QFile::exists(reportFilename))
-        QFile::rename(reportFilename, (currPath + fname + ".RPT").toUpper());
-    if(QFile::exists(batchFilename))
-        QFile::rename(batchFilename, (currPath + fname + ".BAT").toUpper());
-    if(QFile::exists(outFilename))
-        QFile::rename(outFilename, (currPath + fname + ".OUT").toUpper());
-    if(QFile::exists(errFilename))
-        QFile::rename(errFilename, (currPath + fname + ".ERR").toUpper());
-    if(QFile::exists(specFilename))
-        QFile::rename(specFilename, (currPath + fname + ".CNF").toUpper());
-    if(QFile::exists(doneFilename))
-        QFile::remove(doneFilename);
-    if(QFile::exists(printFilename))
-        QFile::remove(printFilename);
+    if(!det || storingJobs.contains(detName))
+        return;
+
+    // A group is stored as a whole, once every one of its jobs has finished
+    QStringList storeNames;
+    JobGroup group;
+    if(findJobGroup(tempDirectory, detName, group))
+    {
+        if(!jobGroupFinished(tempDirectory, group))
+        {
+            ui.statusbar->showMessage(tr("Group %1 is still counting").arg(group.id), 5000);
+            return;
+        }
+        foreach(const QString& name, group.detectors)
+        {
+            if(!group.stored.contains(name) && !storingJobs.contains(name))
+                storeNames << name;
+        }
+    }
+    else
+        storeNames << detName;
+
+    // Nothing is queued unless every detector is known and all counters were written together
+    QList<Detector*> storeDetectors;
+    foreach(const QString& name, storeNames)
+    {
+        det = getDetectorByName(name);
+        if(!det)
+        {
+            QMessageBox::information(this, tr("Error"), tr("Unable to store job, detector %1 not found").arg(name));
+            return;
+        }
+        storeDetectors << det;
+    }
+    if(!updateDetectorSpectrumCounters(envDetectorFile, storeDetectors))
+    {
+        QMessageBox::information(this, tr("Error"), tr("Unable to update the spectrum counters, nothing was stored"));
+        return;
+    }
+
+    foreach(Detector* storeDetector, storeDetectors)
+    {
+        storingJobs.insert(storeDetector->name);
+        QMetaObject::invokeMethod(archiveStore, "store", Qt::QueuedConnection, Q_ARG(Detector, *storeDetector));
+    }
+
+    publishDetectors();
+}
+
+void Nailab::onStoreProgress(const QString& detectorName, int done, int total)
+{
+    ui.statusbar->showMessage(tr("Storing %1 (%2 of %3)").arg(detectorName).arg(done).arg(total));
+}
+
+void Nailab::onJobStoreFailed(const QString& detectorName, const QString& error)
+{
+    storingJobs.remove(detectorName);
+    ui.statusbar->clearMessage();
+    QMessageBox::information(this, tr("Error"), tr("Unable to store job for %1: %2").arg(detectorName).arg(error));
+}
+
+void Nailab::onArchiveCorrupted(const QString& file, const QString& problem)
+{
+    ui.statusbar->showMessage(tr("Archive check: %1 %2").arg(QDir::toNativeSeparators(file)).arg(problem));
+}
+
+void Nailab::onJobStored(const QString& detectorName, const QString& archiveBase)
+{
+    storingJobs.remove(detectorName);
+    ui.statusbar->showMessage(tr("Stored %1").arg(QFileInfo(archiveBase).fileName()), 5000);
+
+    if(resultStore->isOpen() && !resultStore->appendReport(archiveBase + ".RPT"))
+        ui.statusbar->showMessage(tr("Unable to add results to the result store: ") + archiveBase + ".RPT");
+
+    if(!settings.RPTExportFolder.isEmpty())
+        QMetaObject::invokeMethod(reportExporter, "enqueue", Qt::QueuedConnection,
+                                  Q_ARG(QString, archiveBase + ".RPT"), Q_ARG(QString, settings.RPTExportFolder));
+
+    driftMonitor->addSpectrum(detectorName, archiveBase + ".CNF");
+
+    JobGroup group;
+    if(findJobGroup(tempDirectory, detectorName, group))
+    {
+        group.stored.insert(detectorName, archiveBase);
+        if(group.stored.count() < group.detectors.count())
+            writeJobGroup(tempDirectory, group);
+        else if(archiveJobGroup(tempDirectory, archiveDirectory, group))
+            ui.statusbar->showMessage(tr("Stored group %1").arg(group.id), 5000);
+    }
 }
 
 void Nailab::onRejectJob()
@@ -1251,28 +1689,44 @@ void Nailab::onRejectJob()
     QModelIndex idx = ui.lvFinishedJobs->selectionModel()->currentIndex();
     QString doneFile = modelFinishedJobs->filePath(idx);
     QString detName = QFileInfo(doneFile).completeBaseName();
-    QString baseFilename = tempDirectory + detName;
+    if(storingJobs.contains(detName))
+        return;
 
-    QString reportFilename = baseFilename + ".RPT";
-    QString batchFilename = baseFilename + ".BAT";
-    QString outFilename = baseFilename + ".OUT";
-    QString errFilename = baseFilename + ".ERR";
-    QString specFilename = baseFilename + ".CNF";
-    QString doneFilename = baseFilename + ".DONE";
-    QString printFilename = baseFilename + ".PNT";
-
-    if(QFile::exists(reportFilename))
-        QFile::remove(reportFilename);
-    if(QFile::exists(batchFilename))
-        QFile::remove(batchFilename);
-    if(QFile::exists(outFilename))
-        QFile::remove(outFilename);
-    if(QFile::exists(errFilename))
-        QFile::remove(errFilename);
-    if(QFile::exists(specFilename))
-        QFile::remove(specFilename);
-    if(QFile::exists(doneFilename))
-        QFile::remove(doneFilename);
-    if(QFile::exists(printFilename))
-        QFile::remove(printFilename);
+    if(!rejectJob(tempDirectory, detName))
+        return;
+
+    // The rest of the group is stored without the rejected job
+    JobGroup group;
+    if(findJobGroup(tempDirectory, detName, group))
+    {
+        group.detectors.removeAll(detName);
+        if(group.detectors.isEmpty())
+            removeJobGroup(tempDirectory, group.id);
+        else if(group.stored.count() == group.detectors.count())
+            archiveJobGroup(tempDirectory, archiveDirectory, group);
+        else
+            writeJobGroup(tempDirectory, group);
+    }
+}
+
+void Nailab::onQAOutOfControl(const QString& detectorName, const QString& message)
+{
+    countMetric(MetricQAViolations, detectorName);
+    QMessageBox::warning(this, tr("%1 out of control").arg(detectorName),
+                         tr("The check source measurement violates the control rules:\n") + message);
+}
+
+void Nailab::onDriftProgress(int done, int failed, int total)
+{
+    if(total > 1)
+        ui.statusbar->showMessage(tr("Calibration drift: %1 of %2 spectra, %3 failed").arg(done + failed).arg(total).arg(failed), 5000);
+}
+
+void Nailab::onDriftAlert(const QString& detectorName, int alert, const QString& message)
+{
+    countMetric(MetricDriftAlerts, detectorName);
+    if(alert == DriftStatus::AlertRecalibrate)
+        QMessageBox::warning(this, tr("%1 calibration drift").arg(detectorName), message);
+    else
+        ui.statusbar->showMessage(message);
 }
@@ -13,6 +13,10 @@
 #include <QStandardItemModel>
 #include <QFileSystemModel>
 #include <QTimer>
+#include <QThread>
+#include <QFuture>
+#include <QFutureWatcher>
+#include <QSet>
 #include "ui_nailab.h"
 #include "settings.h"
 #include "createbeaker.h"
@@ -21,12 +25,33 @@
 #include "editdetectorbeaker.h"
 #include "beaker.h"
 #include "detector.h"
+#include "detectormodel.h"
 #include "mcalib.h"
+#include "jobapi.h"
+#include "reportexporter.h"
+#include "metrics.h"
+#include "resultstore.h"
+#include "reanalysis.h"
+#include "archivestore.h"
+#include "startupconfig.h"
+#include "jobgroup.h"
+#include "qastore.h"
+#include "qapanel.h"
+#include "driftmonitor.h"
 
 #define NAILAB_ENVIRONMENT_VARIABLE "NAIROOT"
 
 struct SampleInput;
 
+// MCA answers collected off the GUI thread during startup
+struct MCAProbe
+{
+    QMap<QString, int> maxChannels;
+    QMap<QString, bool> busy;
+    QMap<QString, bool> highVoltage;
+    QString error;
+};
+
 class Nailab : public QMainWindow
 {
     Q_OBJECT
@@ -48,53 +73,95 @@ private:
     editdetectorbeaker *dlgEditDetectorBeaker;
 
     QTimer *idleTimer;
+    QThread *apiThread;
+    JobApiServer *apiServer;
+    QThread *exportThread;
+    ReportExporter *reportExporter;
+    MetricsExporter *metricsExporter;
+    QThread *archiveThread;
+    ArchiveStore *archiveStore;
+    QThread *scrubThread;
+    ArchiveScrubber *archiveScrubber;
+    QSet<QString> storingJobs;
+    QStringList groupDetectors;             // detectors of the group sample being entered
+    QList<JobGroup> pendingGroups;          // groups whose jobs are not all at the start barrier yet
+    ResultStore *resultStore;
+    ReanalysisBatch *reanalysis;
+    QAStore *qaStore;
+    QAPanel *qaPanel;
+    DriftMonitor *driftMonitor;
     QString username;    
-    QString rootDirectory, configurationDirectory, archiveDirectory, tempDirectory, libraryDirectory;
+    QString rootDirectory, configurationDirectory, archiveDirectory, tempDirectory, libraryDirectory, resultsDirectory, cacheDirectory;
     QFile envSettingsFile, envBeakerFile, envDetectorFile, envQuantityUnitFile;
 
     QMap<QWidget*, QActionGroup*> toolGroups;
     Settings settings;
     QList<Beaker> beakers;
     QList<Detector> detectors;
+    DetectorIndex detectorIndex;
     QList<QString> detectorNames;    
+    QStringList quantityUnits;
+    QStringList recoveryMessages;
+    QStringList poweredOff;
     QListWidgetItem *listItemJobs, *listItemDetectors, *listItemArchive;
 
     QFileSystemModel *modelArchive, *modelRunningJobs, *modelFinishedJobs;
+    DetectorModel *modelDetectors;
+    DetectorInUseFilter *modelDetectorsInUse;
+    DetectorBeakerModel *modelDetectorBeakers;
 
     bool bAdminDetectorsEnabled, bAdminBeakersEnabled, bFinishedJobsSelected;
 
+    StartupProfile startupProfile;
+    QFuture<MCAProbe> mcaProbe;
+    QFutureWatcher<MCAProbe> mcaProbeWatcher;
+    bool bMCAReady;
+
     bool setupEnvironment();
-    void setupDialogs();
+    CreateBeaker* newBeakerDialog();
+    CreateDetector* newDetectorDialog();
+    createdetectorbeaker* newDetectorBeakerDialog();
+    editdetectorbeaker* editDetectorBeakerDialog();
     bool setupMCA();    
+    void waitForMCA();
+    void setupJobApi();
+    void setupArchive();
+    void publishDetectors();
     void configureWidgets();
     void enableControlTree(QObject *parent, bool enable);
     void updateSettings();
     void updateBeakerViews();
     void updateDetectorViews();
+    void updateDetectorStatus(int row);
+    void setDetectorPowered(const QString& name, bool powered);
 
-    void disableListWidgetItem(QListWidgetItem *item);
     Detector* getDetectorByName(const QString& name);
+    Detector* selectedAdminDetector();
+    bool checkDetectorFree(const Detector* detector);
+    void showSampleInput(const Detector* detector);
 
     void showBeakersForDetector(Detector *detector);
 
-    bool validateSampleInput();
+    bool validateSampleInput(const SampleInput& sampleInput);
     void storeSampleInput(SampleInput& sampleInput);
     bool startJob(SampleInput& sampleInput);
-    void startJobCommand(QTextStream& s, const QString& cmd);
-    void endJobCommand(QTextStream& s);
-    void addJobParam(QTextStream& s, const QString& p, const QString& v);
-    void addJobParamSingle(QTextStream& s, const QString& v);
-    void addJobParamQuoted(QTextStream& s, const QString& p, const QString& v);
-    bool detectorHasJob(const Detector* det);
+    bool startGroupJob(const SampleInput& sampleInput);
+    void releasePendingGroups();
 
 private slots:
 
     void onIdle();
+    void onStartupFinished();
+    void onMCAProbed();
+    void onApiJobStarted(const QString& detectorName);
+    void onReportExported(const QString& reportFile, qint64 latencyMs, int queueDepth);
+    void onReportExportFailed(const QString& reportFile, const QString& error);
     void onQuit();
     void onBack();
     void onAdmin();
     void onMenuSelect(QListWidgetItem* item);
-    void onDetectorSelect(QListWidgetItem* item);
+    void onDetectorSelect(const QModelIndex& index);
+    void onGroupSample();
 
     void onPagesChanged(int index);
     void onTabsAdminChanged(int index);
@@ -108,11 +175,14 @@ private slots:
     void onNewDetector();
     void onNewDetectorAccepted();
     void onNewDetectorBeakerAccepted();
+    void onReanalyseDetector();
+    void onReanalysisProgress(int done, int failed, int total, double spectraPerMinute);
+    void onReanalysisFinished(int done, int failed, qint64 msecs);
     void onEditDetectorBeakerAccepted();
     void onAdminDetectorsAccepted();    
 
     void onLvAdminBeakersCurrentItemChanged(QListWidgetItem *current, QListWidgetItem *previous);
-    void onLvAdminDetectorsCurrentItemChanged(QListWidgetItem *current, QListWidgetItem *previous);
+    void onLvAdminDetectorsCurrentChanged(const QModelIndex& current, const QModelIndex& previous);
 
     void onBrowseBackgroundSubtract();
     void onBrowseTemplateName();
@@ -128,9 +198,17 @@ private slots:
     void onSampleBeakerChanged(QString beaker);    
 
     void onShowJob();
+    void onArchiveActivated(const QModelIndex& index);
     void onPrintJob();
     void onStoreJob();
+    void onStoreProgress(const QString& detectorName, int done, int total);
+    void onJobStored(const QString& detectorName, const QString& archiveBase);
+    void onJobStoreFailed(const QString& detectorName, const QString& error);
+    void onArchiveCorrupted(const QString& file, const QString& problem);
     void onRejectJob();
+    void onQAOutOfControl(const QString& detectorName, const QString& message);
+    void onDriftProgress(int done, int failed, int total);
+    void onDriftAlert(const QString& detectorName, int alert, const QString& message);
 };
 
 #endif // NAILAB_H
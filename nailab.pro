@@ -6,9 +6,9 @@
 
 CONFIG += c++11
 
-QT       += core gui xml
+QT       += core gui xml network
 
-greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
+greaterThan(QT_MAJOR_VERSION, 4): QT += widgets concurrent
 
 TARGET = nailab
 TEMPLATE = app
@@ -18,10 +18,36 @@ SOURCES += main.cpp\
     createbeaker.cpp \
     createdetector.cpp \
     dbutils.cpp \    
+    detector.cpp \
     mcalib.cpp \
     winutils.cpp \
     createdetectorbeaker.cpp \
-    editdetectorbeaker.cpp
+    editdetectorbeaker.cpp \
+    detectormodel.cpp \
+    jobutils.cpp \
+    sampleinput.cpp \
+    preflight.cpp \
+    jobgroup.cpp \
+    jobtrace.cpp \
+    jobjournal.cpp \
+    chunkstore.cpp \
+    archivestore.cpp \
+    metrics.cpp \
+    jobapi.cpp \
+    scheduler.cpp \
+    naiimporter.cpp \
+    reportexporter.cpp \
+    reportparser.cpp \
+    resultstore.cpp \
+    reporttemplate.cpp \
+    reanalysis.cpp \
+    analysiscache.cpp \
+    stagegraph.cpp \
+    startupconfig.cpp \
+    qastore.cpp \
+    controlchart.cpp \
+    qapanel.cpp \
+    driftmonitor.cpp
 
 HEADERS  += nailab.h \
     createbeaker.h \
@@ -35,7 +61,31 @@ HEADERS  += nailab.h \
     sampleinput.h \
     createdetectorbeaker.h \
     editdetectorbeaker.h \
-    exceptions.h
+    exceptions.h \
+    detectormodel.h \
+    jobutils.h \
+    preflight.h \
+    jobgroup.h \
+    jobtrace.h \
+    jobjournal.h \
+    chunkstore.h \
+    archivestore.h \
+    metrics.h \
+    jobapi.h \
+    scheduler.h \
+    naiimporter.h \
+    reportexporter.h \
+    reportparser.h \
+    resultstore.h \
+    reporttemplate.h \
+    reanalysis.h \
+    analysiscache.h \
+    stagegraph.h \
+    startupconfig.h \
+    qastore.h \
+    controlchart.h \
+    qapanel.h \
+    driftmonitor.h
 
 FORMS    += nailab.ui \
     createbeaker.ui \
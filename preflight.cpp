@@ -0,0 +1,147 @@
+#include <QDir>
+#include <QFileInfo>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QRunnable>
+#include <QSemaphore>
+#include <QSharedPointer>
+#include <QThreadPool>
+#include <functional>
+#include "preflight.h"
+#include "jobutils.h"
+
+// Messages of the checks of one preflight. Shared with the checks, which may outlive
+// a preflight that gave up waiting for them.
+struct PreflightState
+{
+    QMutex mutex;
+    QStringList problems;
+    QSemaphore done;
+};
+
+class PreflightCheck : public QRunnable
+{
+public:
+
+    PreflightCheck(const QSharedPointer<PreflightState>& state, const std::function<QString()>& check)
+        : mState(state), mCheck(check)
+    {
+    }
+
+    void run()
+    {
+        QString problem = mCheck();
+        if(!problem.isEmpty())
+        {
+            QMutexLocker lock(&mState->mutex);
+            mState->problems << problem;
+        }
+        mState->done.release();
+    }
+
+private:
+
+    QSharedPointer<PreflightState> mState;
+    std::function<QString()> mCheck;
+};
+
+static QThreadPool* preflightPool()
+{
+    // Not the global pool, running jobs occupy its threads for hours. Never destroyed,
+    // a check blocked on a dead share must not hold up the exit.
+    static QThreadPool* pool = 0;
+    static QMutex mutex;
+    QMutexLocker lock(&mutex);
+    if(!pool)
+    {
+        pool = new QThreadPool;
+        pool->setMaxThreadCount(8);
+    }
+    return pool;
+}
+
+QStringList genieCandidates(const Settings& settings, const QString& name, const QString& folder)
+{
+    QStringList candidates;
+    if(QFileInfo(name).isRelative() && !settings.genieFolder.isEmpty())
+        candidates << QDir(settings.genieFolder).absoluteFilePath(folder + "/" + name);
+    candidates << name;
+    return candidates;
+}
+
+static std::function<QString()> fileCheck(const QString& what, const QString& name, const QStringList& candidates)
+{
+    return [what, name, candidates]() -> QString {
+        foreach(const QString& candidate, candidates)
+        {
+            if(QFileInfo(candidate).isFile())
+                return QString();
+        }
+        return what + " not found: " + name;
+    };
+}
+
+bool preflightJob(const SampleInput& sampleInput, const Detector& detector, const Settings& settings,
+                  const QString& tempDirectory, QStringList& problems, bool checkFiles, int timeoutMs)
+{
+    QSharedPointer<PreflightState> state(new PreflightState);
+    QList<std::function<QString()> > checks;
+
+    QString calibration = detector.beakers.value(sampleInput.geometry);
+    if(checkFiles)
+    {
+        if(!calibration.isEmpty())
+            checks << fileCheck("Calibration file", calibration, genieCandidates(settings, calibration, "CAMFILES"));
+        if(!detector.backgroundSubtract.isEmpty())
+            checks << fileCheck("Background file", detector.backgroundSubtract,
+                                genieCandidates(settings, detector.backgroundSubtract, "CAMFILES"));
+        if(!detector.NIDLibrary.isEmpty())
+            checks << fileCheck("Nuclide library", detector.NIDLibrary, genieCandidates(settings, detector.NIDLibrary, "CAMFILES"));
+        if(!settings.templateName.isEmpty())
+            checks << fileCheck("Report template", settings.templateName, genieCandidates(settings, settings.templateName, "CTLFILES"));
+    }
+
+    QString detectorName = detector.name;
+    checks << [tempDirectory, detectorName]() -> QString {
+        return detectorHasJob(tempDirectory, detectorName) ? "Detector " + detectorName + " already has a job" : QString();
+    };
+
+    QThreadPool* pool = preflightPool();
+    foreach(const std::function<QString()>& check, checks)
+        pool->start(new PreflightCheck(state, check));
+
+    // Everything below needs no I/O and runs while the checks wait on the disk
+    QStringList local;
+    SampleParameters parameters;
+    parseSampleInput(sampleInput, parameters, local);
+
+    if(!detector.enabled || !detector.inUse)
+        local << "Detector " + detector.name + " is not in use";
+    if(calibration.isEmpty())
+        local << "Detector " + detector.name + " has no calibration for geometry '" + sampleInput.geometry + "'";
+    if(checkFiles && detector.NIDLibrary.isEmpty())
+        local << "Detector " + detector.name + " has no nuclide library";
+    if(checkFiles && settings.templateName.isEmpty())
+        local << "No report template";
+
+    // nid_intf only accepts a confidence from 0.1 to 1
+    if(detector.NIDConfidenceTreshold < 0.1 || detector.NIDConfidenceTreshold > 1.0)
+        local << "NID confidence threshold must be from 0.1 to 1, detector " + detector.name + " has "
+                 + QString::number(detector.NIDConfidenceTreshold);
+    if(detector.MDAConfidenceFactor <= 0.0)
+        local << "MDA confidence factor of detector " + detector.name + " must be greater than 0";
+
+    // nailab-cli and the API do not probe the MCA, their jobs are not checked here
+    if(parameters.presetType1 != CountPresetNone && detector.channelsProbed && detector.maxChannels > 0
+            && parameters.presetType1EndChannel > detector.maxChannels)
+        local << "Preset 1 end channel is beyond the " + QString::number(detector.maxChannels) + " channels of the detector";
+
+    bool finished = state->done.tryAcquire(checks.count(), timeoutMs);
+
+    problems << local;
+    QMutexLocker lock(&state->mutex);
+    problems << state->problems;
+    if(!finished)
+        problems << "File checks did not finish within " + QString::number(timeoutMs) + " ms";
+    return local.isEmpty() && state->problems.isEmpty() && finished;
+}
@@ -0,0 +1,24 @@
+#ifndef PREFLIGHT_H
+#define PREFLIGHT_H
+
+#include <QString>
+#include <QStringList>
+#include "detector.h"
+#include "settings.h"
+#include "sampleinput.h"
+
+// Checks run before a job is written, so a job that would fail in movedata, areacor,
+// effcor, nid_intf or report is refused before the detector counts for hours:
+// sample fields (parseSampleInput), detector parameters, the detector being free, and
+// the calibration, background, library and template files existing. File checks run
+// in parallel on a pool of their own, a share that does not answer within timeoutMs
+// counts as missing. Returns false and appends a message per problem.
+bool preflightJob(const SampleInput& sampleInput, const Detector& detector, const Settings& settings,
+                  const QString& tempDirectory, QStringList& problems,
+                  bool checkFiles = true, int timeoutMs = 5000);
+
+// Genie 2000 looks up relative names in its CAMFILES (or CTLFILES) folder, the places
+// name may be found in that order
+QStringList genieCandidates(const Settings& settings, const QString& name, const QString& folder);
+
+#endif // PREFLIGHT_H
@@ -0,0 +1,177 @@
+#include <QComboBox>
+#include <QLineEdit>
+#include <QDateTimeEdit>
+#include <QLabel>
+#include <QPushButton>
+#include <QVBoxLayout>
+#include <QHBoxLayout>
+#include <QFormLayout>
+#include <QMessageBox>
+#include <limits>
+#include "qapanel.h"
+#include "controlchart.h"
+
+static const char* metricLabels[QAMetricCount] = {
+    QT_TRANSLATE_NOOP("QAPanel", "Centroid (keV)"),
+    QT_TRANSLATE_NOOP("QAPanel", "FWHM (keV)"),
+    QT_TRANSLATE_NOOP("QAPanel", "Net count rate (cps)"),
+    QT_TRANSLATE_NOOP("QAPanel", "Background rate (cps)")
+};
+
+QAPanel::QAPanel(QAStore *store, QWidget *parent)
+    : QWidget(parent), mStore(store)
+{
+    mDetector = new QComboBox;
+    mMetric = new QComboBox;
+    for(int m=0; m<QAMetricCount; m++)
+        mMetric->addItem(tr(metricLabels[m]));
+
+    QHBoxLayout *selection = new QHBoxLayout;
+    selection->addWidget(new QLabel(tr("Detector")));
+    selection->addWidget(mDetector, 1);
+    selection->addWidget(new QLabel(tr("Metric")));
+    selection->addWidget(mMetric, 1);
+
+    mChart = new ControlChart;
+
+    // Metrics left empty were not measured
+    QFormLayout *form = new QFormLayout;
+    mTime = new QDateTimeEdit(QDateTime::currentDateTime());
+    mTime->setDisplayFormat("yyyy-MM-dd HH:mm");
+    mTime->setCalendarPopup(true);
+    form->addRow(tr("Measured"), mTime);
+    for(int m=0; m<QAMetricCount; m++)
+    {
+        mValues[m] = new QLineEdit;
+        form->addRow(tr(metricLabels[m]), mValues[m]);
+    }
+
+    QPushButton *record = new QPushButton(tr("Record"));
+    QPushButton *rebaseline = new QPushButton(tr("New baseline"));
+    mLastCheck = new QLabel;
+    mLastCheck->setWordWrap(true);
+    QHBoxLayout *buttons = new QHBoxLayout;
+    buttons->addWidget(mLastCheck, 1);
+    buttons->addWidget(rebaseline);
+    buttons->addWidget(record);
+
+    QVBoxLayout *layout = new QVBoxLayout(this);
+    layout->addLayout(selection);
+    layout->addWidget(mChart, 1);
+    layout->addLayout(form);
+    layout->addLayout(buttons);
+
+    connect(mDetector, SIGNAL(currentIndexChanged(int)), this, SLOT(onSeriesSelected()));
+    connect(mMetric, SIGNAL(currentIndexChanged(int)), this, SLOT(onSeriesSelected()));
+    connect(record, SIGNAL(clicked()), this, SLOT(onRecord()));
+    connect(rebaseline, SIGNAL(clicked()), this, SLOT(onRebaseline()));
+}
+
+void QAPanel::setDetectors(const QStringList& detectors)
+{
+    QString current = mDetector->currentText();
+    mDetector->blockSignals(true);
+    mDetector->clear();
+    mDetector->addItems(detectors);
+    mDetector->setCurrentIndex(qMax(0, detectors.indexOf(current)));
+    mDetector->blockSignals(false);
+    onSeriesSelected();
+}
+
+void QAPanel::onSeriesSelected()
+{
+    QString detector = mDetector->currentText();
+    if(detector.isEmpty())
+    {
+        mChart->setSeries(NULL, QString());
+        return;
+    }
+
+    int metric = mMetric->currentIndex();
+    mChart->setSeries(mStore->series(detector, (QAMetric)metric), detector + " - " + mMetric->currentText());
+}
+
+void QAPanel::onRecord()
+{
+    QString detector = mDetector->currentText();
+    if(detector.isEmpty())
+        return;
+
+    QAMeasurement measurement;
+    measurement.time = mTime->dateTime();
+    bool any = false;
+    for(int m=0; m<QAMetricCount; m++)
+    {
+        measurement.values[m] = std::numeric_limits<double>::quiet_NaN();
+        QString text = mValues[m]->text().trimmed();
+        if(text.isEmpty())
+            continue;
+
+        bool ok;
+        double value = text.toDouble(&ok);
+        if(!ok)
+        {
+            mLastCheck->setText(tr("Invalid value for %1").arg(tr(metricLabels[m])));
+            mValues[m]->setFocus();
+            return;
+        }
+        measurement.values[m] = value;
+        any = true;
+    }
+    if(!any)
+        return;
+
+    int rules[QAMetricCount];
+    if(!mStore->add(detector, measurement, rules))
+    {
+        mLastCheck->setText(tr("Unable to record the measurement for %1").arg(detector));
+        return;
+    }
+
+    QStringList rejected, warnings;
+    for(int m=0; m<QAMetricCount; m++)
+    {
+        QString line = tr(metricLabels[m]) + ": " + qaRuleNames(rules[m]);
+        if(rules[m] & QARejectRules)
+            rejected << line;
+        else if(rules[m])
+            warnings << line;
+        mValues[m]->clear();
+    }
+
+    if(!rejected.isEmpty())
+        mLastCheck->setText(tr("%1 out of control").arg(detector));
+    else if(!warnings.isEmpty())
+        mLastCheck->setText(tr("Warning, %1").arg(warnings.join("; ")));
+    else
+        mLastCheck->setText(tr("%1 in control").arg(detector));
+
+    mTime->setDateTime(QDateTime::currentDateTime());
+    mChart->seriesChanged();
+
+    if(!rejected.isEmpty())
+        emit outOfControl(detector, rejected.join("\n"));
+}
+
+void QAPanel::onRebaseline()
+{
+    QString detector = mDetector->currentText();
+    if(detector.isEmpty())
+        return;
+
+    // E.g. after a repair or with a new check source, the old limits no longer apply
+    if(QMessageBox::question(this, tr("New baseline"),
+                             tr("Establish new control limits for %1 from the next %2 measurements?")
+                             .arg(detector).arg(mStore->baseline()),
+                             QMessageBox::Yes | QMessageBox::No) != QMessageBox::Yes)
+        return;
+
+    if(!mStore->rebaseline(detector, QDateTime::currentDateTime()))
+    {
+        mLastCheck->setText(tr("Unable to start a new baseline for %1").arg(detector));
+        return;
+    }
+
+    mLastCheck->setText(tr("%1 is establishing new limits").arg(detector));
+    mChart->seriesChanged();
+}
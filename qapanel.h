@@ -0,0 +1,48 @@
+#ifndef QAPANEL_H
+#define QAPANEL_H
+
+#include <QWidget>
+#include <QStringList>
+#include "qastore.h"
+
+class QComboBox;
+class QLineEdit;
+class QDateTimeEdit;
+class QLabel;
+class ControlChart;
+
+// Contents of the QA tab: a control chart per detector and metric, and the form a
+// check source measurement is recorded with
+class QAPanel : public QWidget
+{
+    Q_OBJECT
+
+public:
+
+    // The store is not owned
+    explicit QAPanel(QAStore *store, QWidget *parent = 0);
+
+    void setDetectors(const QStringList& detectors);
+
+signals:
+
+    // A recorded measurement broke a rule that puts the detector out of control
+    void outOfControl(const QString& detector, const QString& message);
+
+private slots:
+
+    void onSeriesSelected();
+    void onRecord();
+    void onRebaseline();
+
+private:
+
+    QAStore *mStore;
+    QComboBox *mDetector, *mMetric;
+    ControlChart *mChart;
+    QDateTimeEdit *mTime;
+    QLineEdit *mValues[QAMetricCount];
+    QLabel *mLastCheck;
+};
+
+#endif // QAPANEL_H
@@ -0,0 +1,317 @@
+#include <QDir>
+#include <QFile>
+#include <QTextStream>
+#include <cmath>
+#include "qastore.h"
+
+static const char* metricNames[QAMetricCount] = { "centroid", "fwhm", "net-rate", "background-rate" };
+
+QString qaMetricName(QAMetric metric)
+{
+    return QLatin1String(metricNames[metric]);
+}
+
+bool qaMetricFromName(const QString& name, QAMetric& metric)
+{
+    for(int i=0; i<QAMetricCount; i++)
+    {
+        if(name == metricNames[i])
+        {
+            metric = (QAMetric)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+QString qaRuleNames(int rules)
+{
+    static const char* ruleNames[] = { "1-2s", "1-3s", "2-2s", "R-4s", "4-1s", "10x" };
+    QStringList names;
+    for(int i=0; i<6; i++)
+    {
+        if(rules & (1 << i))
+            names << ruleNames[i];
+    }
+    return names.join(", ");
+}
+
+void RunningStats::add(double value)
+{
+    mCount++;
+    double delta = value - mMean;
+    mMean += delta / mCount;
+    mM2 += delta * (value - mMean);
+}
+
+double RunningStats::standardDeviation() const
+{
+    return std::sqrt(variance());
+}
+
+QASeries::QASeries(int baseline)
+    : mBaseline(qMax(2, baseline)), mBaselineStart(0)
+{
+}
+
+void QASeries::rebaseline()
+{
+    mBaselineStart = mValues.count();
+    mLimits = RunningStats();
+    mStats = RunningStats();
+}
+
+int QASeries::check(double value) const
+{
+    double sd = mLimits.standardDeviation();
+    if(!established() || sd <= 0.0)
+        return 0;
+
+    // z of the new value, then of the values before it since the baseline, newest first
+    double mean = mLimits.mean();
+    double z = (value - mean) / sd;
+    int rules = 0;
+    if(std::fabs(z) > 2.0)
+        rules |= QARule12s;
+    if(std::fabs(z) > 3.0)
+        rules |= QARule13s;
+
+    int n = mValues.count(), since = n - mBaselineStart;
+    if(since >= 1)
+    {
+        double z1 = (mValues[n - 1] - mean) / sd;
+        if((z > 2.0 && z1 > 2.0) || (z < -2.0 && z1 < -2.0))
+            rules |= QARule22s;
+        if((z > 2.0 && z1 < -2.0) || (z < -2.0 && z1 > 2.0))
+            rules |= QARuleR4s;
+    }
+
+    if(since >= 3)
+    {
+        bool above = z > 1.0, below = z < -1.0;
+        for(int i=1; i<=3; i++)
+        {
+            double zi = (mValues[n - i] - mean) / sd;
+            above = above && zi > 1.0;
+            below = below && zi < -1.0;
+        }
+        if(above || below)
+            rules |= QARule41s;
+    }
+
+    if(since >= 9)
+    {
+        bool above = z > 0.0, below = z < 0.0;
+        for(int i=1; i<=9; i++)
+        {
+            above = above && mValues[n - i] > mean;
+            below = below && mValues[n - i] < mean;
+        }
+        if(above || below)
+            rules |= QARule10x;
+    }
+    return rules;
+}
+
+int QASeries::add(const QDateTime& time, double value)
+{
+    int rules = check(value);
+    mTimes.append(time.toMSecsSinceEpoch());
+    mValues.append(value);
+    mRules.append(rules);
+    // Nothing is rejected while the limits are established
+    if(!established())
+        mLimits.add(value);
+    if(!(rules & QARejectRules))
+        mStats.add(value);
+    addToLevels(mValues.count() - 1);
+    return rules;
+}
+
+static void addToBucket(QVector<QABucket>& level, int size, int index, double value, int rules)
+{
+    int b = index / size;
+    if(b == level.count())
+    {
+        QABucket bucket;
+        bucket.first = b * size;
+        bucket.count = 0;
+        bucket.min = bucket.max = value;
+        bucket.rules = 0;
+        level.append(bucket);
+    }
+
+    QABucket& bucket = level[b];
+    bucket.count++;
+    bucket.min = qMin(bucket.min, value);
+    bucket.max = qMax(bucket.max, value);
+    bucket.rules |= rules;
+}
+
+void QASeries::addToLevels(int index)
+{
+    // A level is started from the values so far once it has a full bucket, which adds
+    // up to about a third of the values once more over the life of the series
+    int count = index + 1;
+    int size = 4;
+    for(int k=0; k<mLevels.count() || count >= size; k++, size *= 4)
+    {
+        if(k == mLevels.count())
+        {
+            mLevels.append(QVector<QABucket>());
+            for(int i=0; i<count; i++)
+                addToBucket(mLevels[k], size, i, mValues[i], mRules[i]);
+        }
+        else
+            addToBucket(mLevels[k], size, index, mValues[index], mRules[index]);
+    }
+}
+
+void QASeries::downsample(int from, int to, int maxBuckets, QVector<QABucket>& buckets) const
+{
+    buckets.resize(0);
+    from = qMax(0, from);
+    to = qMin(count(), to);
+    if(from >= to)
+        return;
+
+    int span = to - from;
+    if(span <= maxBuckets || mLevels.isEmpty())
+    {
+        for(int i=from; i<to; i++)
+        {
+            QABucket bucket;
+            bucket.first = i;
+            bucket.count = 1;
+            bucket.min = bucket.max = mValues[i];
+            bucket.rules = mRules[i];
+            buckets.append(bucket);
+        }
+        return;
+    }
+
+    int k = 0, size = 4;
+    while(k < mLevels.count() - 1 && span / size > maxBuckets)
+    {
+        k++;
+        size *= 4;
+    }
+
+    const QVector<QABucket>& level = mLevels[k];
+    for(int b = from / size; b <= (to - 1) / size && b < level.count(); b++)
+        buckets.append(level[b]);
+}
+
+QAStore::QAStore(const QString& directory, int baseline)
+    : mDirectory(directory), mBaseline(baseline)
+{
+}
+
+QAStore::~QAStore()
+{
+    foreach(const DetectorSeries& d, mDetectors)
+    {
+        for(int m=0; m<QAMetricCount; m++)
+            delete d.series[m];
+    }
+}
+
+QAStore::DetectorSeries& QAStore::load(const QString& detector)
+{
+    QMap<QString, DetectorSeries>::iterator iter = mDetectors.find(detector);
+    if(iter != mDetectors.end())
+        return iter.value();
+
+    DetectorSeries d;
+    for(int m=0; m<QAMetricCount; m++)
+        d.series[m] = new QASeries(mBaseline);
+
+    // <ISO time> and one value per metric, tab separated, "-" for not measured, or
+    // BASELINE and the time new limits were started
+    QFile file(mDirectory + detector + ".QA");
+    if(file.open(QIODevice::ReadOnly | QIODevice::Text))
+    {
+        QTextStream stream(&file);
+        while(!stream.atEnd())
+        {
+            QStringList fields = stream.readLine().split('\t');
+            if(fields[0] == "BASELINE")
+            {
+                for(int m=0; m<QAMetricCount; m++)
+                    d.series[m]->rebaseline();
+                continue;
+            }
+            if(fields.count() != QAMetricCount + 1)
+                continue;
+
+            QDateTime time = QDateTime::fromString(fields[0], Qt::ISODate);
+            if(!time.isValid())
+                continue;
+
+            for(int m=0; m<QAMetricCount; m++)
+            {
+                bool ok;
+                double value = fields[m + 1].toDouble(&ok);
+                if(ok)
+                    d.series[m]->add(time, value);
+            }
+        }
+        file.close();
+    }
+
+    return mDetectors.insert(detector, d).value();
+}
+
+bool QAStore::append(const QString& detector, const QString& line)
+{
+    if(!QDir().mkpath(mDirectory))
+        return false;
+    QFile file(mDirectory + detector + ".QA");
+    if(!file.open(QIODevice::WriteOnly | QIODevice::Append | QIODevice::Text))
+        return false;
+
+    QTextStream stream(&file);
+    stream << line << '\n';
+    stream.flush();
+    return file.error() == QFile::NoError;
+}
+
+bool QAStore::add(const QString& detector, const QAMeasurement& measurement, int rules[QAMetricCount])
+{
+    DetectorSeries& d = load(detector);
+
+    QString line = measurement.time.toString(Qt::ISODate);
+    for(int m=0; m<QAMetricCount; m++)
+    {
+        if(std::isnan(measurement.values[m]))
+            line += "\t-";
+        else
+            line += '\t' + QString::number(measurement.values[m], 'g', 10);
+    }
+    if(!append(detector, line))
+        return false;
+
+    for(int m=0; m<QAMetricCount; m++)
+    {
+        rules[m] = 0;
+        if(!std::isnan(measurement.values[m]))
+            rules[m] = d.series[m]->add(measurement.time, measurement.values[m]);
+    }
+    return true;
+}
+
+bool QAStore::rebaseline(const QString& detector, const QDateTime& time)
+{
+    DetectorSeries& d = load(detector);
+    if(!append(detector, "BASELINE\t" + time.toString(Qt::ISODate)))
+        return false;
+
+    for(int m=0; m<QAMetricCount; m++)
+        d.series[m]->rebaseline();
+    return true;
+}
+
+const QASeries* QAStore::series(const QString& detector, QAMetric metric)
+{
+    return load(detector).series[metric];
+}
@@ -0,0 +1,157 @@
+#ifndef QASTORE_H
+#define QASTORE_H
+
+#include <QString>
+#include <QStringList>
+#include <QDateTime>
+#include <QVector>
+#include <QMap>
+
+// Check source measurements per detector for quality control. Every metric keeps its
+// mean and standard deviation up to date in O(1) per measurement and each new value is
+// checked against the Westgard rules as it is recorded. Kept under QA/<detector>.QA,
+// one line per measurement and a BASELINE line where new limits were started.
+
+enum QAMetric
+{
+    QACentroid,             // keV
+    QAFWHM,                 // keV
+    QANetRate,              // counts/s in the check source peak
+    QABackgroundRate,       // counts/s
+    QAMetricCount
+};
+
+QString qaMetricName(QAMetric metric);
+bool qaMetricFromName(const QString& name, QAMetric& metric);
+
+// Westgard rules, on the distance of values from the mean in standard deviations
+enum QARule
+{
+    QARule12s = 0x01,       // one value beyond 2 SD, a warning
+    QARule13s = 0x02,       // one value beyond 3 SD
+    QARule22s = 0x04,       // two values in a row beyond 2 SD on the same side
+    QARuleR4s = 0x08,       // two values in a row 4 SD apart
+    QARule41s = 0x10,       // four values in a row beyond 1 SD on the same side
+    QARule10x = 0x20        // ten values in a row on the same side of the mean
+};
+
+// Rules that put the detector out of control, the value is left out of the statistics
+const int QARejectRules = QARule13s | QARule22s | QARuleR4s | QARule41s | QARule10x;
+
+QString qaRuleNames(int rules);
+
+// Mean and variance updated one value at a time (Welford), numerically stable over
+// years of values
+class RunningStats
+{
+public:
+
+    RunningStats() : mCount(0), mMean(0.0), mM2(0.0) {}
+
+    void add(double value);
+    int count() const { return mCount; }
+    double mean() const { return mMean; }
+    double variance() const { return mCount > 1 ? mM2 / (mCount - 1) : 0.0; }
+    double standardDeviation() const;
+
+private:
+
+    int mCount;
+    double mMean;
+    double mM2;
+};
+
+// Consecutive values of one series summed up for drawing: a bucket covers points
+// [first, first + count)
+struct QABucket
+{
+    int first;
+    int count;
+    double min;
+    double max;
+    int rules;              // any rule violated in the bucket
+};
+
+// One metric of one detector. The limits are the mean and SD of the first baseline
+// values and stay fixed after that, so a slow drift cannot carry them along; later
+// values are checked against them, and only those within control go into the running
+// statistics. Buckets of 4, 16, 64, ... points are kept as values come in, so drawing
+// years of history reads a few hundred buckets.
+class QASeries
+{
+public:
+
+    explicit QASeries(int baseline = 20);
+
+    // Returns the rules the value violates
+    int add(const QDateTime& time, double value);
+    // The values from the next one on establish new limits, e.g. after a repair or with
+    // a new check source
+    void rebaseline();
+
+    int count() const { return mValues.count(); }
+    QDateTime time(int i) const { return QDateTime::fromMSecsSinceEpoch(mTimes[i]); }
+    double value(int i) const { return mValues[i]; }
+    int rules(int i) const { return mRules[i]; }
+    const RunningStats& stats() const { return mStats; }       // values in control since the baseline
+    const RunningStats& limits() const { return mLimits; }     // baseline values
+    bool established() const { return mLimits.count() >= mBaseline; }
+
+    // Points [from, to) in at most about maxBuckets buckets, single points when they fit
+    void downsample(int from, int to, int maxBuckets, QVector<QABucket>& buckets) const;
+
+private:
+
+    int mBaseline;
+    int mBaselineStart;                     // first value of the baseline
+    RunningStats mLimits;
+    RunningStats mStats;
+    QVector<qint64> mTimes;
+    QVector<double> mValues;
+    QVector<int> mRules;
+    QVector<QVector<QABucket> > mLevels;    // level k has buckets of 4^(k+1) points
+
+    int check(double value) const;
+    void addToLevels(int index);
+};
+
+struct QAMeasurement
+{
+    QDateTime time;
+    double values[QAMetricCount];   // NaN for metrics not measured
+};
+
+// The series of every detector, read from QA/<detector>.QA when first asked for
+class QAStore
+{
+public:
+
+    explicit QAStore(const QString& directory, int baseline = 20);
+    ~QAStore();
+
+    // Appends to the detector's file, rules gets the violations per metric
+    bool add(const QString& detector, const QAMeasurement& measurement, int rules[QAMetricCount]);
+    // Measurements recorded from time on establish new limits for every metric
+    bool rebaseline(const QString& detector, const QDateTime& time);
+    const QASeries* series(const QString& detector, QAMetric metric);
+    int baseline() const { return mBaseline; }
+
+private:
+
+    struct DetectorSeries
+    {
+        QASeries* series[QAMetricCount];
+    };
+
+    QString mDirectory;
+    int mBaseline;
+    QMap<QString, DetectorSeries> mDetectors;
+
+    QAStore(const QAStore&);
+    QAStore& operator = (const QAStore&);
+
+    DetectorSeries& load(const QString& detector);
+    bool append(const QString& detector, const QString& line);
+};
+
+#endif // QASTORE_H
@@ -0,0 +1,344 @@
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QTextStream>
+#include <QDateTime>
+#include <QRunnable>
+#include <QMetaObject>
+#include "reanalysis.h"
+#include "reportparser.h"
+
+QStringList findArchivedSpectra(const QString& archiveDirectory, const QString& detectorName,
+                                const QDate& from, const QDate& to)
+{
+    QStringList spectra;
+    ReportParser parser;
+    ReportResult result;
+
+    for(int year = from.year(); year <= to.year(); year++)
+    {
+        // Stored jobs get upper case paths, see storeJob
+        QString path = archivePath(archiveDirectory, detectorName, year);
+        if(!QDir(path).exists())
+            path = path.toUpper();
+
+        QDir dir(path);
+        foreach(const QFileInfo& info, dir.entryInfoList(QStringList() << "*.CNF", QDir::Files, QDir::Name))
+        {
+            QString report = info.absolutePath() + "/" + info.completeBaseName() + ".RPT";
+            QDate date;
+            if(parser.parseFile(report, result) && result.acquisitionStarted.isValid())
+                date = result.acquisitionStarted.date();
+            else
+                date = info.lastModified().date();
+
+            if(date >= from && date <= to)
+                spectra << info.absoluteFilePath();
+        }
+    }
+    return spectra;
+}
+
+static const qint64 analysisCacheMaxBytes = Q_INT64_C(4) * 1024 * 1024 * 1024;
+
+static bool writeProvenance(const QString& filename, const QString& spectrumFile, const Detector& detector,
+                            const Settings& settings, const QString& username, int resumedStage)
+{
+    QFile file(filename);
+    if(!file.open(QIODevice::WriteOnly | QIODevice::Text | QIODevice::Truncate))
+        return false;
+
+    // Same Key=Value form as sample files
+    QTextStream s(&file);
+    s << "Source=" << spectrumFile << "\n";
+    s << "ReanalysedAt=" << QDateTime::currentDateTime().toString("dd.MM.yyyy HH:mm:ss") << "\n";
+    s << "ReanalysedBy=" << username << "\n";
+    s << "Detector=" << detector.name << "\n";
+    s << "SearchRegion=" << detector.searchRegionStart << "," << detector.searchRegionEnd << "\n";
+    s << "SignificanceTreshold=" << detector.significanceTreshold << "\n";
+    s << "Tolerance=" << detector.tolerance << "\n";
+    s << "PeakAreaRegion=" << detector.peakAreaRegionStart << "," << detector.peakAreaRegionEnd << "\n";
+    s << "BackgroundSubtract=" << detector.backgroundSubtract << "\n";
+    s << "EfficiencyCalibrationType=" << efficiencyCalibrationName(detector.efficiencyCalibrationType) << "\n";
+    s << "NIDLibrary=" << detector.NIDLibrary << "\n";
+    s << "NIDConfidenceTreshold=" << detector.NIDConfidenceTreshold << "\n";
+    s << "MDAConfidenceFactor=" << detector.MDAConfidenceFactor << "\n";
+    s << "Template=" << settings.templateName << "\n";
+    s << "CachedStages=" << resumedStage << "\n";
+    s.flush();
+    return s.status() == QTextStream::Ok;
+}
+
+bool reanalyseSpectrum(const QString& spectrumFile, const QString& outputDirectory, const Detector& detector,
+                       const Settings& settings, const QString& username, JobRunner runner, QString& error,
+                       AnalysisCache* cache)
+{
+    if(!QDir().mkpath(outputDirectory))
+    {
+        error = "Unable to create " + outputDirectory;
+        return false;
+    }
+
+    // The analysis writes its results into the spectrum, so work on a copy
+    QString baseFilename = QDir(outputDirectory).absoluteFilePath(QFileInfo(spectrumFile).completeBaseName());
+    QFile::remove(baseFilename + ".CNF");
+    if(!QFile::copy(spectrumFile, baseFilename + ".CNF"))
+    {
+        error = "Unable to copy spectrum";
+        return false;
+    }
+
+    QFile::remove(baseFilename + ".RPT");
+
+    int resumedStage = 0;
+    bool ok;
+    if(cache)
+        ok = runCachedAnalysis(baseFilename, detector, settings, runner, *cache, &resumedStage);
+    else
+    {
+        QFile script(baseFilename + ".BAT");
+        if(!script.open(QIODevice::WriteOnly | QIODevice::Text | QIODevice::Truncate))
+        {
+            error = "Unable to write " + script.fileName();
+            return false;
+        }
+        QTextStream stream(&script);
+        writeAnalysisCommands(stream, baseFilename + ".CNF", baseFilename, detector, settings);
+        stream.flush();
+        script.close();
+
+        ok = runner(jobCommandLine(baseFilename));
+    }
+
+    if(!ok || !QFile::exists(baseFilename + ".RPT"))
+    {
+        error = "Analysis failed, see " + baseFilename + ".ERR";
+        return false;
+    }
+
+    if(!writeProvenance(baseFilename + ".PRV", spectrumFile, detector, settings, username, resumedStage))
+    {
+        error = "Unable to write provenance";
+        return false;
+    }
+    return true;
+}
+
+class ReanalysisRunnable : public QRunnable
+{
+public:
+
+    ReanalysisRunnable(ReanalysisBatch *batch, int maxParallel)
+        : mBatch(batch), mMaxParallel(maxParallel) {}
+
+    void run()
+    {
+        mBatch->mGraph->run(mMaxParallel);
+
+        // Written once all timings are final
+        for(int i=0; i<mBatch->mJobs.count(); i++)
+            mBatch->mGraph->writeTrace(i, mBatch->mJobs[i].baseFilename + ".TRC");
+    }
+
+private:
+
+    ReanalysisBatch *mBatch;
+    int mMaxParallel;
+};
+
+ReanalysisBatch::ReanalysisBatch(const QString& archiveDirectory, const Detector& detector, const Settings& settings,
+                                 const QString& username, JobRunner runner, const QString& cacheDirectory,
+                                 QObject *parent)
+    : QObject(parent), mArchiveDirectory(archiveDirectory), mDetector(detector), mSettings(settings),
+      mUsername(username), mRunner(runner), mCache(NULL), mGraph(NULL), mCancelled(0), mRunning(false),
+      mTotal(0), mDone(0), mFailed(0)
+{
+    if(!cacheDirectory.isEmpty())
+        mCache = new AnalysisCache(cacheDirectory);
+}
+
+ReanalysisBatch::~ReanalysisBatch()
+{
+    cancel();
+    mPool.waitForDone();
+    delete mGraph;
+    delete mCache;
+}
+
+AnalysisCache::Stats ReanalysisBatch::cacheStats() const
+{
+    if(mCache)
+        return mCache->stats();
+
+    AnalysisCache::Stats stats;
+    for(int i=0; i<AnalysisStageCount; i++)
+        stats.hits[i] = stats.misses[i] = 0;
+    return stats;
+}
+
+bool ReanalysisBatch::start(const QDate& from, const QDate& to, int maxParallel)
+{
+    if(mRunning)
+        return false;
+
+    QStringList spectra = findArchivedSpectra(mArchiveDirectory, mDetector.name, from, to);
+    mTotal = spectra.count();
+    mDone = mFailed = 0;
+    mCancelled.store(0);
+    mStamp = QDateTime::currentDateTime().toString("yyyyMMdd-HHmmss");
+    mTimer.start();
+
+    if(spectra.isEmpty())
+    {
+        emit finished(0, 0, 0);
+        return true;
+    }
+
+    mRunning = true;
+    buildGraph(spectra);
+
+    // The graph brings its own threads, the pool only keeps run() off the caller's thread
+    mPool.setMaxThreadCount(1);
+    mPool.start(new ReanalysisRunnable(this, qMax(1, maxParallel)));
+    return true;
+}
+
+void ReanalysisBatch::buildGraph(const QStringList& spectra)
+{
+    mPool.waitForDone();
+    delete mGraph;
+    mGraph = new StageGraph;
+    mJobs.clear();
+    mJobs.resize(spectra.count());
+
+    // Per spectrum: prepare -> peak search -> ... -> report -> verify -> provenance -> done,
+    // so only a verified report gets a provenance file. The Genie stages all work on the
+    // same CNF, so they stay a chain; the scheduler overlaps them with the stages of
+    // other spectra instead.
+    for(int i=0; i<spectra.count(); i++)
+    {
+        ReanalysisJob* job = &mJobs[i];
+        job->spectrumFile = spectra[i];
+        job->resume = 0;
+        job->provenanceWritten = false;
+
+        QString outputDirectory = QFileInfo(spectra[i]).absolutePath() + "/REANALYSIS/" + mStamp;
+        job->baseFilename = QDir(outputDirectory).absoluteFilePath(QFileInfo(spectra[i]).completeBaseName());
+
+        int prepare = mGraph->addStage("prepare", i, [this, job, outputDirectory]() -> bool
+        {
+            return prepareJob(*job, outputDirectory);
+        });
+
+        int previous = prepare;
+        for(int stage=0; stage<AnalysisStageCount; stage++)
+        {
+            previous = mGraph->addStage(analysisStageName((AnalysisStage)stage), i, [this, job, stage]() -> bool
+            {
+                if(stage < job->resume)
+                    return true;
+                if(mCancelled.load())
+                {
+                    job->error = "Cancelled";
+                    return false;
+                }
+                if(!runAnalysisStage(job->baseFilename, (AnalysisStage)stage, mDetector, mSettings, mRunner, mCache, job->keys[stage]))
+                {
+                    job->error = "Analysis failed, see " + analysisStageFilename(job->baseFilename, (AnalysisStage)stage) + ".ERR";
+                    return false;
+                }
+                return true;
+            }, QList<int>() << previous);
+        }
+
+        int verify = mGraph->addStage("verify report", i, [job]() -> bool
+        {
+            ReportParser parser;
+            ReportResult result;
+            if(!parser.parseFile(job->baseFilename + ".RPT", result))
+            {
+                job->error = "Unreadable report " + job->baseFilename + ".RPT";
+                return false;
+            }
+            return true;
+        }, QList<int>() << previous);
+
+        int provenance = mGraph->addStage("provenance", i, [this, job]() -> bool
+        {
+            job->provenanceWritten = writeProvenance(job->baseFilename + ".PRV", job->spectrumFile, mDetector,
+                                                     mSettings, mUsername, job->resume);
+            return job->provenanceWritten;
+        }, QList<int>() << verify);
+
+        mGraph->addStage("done", i, [this, job]() -> bool
+        {
+            bool ok = job->error.isEmpty() && job->provenanceWritten;
+            QString error = job->error.isEmpty() && !ok ? QString("Unable to write provenance") : job->error;
+            QMetaObject::invokeMethod(this, "onSpectrumDone", Qt::QueuedConnection,
+                                      Q_ARG(QString, job->spectrumFile), Q_ARG(bool, ok), Q_ARG(QString, error));
+            return ok;
+        }, QList<int>() << provenance, StageGraph::RunAlways);
+    }
+}
+
+bool ReanalysisBatch::prepareJob(ReanalysisJob& job, const QString& outputDirectory)
+{
+    if(mCancelled.load())
+    {
+        job.error = "Cancelled";
+        return false;
+    }
+
+    if(!QDir().mkpath(outputDirectory))
+    {
+        job.error = "Unable to create " + outputDirectory;
+        return false;
+    }
+
+    // The analysis writes its results into the spectrum, so work on a copy
+    QFile::remove(job.baseFilename + ".CNF");
+    QFile::remove(job.baseFilename + ".RPT");
+    if(!QFile::copy(job.spectrumFile, job.baseFilename + ".CNF"))
+    {
+        job.error = "Unable to copy spectrum";
+        return false;
+    }
+
+    if(mCache)
+    {
+        job.resume = prepareCachedAnalysis(job.baseFilename, mDetector, mSettings, *mCache, job.keys);
+        if(job.resume < 0)
+        {
+            job.error = "Unable to read " + job.baseFilename + ".CNF";
+            return false;
+        }
+    }
+    return true;
+}
+
+void ReanalysisBatch::cancel()
+{
+    mCancelled.store(1);
+}
+
+void ReanalysisBatch::onSpectrumDone(const QString& spectrumFile, bool ok, const QString& error)
+{
+    if(ok)
+        mDone++;
+    else
+    {
+        mFailed++;
+        emit spectrumFailed(spectrumFile, error);
+    }
+
+    qint64 elapsed = qMax<qint64>(1, mTimer.elapsed());
+    emit progress(mDone, mFailed, mTotal, (mDone + mFailed) * 60000.0 / elapsed);
+
+    if(mDone + mFailed == mTotal)
+    {
+        mRunning = false;
+        if(mCache)
+            mCache->trim(analysisCacheMaxBytes);
+        emit finished(mDone, mFailed, elapsed);
+    }
+}
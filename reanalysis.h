@@ -0,0 +1,96 @@
+#ifndef REANALYSIS_H
+#define REANALYSIS_H
+
+#include <QObject>
+#include <QString>
+#include <QStringList>
+#include <QDate>
+#include <QThreadPool>
+#include <QElapsedTimer>
+#include <QAtomicInt>
+#include <QVector>
+#include "settings.h"
+#include "detector.h"
+#include "jobutils.h"
+#include "analysiscache.h"
+#include "stagegraph.h"
+
+
+// Archived spectra (.CNF) of a detector acquired between from and to, inclusive.
+// The acquisition date is taken from the archived report, or the spectrum file time.
+QStringList findArchivedSpectra(const QString& archiveDirectory, const QString& detectorName,
+                                const QDate& from, const QDate& to);
+
+// Runs the analysis steps of a job on a copy of an archived spectrum in outputDirectory.
+// The copy, script, report and a .PRV provenance file end up next to each other. With a
+// cache, stages whose inputs and parameters did not change are not run again.
+bool reanalyseSpectrum(const QString& spectrumFile, const QString& outputDirectory, const Detector& detector,
+                       const Settings& settings, const QString& username, JobRunner runner, QString& error,
+                       AnalysisCache* cache = 0);
+
+// One spectrum of a batch, shared by the stages of its graph
+struct ReanalysisJob
+{
+    QString spectrumFile;
+    QString baseFilename;
+    QByteArray keys[AnalysisStageCount];
+    int resume;
+    QString error;          // set by the analysis chain, which runs one stage at a time
+    bool provenanceWritten;
+};
+
+// Re-analyses a range of archived spectra with the current detector parameters, each
+// analysis stage scheduled separately on at most maxParallel threads. Results go to
+// REANALYSIS/<timestamp> below each spectrum's archive folder, the originals are left
+// untouched; a .TRC file per spectrum lists stage timings and the critical path.
+// Signals arrive in the thread the batch lives in, which needs an event loop.
+class ReanalysisBatch : public QObject
+{
+    Q_OBJECT
+
+public:
+
+    ReanalysisBatch(const QString& archiveDirectory, const Detector& detector, const Settings& settings,
+                    const QString& username, JobRunner runner, const QString& cacheDirectory = QString(),
+                    QObject *parent = 0);
+    ~ReanalysisBatch();
+
+    bool start(const QDate& from, const QDate& to, int maxParallel);
+    void cancel();
+    bool isRunning() const { return mRunning; }
+    AnalysisCache::Stats cacheStats() const;
+
+signals:
+
+    void progress(int done, int failed, int total, double spectraPerMinute);
+    void spectrumFailed(const QString& spectrumFile, const QString& error);
+    void finished(int done, int failed, qint64 msecs);
+
+private slots:
+
+    void onSpectrumDone(const QString& spectrumFile, bool ok, const QString& error);
+
+private:
+
+    friend class ReanalysisRunnable;
+
+    void buildGraph(const QStringList& spectra);
+    bool prepareJob(ReanalysisJob& job, const QString& outputDirectory);
+
+    QString mArchiveDirectory;
+    Detector mDetector;
+    Settings mSettings;
+    QString mUsername;
+    JobRunner mRunner;
+    AnalysisCache *mCache;
+    StageGraph *mGraph;
+    QVector<ReanalysisJob> mJobs;
+    QThreadPool mPool;
+    QElapsedTimer mTimer;
+    QString mStamp;
+    QAtomicInt mCancelled;
+    bool mRunning;
+    int mTotal, mDone, mFailed;
+};
+
+#endif // REANALYSIS_H
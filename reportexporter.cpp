@@ -0,0 +1,158 @@
+#include <QTimer>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QMutexLocker>
+#include "reportexporter.h"
+
+static const int exportBatchDelay = 200;    // ms to wait for more reports before writing
+static const int exportBatchSize = 64;      // max reports written in one pass
+static const int exportMaxAttempts = 6;
+static const int exportRetryDelay = 1000;   // ms, doubled for every failed attempt
+
+bool exportReport(const QString& reportFile, const QString& exportFolder)
+{
+    QFileInfo info(reportFile);
+    if(!info.exists())
+        return false;
+
+    QDir dir(exportFolder);
+    if(!dir.exists() && !dir.mkpath("."))
+        return false;
+
+    // Copy to a temporary name first so readers of the export folder never see partial reports
+    QString dest = dir.absoluteFilePath(info.fileName());
+    QString tmp = dest + ".tmp";
+    QFile::remove(tmp);
+    if(!QFile::copy(reportFile, tmp))
+        return false;
+
+    QFile::remove(dest);
+    if(!QFile::rename(tmp, dest))
+    {
+        QFile::remove(tmp);
+        return false;
+    }
+    return true;
+}
+
+ReportExporter::ReportExporter(QObject *parent)
+    : QObject(parent), mTimer(NULL)
+{
+    mStats.queueDepth = mStats.exported = mStats.failed = mStats.retries = 0;
+    mStats.lastLatencyMs = mStats.maxLatencyMs = mStats.totalLatencyMs = 0;
+    mClock.start();
+}
+
+ReportExporter::Stats ReportExporter::stats() const
+{
+    QMutexLocker lock(&mStatsMutex);
+    return mStats;
+}
+
+void ReportExporter::start()
+{
+    if(mTimer)
+        return;
+
+    mTimer = new QTimer(this);
+    mTimer->setSingleShot(true);
+    connect(mTimer, SIGNAL(timeout()), this, SLOT(flush()));
+}
+
+void ReportExporter::enqueue(const QString& reportFile, const QString& exportFolder)
+{
+    if(exportFolder.isEmpty())
+        return;
+
+    start();
+
+    ExportItem item;
+    item.reportFile = reportFile;
+    item.exportFolder = exportFolder;
+    item.enqueuedAt = mClock.elapsed();
+    item.notBefore = 0;
+    item.attempts = 0;
+    mQueue.enqueue(item);
+
+    {
+        QMutexLocker lock(&mStatsMutex);
+        mStats.queueDepth = mQueue.count();
+    }
+
+    if(mQueue.count() >= exportBatchSize)
+        flush();
+    else
+        scheduleFlush(exportBatchDelay);
+}
+
+void ReportExporter::scheduleFlush(int msec)
+{
+    if(!mTimer->isActive() || mTimer->remainingTime() > msec)
+        mTimer->start(msec);
+}
+
+void ReportExporter::flush()
+{
+    qint64 now = mClock.elapsed();
+    qint64 nextAttempt = -1;
+    int processed = 0;
+    int count = mQueue.count();
+
+    for(int i=0; i<count && processed < exportBatchSize; i++)
+    {
+        ExportItem item = mQueue.dequeue();
+        if(item.notBefore > now)
+        {
+            mQueue.enqueue(item);
+            if(nextAttempt < 0 || item.notBefore < nextAttempt)
+                nextAttempt = item.notBefore;
+            continue;
+        }
+
+        processed++;
+        if(exportReport(item.reportFile, item.exportFolder))
+        {
+            qint64 latency = mClock.elapsed() - item.enqueuedAt;
+            {
+                QMutexLocker lock(&mStatsMutex);
+                mStats.exported++;
+                mStats.lastLatencyMs = latency;
+                mStats.maxLatencyMs = qMax(mStats.maxLatencyMs, latency);
+                mStats.totalLatencyMs += latency;
+            }
+            emit exported(item.reportFile, latency, mQueue.count());
+        }
+        else if(++item.attempts >= exportMaxAttempts)
+        {
+            {
+                QMutexLocker lock(&mStatsMutex);
+                mStats.failed++;
+            }
+            emit exportFailed(item.reportFile, tr("Unable to copy report to %1").arg(item.exportFolder));
+        }
+        else
+        {
+            item.notBefore = now + ((qint64)exportRetryDelay << (item.attempts - 1));
+            mQueue.enqueue(item);
+            if(nextAttempt < 0 || item.notBefore < nextAttempt)
+                nextAttempt = item.notBefore;
+            QMutexLocker lock(&mStatsMutex);
+            mStats.retries++;
+        }
+    }
+
+    {
+        QMutexLocker lock(&mStatsMutex);
+        mStats.queueDepth = mQueue.count();
+    }
+
+    if(mQueue.isEmpty())
+        return;
+
+    // Either the batch was full and more reports are ready, or only retries are left
+    if(processed >= exportBatchSize)
+        scheduleFlush(0);
+    else if(nextAttempt >= 0)
+        scheduleFlush((int)qMax<qint64>(0, nextAttempt - mClock.elapsed()));
+}
@@ -0,0 +1,69 @@
+#ifndef REPORTEXPORTER_H
+#define REPORTEXPORTER_H
+
+#include <QObject>
+#include <QQueue>
+#include <QString>
+#include <QMutex>
+#include <QElapsedTimer>
+
+class QTimer;
+
+bool exportReport(const QString& reportFile, const QString& exportFolder);
+
+// Copies stored reports to Settings::RPTExportFolder on a background thread.
+// Reports queued in quick succession are written in one pass, failed copies are
+// retried with increasing delay before they are given up.
+class ReportExporter : public QObject
+{
+    Q_OBJECT
+
+public:
+
+    struct Stats
+    {
+        int queueDepth;
+        int exported;
+        int failed;
+        int retries;
+        qint64 lastLatencyMs;
+        qint64 maxLatencyMs;
+        qint64 totalLatencyMs;
+    };
+
+    explicit ReportExporter(QObject *parent = 0);
+
+    Stats stats() const;
+
+public slots:
+
+    void start();
+    void enqueue(const QString& reportFile, const QString& exportFolder);
+    void flush();
+
+signals:
+
+    void exported(const QString& reportFile, qint64 latencyMs, int queueDepth);
+    void exportFailed(const QString& reportFile, const QString& error);
+
+private:
+
+    struct ExportItem
+    {
+        QString reportFile;
+        QString exportFolder;
+        qint64 enqueuedAt;
+        qint64 notBefore;
+        int attempts;
+    };
+
+    QQueue<ExportItem> mQueue;
+    QTimer *mTimer;
+    QElapsedTimer mClock;
+    mutable QMutex mStatsMutex;
+    Stats mStats;
+
+    void scheduleFlush(int msec);
+};
+
+#endif // REPORTEXPORTER_H
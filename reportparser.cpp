@@ -0,0 +1,306 @@
+#include <QFile>
+#include <QDate>
+#include <QTime>
+#include <cstring>
+#include <cmath>
+#include "reportparser.h"
+
+enum ReportField
+{
+    FieldTitle, FieldSampleId, FieldSampleType, FieldGeometry, FieldQuantity,
+    FieldSampleDate, FieldDetector, FieldAcquisitionStarted, FieldLiveTime, FieldRealTime
+};
+
+struct ReportKey
+{
+    const char* name;
+    ReportField field;
+};
+
+static const ReportKey reportKeys[] = {
+    { "Sample Title", FieldTitle },
+    { "Sample Identification", FieldSampleId },
+    { "Sample Type", FieldSampleType },
+    { "Sample Geometry", FieldGeometry },
+    { "Sample Quantity", FieldQuantity },
+    { "Sample Date", FieldSampleDate },
+    { "Detector Name", FieldDetector },
+    { "Acquisition Started", FieldAcquisitionStarted },
+    { "Live Time", FieldLiveTime },
+    { "Real Time", FieldRealTime }
+};
+
+void ReportResult::clear()
+{
+    title.clear();
+    sampleId.clear();
+    sampleType.clear();
+    geometry.clear();
+    quantity = 0.0;
+    units.clear();
+    sampleDate = QDateTime();
+    detector.clear();
+    acquisitionStarted = QDateTime();
+    liveTime = realTime = 0.0;
+    nuclides.resize(0); // keeps the capacity for the next report
+}
+
+static inline bool isBlank(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+static inline bool isDigit(char c)
+{
+    return c >= '0' && c <= '9';
+}
+
+static const char* skipBlanks(const char* p, const char* end)
+{
+    while(p < end && isBlank(*p))
+        p++;
+    return p;
+}
+
+static const char* trimEnd(const char* begin, const char* end)
+{
+    while(end > begin && isBlank(end[-1]))
+        end--;
+    return end;
+}
+
+static const char* nextToken(const char* p, const char* end)
+{
+    while(p < end && !isBlank(*p))
+        p++;
+    return p;
+}
+
+static const char* parseNumber(const char* p, const char* end, double& value)
+{
+    // Plain and exponent notation as written by the report templates, independent of locale
+    bool negative = false;
+    if(p < end && (*p == '-' || *p == '+'))
+        negative = *p++ == '-';
+
+    qint64 mantissa = 0;
+    int exponent = 0, digits = 0;
+    while(p < end && isDigit(*p))
+    {
+        if(digits < 18)
+            mantissa = mantissa * 10 + (*p - '0');
+        else
+            exponent++;
+        digits++;
+        p++;
+    }
+    if(p < end && *p == '.')
+    {
+        p++;
+        while(p < end && isDigit(*p))
+        {
+            if(digits < 18)
+            {
+                mantissa = mantissa * 10 + (*p - '0');
+                exponent--;
+            }
+            digits++;
+            p++;
+        }
+    }
+    if(digits == 0)
+        return NULL;
+
+    if(p < end && (*p == 'e' || *p == 'E'))
+    {
+        const char* q = p + 1;
+        bool negativeExp = false;
+        if(q < end && (*q == '-' || *q == '+'))
+            negativeExp = *q++ == '-';
+        int e = 0;
+        const char* first = q;
+        while(q < end && isDigit(*q))
+            e = e * 10 + (*q++ - '0');
+        if(q > first)
+        {
+            exponent += negativeExp ? -e : e;
+            p = q;
+        }
+    }
+
+    value = exponent < 0 ? mantissa / std::pow(10.0, -exponent) : mantissa * std::pow(10.0, exponent);
+    if(negative)
+        value = -value;
+    return p;
+}
+
+static int parseFixed(const char* p, int count)
+{
+    int n = 0;
+    for(int i=0; i<count; i++)
+    {
+        if(!isDigit(p[i]))
+            return -1;
+        n = n * 10 + (p[i] - '0');
+    }
+    return n;
+}
+
+static QDateTime parseDateTime(const char* begin, const char* end)
+{
+    // dd.MM.yyyy HH:mm:ss as written to the job script
+    if(end - begin < 19)
+        return QDateTime();
+
+    int day = parseFixed(begin, 2), month = parseFixed(begin + 3, 2), year = parseFixed(begin + 6, 4);
+    int hour = parseFixed(begin + 11, 2), minute = parseFixed(begin + 14, 2), second = parseFixed(begin + 17, 2);
+    if(day < 0 || month < 0 || year < 0 || hour < 0 || minute < 0 || second < 0)
+        return QDateTime();
+
+    return QDateTime(QDate(year, month, day), QTime(hour, minute, second));
+}
+
+const QString& ReportParser::intern(const char* begin, const char* end)
+{
+    // fromRawData avoids a copy for values seen before
+    QByteArray key = QByteArray::fromRawData(begin, int(end - begin));
+    QHash<QByteArray, QString>::const_iterator iter = mStrings.constFind(key);
+    if(iter != mStrings.constEnd())
+        return iter.value();
+
+    return mStrings.insert(QByteArray(begin, int(end - begin)), QString::fromLocal8Bit(begin, int(end - begin))).value();
+}
+
+bool ReportParser::parse(const char* data, int size, ReportResult& result)
+{
+    result.clear();
+
+    const char* end = data + size;
+    const char* line = data;
+    bool header = false, table = false;
+
+    while(line < end)
+    {
+        const char* eol = static_cast<const char*>(std::memchr(line, '\n', end - line));
+        if(!eol)
+            eol = end;
+
+        const char* p = skipBlanks(line, eol);
+        const char* e = trimEnd(p, eol);
+        line = eol + 1;
+
+        if(table)
+        {
+            // Nuclide table ends at the first blank line
+            if(p == e || *p == '*')
+            {
+                table = false;
+                continue;
+            }
+
+            ReportNuclide nuclide;
+            const char* nameEnd = nextToken(p, e);
+            const char* q = skipBlanks(nameEnd, e);
+            if(!(q = parseNumber(q, e, nuclide.energy))
+                    || !(q = parseNumber(skipBlanks(q, e), e, nuclide.activity))
+                    || !(q = parseNumber(skipBlanks(q, e), e, nuclide.uncertainty))
+                    || !(q = parseNumber(skipBlanks(q, e), e, nuclide.mda)))
+                continue;
+
+            nuclide.name = intern(p, nameEnd);
+            nuclide.flags = 0;
+            if(std::memchr(q, '<', e - q))
+                nuclide.flags |= ReportNuclide::BelowMDA;
+            result.nuclides.append(nuclide);
+            continue;
+        }
+
+        if(p == e)
+            continue;
+
+        if(*p == '-' && e - p >= 3 && p[1] == '-' && p[2] == '-')
+        {
+            table = true;
+            continue;
+        }
+
+        const char* colon = static_cast<const char*>(std::memchr(p, ':', e - p));
+        if(!colon)
+            continue;
+
+        const char* keyEnd = trimEnd(p, colon);
+        const char* value = skipBlanks(colon + 1, e);
+        int keyLength = int(keyEnd - p);
+
+        for(unsigned int i=0; i<sizeof(reportKeys) / sizeof(reportKeys[0]); i++)
+        {
+            if(int(std::strlen(reportKeys[i].name)) != keyLength || std::memcmp(reportKeys[i].name, p, keyLength) != 0)
+                continue;
+
+            header = true;
+            switch(reportKeys[i].field)
+            {
+            case FieldTitle:
+                result.title = QString::fromLocal8Bit(value, int(e - value));
+                break;
+            case FieldSampleId:
+                result.sampleId = QString::fromLocal8Bit(value, int(e - value));
+                break;
+            case FieldSampleType:
+                result.sampleType = intern(value, e);
+                break;
+            case FieldGeometry:
+                result.geometry = intern(value, e);
+                break;
+            case FieldQuantity:
+            {
+                const char* q = parseNumber(value, e, result.quantity);
+                if(q)
+                    result.units = intern(skipBlanks(q, e), e);
+                break;
+            }
+            case FieldSampleDate:
+                result.sampleDate = parseDateTime(value, e);
+                break;
+            case FieldDetector:
+                result.detector = intern(value, e);
+                break;
+            case FieldAcquisitionStarted:
+                result.acquisitionStarted = parseDateTime(value, e);
+                break;
+            case FieldLiveTime:
+                parseNumber(value, e, result.liveTime);
+                break;
+            case FieldRealTime:
+                parseNumber(value, e, result.realTime);
+                break;
+            }
+            break;
+        }
+    }
+
+    return header;
+}
+
+bool ReportParser::parseFile(const QString& filename, ReportResult& result)
+{
+    QFile file(filename);
+    if(!file.open(QIODevice::ReadOnly))
+        return false;
+
+    // Map the report instead of reading it, large archives are parsed without copying
+    qint64 size = file.size();
+    if(size <= 0)
+        return false;
+
+    uchar* data = file.map(0, size);
+    if(data)
+    {
+        bool ok = parse(reinterpret_cast<const char*>(data), int(size), result);
+        file.unmap(data);
+        return ok;
+    }
+
+    QByteArray bytes = file.readAll();
+    return parse(bytes.constData(), bytes.size(), result);
+}
@@ -0,0 +1,59 @@
+#ifndef REPORTPARSER_H
+#define REPORTPARSER_H
+
+#include <QString>
+#include <QByteArray>
+#include <QDateTime>
+#include <QVector>
+#include <QHash>
+
+struct ReportNuclide
+{
+    enum Flags { BelowMDA = 0x1 };
+
+    QString name;
+    double energy;          // keV
+    double activity;        // Bq
+    double uncertainty;     // Bq
+    double mda;             // Bq
+    int flags;
+};
+
+struct ReportResult
+{
+    QString title;
+    QString sampleId;
+    QString sampleType;
+    QString geometry;
+    double quantity;
+    QString units;
+    QDateTime sampleDate;
+    QString detector;
+    QDateTime acquisitionStarted;
+    double liveTime;        // seconds
+    double realTime;        // seconds
+    QVector<ReportNuclide> nuclides;
+
+    void clear();
+};
+
+// Reads nuclide identification reports (.RPT) into typed records in one pass.
+// Lines are scanned in place in the raw bytes, numbers are converted without
+// temporaries and repeating values (nuclide names, detectors, geometries, ...) are
+// shared between results, so a parser reused over many reports only allocates the
+// strings unique to each report.
+class ReportParser
+{
+public:
+
+    bool parse(const char* data, int size, ReportResult& result);
+    bool parseFile(const QString& filename, ReportResult& result);
+
+private:
+
+    QHash<QByteArray, QString> mStrings;
+
+    const QString& intern(const char* begin, const char* end);
+};
+
+#endif // REPORTPARSER_H
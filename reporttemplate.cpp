@@ -0,0 +1,347 @@
+#include <QFile>
+#include <QFileInfo>
+#include <QHash>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QDateTime>
+#include <QStringList>
+#include "reporttemplate.h"
+
+enum TemplateField
+{
+    FieldTitle, FieldSampleId, FieldSampleType, FieldGeometry, FieldQuantity, FieldUnits,
+    FieldSampleDate, FieldDetector, FieldAcquisitionStarted, FieldLiveTime, FieldRealTime,
+    FieldNuclide, FieldEnergy, FieldActivity, FieldUncertainty, FieldMDA, FieldFlags,
+    FieldCount
+};
+
+static const char* fieldNames[FieldCount] = {
+    "Title", "SampleId", "SampleType", "Geometry", "Quantity", "Units",
+    "SampleDate", "Detector", "AcquisitionStarted", "LiveTime", "RealTime",
+    "Nuclide", "Energy", "Activity", "Uncertainty", "MDA", "Flags"
+};
+
+static const char* dateFormat = "dd.MM.yyyy HH:mm:ss";
+
+QString ReportTemplate::defaultTemplate()
+{
+    // Same layout as the reports written by the simulated job runner
+    return QString(
+        "  *****************************************************************\n"
+        "  *****  N U C L I D E   I D E N T I F I C A T I O N   R E P O R T\n"
+        "  *****************************************************************\n\n"
+        "  Sample Title                 : {Title}\n"
+        "  Sample Identification        : {SampleId}\n"
+        "  Sample Type                  : {SampleType}\n"
+        "  Sample Geometry              : {Geometry}\n"
+        "  Sample Quantity              : {Quantity} {Units}\n"
+        "  Sample Date                  : {SampleDate}\n"
+        "  Detector Name                : {Detector}\n"
+        "  Acquisition Started          : {AcquisitionStarted}\n"
+        "  Live Time                    : {LiveTime:0:F1} seconds\n"
+        "  Real Time                    : {RealTime:0:F1} seconds\n\n"
+        "  Nuclide    Energy     Activity     Uncertainty  MDA          Flags\n"
+        "  Name       (keV)      (Bq)         (Bq)         (Bq)\n"
+        "  ------------------------------------------------------------------\n"
+        "{Nuclides}\n"
+        "  {Nuclide:10} {Energy:10:F2} {Activity:12:E4} {Uncertainty:12:E3} {MDA:12:E3} {Flags}\n"
+        "{/Nuclides}\n"
+        "\n  *****  End of report  *****\n");
+}
+
+bool ReportTemplate::compile(const QString& text, QString* error)
+{
+    mCode.clear();
+
+    QString literal;
+    int blockStart = -1;
+    int line = 1;
+
+    for(int i=0; i<text.length(); i++)
+    {
+        QChar c = text[i];
+        if(c == '\n')
+            line++;
+
+        if(c != '{')
+        {
+            literal.append(c);
+            continue;
+        }
+
+        if(i + 1 < text.length() && text[i + 1] == '{')
+        {
+            literal.append('{');
+            i++;
+            continue;
+        }
+
+        int close = text.indexOf('}', i);
+        if(close < 0)
+        {
+            if(error)
+                *error = QString("Line %1: missing '}'").arg(line);
+            return false;
+        }
+
+        if(!literal.isEmpty())
+        {
+            Instruction ins;
+            ins.op = OpLiteral;
+            ins.text = literal.toLocal8Bit();
+            mCode.append(ins);
+            literal.clear();
+        }
+
+        QStringList parts = text.mid(i + 1, close - i - 1).split(':');
+        QString name = parts[0].trimmed();
+        i = close;
+
+        Instruction ins;
+        ins.field = -1;
+        ins.width = 0;
+        ins.format = 0;
+        ins.precision = 6;
+        ins.jump = -1;
+
+        if(name == "Nuclides" || name == "/Nuclides")
+        {
+            bool begin = name == "Nuclides";
+            if(begin == (blockStart >= 0))
+            {
+                if(error)
+                    *error = QString("Line %1: unbalanced %2").arg(line).arg(name);
+                return false;
+            }
+
+            ins.op = begin ? OpBeginNuclides : OpEndNuclides;
+            if(begin)
+                blockStart = mCode.count();
+            else
+            {
+                ins.jump = blockStart + 1;
+                mCode[blockStart].jump = mCode.count() + 1;
+                blockStart = -1;
+            }
+            mCode.append(ins);
+
+            // Block tags on a line of their own do not produce an empty line
+            if(i + 1 < text.length() && text[i + 1] == '\n')
+            {
+                i++;
+                line++;
+            }
+            continue;
+        }
+
+        for(int f=0; f<FieldCount; f++)
+        {
+            if(name == fieldNames[f])
+                ins.field = f;
+        }
+        if(ins.field < 0 || (ins.field >= FieldNuclide && blockStart < 0))
+        {
+            if(error)
+                *error = QString("Line %1: unknown field %2").arg(line).arg(name);
+            return false;
+        }
+
+        bool ok = true;
+        if(parts.count() > 1)
+            ins.width = parts[1].trimmed().toInt(&ok);
+        if(ok && parts.count() > 2)
+        {
+            QString spec = parts[2].trimmed().toUpper();
+            ok = !spec.isEmpty() && (spec[0] == 'E' || spec[0] == 'F' || spec[0] == 'G');
+            if(ok)
+            {
+                ins.format = spec[0].toLatin1();
+                if(spec.length() > 1)
+                    ins.precision = spec.mid(1).toInt(&ok);
+            }
+        }
+        if(!ok)
+        {
+            if(error)
+                *error = QString("Line %1: invalid format for %2").arg(line).arg(name);
+            return false;
+        }
+
+        ins.op = OpField;
+        mCode.append(ins);
+    }
+
+    if(blockStart >= 0)
+    {
+        if(error)
+            *error = "Missing {/Nuclides}";
+        return false;
+    }
+
+    if(!literal.isEmpty())
+    {
+        Instruction ins;
+        ins.op = OpLiteral;
+        ins.text = literal.toLocal8Bit();
+        mCode.append(ins);
+    }
+    return true;
+}
+
+bool ReportTemplate::load(const QString& filename, QString* error)
+{
+    QFile file(filename);
+    if(!file.open(QIODevice::ReadOnly | QIODevice::Text))
+    {
+        if(error)
+            *error = "Unable to open " + filename;
+        return false;
+    }
+    return compile(QString::fromLocal8Bit(file.readAll()), error);
+}
+
+static void appendNumber(QByteArray& output, double value, char format, int precision)
+{
+    // Qt knows 'f' but no upper case 'F'
+    if(format == 'F' || !format)
+        format = format ? 'f' : 'g';
+    output.append(QByteArray::number(value, format, precision));
+}
+
+void ReportTemplate::formatField(const Instruction& ins, const ReportResult& result,
+                                 const ReportNuclide* nuclide, QByteArray& output) const
+{
+    int start = output.size();
+    switch(ins.field)
+    {
+    case FieldTitle: output.append(result.title.toLocal8Bit()); break;
+    case FieldSampleId: output.append(result.sampleId.toLocal8Bit()); break;
+    case FieldSampleType: output.append(result.sampleType.toLocal8Bit()); break;
+    case FieldGeometry: output.append(result.geometry.toLocal8Bit()); break;
+    case FieldQuantity: appendNumber(output, result.quantity, ins.format, ins.precision); break;
+    case FieldUnits: output.append(result.units.toLocal8Bit()); break;
+    case FieldSampleDate: output.append(result.sampleDate.toString(dateFormat).toLatin1()); break;
+    case FieldDetector: output.append(result.detector.toLocal8Bit()); break;
+    case FieldAcquisitionStarted: output.append(result.acquisitionStarted.toString(dateFormat).toLatin1()); break;
+    case FieldLiveTime: appendNumber(output, result.liveTime, ins.format, ins.precision); break;
+    case FieldRealTime: appendNumber(output, result.realTime, ins.format, ins.precision); break;
+    case FieldNuclide: output.append(nuclide->name.toLocal8Bit()); break;
+    case FieldEnergy: appendNumber(output, nuclide->energy, ins.format, ins.precision); break;
+    case FieldActivity: appendNumber(output, nuclide->activity, ins.format, ins.precision); break;
+    case FieldUncertainty: appendNumber(output, nuclide->uncertainty, ins.format, ins.precision); break;
+    case FieldMDA: appendNumber(output, nuclide->mda, ins.format, ins.precision); break;
+    case FieldFlags:
+        if(nuclide->flags & ReportNuclide::BelowMDA)
+            output.append('<');
+        break;
+    }
+
+    int length = output.size() - start;
+    int width = qAbs(ins.width);
+    if(length >= width)
+        return;
+
+    if(ins.width > 0)
+        output.append(QByteArray(width - length, ' '));
+    else
+        output.insert(start, QByteArray(width - length, ' '));
+}
+
+void ReportTemplate::render(const ReportResult& result, QByteArray& output) const
+{
+    output.clear();
+
+    int nuclide = 0;
+    int pc = 0;
+    while(pc < mCode.count())
+    {
+        const Instruction& ins = mCode[pc];
+        switch(ins.op)
+        {
+        case OpLiteral:
+            output.append(ins.text);
+            break;
+        case OpField:
+            formatField(ins, result, nuclide < result.nuclides.count() ? &result.nuclides[nuclide] : NULL, output);
+            break;
+        case OpBeginNuclides:
+            nuclide = 0;
+            if(result.nuclides.isEmpty())
+            {
+                pc = ins.jump;
+                continue;
+            }
+            break;
+        case OpEndNuclides:
+            if(++nuclide < result.nuclides.count())
+            {
+                pc = ins.jump;
+                continue;
+            }
+            break;
+        }
+        pc++;
+    }
+}
+
+bool ReportTemplate::renderFile(const ReportResult& result, const QString& filename) const
+{
+    QByteArray output;
+    render(result, output);
+
+    QFile file(filename);
+    if(!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+        return false;
+    return file.write(output) == output.size();
+}
+
+QString nativeTemplateName(const QString& templateName)
+{
+    if(templateName.isEmpty())
+        return QString();
+
+    QFileInfo info(templateName);
+    QString filename = info.absolutePath() + "/" + info.completeBaseName() + ".ntpl";
+    return QFile::exists(filename) ? filename : QString();
+}
+
+struct CachedTemplate
+{
+    QDateTime modified;
+    QSharedPointer<const ReportTemplate> compiled;
+};
+
+QSharedPointer<const ReportTemplate> loadReportTemplate(const QString& filename, QString* error)
+{
+    static QMutex mutex;
+    static QHash<QString, CachedTemplate> cache;
+
+    // An empty filename gives the built-in template
+    QString key;
+    QDateTime modified;
+    if(!filename.isEmpty())
+    {
+        QFileInfo info(filename);
+        key = info.absoluteFilePath();
+        modified = info.lastModified();
+    }
+
+    QMutexLocker lock(&mutex);
+    QHash<QString, CachedTemplate>::const_iterator iter = cache.constFind(key);
+    if(iter != cache.constEnd() && iter.value().modified == modified)
+        return iter.value().compiled;
+
+    ReportTemplate* tpl = new ReportTemplate;
+    bool ok = filename.isEmpty() ? tpl->compile(ReportTemplate::defaultTemplate(), error) : tpl->load(filename, error);
+    if(!ok)
+    {
+        delete tpl;
+        return QSharedPointer<const ReportTemplate>();
+    }
+
+    CachedTemplate entry;
+    entry.modified = modified;
+    entry.compiled = QSharedPointer<const ReportTemplate>(tpl);
+    cache.insert(key, entry);
+    return entry.compiled;
+}
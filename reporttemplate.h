@@ -0,0 +1,63 @@
+#ifndef REPORTTEMPLATE_H
+#define REPORTTEMPLATE_H
+
+#include <QString>
+#include <QByteArray>
+#include <QVector>
+#include <QSharedPointer>
+#include "reportparser.h"
+
+// Report template compiled once into a flat instruction list and rendered straight
+// from ReportResult records. Template syntax:
+//
+//   {Field}               value with default formatting
+//   {Field:12}            left justified in 12 columns (-12 right justifies)
+//   {Field:12:E4}         with number format E, F or G and precision
+//   {{                    a literal '{'
+//   {Nuclides} ... {/Nuclides}
+//                         repeated for every nuclide in the report
+//
+// Report fields are Title, SampleId, SampleType, Geometry, Quantity, Units, SampleDate,
+// Detector, AcquisitionStarted, LiveTime and RealTime. Inside the nuclide block also
+// Nuclide, Energy, Activity, Uncertainty, MDA and Flags.
+class ReportTemplate
+{
+public:
+
+    bool compile(const QString& text, QString* error = 0);
+    bool load(const QString& filename, QString* error = 0);
+
+    void render(const ReportResult& result, QByteArray& output) const;
+    bool renderFile(const ReportResult& result, const QString& filename) const;
+
+    static QString defaultTemplate();
+
+private:
+
+    enum Opcode { OpLiteral, OpField, OpBeginNuclides, OpEndNuclides };
+
+    struct Instruction
+    {
+        Opcode op;
+        int field;
+        int width;
+        char format;
+        int precision;
+        int jump;           // OpBeginNuclides: past the block, OpEndNuclides: block start
+        QByteArray text;
+    };
+
+    QVector<Instruction> mCode;
+
+    void formatField(const Instruction& ins, const ReportResult& result, const ReportNuclide* nuclide, QByteArray& output) const;
+};
+
+// Native templates live next to the Genie template in Settings::templateName with the
+// extension .ntpl. Returns an empty string if there is none.
+QString nativeTemplateName(const QString& templateName);
+
+// Compiled templates are cached per file and recompiled when the file changes.
+// Thread safe, the returned template may be shared between threads.
+QSharedPointer<const ReportTemplate> loadReportTemplate(const QString& filename, QString* error = 0);
+
+#endif // REPORTTEMPLATE_H
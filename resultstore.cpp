@@ -0,0 +1,494 @@
+#include <QDir>
+#include <QDate>
+#include <QLockFile>
+#include <algorithm>
+#include <limits>
+#include "resultstore.h"
+
+static const char* columnFiles[] = {
+    "time.col", "activity.col", "uncertainty.col", "mda.col",
+    "nuclide.col", "detector.col", "beaker.col", "sample.col", "flags.col"
+};
+
+static const int columnWidths[] = {
+    sizeof(qint64), sizeof(double), sizeof(double), sizeof(double),
+    sizeof(quint16), sizeof(quint16), sizeof(quint16), sizeof(quint32), sizeof(quint8)
+};
+
+static const char* dictionaryFiles[] = { "nuclides.dict", "detectors.dict", "beakers.dict", "samples.dict" };
+
+static const quint32 invalidId = 0xFFFFFFFF;
+static const int lockTimeoutMs = 30 * 1000;
+
+template<typename T> static void appendValue(QByteArray& buffer, T value)
+{
+    buffer.append(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+ResultStore::ResultStore(const QString& directory)
+    : mDirectory(directory), mOpen(false), mReadOnly(false), mRows(0), mMappedRows(-1)
+{
+    for(int i=0; i<ColumnCount; i++)
+        mMaps[i] = NULL;
+    for(int i=0; i<DictionaryCount; i++)
+        mDictionarySizes[i] = 0;
+}
+
+// Held by the process appending to the store. Only the lock of a process that is gone
+// is stale.
+static bool lockStore(QLockFile& lock)
+{
+    lock.setStaleLockTime(0);
+    return lock.tryLock(lockTimeoutMs);
+}
+
+ResultStore::~ResultStore()
+{
+    close();
+}
+
+bool ResultStore::open(bool readOnly)
+{
+    if(mOpen)
+        return true;
+
+    if(!readOnly && !QDir().mkpath(mDirectory))
+        return false;
+
+    QDir dir(mDirectory);
+    mReadOnly = readOnly;
+    for(int i=0; i<ColumnCount; i++)
+    {
+        // A store nothing was added to yet has no files, read-only it is just empty
+        mColumns[i].setFileName(dir.absoluteFilePath(columnFiles[i]));
+        if(readOnly && !mColumns[i].exists())
+            continue;
+        if(!mColumns[i].open(readOnly ? QIODevice::ReadOnly : QIODevice::ReadWrite))
+        {
+            close();
+            return false;
+        }
+    }
+
+    QLockFile lock(dir.absoluteFilePath("results.lck"));
+    if((!readOnly && !lockStore(lock)) || !refresh())
+    {
+        close();
+        return false;
+    }
+
+    mMappedRows = -1;
+    mOpen = true;
+    return true;
+}
+
+// Brings the row count and the dictionaries up to what is on disk, other processes may
+// have appended since. Writers call it with the lock held.
+bool ResultStore::refresh()
+{
+    // Columns are written in order, the shortest one has the complete rows
+    mRows = -1;
+    for(int i=0; i<ColumnCount; i++)
+    {
+        qint64 rows = mColumns[i].isOpen() ? mColumns[i].size() / columnWidths[i] : 0;
+        mRows = mRows < 0 ? rows : qMin(mRows, rows);
+    }
+
+    // Drops the tail of an append that did not reach all columns
+    if(!mReadOnly)
+    {
+        for(int i=0; i<ColumnCount; i++)
+        {
+            if(mColumns[i].size() != mRows * columnWidths[i] && !mColumns[i].resize(mRows * columnWidths[i]))
+                return false;
+        }
+    }
+
+    // Strings are added before the rows using them, the dictionaries are read last
+    for(int i=0; i<DictionaryCount; i++)
+    {
+        if(!loadDictionary((Dictionary)i))
+            return false;
+    }
+    return true;
+}
+
+void ResultStore::close()
+{
+    unmapColumns();
+    for(int i=0; i<ColumnCount; i++)
+        mColumns[i].close();
+    for(int i=0; i<DictionaryCount; i++)
+    {
+        mStrings[i].clear();
+        mIndex[i].clear();
+        mDictionarySizes[i] = 0;
+    }
+    mRows = 0;
+    mOpen = false;
+}
+
+// Reads the strings added since the last call, only complete lines
+bool ResultStore::loadDictionary(Dictionary dict)
+{
+    QFile file(QDir(mDirectory).absoluteFilePath(dictionaryFiles[dict]));
+    if(!file.exists() || file.size() == mDictionarySizes[dict])
+        return true;
+    if(!file.open(QIODevice::ReadOnly) || !file.seek(mDictionarySizes[dict]))
+        return false;
+
+    while(!file.atEnd())
+    {
+        QByteArray line = file.readLine();
+        if(!line.endsWith('\n'))
+            break;
+        mDictionarySizes[dict] += line.size();
+        QString value = QString::fromUtf8(line.constData(), line.size() - 1);
+        mIndex[dict].insert(value, mStrings[dict].count());
+        mStrings[dict].append(value);
+    }
+    return true;
+}
+
+quint32 ResultStore::stringId(Dictionary dict, const QString& value)
+{
+    QString key = value;
+    key.replace('\n', ' ');
+
+    QHash<QString, quint32>::const_iterator iter = mIndex[dict].constFind(key);
+    if(iter != mIndex[dict].constEnd())
+        return iter.value();
+
+    // All dictionaries but the sample IDs are stored as 16 bit ids
+    if(dict != DictSample && mStrings[dict].count() >= 0xFFFF)
+        return invalidId;
+
+    QFile file(QDir(mDirectory).absoluteFilePath(dictionaryFiles[dict]));
+    if(!file.open(QIODevice::WriteOnly | QIODevice::Append))
+        return invalidId;
+    QByteArray line = key.toUtf8() + '\n';
+    if(file.write(line) != line.size())
+        return invalidId;
+    file.close();
+    mDictionarySizes[dict] += line.size();
+
+    quint32 id = mStrings[dict].count();
+    mIndex[dict].insert(key, id);
+    mStrings[dict].append(key);
+    return id;
+}
+
+bool ResultStore::append(const ReportResult& result)
+{
+    if(!mOpen || mReadOnly)
+        return false;
+    if(result.nuclides.isEmpty())
+        return true;
+
+    // Mappings do not follow the file size, they are recreated by the next query
+    unmapColumns();
+
+    // Rows and strings another process added since are taken in first, the rows below
+    // go after them
+    QLockFile lock(QDir(mDirectory).absoluteFilePath("results.lck"));
+    if(!lockStore(lock) || !refresh())
+        return false;
+
+    QDateTime time = result.acquisitionStarted;
+    if(!time.isValid())
+        time = result.sampleDate.isValid() ? result.sampleDate : QDateTime::currentDateTime();
+
+    quint32 detector = stringId(DictDetector, result.detector);
+    quint32 beaker = stringId(DictBeaker, result.geometry);
+    quint32 sample = stringId(DictSample, result.sampleId);
+    if(detector == invalidId || beaker == invalidId || sample == invalidId)
+        return false;
+
+    QByteArray buffers[ColumnCount];
+    foreach(const ReportNuclide& nuclide, result.nuclides)
+    {
+        quint32 id = stringId(DictNuclide, nuclide.name);
+        if(id == invalidId)
+            return false;
+
+        appendValue<qint64>(buffers[ColTime], time.toMSecsSinceEpoch());
+        appendValue<double>(buffers[ColActivity], nuclide.activity);
+        appendValue<double>(buffers[ColUncertainty], nuclide.uncertainty);
+        appendValue<double>(buffers[ColMDA], nuclide.mda);
+        appendValue<quint16>(buffers[ColNuclide], id);
+        appendValue<quint16>(buffers[ColDetector], detector);
+        appendValue<quint16>(buffers[ColBeaker], beaker);
+        appendValue<quint32>(buffers[ColSample], sample);
+        appendValue<quint8>(buffers[ColFlags], nuclide.flags);
+    }
+
+    for(int i=0; i<ColumnCount; i++)
+    {
+        if(!mColumns[i].seek(mRows * columnWidths[i])
+                || mColumns[i].write(buffers[i]) != buffers[i].size()
+                || !mColumns[i].flush())
+        {
+            for(int j=0; j<=i; j++)
+                mColumns[j].resize(mRows * columnWidths[j]);
+            return false;
+        }
+    }
+
+    mRows += result.nuclides.count();
+    return true;
+}
+
+bool ResultStore::appendReport(const QString& reportFile)
+{
+    ReportResult result;
+    if(!mParser.parseFile(reportFile, result))
+        return false;
+    return append(result);
+}
+
+bool ResultStore::mapColumns()
+{
+    if(mMappedRows == mRows)
+        return true;
+
+    unmapColumns();
+    if(mRows > 0)
+    {
+        for(int i=0; i<ColumnCount; i++)
+        {
+            mMaps[i] = mColumns[i].map(0, mRows * columnWidths[i]);
+            if(!mMaps[i])
+            {
+                unmapColumns();
+                return false;
+            }
+        }
+    }
+    mMappedRows = mRows;
+    return true;
+}
+
+void ResultStore::unmapColumns()
+{
+    for(int i=0; i<ColumnCount; i++)
+    {
+        if(mMaps[i])
+        {
+            mColumns[i].unmap(mMaps[i]);
+            mMaps[i] = NULL;
+        }
+    }
+    mMappedRows = -1;
+}
+
+ResultStore::Filter ResultStore::makeFilter(const ResultQuery& query) const
+{
+    Filter filter;
+    filter.empty = false;
+    filter.from = query.from.isValid() ? query.from.toMSecsSinceEpoch() : std::numeric_limits<qint64>::min();
+    filter.to = query.to.isValid() ? query.to.toMSecsSinceEpoch() : std::numeric_limits<qint64>::max();
+
+    // A name that was never stored can not match any row
+    const Dictionary dicts[] = { DictNuclide, DictDetector, DictBeaker };
+    const QString* names[] = { &query.nuclide, &query.detector, &query.beaker };
+    int* ids[] = { &filter.nuclide, &filter.detector, &filter.beaker };
+    for(int i=0; i<3; i++)
+    {
+        *ids[i] = -1;
+        if(names[i]->isEmpty())
+            continue;
+        QHash<QString, quint32>::const_iterator iter = mIndex[dicts[i]].constFind(*names[i]);
+        if(iter != mIndex[dicts[i]].constEnd())
+            *ids[i] = iter.value();
+        else
+        {
+            // Reports spell nuclides in upper case, "Cs-137" should still match
+            for(int j=0; j<mStrings[dicts[i]].count() && *ids[i] < 0; j++)
+            {
+                if(mStrings[dicts[i]][j].compare(*names[i], Qt::CaseInsensitive) == 0)
+                    *ids[i] = j;
+            }
+            if(*ids[i] < 0)
+                filter.empty = true;
+        }
+    }
+
+    if(!query.samplePrefix.isEmpty())
+    {
+        bool any = false;
+        filter.samples.resize(mStrings[DictSample].count());
+        for(int i=0; i<filter.samples.count(); i++)
+        {
+            filter.samples[i] = mStrings[DictSample][i].startsWith(query.samplePrefix, Qt::CaseInsensitive);
+            any = any || filter.samples[i];
+        }
+        if(!any)
+            filter.empty = true;
+    }
+
+    return filter;
+}
+
+template<typename Visitor> bool ResultStore::scan(const ResultQuery& query, Visitor visit)
+{
+    if(!mOpen || !mapColumns())
+        return false;
+
+    Filter filter = makeFilter(query);
+    if(filter.empty || mRows == 0)
+        return true;
+
+    const qint64* time = reinterpret_cast<const qint64*>(mMaps[ColTime]);
+    const quint16* nuclide = reinterpret_cast<const quint16*>(mMaps[ColNuclide]);
+    const quint16* detector = reinterpret_cast<const quint16*>(mMaps[ColDetector]);
+    const quint16* beaker = reinterpret_cast<const quint16*>(mMaps[ColBeaker]);
+    const quint32* sample = reinterpret_cast<const quint32*>(mMaps[ColSample]);
+    const bool* samples = filter.samples.isEmpty() ? NULL : filter.samples.constData();
+
+    for(qint64 i=0; i<mRows; i++)
+    {
+        if(time[i] < filter.from || time[i] >= filter.to)
+            continue;
+        if(filter.nuclide >= 0 && nuclide[i] != filter.nuclide)
+            continue;
+        if(filter.detector >= 0 && detector[i] != filter.detector)
+            continue;
+        if(filter.beaker >= 0 && beaker[i] != filter.beaker)
+            continue;
+        if(samples && !samples[sample[i]])
+            continue;
+        if(!visit(i))
+            break;
+    }
+    return true;
+}
+
+bool ResultStore::select(const ResultQuery& query, QVector<ResultRow>& rows, int limit)
+{
+    rows.clear();
+
+    return scan(query, [&](qint64 i) -> bool
+    {
+        ResultRow row;
+        row.time = QDateTime::fromMSecsSinceEpoch(reinterpret_cast<const qint64*>(mMaps[ColTime])[i]);
+        row.activity = reinterpret_cast<const double*>(mMaps[ColActivity])[i];
+        row.uncertainty = reinterpret_cast<const double*>(mMaps[ColUncertainty])[i];
+        row.mda = reinterpret_cast<const double*>(mMaps[ColMDA])[i];
+        row.nuclide = mStrings[DictNuclide][reinterpret_cast<const quint16*>(mMaps[ColNuclide])[i]];
+        row.detector = mStrings[DictDetector][reinterpret_cast<const quint16*>(mMaps[ColDetector])[i]];
+        row.beaker = mStrings[DictBeaker][reinterpret_cast<const quint16*>(mMaps[ColBeaker])[i]];
+        row.sampleId = mStrings[DictSample][reinterpret_cast<const quint32*>(mMaps[ColSample])[i]];
+        row.flags = mMaps[ColFlags][i];
+        rows.append(row);
+        return limit < 0 || rows.count() < limit;
+    });
+}
+
+bool ResultStore::aggregate(const ResultQuery& query, GroupBy groupBy, QVector<ResultGroup>& groups)
+{
+    groups.clear();
+
+    const qint64* time = NULL;
+    const double* activity = NULL;
+    QHash<qint64, ResultGroup> accumulators;
+    qint64 lastKey = -1, lastDay = std::numeric_limits<qint64>::min();
+    ResultGroup* last = NULL;
+
+    bool ok = scan(query, [&](qint64 i) -> bool
+    {
+        // scan maps the columns before the first visit
+        if(!time)
+        {
+            time = reinterpret_cast<const qint64*>(mMaps[ColTime]);
+            activity = reinterpret_cast<const double*>(mMaps[ColActivity]);
+        }
+
+        qint64 key;
+        switch(groupBy)
+        {
+        case GroupNuclide:
+            key = reinterpret_cast<const quint16*>(mMaps[ColNuclide])[i];
+            break;
+        case GroupDetector:
+            key = reinterpret_cast<const quint16*>(mMaps[ColDetector])[i];
+            break;
+        case GroupBeaker:
+            key = reinterpret_cast<const quint16*>(mMaps[ColBeaker])[i];
+            break;
+        case GroupSample:
+            key = reinterpret_cast<const quint32*>(mMaps[ColSample])[i];
+            break;
+        default:
+        {
+            // Months and years are counted in UTC, days are cached as rows arrive mostly in order
+            qint64 day = time[i] / 86400000;
+            if(time[i] < 0 && time[i] % 86400000)
+                day--;
+            if(day == lastDay && last)
+            {
+                key = lastKey;
+                break;
+            }
+            lastDay = day;
+            QDate date = QDate::fromJulianDay(2440588 + day);
+            key = groupBy == GroupMonth ? date.year() * 12 + date.month() - 1 : date.year();
+            break;
+        }
+        }
+
+        if(!last || key != lastKey)
+        {
+            QHash<qint64, ResultGroup>::iterator iter = accumulators.find(key);
+            if(iter == accumulators.end())
+            {
+                ResultGroup group;
+                group.count = 0;
+                group.sum = 0.0;
+                group.min = std::numeric_limits<double>::max();
+                group.max = -std::numeric_limits<double>::max();
+                iter = accumulators.insert(key, group);
+            }
+            last = &iter.value();
+            lastKey = key;
+        }
+
+        double value = activity[i];
+        last->count++;
+        last->sum += value;
+        last->min = qMin(last->min, value);
+        last->max = qMax(last->max, value);
+        return true;
+    });
+
+    QHash<qint64, ResultGroup>::iterator iter;
+    for(iter = accumulators.begin(); iter != accumulators.end(); ++iter)
+    {
+        ResultGroup group = iter.value();
+        qint64 key = iter.key();
+        switch(groupBy)
+        {
+        case GroupNuclide:
+            group.key = mStrings[DictNuclide][key];
+            break;
+        case GroupDetector:
+            group.key = mStrings[DictDetector][key];
+            break;
+        case GroupBeaker:
+            group.key = mStrings[DictBeaker][key];
+            break;
+        case GroupSample:
+            group.key = mStrings[DictSample][key];
+            break;
+        case GroupMonth:
+            group.key = QString("%1-%2").arg(key / 12).arg(key % 12 + 1, 2, 10, QChar('0'));
+            break;
+        case GroupYear:
+            group.key = QString::number(key);
+            break;
+        }
+        groups.append(group);
+    }
+
+    std::sort(groups.begin(), groups.end(), [](const ResultGroup& a, const ResultGroup& b) { return a.key < b.key; });
+    return ok;
+}
@@ -0,0 +1,102 @@
+#ifndef RESULTSTORE_H
+#define RESULTSTORE_H
+
+#include <QString>
+#include <QStringList>
+#include <QDateTime>
+#include <QVector>
+#include <QHash>
+#include <QFile>
+#include "reportparser.h"
+
+struct ResultQuery
+{
+    QDateTime from, to;         // acquisition start, [from, to), invalid means open
+    QString nuclide;            // empty matches all
+    QString detector;
+    QString beaker;
+    QString samplePrefix;       // sample IDs starting with this, e.g. a project code
+};
+
+struct ResultRow
+{
+    QDateTime time;
+    QString nuclide;
+    QString detector;
+    QString beaker;
+    QString sampleId;
+    double activity;
+    double uncertainty;
+    double mda;
+    int flags;
+};
+
+struct ResultGroup
+{
+    QString key;
+    qint64 count;
+    double sum;
+    double min;
+    double max;
+};
+
+// Nuclide results of all stored jobs, one row per nuclide and report, kept column by
+// column under RESULTS (one fixed width file per field, strings as dictionary ids).
+// Columns are memory mapped for queries, so filters only touch the fields they test.
+// Appends hold RESULTS/results.lck, so Nailab and nailab-cli can both add results; a
+// store opened read-only for queries sees the rows complete when it was opened.
+class ResultStore
+{
+public:
+
+    enum GroupBy { GroupNuclide, GroupDetector, GroupBeaker, GroupSample, GroupMonth, GroupYear };
+
+    explicit ResultStore(const QString& directory);
+    ~ResultStore();
+
+    bool open(bool readOnly = false);
+    void close();
+    bool isOpen() const { return mOpen; }
+
+    bool append(const ReportResult& result);
+    bool appendReport(const QString& reportFile);
+    qint64 rowCount() const { return mRows; }
+
+    bool select(const ResultQuery& query, QVector<ResultRow>& rows, int limit = -1);
+    bool aggregate(const ResultQuery& query, GroupBy groupBy, QVector<ResultGroup>& groups);
+
+private:
+
+    enum Column { ColTime, ColActivity, ColUncertainty, ColMDA, ColNuclide, ColDetector, ColBeaker, ColSample, ColFlags, ColumnCount };
+    enum Dictionary { DictNuclide, DictDetector, DictBeaker, DictSample, DictionaryCount };
+
+    struct Filter
+    {
+        qint64 from, to;
+        int nuclide, detector, beaker;
+        QVector<bool> samples;
+        bool empty;
+    };
+
+    QString mDirectory;
+    bool mOpen;
+    bool mReadOnly;
+    qint64 mRows;
+    QFile mColumns[ColumnCount];
+    uchar* mMaps[ColumnCount];
+    qint64 mMappedRows;
+    QStringList mStrings[DictionaryCount];
+    QHash<QString, quint32> mIndex[DictionaryCount];
+    qint64 mDictionarySizes[DictionaryCount];      // bytes read so far
+    ReportParser mParser;
+
+    bool refresh();
+    bool loadDictionary(Dictionary dict);
+    quint32 stringId(Dictionary dict, const QString& value);
+    bool mapColumns();
+    void unmapColumns();
+    Filter makeFilter(const ResultQuery& query) const;
+    template<typename Visitor> bool scan(const ResultQuery& query, Visitor visit);
+};
+
+#endif // RESULTSTORE_H
@@ -0,0 +1,119 @@
+#include <QLocale>
+#include "sampleinput.h"
+
+static bool parseNumber(const QString& text, const QString& field, double minimum, double& value, QStringList& problems)
+{
+    value = 0.0;
+    if(text.trimmed().isEmpty())
+        return true;
+
+    bool ok;
+    value = text.trimmed().toDouble(&ok);
+    if(!ok)
+        value = QLocale().toDouble(text.trimmed(), &ok);
+    if(!ok)
+    {
+        problems << field + " is not a number: " + text;
+        return false;
+    }
+    if(value < minimum)
+    {
+        problems << field + " must be at least " + QString::number(minimum);
+        return false;
+    }
+    return true;
+}
+
+static bool parseTime(const QString& text, const QString& field, QDateTime& value, QStringList& problems)
+{
+    value = QDateTime();
+    if(text.trimmed().isEmpty())
+        return true;
+
+    // The format of the job files, of the date edits and of sample files
+    static const char* formats[] = { "dd.MM.yyyy HH:mm:ss", "dd.MM.yyyy HH:mm", "yyyy-MM-dd HH:mm:ss" };
+    for(int i=0; i<3 && !value.isValid(); i++)
+        value = QDateTime::fromString(text.trimmed(), formats[i]);
+    if(!value.isValid())
+        value = QLocale().toDateTime(text.trimmed(), QLocale::ShortFormat);
+    if(!value.isValid())
+        value = QDateTime::fromString(text.trimmed(), Qt::ISODate);
+    if(!value.isValid())
+    {
+        problems << field + " is not a date: " + text;
+        return false;
+    }
+    return true;
+}
+
+bool parseSampleInput(const SampleInput& sampleInput, SampleParameters& parameters, QStringList& problems)
+{
+    int count = problems.count();
+
+    parseNumber(sampleInput.quantity, "Quantity", 0.0, parameters.quantity, problems);
+    parseNumber(sampleInput.quantityError, "Quantity uncertainty", 0.0, parameters.quantityError, problems);
+    parseNumber(sampleInput.randomError, "Random error", 0.0, parameters.randomError, problems);
+    parseNumber(sampleInput.systematicError, "Systematic error", 0.0, parameters.systematicError, problems);
+
+    parameters.buildupType = BuildupNone;
+    if(sampleInput.builduptype == "DEPOSIT")
+        parameters.buildupType = BuildupDeposit;
+    else if(sampleInput.builduptype == "IRRAD")
+        parameters.buildupType = BuildupIrradiation;
+    else if(sampleInput.builduptype != "NONE" && !sampleInput.builduptype.isEmpty())
+        problems << "Unknown buildup type: " + sampleInput.builduptype;
+
+    parseTime(sampleInput.startTime, "Sample time", parameters.startTime, problems);
+    parseTime(sampleInput.endTime, "Sample end time", parameters.endTime, problems);
+
+    // Deposition and irradiation need both ends of the interval, see /sdeposit
+    if(parameters.buildupType != BuildupNone)
+    {
+        if(!parameters.startTime.isValid() || !parameters.endTime.isValid())
+            problems << "Buildup " + sampleInput.builduptype + " needs a start and an end time";
+        else if(parameters.endTime < parameters.startTime)
+            problems << "Sample end time is before the start time";
+    }
+
+    parameters.presetType1 = countPresetFromName(sampleInput.presetType1);
+    parameters.presetType2 = timePresetFromName(sampleInput.presetType2);
+    parseNumber(sampleInput.presetType1Value, "Preset 1 value", 0.0, parameters.presetType1Value, problems);
+    parseNumber(sampleInput.presetType2Value, "Preset 2 value", 0.0, parameters.presetType2Value, problems);
+
+    double channel;
+    parseNumber(sampleInput.presetType1StartChannel, "Preset 1 start channel", 0.0, channel, problems);
+    parameters.presetType1StartChannel = int(channel);
+    parseNumber(sampleInput.presetType1EndChannel, "Preset 1 end channel", 0.0, channel, problems);
+    parameters.presetType1EndChannel = int(channel);
+
+    double priority;
+    parseNumber(sampleInput.priority, "Priority", 0.0, priority, problems);
+    parameters.priority = int(priority);
+
+    parameters.mda = 0.0;
+    parameters.mdaNuclide.clear();
+    if(!sampleInput.mda.trimmed().isEmpty())
+    {
+        int sep = sampleInput.mda.lastIndexOf(':');
+        parameters.mdaNuclide = sampleInput.mda.left(sep).trimmed();
+        if(sep <= 0 || parameters.mdaNuclide.isEmpty())
+            problems << "MDA must be given as <nuclide>:<Bq>: " + sampleInput.mda;
+        else if(parseNumber(sampleInput.mda.mid(sep + 1), "MDA", 0.0, parameters.mda, problems) && parameters.mda <= 0.0)
+            problems << "MDA must be greater than 0";
+    }
+
+    // startmca without a preset counts until someone stops it
+    if(parameters.presetType1 == CountPresetNone && parameters.presetType2 == TimePresetNone)
+        problems << "No acquisition preset";
+    if(parameters.presetType1 != CountPresetNone)
+    {
+        if(parameters.presetType1Value <= 0.0)
+            problems << "Preset 1 value must be greater than 0";
+        if(parameters.presetType1EndChannel < parameters.presetType1StartChannel)
+            problems << "Preset 1 end channel is before the start channel";
+    }
+    if(parameters.presetType2 != TimePresetNone && parameters.presetType2Value <= 0.0)
+        problems << "Preset 2 value must be greater than 0";
+
+    return problems.count() == count;
+}
@@ -2,7 +2,11 @@
 #define SAMPLEINPUT_H
 
 #include <QString>
+#include <QStringList>
+#include <QDateTime>
+#include "detector.h"
 
+// Sample fields as entered, written to the job script as they are
 struct SampleInput
 {
     QString detector;
@@ -27,6 +31,39 @@ struct SampleInput
     QString presetType1EndChannel;
     QString presetType2;
     QString presetType2Value;
+    // Only used to schedule the sample, see scheduler.h
+    QString priority;
+    QString mda;                // "<nuclide>:<Bq>", count until the MDA is reached
 };
 
+enum BuildupType
+{
+    BuildupNone, BuildupDeposit, BuildupIrradiation
+};
+
+// The numbers, dates and closed sets of a SampleInput. Fields left empty in the
+// input are 0 or invalid here.
+struct SampleParameters
+{
+    double quantity;
+    double quantityError;
+    BuildupType buildupType;
+    QDateTime startTime;
+    QDateTime endTime;
+    double randomError;
+    double systematicError;
+    CountPreset presetType1;
+    double presetType1Value;
+    int presetType1StartChannel;
+    int presetType1EndChannel;
+    TimePreset presetType2;
+    double presetType2Value;
+    int priority;
+    QString mdaNuclide;
+    double mda;
+};
+
+// Appends a message per field that does not parse or is out of range
+bool parseSampleInput(const SampleInput& sampleInput, SampleParameters& parameters, QStringList& problems);
+
 #endif // SAMPLEINPUT_H
@@ -0,0 +1,331 @@
+#include <QDir>
+#include <QDirIterator>
+#include <QFileInfo>
+#include <QVector>
+#include <algorithm>
+#include <cmath>
+#include "scheduler.h"
+
+QString schedulePolicyName(SchedulePolicy policy)
+{
+    return policy == ScheduleMakespan ? "makespan" : "first-free";
+}
+
+bool schedulePolicyFromName(const QString& name, SchedulePolicy& policy)
+{
+    if(name == "makespan")
+        policy = ScheduleMakespan;
+    else if(name == "first-free")
+        policy = ScheduleFirstFree;
+    else
+        return false;
+    return true;
+}
+
+ScheduleSample scheduleSample(const SampleInput& sampleInput, double arrival)
+{
+    ScheduleSample sample;
+    sample.geometry = sampleInput.geometry;
+    sample.detector = sampleInput.detector;
+    sample.mda = 0.0;
+    int sep = sampleInput.mda.lastIndexOf(':');
+    if(sep > 0)
+    {
+        sample.nuclide = sampleInput.mda.left(sep).trimmed();
+        sample.mda = qMax(0.0, sampleInput.mda.mid(sep + 1).trimmed().toDouble());
+    }
+    sample.preset = timePresetFromName(sampleInput.presetType2);
+    sample.presetValue = sampleInput.presetType2Value.toDouble();
+    sample.priority = sampleInput.priority.toInt();
+    sample.arrival = arrival;
+    return sample;
+}
+
+ScheduleDetector scheduleDetector(const Detector& detector, bool powered, double freeAt)
+{
+    ScheduleDetector d;
+    d.name = detector.name;
+    d.beakers = detector.beakers.keys();
+    d.preset = detector.presetType2;
+    d.presetValue = detector.presetType2Value;
+    d.available = detector.inUse && powered;
+    d.freeAt = freeAt;
+    return d;
+}
+
+static QString modelKey(const QString& detector, const QString& geometry, const QString& nuclide = QString())
+{
+    return detector.toUpper() + '|' + geometry.toUpper() + '|' + nuclide.toUpper();
+}
+
+JobDurationModel::JobDurationModel()
+    : mOverhead(120.0), mReports(0)
+{
+}
+
+void JobDurationModel::addReport(const ReportResult& result)
+{
+    if(result.liveTime <= 0.0 || result.detector.isEmpty())
+        return;
+
+    if(result.realTime >= result.liveTime)
+        mRealPerLive[result.detector.toUpper()].add(result.realTime / result.liveTime);
+    mLiveTime[modelKey(result.detector, result.geometry)].add(result.liveTime);
+
+    double root = std::sqrt(result.liveTime);
+    for(int i=0; i<result.nuclides.count(); i++)
+    {
+        const ReportNuclide& nuclide = result.nuclides[i];
+        if(nuclide.mda > 0.0)
+            mMDAReference[modelKey(result.detector, result.geometry, nuclide.name)].add(nuclide.mda * root);
+    }
+    mReports++;
+}
+
+bool JobDurationModel::canCount(const ScheduleSample& sample, const ScheduleDetector& detector) const
+{
+    if(!detector.available || !detector.beakers.contains(sample.geometry))
+        return false;
+    return sample.detector.isEmpty() || detector.name.compare(sample.detector, Qt::CaseInsensitive) == 0;
+}
+
+bool JobDurationModel::hasMDAReference(const ScheduleSample& sample, const ScheduleDetector& detector) const
+{
+    return sample.mda > 0.0 && mMDAReference.value(modelKey(detector.name, sample.geometry, sample.nuclide)).count > 0;
+}
+
+double JobDurationModel::countTime(TimePreset preset, double value, const QString& detector) const
+{
+    if(value <= 0.0)
+        return 0.0;
+    if(preset == TimePresetLive)
+        return value;
+    if(preset == TimePresetReal)
+    {
+        double ratio = mRealPerLive.value(detector.toUpper()).value();
+        return ratio > 0.0 ? value / ratio : value;
+    }
+    return 0.0;
+}
+
+double JobDurationModel::liveTime(const ScheduleSample& sample, const ScheduleDetector& detector) const
+{
+    if(sample.mda > 0.0)
+    {
+        double reference = mMDAReference.value(modelKey(detector.name, sample.geometry, sample.nuclide)).value();
+        if(reference > 0.0)
+            return (reference / sample.mda) * (reference / sample.mda);
+    }
+
+    // Count presets (area, integral) stop at a number of counts, use what such counts took before
+    double t = countTime(sample.preset, sample.presetValue, detector.name);
+    if(t <= 0.0 && sample.preset == TimePresetNone)
+        t = countTime(detector.preset, detector.presetValue, detector.name);
+    if(t <= 0.0)
+        t = mLiveTime.value(modelKey(detector.name, sample.geometry)).value();
+    return t > 0.0 ? t : 3600.0;
+}
+
+double JobDurationModel::duration(const ScheduleSample& sample, const ScheduleDetector& detector) const
+{
+    double ratio = mRealPerLive.value(detector.name.toUpper()).value();
+    return liveTime(sample, detector) * (ratio > 0.0 ? ratio : 1.0) + mOverhead;
+}
+
+int loadDurationModel(const QString& archiveDirectory, const QDateTime& from, const QDateTime& to,
+                      JobDurationModel& model, QList<ReportResult>* reports)
+{
+    // The archive is ARCHIVE/<year>/<detector>/, a report is written after its count started
+    ReportParser parser;
+    int count = 0;
+    for(int year = from.date().year(); year <= to.date().year(); year++)
+    {
+        QDirIterator iter(archiveDirectory + QString::number(year), QStringList() << "*.RPT",
+                          QDir::Files, QDirIterator::Subdirectories);
+        while(iter.hasNext())
+        {
+            QString filename = iter.next();
+            // Reanalysis copies and chunk data are not jobs of their own
+            QStringList parts = QDir(archiveDirectory).relativeFilePath(filename).split('/');
+            if(parts.contains("REANALYSIS") || parts.contains("CHUNKS"))
+                continue;
+            if(iter.fileInfo().lastModified() < from)
+                continue;
+
+            ReportResult result;
+            if(!parser.parseFile(filename, result) || result.acquisitionStarted < from || result.acquisitionStarted >= to)
+                continue;
+
+            model.addReport(result);
+            if(reports)
+                reports->append(result);
+            count++;
+        }
+    }
+    return count;
+}
+
+bool scheduleSamples(const QList<ScheduleSample>& samples, const QList<ScheduleDetector>& detectors,
+                     const JobDurationModel& model, SchedulePolicy policy, QList<ScheduleAssignment>& assignments)
+{
+    assignments.clear();
+    QVector<double> freeAt(detectors.count());
+    for(int k=0; k<detectors.count(); k++)
+        freeAt[k] = detectors[k].freeAt;
+
+    // Detectors each sample can go to, in configuration order
+    bool ok = true;
+    QVector<QList<int> > eligible(samples.count());
+    QList<int> pending;
+    for(int i=0; i<samples.count(); i++)
+    {
+        ScheduleAssignment assignment;
+        assignment.sample = i;
+        assignment.detector = -1;
+        assignment.start = assignment.finish = assignment.liveTime = 0.0;
+        assignments << assignment;
+
+        for(int k=0; k<detectors.count(); k++)
+        {
+            if(model.canCount(samples[i], detectors[k]))
+                eligible[i] << k;
+        }
+        if(eligible[i].isEmpty())
+            ok = false;
+        else
+            pending << i;
+    }
+
+    if(policy == ScheduleMakespan)
+    {
+        QVector<double> shortest(samples.count());
+        foreach(int i, pending)
+        {
+            shortest[i] = -1.0;
+            foreach(int k, eligible[i])
+            {
+                double d = model.duration(samples[i], detectors[k]);
+                if(shortest[i] < 0.0 || d < shortest[i])
+                    shortest[i] = d;
+            }
+        }
+
+        // A sample that has not arrived cannot go before one that has, whatever its priority
+        std::stable_sort(pending.begin(), pending.end(), [&](int a, int b)
+        {
+            if(samples[a].arrival != samples[b].arrival)
+                return samples[a].arrival < samples[b].arrival;
+            if(samples[a].priority != samples[b].priority)
+                return samples[a].priority > samples[b].priority;
+            if(eligible[a].count() != eligible[b].count())
+                return eligible[a].count() < eligible[b].count();
+            return shortest[a] > shortest[b];
+        });
+
+        foreach(int i, pending)
+        {
+            ScheduleAssignment& assignment = assignments[i];
+            foreach(int k, eligible[i])
+            {
+                double start = qMax(freeAt[k], samples[i].arrival);
+                double finish = start + model.duration(samples[i], detectors[k]);
+                if(assignment.detector < 0 || finish < assignment.finish)
+                {
+                    assignment.detector = k;
+                    assignment.start = start;
+                    assignment.finish = finish;
+                }
+            }
+            assignment.liveTime = model.liveTime(samples[i], detectors[assignment.detector]);
+            freeAt[assignment.detector] = assignment.finish;
+        }
+        return ok;
+    }
+
+    // First free: replays the dispatch loop, every time a detector frees up or a sample
+    // arrives the queue is walked in order
+    double now = 0.0;
+    while(!pending.isEmpty())
+    {
+        for(int p=0; p<pending.count();)
+        {
+            int i = pending[p];
+            int chosen = -1;
+            if(samples[i].arrival <= now)
+            {
+                foreach(int k, eligible[i])
+                {
+                    if(freeAt[k] <= now)
+                    {
+                        chosen = k;
+                        break;
+                    }
+                }
+            }
+            if(chosen < 0)
+            {
+                p++;
+                continue;
+            }
+
+            ScheduleAssignment& assignment = assignments[i];
+            assignment.detector = chosen;
+            assignment.start = now;
+            assignment.finish = now + model.duration(samples[i], detectors[chosen]);
+            assignment.liveTime = model.liveTime(samples[i], detectors[chosen]);
+            freeAt[chosen] = assignment.finish;
+            pending.removeAt(p);
+        }
+
+        double next = -1.0;
+        for(int k=0; k<freeAt.count(); k++)
+        {
+            if(freeAt[k] > now && (next < 0.0 || freeAt[k] < next))
+                next = freeAt[k];
+        }
+        foreach(int i, pending)
+        {
+            if(samples[i].arrival > now && (next < 0.0 || samples[i].arrival < next))
+                next = samples[i].arrival;
+        }
+        if(next < 0.0)
+            break;
+        now = next;
+    }
+    return ok;
+}
+
+ScheduleStats scheduleStats(const QList<ScheduleSample>& samples, const QList<ScheduleDetector>& detectors,
+                            const QList<ScheduleAssignment>& assignments)
+{
+    ScheduleStats stats;
+    stats.makespan = stats.meanWait = stats.utilisation = 0.0;
+    stats.scheduled = stats.unscheduled = 0;
+
+    double busy = 0.0, wait = 0.0;
+    foreach(const ScheduleAssignment& assignment, assignments)
+    {
+        if(assignment.detector < 0)
+        {
+            stats.unscheduled++;
+            continue;
+        }
+        stats.scheduled++;
+        stats.makespan = qMax(stats.makespan, assignment.finish);
+        busy += assignment.finish - assignment.start;
+        wait += assignment.start - samples[assignment.sample].arrival;
+    }
+
+    int available = 0;
+    foreach(const ScheduleDetector& detector, detectors)
+    {
+        if(detector.available)
+            available++;
+    }
+
+    if(stats.scheduled)
+        stats.meanWait = wait / stats.scheduled;
+    if(available && stats.makespan > 0.0)
+        stats.utilisation = busy / (available * stats.makespan);
+    return stats;
+}
@@ -0,0 +1,130 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <QString>
+#include <QStringList>
+#include <QList>
+#include <QHash>
+#include <QDateTime>
+#include "detector.h"
+#include "reportparser.h"
+#include "sampleinput.h"
+
+// Assigns queued samples to detectors. A sample can only go to a detector that is in
+// use, powered and has a calibration for its geometry (and is the one it names, if
+// any). How long a detector is occupied is predicted by a JobDurationModel learned
+// from stored reports. Times are seconds from the moment the schedule is made.
+
+enum SchedulePolicy
+{
+    // The queue in order, each sample on the first free detector in configuration
+    // order, as the dispatchers did before
+    ScheduleFirstFree,
+    // Highest priority first, then the samples with the fewest possible detectors and
+    // the longest counts, each on the detector where it would finish first. Keeps the
+    // time until the last sample is done (makespan) short.
+    ScheduleMakespan
+};
+
+QString schedulePolicyName(SchedulePolicy policy);
+bool schedulePolicyFromName(const QString& name, SchedulePolicy& policy);
+
+struct ScheduleSample
+{
+    QString geometry;
+    QString detector;           // only this detector when set
+    QString nuclide;            // with mda set, counted until this nuclide reaches it
+    double mda;                 // Bq, 0 for a count with the preset
+    TimePreset preset;          // TimePresetNone uses the detector default
+    double presetValue;         // seconds
+    int priority;               // higher goes first
+    double arrival;             // when the sample can be started
+};
+
+struct ScheduleDetector
+{
+    QString name;
+    QStringList beakers;
+    TimePreset preset;          // detector default
+    double presetValue;
+    bool available;             // in use and powered
+    double freeAt;              // when its current job is expected to end, 0 when free
+};
+
+// Fields that do not parse are left at their defaults, preflightJob reports them
+ScheduleSample scheduleSample(const SampleInput& sampleInput, double arrival = 0.0);
+ScheduleDetector scheduleDetector(const Detector& detector, bool powered = true, double freeAt = 0.0);
+
+struct ScheduleAssignment
+{
+    int sample;
+    int detector;               // -1 when no detector can count the sample
+    double start;
+    double finish;
+    double liveTime;            // predicted, the live preset for samples with an MDA target
+};
+
+struct ScheduleStats
+{
+    double makespan;            // until the last sample is done
+    double meanWait;            // from arrival to start
+    double utilisation;         // busy share of the available detectors until makespan
+    int scheduled;
+    int unscheduled;
+};
+
+// Per detector real to live time ratio (dead time) and, per detector, geometry and
+// nuclide, MDA * sqrt(live time): the MDA of a count falls with the square root of its
+// live time, so that product gives the live time a target MDA needs.
+class JobDurationModel
+{
+public:
+
+    JobDurationModel();
+
+    void addReport(const ReportResult& result);
+    int reportCount() const { return mReports; }
+
+    // Analysis, storing and changing the sample after each count
+    void setOverhead(double seconds) { mOverhead = seconds; }
+    double overhead() const { return mOverhead; }
+
+    bool canCount(const ScheduleSample& sample, const ScheduleDetector& detector) const;
+    // Whether the detector counted the sample's geometry for its MDA nuclide before
+    bool hasMDAReference(const ScheduleSample& sample, const ScheduleDetector& detector) const;
+    double liveTime(const ScheduleSample& sample, const ScheduleDetector& detector) const;
+    // How long the detector is occupied by the sample, count and overhead
+    double duration(const ScheduleSample& sample, const ScheduleDetector& detector) const;
+
+private:
+
+    struct Mean
+    {
+        double sum;
+        int count;
+        Mean() : sum(0.0), count(0) {}
+        void add(double value) { sum += value; count++; }
+        double value() const { return count ? sum / count : 0.0; }
+    };
+
+    QHash<QString, Mean> mRealPerLive;      // detector
+    QHash<QString, Mean> mLiveTime;         // detector|geometry
+    QHash<QString, Mean> mMDAReference;     // detector|geometry|nuclide
+    double mOverhead;
+    int mReports;
+
+    double countTime(TimePreset preset, double value, const QString& detector) const;
+};
+
+// Reads the stored reports of jobs started in [from, to) into the model, and into
+// reports if given. Only the archive years of the range are searched.
+int loadDurationModel(const QString& archiveDirectory, const QDateTime& from, const QDateTime& to,
+                      JobDurationModel& model, QList<ReportResult>* reports = 0);
+
+// One assignment per sample, in sample order. False if a sample has no detector.
+bool scheduleSamples(const QList<ScheduleSample>& samples, const QList<ScheduleDetector>& detectors,
+                     const JobDurationModel& model, SchedulePolicy policy, QList<ScheduleAssignment>& assignments);
+ScheduleStats scheduleStats(const QList<ScheduleSample>& samples, const QList<ScheduleDetector>& detectors,
+                            const QList<ScheduleAssignment>& assignments);
+
+#endif // SCHEDULER_H
@@ -0,0 +1,315 @@
+#include <QFile>
+#include <QFileInfo>
+#include <QTextStream>
+#include <QStringList>
+#include <QDateTime>
+#include <QThread>
+#include <QElapsedTimer>
+#include <QMap>
+#include <cmath>
+#include "simjob.h"
+#include "reporttemplate.h"
+
+static double timeScale = 0.001;
+static const qint64 barrierTimeoutMs = 180 * 1000;
+
+struct SimNuclide
+{
+    const char* name;
+    double energy;
+    double activity;
+};
+
+static const SimNuclide simNuclides[] = {
+    { "K-40", 1460.81, 350.0 },
+    { "CS-137", 661.66, 45.0 },
+    { "CS-134", 604.70, 3.0 },
+    { "BI-214", 609.31, 20.0 },
+    { "PB-214", 351.92, 18.0 },
+    { "TL-208", 583.19, 6.0 },
+    { "AC-228", 911.20, 9.0 }
+};
+
+void setSimulatedJobTimeScale(double scale)
+{
+    timeScale = scale;
+}
+
+double simulatedJobTimeScale()
+{
+    return timeScale;
+}
+
+static QStringList splitCommand(const QString& line)
+{
+    // Splits on whitespace, keeping quoted strings (with quotes removed) as part of the token
+    QStringList tokens;
+    QString token;
+    bool quoted = false, hasToken = false;
+
+    for(int i=0; i<line.length(); i++)
+    {
+        QChar c = line[i];
+        if(c == '"')
+        {
+            quoted = !quoted;
+            hasToken = true;
+        }
+        else if(c.isSpace() && !quoted)
+        {
+            if(hasToken)
+                tokens.append(token);
+            token.clear();
+            hasToken = false;
+        }
+        else
+        {
+            token.append(c);
+            hasToken = true;
+        }
+    }
+    if(hasToken)
+        tokens.append(token);
+    return tokens;
+}
+
+static QString paramValue(const QStringList& tokens, const QString& param)
+{
+    foreach(const QString& t, tokens)
+    {
+        if(t.startsWith(param, Qt::CaseInsensitive))
+            return t.mid(param.length());
+    }
+    return QString();
+}
+
+static bool touchFile(const QString& filename, const QByteArray& content = QByteArray())
+{
+    QFile file(filename);
+    if(!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+        return false;
+    file.write(content);
+    file.close();
+    return true;
+}
+
+bool writeSimulatedReport(const QString& filename, const QString& detector,
+                          const QMap<QString, QString>& sample, double liveTime, const QString& templateName)
+{
+    QSharedPointer<const ReportTemplate> tpl = loadReportTemplate(nativeTemplateName(templateName));
+    if(!tpl)
+        return false;
+
+    uint seed = qHash(sample.value("/sident=") + detector + QString::number(QDateTime::currentMSecsSinceEpoch()));
+
+    ReportResult result;
+    result.clear();
+    result.title = sample.value("/stitle=");
+    result.sampleId = sample.value("/sident=");
+    result.sampleType = sample.value("/stype=");
+    result.geometry = sample.value("/sgeomtry=");
+    result.quantity = sample.value("/squant=").toDouble();
+    result.units = sample.value("/sunits=");
+    result.sampleDate = QDateTime::fromString(sample.value("/stime="), "dd.MM.yyyy HH:mm:ss");
+    result.detector = detector;
+    result.acquisitionStarted = QDateTime::currentDateTime();
+    result.liveTime = liveTime;
+    result.realTime = liveTime * 1.01;
+
+    for(unsigned int i=0; i<sizeof(simNuclides) / sizeof(simNuclides[0]); i++)
+    {
+        seed = seed * 1103515245u + 12345u;
+        double factor = 0.5 + (seed % 1000) / 1000.0;
+
+        ReportNuclide nuclide;
+        nuclide.name = simNuclides[i].name;
+        nuclide.energy = simNuclides[i].energy;
+        nuclide.activity = simNuclides[i].activity * factor;
+        nuclide.uncertainty = nuclide.activity * 0.08;
+        nuclide.mda = simNuclides[i].activity * 0.05;
+        nuclide.flags = nuclide.activity < nuclide.mda * 2.0 ? ReportNuclide::BelowMDA : 0;
+        result.nuclides.append(nuclide);
+    }
+
+    return tpl->renderFile(result, filename);
+}
+
+// Peak list of an archived spectrum as the NAIPEAKS template writes it, see driftmonitor.h.
+// The gain wanders by up to 1% over a few months of spectrum file times.
+static bool writeSimulatedPeakReport(const QString& filename, const QString& spectrumFile)
+{
+    QFile file(filename);
+    if(!file.open(QIODevice::WriteOnly | QIODevice::Text | QIODevice::Truncate))
+        return false;
+
+    double days = QFileInfo(spectrumFile).lastModified().toMSecsSinceEpoch() / 86400000.0;
+    double gain = 0.01 * std::sin(days / 60.0);
+    uint seed = qHash(spectrumFile);
+
+    QTextStream s(&file);
+    s << "Peak  Energy (keV)  Centroid  FWHM (keV)  Net area\n";
+    s << "-----------------------------------------------------\n";
+    for(unsigned int i=0; i<sizeof(simNuclides) / sizeof(simNuclides[0]); i++)
+    {
+        seed = seed * 1103515245u + 12345u;
+        double noise = ((seed % 1000) / 1000.0 - 0.5) * 0.5;
+        double energy = simNuclides[i].energy * (1.0 + gain) + noise;
+        double fwhm = 0.07 * simNuclides[i].energy * std::sqrt(662.0 / simNuclides[i].energy);
+        s << i + 1 << "  " << QString::number(energy, 'f', 2) << "  " << QString::number(energy / 3.0, 'f', 2)
+          << "  " << QString::number(fwhm, 'f', 2) << "  " << QString::number(simNuclides[i].activity * 40.0, 'f', 0) << "\n";
+    }
+    s << "\n";
+    s.flush();
+    return s.status() == QTextStream::Ok;
+}
+
+bool runSimulatedJob(const QString& cmd)
+{
+    // Accepts the same command line as runJob: "<script> [>out] [2>err]", paths with
+    // spaces quoted as jobCommandLine does
+    QStringList parts = splitCommand(cmd);
+    if(parts.isEmpty())
+        return false;
+
+    QString scriptFilename = parts[0];
+    QString outFilename, errFilename;
+    for(int i=1; i<parts.count(); i++)
+    {
+        if(parts[i].startsWith("2>"))
+            errFilename = parts[i].mid(2);
+        else if(parts[i].startsWith(">"))
+            outFilename = parts[i].mid(1);
+    }
+
+    QFile script(scriptFilename);
+    if(!script.open(QIODevice::ReadOnly | QIODevice::Text))
+        return false;
+
+    QFile out(outFilename);
+    if(!outFilename.isEmpty())
+        out.open(QIODevice::WriteOnly | QIODevice::Text | QIODevice::Truncate);
+    QTextStream outStream(&out);
+
+    if(!errFilename.isEmpty())
+        touchFile(errFilename);
+
+    QString detector;
+    QMap<QString, QString> sample;
+    double liveTime = 0.0;
+
+    QTextStream in(&script);
+    while(!in.atEnd())
+    {
+        QString line = in.readLine().trimmed();
+        if(line.isEmpty())
+            continue;
+
+        if(line.startsWith(">>"))
+        {
+            // >>"X.JTR" echo B %TIME% name, written by instrumentJobScript
+            int end = line.indexOf("echo ", 2);
+            if(end > 0)
+            {
+                QString filename = line.mid(2, end - 2).trimmed().remove('"');
+                QString text = line.mid(end + 5).replace("%TIME%", QTime::currentTime().toString("HH:mm:ss.zzz").left(11));
+                QFile trace(filename);
+                if(trace.open(QIODevice::WriteOnly | QIODevice::Text | QIODevice::Append))
+                    trace.write(text.toLocal8Bit() + "\n");
+            }
+            continue;
+        }
+
+        QStringList tokens = splitCommand(line);
+        QString command = tokens[0].toLower();
+
+        if(out.isOpen())
+            outStream << ">" << line << "\n";
+
+        QString det = paramValue(tokens, "det:");
+        if(!det.isEmpty())
+            detector = det;
+
+        if(command == "pars")
+        {
+            foreach(const QString& t, tokens)
+            {
+                int sep = t.indexOf('=');
+                if(t.startsWith('/') && sep > 0)
+                    sample[t.left(sep + 1).toLower()] = t.mid(sep + 1);
+            }
+        }
+        else if(command == "startmca")
+        {
+            QString preset = paramValue(tokens, "/LIVEPRESET=");
+            if(preset.isEmpty())
+                preset = paramValue(tokens, "/REALPRESET=");
+            liveTime = preset.toDouble();
+        }
+        else if(command == "wait")
+        {
+            QThread::msleep((unsigned long)(liveTime * timeScale * 1000.0));
+        }
+        else if(command == "report")
+        {
+            QString outfile = paramValue(tokens, "/outfile=");
+            QString templateName = paramValue(tokens, "/template=");
+            if(outfile.endsWith(".PKS", Qt::CaseInsensitive))
+            {
+                // report "spectrum.CNF" ... /outfile="X.PKS", the drift monitor's peak list
+                if(tokens.count() < 2 || !writeSimulatedPeakReport(outfile, tokens[1]))
+                    return false;
+            }
+            else if(!outfile.isEmpty() && !writeSimulatedReport(outfile, detector, sample, liveTime, templateName))
+                return false;
+        }
+        else if(command == "movedata" && tokens.contains("/overwrite", Qt::CaseInsensitive)
+                && !tokens.contains("/effcal", Qt::CaseInsensitive))
+        {
+            // movedata det:X "spectrum.CNF" /overwrite
+            foreach(const QString& t, tokens.mid(1))
+            {
+                if(!t.startsWith('/') && !t.startsWith("det:", Qt::CaseInsensitive))
+                    touchFile(t, QByteArray(1024 * 4, '\0'));
+            }
+        }
+        else if(command == "if" && tokens.count() >= 4 && tokens[1].compare("not", Qt::CaseInsensitive) == 0
+                && tokens[2].compare("exist", Qt::CaseInsensitive) == 0)
+        {
+            // if not exist "X.GO" (ping ... & goto startbarrier), the start barrier of a job group
+            // The group is force released after two minutes, a barrier that never shows up fails the job
+            QElapsedTimer waited;
+            waited.start();
+            while(!QFile::exists(tokens[3]))
+            {
+                if(waited.elapsed() > barrierTimeoutMs)
+                    return false;
+                QThread::msleep(50);
+            }
+        }
+        else if(command == "copy")
+        {
+            // copy /y NUL "X.DONE" >NUL, or copy /y "X.CNF" "Y.CNF" >NUL
+            if(tokens.count() >= 4 && tokens[2].compare("NUL", Qt::CaseInsensitive) == 0)
+                touchFile(tokens[3]);
+            else if(tokens.count() >= 4)
+            {
+                QFile::remove(tokens[3]);
+                QFile::copy(tokens[2], tokens[3]);
+            }
+        }
+        else if(command == "move" && tokens.count() >= 4)
+        {
+            // move /y "X.tmp" "X" >NUL
+            QFile::remove(tokens[3]);
+            QFile::rename(tokens[2], tokens[3]);
+        }
+    }
+
+    script.close();
+    if(out.isOpen())
+    {
+        outStream.flush();
+        out.close();
+    }
+    return true;
+}
@@ -0,0 +1,23 @@
+#ifndef SIMJOB_H
+#define SIMJOB_H
+
+#include <QString>
+#include <QMap>
+
+// Stand-in for the Genie 2000 command set, used where no MCA hardware is available.
+// Interprets a generated job script, sleeps for the acquisition preset scaled by the
+// time scale and produces the same files (.OUT, .ERR, .RPT, .CNF, .DONE) as a real job.
+
+void setSimulatedJobTimeScale(double scale);
+double simulatedJobTimeScale();
+
+bool runSimulatedJob(const QString& cmd);
+
+// Writes a synthetic nuclide identification report. Sample fields are keyed by their
+// pars switch, e.g. "/stitle=" or "/sident=". The report is rendered with the native
+// template belonging to templateName, or the built-in layout if there is none.
+bool writeSimulatedReport(const QString& filename, const QString& detector,
+                          const QMap<QString, QString>& sample, double liveTime,
+                          const QString& templateName = QString());
+
+#endif // SIMJOB_H
@@ -0,0 +1,306 @@
+#include <QFile>
+#include <QTextStream>
+#include <QThread>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QWaitCondition>
+#include <QAtomicInt>
+#include <QElapsedTimer>
+#include <QScopedArrayPointer>
+#include <deque>
+#include "stagegraph.h"
+
+class StageScheduler
+{
+public:
+
+    StageScheduler(StageGraph& graph, int threadCount);
+
+    void work(int thread);
+    bool failed() const { return mFailed.load() != 0; }
+
+private:
+
+    struct WorkQueue
+    {
+        QMutex mutex;
+        std::deque<int> stages;
+    };
+
+    void push(int thread, int stage);
+    bool pop(int thread, int& stage);
+    bool steal(int thread, int& stage);
+    void execute(int thread, int stage);
+
+    StageGraph& mGraph;
+    int mThreadCount;
+    QScopedArrayPointer<WorkQueue> mQueues;
+    QScopedArrayPointer<QAtomicInt> mPending;
+    QAtomicInt mQueued, mRemaining, mFailed;
+    QMutex mIdleMutex;
+    QWaitCondition mIdle;
+    QElapsedTimer mTimer;
+};
+
+class StageWorker : public QThread
+{
+public:
+
+    StageWorker(StageScheduler *scheduler, int thread)
+        : mScheduler(scheduler), mThread(thread) {}
+
+protected:
+
+    void run() { mScheduler->work(mThread); }
+
+private:
+
+    StageScheduler *mScheduler;
+    int mThread;
+};
+
+StageScheduler::StageScheduler(StageGraph& graph, int threadCount)
+    : mGraph(graph), mThreadCount(threadCount), mQueues(new WorkQueue[threadCount]),
+      mPending(new QAtomicInt[graph.count()]), mQueued(0), mRemaining(graph.count()), mFailed(0)
+{
+    mTimer.start();
+
+    // Stages without dependencies are dealt out round robin, the rest wait for their count to drop to zero
+    int next = 0;
+    for(int i=0; i<graph.count(); i++)
+    {
+        mPending[i].store(graph.mStages[i].dependsOn.count());
+        if(graph.mStages[i].dependsOn.isEmpty())
+        {
+            mQueues[next].stages.push_back(i);
+            mQueued.ref();
+            next = (next + 1) % mThreadCount;
+        }
+    }
+}
+
+void StageScheduler::push(int thread, int stage)
+{
+    mQueued.ref();
+    {
+        QMutexLocker lock(&mQueues[thread].mutex);
+        mQueues[thread].stages.push_back(stage);
+    }
+
+    QMutexLocker lock(&mIdleMutex);
+    mIdle.wakeOne();
+}
+
+bool StageScheduler::pop(int thread, int& stage)
+{
+    // Newest first, the successor of the stage just run is likely to use the same files
+    QMutexLocker lock(&mQueues[thread].mutex);
+    if(mQueues[thread].stages.empty())
+        return false;
+    stage = mQueues[thread].stages.back();
+    mQueues[thread].stages.pop_back();
+    mQueued.deref();
+    return true;
+}
+
+bool StageScheduler::steal(int thread, int& stage)
+{
+    // Oldest first, that is the stage the owner would get to last
+    for(int i=1; i<mThreadCount; i++)
+    {
+        WorkQueue& victim = mQueues[(thread + i) % mThreadCount];
+        QMutexLocker lock(&victim.mutex);
+        if(victim.stages.empty())
+            continue;
+        stage = victim.stages.front();
+        victim.stages.pop_front();
+        mQueued.deref();
+        return true;
+    }
+    return false;
+}
+
+void StageScheduler::execute(int thread, int stage)
+{
+    StageGraph::Stage& s = mGraph.mStages[stage];
+    StageGraph::StageTiming& t = s.timing;
+
+    bool blocked = false;
+    foreach(int dep, s.dependsOn)
+    {
+        const StageGraph::StageTiming& d = mGraph.mStages[dep].timing;
+        if(!d.ok || d.skipped)
+            blocked = true;
+    }
+
+    t.thread = thread;
+    t.startNs = mTimer.nsecsElapsed();
+    if(blocked && !(s.flags & StageGraph::RunAlways))
+    {
+        t.skipped = true;
+        t.ok = false;
+    }
+    else
+    {
+        t.skipped = false;
+        t.ok = s.task();
+        if(!t.ok)
+            mFailed.store(1);
+    }
+    t.endNs = mTimer.nsecsElapsed();
+
+    foreach(int succ, s.successors)
+    {
+        if(!mPending[succ].deref())
+            push(thread, succ);
+    }
+
+    if(!mRemaining.deref())
+    {
+        QMutexLocker lock(&mIdleMutex);
+        mIdle.wakeAll();
+    }
+}
+
+void StageScheduler::work(int thread)
+{
+    for(;;)
+    {
+        int stage;
+        if(pop(thread, stage) || steal(thread, stage))
+        {
+            execute(thread, stage);
+            continue;
+        }
+
+        QMutexLocker lock(&mIdleMutex);
+        if(mRemaining.load() == 0)
+            return;
+        if(mQueued.load() == 0)
+            mIdle.wait(&mIdleMutex);
+    }
+}
+
+StageGraph::StageGraph()
+{
+}
+
+StageGraph::~StageGraph()
+{
+}
+
+int StageGraph::addStage(const QString& name, int group, const Task& task, const QList<int>& dependsOn, int flags)
+{
+    int id = mStages.count();
+
+    Stage stage;
+    stage.task = task;
+    stage.flags = flags;
+    stage.dependsOn = dependsOn;
+    stage.timing.name = name;
+    stage.timing.group = group;
+    stage.timing.startNs = stage.timing.endNs = 0;
+    stage.timing.thread = -1;
+    stage.timing.ok = false;
+    stage.timing.skipped = true;
+    mStages.append(stage);
+
+    foreach(int dep, dependsOn)
+    {
+        Q_ASSERT(dep >= 0 && dep < id);
+        mStages[dep].successors.append(id);
+    }
+    return id;
+}
+
+bool StageGraph::run(int maxThreads)
+{
+    if(mStages.isEmpty())
+        return true;
+
+    int threadCount = qBound(1, maxThreads, mStages.count());
+    StageScheduler scheduler(*this, threadCount);
+
+    QList<StageWorker*> workers;
+    for(int i=1; i<threadCount; i++)
+    {
+        StageWorker* worker = new StageWorker(&scheduler, i);
+        workers.append(worker);
+        worker->start();
+    }
+
+    scheduler.work(0);
+
+    foreach(StageWorker* worker, workers)
+    {
+        worker->wait();
+        delete worker;
+    }
+    return !scheduler.failed();
+}
+
+const StageGraph::StageTiming& StageGraph::timing(int stage) const
+{
+    return mStages[stage].timing;
+}
+
+QVector<int> StageGraph::criticalPath(int group) const
+{
+    int last = -1;
+    for(int i=0; i<mStages.count(); i++)
+    {
+        if(mStages[i].timing.group == group && (last < 0 || mStages[i].timing.endNs > mStages[last].timing.endNs))
+            last = i;
+    }
+
+    QVector<int> path;
+    while(last >= 0)
+    {
+        path.prepend(last);
+
+        int gate = -1;
+        foreach(int dep, mStages[last].dependsOn)
+        {
+            if(gate < 0 || mStages[dep].timing.endNs > mStages[gate].timing.endNs)
+                gate = dep;
+        }
+        last = gate;
+    }
+    return path;
+}
+
+bool StageGraph::writeTrace(int group, const QString& filename) const
+{
+    QFile file(filename);
+    if(!file.open(QIODevice::WriteOnly | QIODevice::Text | QIODevice::Truncate))
+        return false;
+
+    QVector<int> path = criticalPath(group);
+    qint64 origin = path.isEmpty() ? 0 : mStages[path.first()].timing.startNs;
+    qint64 total = path.isEmpty() ? 0 : mStages[path.last()].timing.endNs - origin;
+
+    // Wait is the time a stage was ready but had no thread to run on
+    QTextStream s(&file);
+    s << "# Critical path " << QString::number(total / 1e6, 'f', 1) << " ms, stages marked with *\n";
+    s << "# stage                start ms   run ms  wait ms  thread  state\n";
+    for(int i=0; i<mStages.count(); i++)
+    {
+        const StageTiming& t = mStages[i].timing;
+        if(t.group != group)
+            continue;
+
+        qint64 ready = origin;
+        foreach(int dep, mStages[i].dependsOn)
+            ready = qMax(ready, mStages[dep].timing.endNs);
+
+        s << (path.contains(i) ? "* " : "  ")
+          << t.name.leftJustified(20)
+          << QString::number((t.startNs - origin) / 1e6, 'f', 1).rightJustified(10)
+          << QString::number((t.endNs - t.startNs) / 1e6, 'f', 1).rightJustified(9)
+          << QString::number(qMax<qint64>(0, t.startNs - ready) / 1e6, 'f', 1).rightJustified(9)
+          << QString::number(t.thread).rightJustified(8)
+          << "  " << (t.skipped ? "skipped" : (t.ok ? "ok" : "failed")) << "\n";
+    }
+    s.flush();
+    return s.status() == QTextStream::Ok;
+}
@@ -0,0 +1,75 @@
+#ifndef STAGEGRAPH_H
+#define STAGEGRAPH_H
+
+#include <QString>
+#include <QList>
+#include <QVector>
+#include <functional>
+
+// A set of tasks with dependencies, run on a fixed number of threads. Each thread
+// keeps its own queue: a finished stage pushes the stages it unblocks onto the
+// queue of the thread that ran it (so one job tends to stay on one thread), and
+// idle threads steal the oldest queued stage from the others. Start and end of
+// every stage are recorded for criticalPath and writeTrace.
+class StageGraph
+{
+public:
+
+    typedef std::function<bool()> Task;
+
+    enum Flags
+    {
+        SkipOnFailure = 0x0,
+        RunAlways = 0x1     // runs even if a stage it depends on failed or was skipped
+    };
+
+    struct StageTiming
+    {
+        QString name;
+        int group;
+        qint64 startNs;     // since run() was called
+        qint64 endNs;
+        int thread;
+        bool ok;
+        bool skipped;
+    };
+
+    StageGraph();
+    ~StageGraph();
+
+    // group ties the stages of one job together for criticalPath and writeTrace
+    int addStage(const QString& name, int group, const Task& task,
+                 const QList<int>& dependsOn = QList<int>(), int flags = SkipOnFailure);
+
+    int count() const { return mStages.count(); }
+
+    // Runs all stages on maxThreads threads, one of them the calling thread, and
+    // returns when every stage has run or been skipped. False if any stage failed.
+    bool run(int maxThreads);
+
+    const StageTiming& timing(int stage) const;
+
+    // Walks back from the last stage of the group to finish, at each step taking the
+    // dependency that finished last, i.e. the one the stage waited for
+    QVector<int> criticalPath(int group) const;
+
+    // Text table of the stages of a group, critical ones marked with '*'
+    bool writeTrace(int group, const QString& filename) const;
+
+private:
+
+    friend class StageScheduler;
+
+    struct Stage
+    {
+        Task task;
+        int flags;
+        QList<int> dependsOn;
+        QList<int> successors;
+        StageTiming timing;
+    };
+
+    QVector<Stage> mStages;
+};
+
+#endif // STAGEGRAPH_H
@@ -0,0 +1,89 @@
+#include <QFile>
+#include <QTextStream>
+#include <QtConcurrent/QtConcurrent>
+#include "startupconfig.h"
+#include "dbutils.h"
+
+StartupProfile::StartupProfile()
+    : mLast(0)
+{
+    mTimer.start();
+}
+
+void StartupProfile::mark(const QString& phase)
+{
+    qint64 now = mTimer.elapsed();
+    mPhases.append(qMakePair(phase, now - mLast));
+    mLast = now;
+}
+
+QString StartupProfile::summary() const
+{
+    QStringList parts;
+    for(int i=0; i<mPhases.count(); i++)
+        parts << QString("%1 %2 ms").arg(mPhases[i].first).arg(mPhases[i].second);
+    parts << QString("total %1 ms").arg(mLast);
+    return parts.join(", ");
+}
+
+bool StartupProfile::write(const QString& filename) const
+{
+    QFile file(filename);
+    if(!file.open(QIODevice::WriteOnly | QIODevice::Text | QIODevice::Truncate))
+        return false;
+
+    QTextStream s(&file);
+    for(int i=0; i<mPhases.count(); i++)
+        s << mPhases[i].first << "=" << mPhases[i].second << "\n";
+    s << "total=" << mLast << "\n";
+    s.flush();
+    return s.status() == QTextStream::Ok;
+}
+
+static bool loadSettings(const QString& filename, Settings* settings)
+{
+    QFile file(filename);
+    return readSettingsXml(file, *settings);
+}
+
+static bool loadBeakers(const QString& filename, QList<Beaker>* beakers)
+{
+    QFile file(filename);
+    return readBeakerXml(file, *beakers);
+}
+
+static bool loadDetectors(const QString& filename, QList<Detector>* detectors)
+{
+    QFile file(filename);
+    return readDetectorXml(file, *detectors);
+}
+
+static bool loadQuantityUnits(const QString& filename, QStringList* units)
+{
+    QFile file(filename);
+    return readQuantityUnitsXml(file, *units);
+}
+
+bool loadStartupConfig(const QString& configurationDirectory, StartupConfig& config, bool parallel)
+{
+    QString settingsFile = configurationDirectory + "settings.xml";
+    QString beakerFile = configurationDirectory + "beaker.xml";
+    QString detectorFile = configurationDirectory + "mca.xml";
+    QString unitsFile = configurationDirectory + "quantity_units.xml";
+
+    if(!parallel)
+    {
+        return loadSettings(settingsFile, &config.settings)
+                && loadBeakers(beakerFile, &config.beakers)
+                && loadDetectors(detectorFile, &config.detectors)
+                && loadQuantityUnits(unitsFile, &config.quantityUnits);
+    }
+
+    // mca.xml grows with the number of detectors, it gets the calling thread
+    QFuture<bool> settingsOk = QtConcurrent::run(loadSettings, settingsFile, &config.settings);
+    QFuture<bool> beakersOk = QtConcurrent::run(loadBeakers, beakerFile, &config.beakers);
+    QFuture<bool> unitsOk = QtConcurrent::run(loadQuantityUnits, unitsFile, &config.quantityUnits);
+    bool detectorsOk = loadDetectors(detectorFile, &config.detectors);
+
+    return settingsOk.result() && beakersOk.result() && unitsOk.result() && detectorsOk;
+}
@@ -0,0 +1,46 @@
+#ifndef STARTUPCONFIG_H
+#define STARTUPCONFIG_H
+
+#include <QString>
+#include <QStringList>
+#include <QList>
+#include <QPair>
+#include <QElapsedTimer>
+#include "settings.h"
+#include "beaker.h"
+#include "detector.h"
+
+// Wall time of the phases of application startup, each phase ends where the next begins
+class StartupProfile
+{
+public:
+
+    StartupProfile();
+
+    void mark(const QString& phase);
+    qint64 elapsedMs() const { return mTimer.elapsed(); }
+
+    // "environment 2 ms, configuration 14 ms, ..., total 180 ms"
+    QString summary() const;
+    bool write(const QString& filename) const;
+
+private:
+
+    QElapsedTimer mTimer;
+    qint64 mLast;
+    QList<QPair<QString, qint64> > mPhases;
+};
+
+struct StartupConfig
+{
+    Settings settings;
+    QList<Beaker> beakers;
+    QList<Detector> detectors;
+    QStringList quantityUnits;
+};
+
+// Reads settings.xml, beaker.xml, mca.xml and quantity_units.xml from the configuration
+// directory. With parallel set the files are read on pool threads at the same time.
+bool loadStartupConfig(const QString& configurationDirectory, StartupConfig& config, bool parallel);
+
+#endif // STARTUPCONFIG_H